@@ -0,0 +1,156 @@
+/*******************************************************************************
+* mip_acq.c
+* By: Stuart Sonatina
+*
+* Timestamped sensor snapshots, see mip_acq.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "mip_acq.h"
+
+/*******************************************************************************
+* int mip_acq_init()
+*******************************************************************************/
+int mip_acq_init(mip_acq_t* a, float period, int channel_l, int channel_r){
+	if(period<=0){
+		printf("ERROR: mip_acq_init, period must be > 0\n");
+		return -1;
+	}
+	memset(a, 0, sizeof(*a));
+	a->period = period;
+	a->channel_l = channel_l;
+	a->channel_r = channel_r;
+	a->dt_min = INFINITY;
+	atomic_init(&a->n_samples, 0);
+	atomic_init(&a->n_missed, 0);
+	atomic_init(&a->n_duplicate, 0);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_acq_capture()
+*
+* Snapshot for the interrupt that started at t_ns. The first one gets the
+* nominal period as its dt and starts the grid. Returns 1 for a duplicate,
+* s is left as it was so the caller can skip the step, otherwise 0.
+*******************************************************************************/
+int mip_acq_capture(mip_acq_t* a, uint64_t t_ns, const imu_data_t* imu,
+														mip_acq_sample_t* s){
+	const int64_t period_ns = a->period*1e9f;
+	float imu_now[9], gap, dt = a->period;
+	int64_t late, slot;
+	int missed = 0;
+
+	memcpy(imu_now, imu->accel, 3*sizeof(float));
+	memcpy(imu_now+3, imu->gyro, 3*sizeof(float));
+	memcpy(imu_now+6, imu->dmp_TaitBryan, 3*sizeof(float));
+	if(a->seq){
+		gap = (t_ns - a->last_ns)*1e-9f;
+		if(gap<MIP_ACQ_DUPLICATE*a->period && \
+						!memcmp(imu_now, a->last_imu, sizeof(imu_now))){
+			atomic_fetch_add(&a->n_duplicate, 1);
+			return 1;
+		}
+		if(gap<a->dt_min) a->dt_min = gap;
+		if(gap>a->dt_max) a->dt_max = gap;
+		a->dt_sum += gap;
+
+		// whole periods late for the next slot are missed samples, an
+		// early interrupt means the grid was late and it moves back to it
+		slot = a->slot_ns + period_ns;
+		late = (int64_t)t_ns - slot;
+		if(late<0) slot = t_ns;
+		else{
+			missed = late/period_ns;
+			slot += missed*period_ns + (late-missed*period_ns)/MIP_ACQ_TRACK;
+		}
+		if(missed>0) atomic_fetch_add(&a->n_missed, missed);
+		dt = (slot - a->slot_ns)*1e-9f;
+		if(dt>MIP_ACQ_MAX_PERIODS*a->period){
+			dt = MIP_ACQ_MAX_PERIODS*a->period;
+		}
+		a->slot_ns = slot;
+	}
+	else a->slot_ns = t_ns;
+	a->last_ns = t_ns;
+	memcpy(a->last_imu, imu_now, sizeof(imu_now));
+	a->seq++;
+	atomic_fetch_add(&a->n_samples, 1);
+
+	s->t_ns = t_ns;
+	s->seq = a->seq;
+	s->missed = missed;
+	s->dt = dt;
+	memcpy(s->accel, imu->accel, sizeof(s->accel));
+	memcpy(s->gyro, imu->gyro, sizeof(s->gyro));
+	memcpy(s->dmp_TaitBryan, imu->dmp_TaitBryan, sizeof(s->dmp_TaitBryan));
+	s->encoder_l = get_encoder_pos(a->channel_l);
+	s->encoder_r = get_encoder_pos(a->channel_r);
+	return 0;
+}
+
+/*******************************************************************************
+* uint32_t mip_acq_missed(), uint32_t mip_acq_duplicates()
+*
+* Totals so far, safe from any thread.
+*******************************************************************************/
+uint32_t mip_acq_missed(mip_acq_t* a){
+	return atomic_load(&a->n_missed);
+}
+
+uint32_t mip_acq_duplicates(mip_acq_t* a){
+	return atomic_load(&a->n_duplicate);
+}
+
+/*******************************************************************************
+* int mip_acq_print()
+*******************************************************************************/
+int mip_acq_print(mip_acq_t* a){
+	uint32_t n = atomic_load(&a->n_samples);
+	if(n<2){
+		printf("acquisition: %u samples\n", n);
+		return 0;
+	}
+	printf("acquisition: %u samples, gap min %.3f ms, mean %.3f ms, " \
+			"max %.3f ms, %u missed, %u duplicate\n", n, a->dt_min*1e3, \
+			a->dt_sum/(n-1)*1e3, a->dt_max*1e3, mip_acq_missed(a), \
+			mip_acq_duplicates(a));
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_acq_rate_init(), int mip_acq_rate_reset()
+*
+* reset starts the difference from x with y as the previous rate.
+*******************************************************************************/
+int mip_acq_rate_init(mip_acq_rate_t* r, float tau){
+	if(tau<0){
+		printf("ERROR: mip_acq_rate_init, tau must be >= 0\n");
+		return -1;
+	}
+	r->tau = tau;
+	r->x = r->y = 0;
+	return 0;
+}
+
+int mip_acq_rate_reset(mip_acq_rate_t* r, float x, float y){
+	r->x = x;
+	r->y = y;
+	return 0;
+}
+
+/*******************************************************************************
+* float mip_acq_rate()
+*
+* Backward Euler over the measured dt, so a sample after a miss divides the
+* change by the time it really took.
+*******************************************************************************/
+float mip_acq_rate(mip_acq_rate_t* r, float x, float dt){
+	float k = 1.0f/(r->tau+dt);
+	r->y = (x - r->x)*k + r->tau*k*r->y;
+	r->x = x;
+	return r->y;
+}
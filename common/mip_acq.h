@@ -0,0 +1,105 @@
+/*******************************************************************************
+* mip_acq.h
+* By: Stuart Sonatina
+*
+* One timestamped snapshot of the sensors per IMU interrupt.
+*
+* mip_acq_capture() is the first thing the interrupt function does. It
+* copies the IMU data and both encoder counts into a snapshot stamped with
+* the interrupt's time and works out dt, the time since the last sample.
+*
+* The sensor samples on its own clock and the interrupt comes some time
+* after, never before. So the sample times are tracked as a grid of slots
+* one period apart, following the earliest interrupts, and each interrupt
+* is placed by how late it is for the slot after the last one's:
+*
+*	on time		less than a period late, however late that is
+*	missed		n periods or more late, n slots went by without an
+*				interrupt, n is counted and dt covers them
+*	duplicate	the same IMU data as the last one and under
+*				MIP_ACQ_DUPLICATE of a period after it. Counted, and the
+*				caller skips the step. Fresh data is never skipped.
+*
+* Interrupt latency under a period is only jitter and counts as nothing.
+* dt is the time between the slots rather than the interrupts, so it
+* doesn't carry the jitter into the integrators either. Integrators and rate
+* estimates use it in place of the nominal period, see mip_acq_rate(). dt
+* is clamped to MIP_ACQ_MAX_PERIODS so a long stall, a pause or a debugger,
+* doesn't integrate into a jump.
+* The discrete controllers keep their fixed coefficients, they are designed
+* for the nominal period.
+*
+* The counters are atomic so the printf thread or a metrics reader can look
+* at them while the interrupt runs.
+*******************************************************************************/
+
+#ifndef MIP_ACQ_H
+#define MIP_ACQ_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#ifdef MIP_SIM
+#include "../mipsim/mipsim.h"
+#else
+#include <roboticscape.h>
+#endif
+
+#define MIP_ACQ_DUPLICATE	0.5		// of a period, closer is the same sample
+#define MIP_ACQ_MAX_PERIODS	4		// longest dt handed out, in periods
+#define MIP_ACQ_TRACK		64		// late interrupts move the grid 1/n of it
+
+/*******************************************************************************
+* mip_acq_sample_t
+*******************************************************************************/
+typedef struct mip_acq_sample_t{
+	uint64_t t_ns;				// interrupt time, CLOCK_MONOTONIC
+	uint32_t seq;				// samples so far, duplicates don't count
+	int missed;					// periods missed right before this one
+	float dt;					// s since the last sample's slot, clamped
+	float accel[3];				// m/s^2
+	float gyro[3];				// deg/s
+	float dmp_TaitBryan[3];		// rad
+	int encoder_l, encoder_r;	// raw counts
+}mip_acq_sample_t;
+
+/*******************************************************************************
+* mip_acq_t
+*******************************************************************************/
+typedef struct mip_acq_t{
+	float period;				// nominal, s
+	int channel_l, channel_r;	// encoder channels
+	uint64_t last_ns;			// last interrupt
+	int64_t slot_ns;			// the sample time it was placed at
+	float last_imu[9];			// its accel, gyro and DMP angles
+	uint32_t seq;
+	_Atomic uint32_t n_samples;
+	_Atomic uint32_t n_missed;		// periods
+	_Atomic uint32_t n_duplicate;
+	float dt_min, dt_max;			// between interrupts
+	double dt_sum;
+}mip_acq_t;
+
+/*******************************************************************************
+* mip_acq_rate_t
+*
+* Lowpassed difference, (x - x_prev)/(tau+dt) + tau/(tau+dt)*y_prev. At the
+* nominal dt it is the same filter Jbalance used to build with mip_filter.
+*******************************************************************************/
+typedef struct mip_acq_rate_t{
+	float tau;
+	float x, y;
+}mip_acq_rate_t;
+
+int mip_acq_init(mip_acq_t* a, float period, int channel_l, int channel_r);
+int mip_acq_capture(mip_acq_t* a, uint64_t t_ns, const imu_data_t* imu,
+														mip_acq_sample_t* s);
+uint32_t mip_acq_missed(mip_acq_t* a);
+uint32_t mip_acq_duplicates(mip_acq_t* a);
+int mip_acq_print(mip_acq_t* a);
+
+int mip_acq_rate_init(mip_acq_rate_t* r, float tau);
+int mip_acq_rate_reset(mip_acq_rate_t* r, float x, float y);
+float mip_acq_rate(mip_acq_rate_t* r, float x, float dt);
+
+#endif //MIP_ACQ_H
@@ -0,0 +1,109 @@
+/*******************************************************************************
+* mip_arena.c
+* By: Stuart Sonatina
+*
+* Startup arena, see mip_arena.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#include "mip_arena.h"
+
+static uint8_t* base = NULL;
+static size_t size = 0;
+static _Atomic size_t used = 0;
+static _Atomic int sealed = 0;
+static _Atomic int n_failed = 0;
+static int locked = 0;
+
+/*******************************************************************************
+* int mip_arena_init()
+*
+* Call once from main() before anything that allocates.
+*******************************************************************************/
+int mip_arena_init(size_t bytes){
+	if(base!=NULL){
+		printf("ERROR: mip_arena already initialized\n");
+		return -1;
+	}
+	base = aligned_alloc(MIP_ARENA_ALIGN, \
+				(bytes+MIP_ARENA_ALIGN-1)/MIP_ARENA_ALIGN*MIP_ARENA_ALIGN);
+	if(base==NULL){
+		printf("ERROR: mip_arena failed to allocate %zu bytes\n", bytes);
+		return -1;
+	}
+	// every page written now so none faults in later
+	memset(base, 0, bytes);
+	locked = !mlock(base, bytes);
+	size = bytes;
+	return 0;
+}
+
+/*******************************************************************************
+* void* mip_arena_calloc()
+*
+* n*size zeroed bytes from the arena, or from the heap before
+* mip_arena_init(). NULL with a message when the arena is full or sealed.
+*******************************************************************************/
+void* mip_arena_calloc(size_t n, size_t sz){
+	size_t bytes, at;
+	if(base==NULL) return calloc(n, sz);
+	if(sz && n>SIZE_MAX/sz){
+		printf("ERROR: mip_arena allocation too large\n");
+		return NULL;
+	}
+	if(atomic_load(&sealed)){
+		atomic_fetch_add(&n_failed, 1);
+		printf("ERROR: mip_arena is sealed, allocation after startup\n");
+		return NULL;
+	}
+	bytes = (n*sz+MIP_ARENA_ALIGN-1)/MIP_ARENA_ALIGN*MIP_ARENA_ALIGN;
+	at = atomic_fetch_add(&used, bytes);
+	if(at+bytes>size){
+		atomic_fetch_add(&n_failed, 1);
+		printf("ERROR: mip_arena out of room, %zu more bytes needed\n", \
+															at+bytes-size);
+		return NULL;
+	}
+	return base+at;
+}
+
+/*******************************************************************************
+* int mip_arena_free()
+*
+* Heap pointers go back to the heap, arena pieces stay until exit.
+*******************************************************************************/
+int mip_arena_free(void* p){
+	if(p==NULL) return 0;
+	if(base!=NULL && (uint8_t*)p>=base && (uint8_t*)p<base+size) return 0;
+	free(p);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_arena_seal()
+*******************************************************************************/
+int mip_arena_seal(){
+	atomic_store(&sealed, 1);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_arena_print()
+*
+* How much was used, for sizing ARENA_BYTES.
+*******************************************************************************/
+int mip_arena_print(){
+	size_t u = atomic_load(&used);
+	if(base==NULL) return 0;
+	if(u>size) u = size;
+	printf("arena: %zu of %zu kB used%s, %d failed allocations\n", \
+			u/1024, size/1024, locked ? ", locked in RAM" : "", \
+			atomic_load(&n_failed));
+	return 0;
+}
@@ -0,0 +1,37 @@
+/*******************************************************************************
+* mip_arena.h
+* By: Stuart Sonatina
+*
+* One block of memory taken at startup that the rings, codecs, log blocks
+* and trace buffers are carved from, so once the program is running nothing
+* it set up ever goes back to the heap.
+*
+* mip_arena_init() allocates the whole block once, touches every page and
+* locks it in RAM (best effort, needs root) so the first write to a ring
+* from the IMU interrupt can't page fault. mip_arena_calloc() hands out
+* zeroed, 64 byte aligned pieces with one atomic add. Pieces are never
+* given back, mip_arena_free() ignores them, they last the run.
+* mip_arena_seal() at the end of startup makes any later allocation an
+* error instead, so a module that allocates late shows up straight away.
+*
+* Before mip_arena_init() everything comes from the heap as it always did,
+* so the host tools that share these modules don't need an arena.
+*
+* The filters, controllers and tune sets are fixed size structs in static
+* storage already and need nothing from here.
+*******************************************************************************/
+
+#ifndef MIP_ARENA_H
+#define MIP_ARENA_H
+
+#include <stddef.h>
+
+#define MIP_ARENA_ALIGN		64		// cache line, rings keep head and tail apart
+
+int mip_arena_init(size_t bytes);
+void* mip_arena_calloc(size_t n, size_t size);
+int mip_arena_free(void* p);
+int mip_arena_seal();
+int mip_arena_print();
+
+#endif //MIP_ARENA_H
@@ -0,0 +1,330 @@
+/*******************************************************************************
+* mip_battery.c
+* By: Stuart Sonatina
+*
+* Battery sampling thread, estimate and gain tables, see mip_battery.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#ifdef MIP_SIM
+#include "../mipsim/mipsim.h"
+#else
+#include <roboticscape.h>
+#endif
+
+#include "mip_battery.h"
+#include "mip_trace.h"
+
+// resting cell voltage at each 5% of charge, 0% to 100%
+static const float cell_curve[21] = {
+	3.27, 3.61, 3.69, 3.71, 3.73, 3.75, 3.77, 3.79, 3.80, 3.82, 3.84,
+	3.85, 3.87, 3.91, 3.95, 3.98, 4.02, 4.08, 4.11, 4.15, 4.20
+};
+
+static pthread_t thread;
+static volatile int running = 0;
+static _Atomic float period_s;
+
+// published, read from any thread
+static _Atomic float v_est = 0;
+static _Atomic float soc_est = 0;
+static _Atomic float runtime_est = -1;
+static _Atomic unsigned int n_samples = 0;
+static _Atomic unsigned int n_rejected = 0;
+static _Atomic int fallback = 0;		// v_est isn't a reading
+
+// sampling thread only
+static float med[MIP_BATTERY_MEDIAN];
+static int n_med = 0, i_med = 0;
+static float soc_t[MIP_BATTERY_SOC_POINTS], soc_v[MIP_BATTERY_SOC_POINTS];
+static int n_soc = 0, i_soc = 0;
+
+/*******************************************************************************
+* float median()
+*******************************************************************************/
+static float median(){
+	float s[MIP_BATTERY_MEDIAN], v;
+	int i, j;
+	for(i=0;i<n_med;i++){
+		v = med[i];
+		for(j=i;j>0 && s[j-1]>v;j--) s[j] = s[j-1];
+		s[j] = v;
+	}
+	return s[n_med/2];
+}
+
+/*******************************************************************************
+* float soc_from_voltage()
+*
+* Interpolates the per cell discharge curve, 0 to 100 %.
+*******************************************************************************/
+static float soc_from_voltage(float v){
+	float c = v/MIP_BATTERY_CELLS;
+	int i;
+	if(c<=cell_curve[0]) return 0;
+	if(c>=cell_curve[20]) return 100;
+	for(i=1;i<20 && c>cell_curve[i];i++);
+	return 5.0f*(i-1 + (c-cell_curve[i-1])/(cell_curve[i]-cell_curve[i-1]));
+}
+
+/*******************************************************************************
+* float fit_runtime()
+*
+* Least squares slope of charge over time, -1 until it is clearly draining.
+*******************************************************************************/
+static float fit_runtime(float soc){
+	double tm = 0, sm = 0, num = 0, den = 0, slope;
+	int i;
+	if(n_soc<6) return -1;
+	for(i=0;i<n_soc;i++){
+		tm += soc_t[i];
+		sm += soc_v[i];
+	}
+	tm /= n_soc;
+	sm /= n_soc;
+	for(i=0;i<n_soc;i++){
+		num += (soc_t[i]-tm)*(soc_v[i]-sm);
+		den += (soc_t[i]-tm)*(soc_t[i]-tm);
+	}
+	if(den<=0) return -1;
+	slope = num/den;				// %/s
+	if(slope>-1e-4) return -1;
+	if(soc<=MIP_BATTERY_SOC_EMPTY) return 0;
+	return (soc-MIP_BATTERY_SOC_EMPTY)/(-slope);
+}
+
+/*******************************************************************************
+* void sample()
+*
+* One reading through range check, median and asymmetric lowpass.
+*******************************************************************************/
+static void sample(double t, float dt){
+	static double t_soc = -1e9;
+	float v, m, est, tau, soc;
+
+	v = get_battery_voltage();
+	if(v<MIP_BATTERY_V_MIN || v>MIP_BATTERY_V_MAX){
+		atomic_fetch_add(&n_rejected, 1);
+		return;
+	}
+	med[i_med] = v;
+	i_med = (i_med+1)%MIP_BATTERY_MEDIAN;
+	if(n_med<MIP_BATTERY_MEDIAN) n_med++;
+	m = median();
+
+	est = atomic_load(&v_est);
+	if(est==0 || atomic_exchange(&fallback, 0)) est = m;
+	else{
+		tau = m>est ? MIP_BATTERY_TAU_RISE : MIP_BATTERY_TAU_FALL;
+		est += (m-est)*dt/(tau+dt);
+	}
+	atomic_store(&v_est, est);
+	atomic_fetch_add(&n_samples, 1);
+	MIP_TRACE_COUNTER("vBatt", est);
+
+	soc = soc_from_voltage(est);
+	atomic_store(&soc_est, soc);
+	if(t-t_soc>=MIP_BATTERY_SOC_PERIOD){
+		t_soc = t;
+		soc_t[i_soc] = t;
+		soc_v[i_soc] = soc;
+		i_soc = (i_soc+1)%MIP_BATTERY_SOC_POINTS;
+		if(n_soc<MIP_BATTERY_SOC_POINTS) n_soc++;
+		atomic_store(&runtime_est, fit_runtime(soc));
+	}
+}
+
+/*******************************************************************************
+* void* battery_loop()
+*******************************************************************************/
+static void* battery_loop(void* ptr){
+	struct timespec next, t0;
+	float dt;
+	double t;
+
+	mip_trace_thread_name("battery");
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	t0 = next;
+	while(running){
+		t = (next.tv_sec-t0.tv_sec) + (next.tv_nsec-t0.tv_nsec)/1e9;
+		dt = atomic_load(&period_s);
+		MIP_TRACE_BEGIN("battery_sample");
+		sample(t, dt);
+		MIP_TRACE_END("battery_sample");
+		next.tv_nsec += (long)(dt*1e9);
+		while(next.tv_nsec>=1000000000L){
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* int mip_battery_start()
+*
+* mip_battery_voltage() is 0 until the first good reading.
+*******************************************************************************/
+int mip_battery_start(float hz){
+	if(running) return 0;
+	if(hz<=0){
+		printf("ERROR: mip_battery_start, hz must be > 0\n");
+		return -1;
+	}
+	period_s = 1.0f/hz;
+	running = 1;
+	if(pthread_create(&thread, NULL, battery_loop, NULL)){
+		printf("ERROR: failed to start battery thread\n");
+		running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_battery_stop()
+*******************************************************************************/
+int mip_battery_stop(){
+	if(!running) return 0;
+	running = 0;
+	pthread_join(thread, NULL);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_battery_set_rate()
+*
+* Change the sample rate of a running thread, from the next sample on.
+*******************************************************************************/
+int mip_battery_set_rate(float hz){
+	if(hz<=0){
+		printf("ERROR: mip_battery_set_rate, hz must be > 0\n");
+		return -1;
+	}
+	atomic_store(&period_s, 1.0f/hz);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_battery_wait()
+*
+* Waits up to timeout_s for the first good reading, or until EXITING.
+* Returns 0 with a reading, otherwise the estimate is set to v_fallback and
+* it returns -1.
+*******************************************************************************/
+int mip_battery_wait(float timeout_s, float v_fallback){
+	float zero = 0;
+	int i;
+	for(i=0;i<timeout_s*1000 && get_state()!=EXITING;i++){
+		if(atomic_load(&v_est)!=0) return 0;
+		usleep(1000);
+	}
+	atomic_store(&fallback, 1);
+	if(!atomic_compare_exchange_strong(&v_est, &zero, v_fallback)){
+		atomic_store(&fallback, 0);
+		return 0;
+	}
+	printf("WARNING: no battery reading in %.1f s, assuming %.1f V\n", \
+												timeout_s, v_fallback);
+	return -1;
+}
+
+/*******************************************************************************
+* estimates, lock free and safe from the IMU interrupt
+*******************************************************************************/
+float mip_battery_voltage(){
+	return atomic_load(&v_est);
+}
+
+float mip_battery_soc(){
+	return atomic_load(&soc_est);
+}
+
+float mip_battery_runtime_s(){
+	return atomic_load(&runtime_est);
+}
+
+/*******************************************************************************
+* int mip_battery_print()
+*******************************************************************************/
+int mip_battery_print(){
+	float r = mip_battery_runtime_s();
+	printf("battery: %.2f V, %.0f%% charge, %u readings, %u rejected", \
+			mip_battery_voltage(), mip_battery_soc(), \
+			atomic_load(&n_samples), atomic_load(&n_rejected));
+	if(r>=0) printf(", about %.0f min left\n", r/60);
+	else printf(", runtime unknown\n");
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_gain_table_init()
+*
+* Fill the table with func over the grid. Use n_x 1 for a voltage only table,
+* x_min and x_max are then ignored.
+*******************************************************************************/
+int mip_gain_table_init(mip_gain_table_t* t, float v_min, float v_max,
+							int n_v, float x_min, float x_max, int n_x,
+							float (*func)(float v, float x)){
+	int i, j;
+	float v, x;
+	if(n_v<2 || n_x<1 || n_v*n_x>MIP_GAIN_TABLE_MAX || v_max<=v_min){
+		printf("ERROR: mip_gain_table_init, bad grid\n");
+		return -1;
+	}
+	if(n_x>1 && x_max<=x_min){
+		printf("ERROR: mip_gain_table_init, x_max must be more than x_min\n");
+		return -1;
+	}
+	t->v_min = v_min;
+	t->v_step_inv = (n_v-1)/(v_max-v_min);
+	t->n_v = n_v;
+	t->x_min = x_min;
+	t->x_step_inv = n_x>1 ? (n_x-1)/(x_max-x_min) : 0;
+	t->n_x = n_x;
+	for(i=0;i<n_v;i++){
+		v = v_min + i/t->v_step_inv;
+		for(j=0;j<n_x;j++){
+			x = n_x>1 ? x_min + j/t->x_step_inv : x_min;
+			t->gain[i*n_x+j] = func(v, x);
+		}
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* float mip_gain_table_lookup()
+*
+* Linear in v, bilinear with an x axis, clamped at the table edges.
+*******************************************************************************/
+float mip_gain_table_lookup(const mip_gain_table_t* t, float v, float x){
+	float fv, fx, g0, g1;
+	int iv, ix;
+	fv = (v - t->v_min)*t->v_step_inv;
+	if(fv<0) fv = 0;
+	if(fv>t->n_v-1) fv = t->n_v-1;
+	iv = (int)fv;
+	if(iv>t->n_v-2) iv = t->n_v-2;
+	fv -= iv;
+	if(t->n_x==1){
+		return t->gain[iv] + fv*(t->gain[iv+1]-t->gain[iv]);
+	}
+	fx = (x - t->x_min)*t->x_step_inv;
+	if(fx<0) fx = 0;
+	if(fx>t->n_x-1) fx = t->n_x-1;
+	ix = (int)fx;
+	if(ix>t->n_x-2) ix = t->n_x-2;
+	fx -= ix;
+	g0 = t->gain[iv*t->n_x+ix] \
+				+ fx*(t->gain[iv*t->n_x+ix+1]-t->gain[iv*t->n_x+ix]);
+	g1 = t->gain[(iv+1)*t->n_x+ix] \
+				+ fx*(t->gain[(iv+1)*t->n_x+ix+1]-t->gain[(iv+1)*t->n_x+ix]);
+	return g0 + fv*(g1-g0);
+}
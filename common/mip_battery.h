@@ -0,0 +1,70 @@
+/*******************************************************************************
+* mip_battery.h
+* By: Stuart Sonatina
+*
+* Battery voltage estimate for the control loop.
+*
+* mip_battery_start() runs a thread that samples get_battery_voltage() at
+* the given rate. Readings outside MIP_BATTERY_V_MIN..V_MAX are thrown away.
+* A median of the last MIP_BATTERY_MEDIAN readings removes short dips when
+* the motors pull current. After that an asymmetric lowpass follows rises
+* quickly and falls slowly, since the cells themselves only discharge over
+* minutes and anything faster is sag. The estimate is published through an
+* atomic so the IMU interrupt reads it with one load and never waits.
+*
+* mip_battery_wait() holds startup until the first good reading. If none
+* comes within the timeout, say the ADC or the divider is missing or a bench
+* supply is outside the range, the estimate is set to a fallback voltage
+* instead and stays there until a good reading replaces it.
+*
+* The state of charge comes from a 2S lipo discharge curve. The remaining
+* runtime comes from a least squares slope of the charge over the last few
+* minutes.
+*
+* mip_gain_table_t precomputes a gain schedule over voltage and optionally a
+* second variable like pitch or speed, so the controller interpolates a
+* table instead of dividing by the voltage every step.
+*******************************************************************************/
+
+#ifndef MIP_BATTERY_H
+#define MIP_BATTERY_H
+
+#define MIP_BATTERY_V_MIN		5.0		// V, readings outside are rejected
+#define MIP_BATTERY_V_MAX		9.0
+#define MIP_BATTERY_CELLS		2
+#define MIP_BATTERY_MEDIAN		5		// readings, odd
+#define MIP_BATTERY_TAU_RISE	1.0		// s
+#define MIP_BATTERY_TAU_FALL	10.0	// s
+#define MIP_BATTERY_SOC_PERIOD	5.0		// s between runtime fit points
+#define MIP_BATTERY_SOC_POINTS	32		// fit window, 160 s
+#define MIP_BATTERY_SOC_EMPTY	5.0		// %, where runtime runs out
+
+int mip_battery_start(float hz);
+int mip_battery_stop();
+int mip_battery_set_rate(float hz);
+int mip_battery_wait(float timeout_s, float v_fallback);
+float mip_battery_voltage();
+float mip_battery_soc();
+float mip_battery_runtime_s();
+int mip_battery_print();
+
+/*******************************************************************************
+* mip_gain_table_t
+*
+* n_v by n_x grid, gain[i_v*n_x + i_x]. Make n_x 1 for voltage only.
+*******************************************************************************/
+#define MIP_GAIN_TABLE_MAX	512
+
+typedef struct mip_gain_table_t{
+	float v_min, v_step_inv;
+	float x_min, x_step_inv;
+	int n_v, n_x;
+	float gain[MIP_GAIN_TABLE_MAX];
+}mip_gain_table_t;
+
+int mip_gain_table_init(mip_gain_table_t* t, float v_min, float v_max,
+							int n_v, float x_min, float x_max, int n_x,
+							float (*func)(float v, float x));
+float mip_gain_table_lookup(const mip_gain_table_t* t, float v, float x);
+
+#endif //MIP_BATTERY_H
@@ -0,0 +1,356 @@
+/*******************************************************************************
+* mip_button.c
+* By: Stuart Sonatina
+*
+* Edge queue and gesture state machines, see mip_button.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef MIP_SIM
+#include "../mipsim/mipsim.h"
+#else
+#include <roboticscape.h>
+#endif
+
+#include "mip_button.h"
+
+#define NEVER UINT64_MAX
+
+/*******************************************************************************
+* button_state_machine_t
+*
+* IDLE -press-> DOWN -release-> (WAIT_DOUBLE -press-> DOWN) -> IDLE
+*                    -held long-> LONG_HELD -release-> IDLE
+*******************************************************************************/
+typedef enum sm_state_t{
+	SM_IDLE,
+	SM_DOWN,
+	SM_LONG_HELD,
+	SM_WAIT_DOUBLE
+}sm_state_t;
+
+typedef struct edge_t{
+	uint64_t t_ms;
+	mip_button_t button;
+	int pressed;
+}edge_t;
+
+typedef struct machine_t{
+	sm_state_t state;
+	int level;				// debounced level
+	uint64_t t_edge;		// last accepted edge
+	int raw;				// level of the last edge seen
+	uint64_t t_raw;
+	uint64_t settle;		// end of the debounce window it came in
+	uint64_t t_press;
+	uint64_t deadline;		// long press or double click timeout
+	int clicks;				// completed clicks in this gesture
+	uint64_t held_ms;
+	int (*func[MIP_GESTURE_N])(void);
+}machine_t;
+
+static machine_t machine[MIP_BUTTON_N];
+static edge_t queue[MIP_BUTTON_QUEUE_LEN];
+static int q_head = 0, q_len = 0, q_dropped = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake;
+static pthread_t engine_thread;
+static volatile int running = 0;
+
+static const char* gesture_names[MIP_GESTURE_N] = {
+	"press", "release", "short", "long", "double"
+};
+
+/*******************************************************************************
+* uint64_t now_ms()
+*******************************************************************************/
+static uint64_t now_ms(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/*******************************************************************************
+* int mip_button_edge()
+*
+* Timestamp and queue one edge. This is all the library's button thread does,
+* it never waits on a handler.
+*******************************************************************************/
+int mip_button_edge(mip_button_t button, int pressed){
+	edge_t* e;
+	if(button<0 || button>=MIP_BUTTON_N) return -1;
+	pthread_mutex_lock(&lock);
+	if(q_len==MIP_BUTTON_QUEUE_LEN){
+		q_dropped++;
+		pthread_mutex_unlock(&lock);
+		return -1;
+	}
+	e = &queue[(q_head+q_len)%MIP_BUTTON_QUEUE_LEN];
+	e->t_ms = now_ms();
+	e->button = button;
+	e->pressed = pressed;
+	q_len++;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+// library callbacks
+static int on_pause_pressed(){ return mip_button_edge(MIP_BUTTON_PAUSE, 1); }
+static int on_pause_released(){ return mip_button_edge(MIP_BUTTON_PAUSE, 0); }
+static int on_mode_pressed(){ return mip_button_edge(MIP_BUTTON_MODE, 1); }
+static int on_mode_released(){ return mip_button_edge(MIP_BUTTON_MODE, 0); }
+
+/*******************************************************************************
+* fire list
+*
+* Gestures found while holding the lock are run after releasing it so new
+* edges can queue while a handler runs.
+*******************************************************************************/
+typedef struct fire_t{
+	int (*func)(void);
+	mip_button_t button;
+	mip_gesture_t gesture;
+}fire_t;
+
+static fire_t fire[MIP_BUTTON_QUEUE_LEN*2];
+static int n_fire = 0;
+
+static void emit(mip_button_t b, mip_gesture_t g){
+	if(machine[b].func[g]==NULL) return;
+	if(n_fire>=(int)(sizeof(fire)/sizeof(fire[0]))) return;
+	fire[n_fire].func = machine[b].func[g];
+	fire[n_fire].button = b;
+	fire[n_fire].gesture = g;
+	n_fire++;
+}
+
+/*******************************************************************************
+* void accept()
+*
+* Step the button's state machine with a debounced edge at t.
+*******************************************************************************/
+static void accept(mip_button_t b, int pressed, uint64_t t){
+	machine_t* m = &machine[b];
+	m->level = pressed;
+	m->t_edge = t;
+
+	if(pressed){
+		emit(b, MIP_GESTURE_PRESS);
+		if(m->state!=SM_WAIT_DOUBLE) m->clicks = 0;
+		m->state = SM_DOWN;
+		m->t_press = t;
+		m->deadline = t + MIP_BUTTON_LONG_MS;
+		return;
+	}
+
+	emit(b, MIP_GESTURE_RELEASE);
+	m->held_ms = t - m->t_press;
+	switch(m->state){
+	case SM_DOWN:
+		m->clicks++;
+		if(m->clicks>=2){
+			emit(b, MIP_GESTURE_DOUBLE);
+			m->state = SM_IDLE;
+			m->deadline = NEVER;
+		}
+		else if(m->func[MIP_GESTURE_DOUBLE]!=NULL){
+			m->state = SM_WAIT_DOUBLE;
+			m->deadline = t + MIP_BUTTON_DOUBLE_MS;
+		}
+		else{
+			emit(b, MIP_GESTURE_SHORT);
+			m->state = SM_IDLE;
+			m->deadline = NEVER;
+		}
+		break;
+	default:
+		m->state = SM_IDLE;
+		m->deadline = NEVER;
+		break;
+	}
+}
+
+/*******************************************************************************
+* void on_edge()
+*
+* Debounce: an edge inside the window after the last accepted one waits for
+* the window to end, then on_time() takes the level the button settled at.
+* A bounce that ends where it started is nothing.
+*******************************************************************************/
+static void on_edge(const edge_t* e){
+	machine_t* m = &machine[e->button];
+	m->raw = e->pressed;
+	m->t_raw = e->t_ms;
+	if(e->pressed==m->level){
+		m->settle = NEVER;
+		return;
+	}
+	if(m->t_edge && e->t_ms - m->t_edge < MIP_BUTTON_DEBOUNCE_MS){
+		m->settle = m->t_edge + MIP_BUTTON_DEBOUNCE_MS;
+		return;
+	}
+	m->settle = NEVER;
+	accept(e->button, e->pressed, e->t_ms);
+}
+
+/*******************************************************************************
+* void on_time()
+*
+* Deadlines that passed: the end of a debounce window with an edge waiting,
+* long press while held, or no second click.
+*******************************************************************************/
+static void on_time(uint64_t t){
+	machine_t* m;
+	int b;
+	for(b=0;b<MIP_BUTTON_N;b++){
+		m = &machine[b];
+		if(t>=m->settle){
+			m->settle = NEVER;
+			if(m->raw!=m->level) accept(b, m->raw, m->t_raw);
+		}
+		if(t<m->deadline) continue;
+		if(m->state==SM_DOWN){
+			m->held_ms = t - m->t_press;
+			emit(b, MIP_GESTURE_LONG);
+			m->state = SM_LONG_HELD;
+		}
+		else if(m->state==SM_WAIT_DOUBLE){
+			emit(b, MIP_GESTURE_SHORT);
+			m->state = SM_IDLE;
+		}
+		m->deadline = NEVER;
+	}
+}
+
+/*******************************************************************************
+* void* engine()
+*
+* Sleep until an edge arrives or the next deadline, whichever is first.
+*******************************************************************************/
+static void* engine(void* ptr){
+	struct timespec ts;
+	uint64_t next, t;
+	edge_t e;
+	int i, b;
+
+	pthread_mutex_lock(&lock);
+	while(running){
+		while(q_len){
+			e = queue[q_head];
+			q_head = (q_head+1)%MIP_BUTTON_QUEUE_LEN;
+			q_len--;
+			// a deadline that passed before this edge happened goes first
+			on_time(e.t_ms);
+			on_edge(&e);
+		}
+		on_time(now_ms());
+
+		if(n_fire){
+			pthread_mutex_unlock(&lock);
+			for(i=0;i<n_fire;i++) fire[i].func();
+			pthread_mutex_lock(&lock);
+			n_fire = 0;
+			continue;
+		}
+
+		next = now_ms() + 1000;
+		for(b=0;b<MIP_BUTTON_N;b++){
+			if(machine[b].deadline<next) next = machine[b].deadline;
+			if(machine[b].settle<next) next = machine[b].settle;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		t = now_ms();
+		if(next>t){
+			ts.tv_sec += (next-t)/1000;
+			ts.tv_nsec += ((next-t)%1000)*1000000;
+			if(ts.tv_nsec>=1000000000){
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			if(!q_len && running) pthread_cond_timedwait(&wake, &lock, &ts);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/*******************************************************************************
+* int mip_button_start()
+*
+* Take over the library's pause and mode callbacks and start the engine.
+* Set handlers with mip_button_set_func() before or after.
+*******************************************************************************/
+int mip_button_start(){
+	pthread_condattr_t attr;
+	int b;
+	if(running) return 0;
+	for(b=0;b<MIP_BUTTON_N;b++){
+		machine[b].state = SM_IDLE;
+		machine[b].deadline = NEVER;
+		machine[b].settle = NEVER;
+	}
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&wake, &attr);
+	pthread_condattr_destroy(&attr);
+
+	running = 1;
+	if(pthread_create(&engine_thread, NULL, engine, NULL)){
+		printf("ERROR: failed to start button thread\n");
+		running = 0;
+		return -1;
+	}
+	set_pause_pressed_func(&on_pause_pressed);
+	set_pause_released_func(&on_pause_released);
+	set_mode_pressed_func(&on_mode_pressed);
+	set_mode_released_func(&on_mode_released);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_button_stop()
+*******************************************************************************/
+int mip_button_stop(){
+	if(!running) return 0;
+	pthread_mutex_lock(&lock);
+	running = 0;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	pthread_join(engine_thread, NULL);
+	if(q_dropped) printf("buttons: %d edges dropped\n", q_dropped);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_button_set_func()
+*******************************************************************************/
+int mip_button_set_func(mip_button_t button, mip_gesture_t gesture,
+														int (*func)(void)){
+	if(button<0 || button>=MIP_BUTTON_N) return -1;
+	if(gesture<0 || gesture>=MIP_GESTURE_N) return -1;
+	pthread_mutex_lock(&lock);
+	machine[button].func[gesture] = func;
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+/*******************************************************************************
+* uint64_t mip_button_held_ms()
+*
+* How long the button was held for the gesture being handled, measured
+* between edge timestamps.
+*******************************************************************************/
+uint64_t mip_button_held_ms(mip_button_t button){
+	if(button<0 || button>=MIP_BUTTON_N) return 0;
+	return machine[button].held_ms;
+}
+
+const char* mip_gesture_name(mip_gesture_t gesture){
+	if(gesture<0 || gesture>=MIP_GESTURE_N) return "unknown";
+	return gesture_names[gesture];
+}
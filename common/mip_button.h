@@ -0,0 +1,66 @@
+/*******************************************************************************
+* mip_button.h
+* By: Stuart Sonatina
+*
+* Button gestures without sleeping in the library's button callbacks.
+*
+* mip_button_start() hooks the pause and mode button callbacks of the cape
+* library. Those callbacks only timestamp the edge and queue it, then return.
+* An engine thread debounces the edges and runs a small state machine per
+* button that turns them into gestures:
+*
+*	MIP_GESTURE_PRESS		edge, delivered as soon as it is seen
+*	MIP_GESTURE_RELEASE		edge
+*	MIP_GESTURE_SHORT		released before MIP_BUTTON_LONG_MS. If the button
+*							has a DOUBLE handler this waits MIP_BUTTON_DOUBLE_MS
+*							for a second click first.
+*	MIP_GESTURE_LONG		still held MIP_BUTTON_LONG_MS after the press,
+*							fires while the button is held
+*	MIP_GESTURE_DOUBLE		second click within MIP_BUTTON_DOUBLE_MS
+*
+* Gesture timing uses the edge timestamps, so it is accurate to the
+* millisecond however late the engine wakes up. Handlers run on the engine
+* thread one at a time and should return quickly, anything slow belongs in
+* the program's own threads.
+*******************************************************************************/
+
+#ifndef MIP_BUTTON_H
+#define MIP_BUTTON_H
+
+#include <stdint.h>
+
+#ifndef MIP_BUTTON_DEBOUNCE_MS
+#define MIP_BUTTON_DEBOUNCE_MS	20
+#endif
+#ifndef MIP_BUTTON_LONG_MS
+#define MIP_BUTTON_LONG_MS		2000
+#endif
+#ifndef MIP_BUTTON_DOUBLE_MS
+#define MIP_BUTTON_DOUBLE_MS	300
+#endif
+#define MIP_BUTTON_QUEUE_LEN	32
+
+typedef enum mip_button_t{
+	MIP_BUTTON_PAUSE,
+	MIP_BUTTON_MODE,
+	MIP_BUTTON_N
+}mip_button_t;
+
+typedef enum mip_gesture_t{
+	MIP_GESTURE_PRESS,
+	MIP_GESTURE_RELEASE,
+	MIP_GESTURE_SHORT,
+	MIP_GESTURE_LONG,
+	MIP_GESTURE_DOUBLE,
+	MIP_GESTURE_N
+}mip_gesture_t;
+
+int mip_button_start();
+int mip_button_stop();
+int mip_button_set_func(mip_button_t button, mip_gesture_t gesture,
+														int (*func)(void));
+int mip_button_edge(mip_button_t button, int pressed);
+uint64_t mip_button_held_ms(mip_button_t button);
+const char* mip_gesture_name(mip_gesture_t gesture);
+
+#endif //MIP_BUTTON_H
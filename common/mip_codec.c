@@ -0,0 +1,255 @@
+/*******************************************************************************
+* mip_codec.c
+* By: Stuart Sonatina
+*
+* Channel codecs for the MIP log, see mip_codec.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mip_codec.h"
+#include "mip_arena.h"
+
+#define VARINT_MAX_BYTES 10
+
+static inline uint32_t float_bits(float v){
+	uint32_t b;
+	memcpy(&b, &v, 4);
+	return b;
+}
+
+static inline float bits_float(uint32_t b){
+	float v;
+	memcpy(&v, &b, 4);
+	return v;
+}
+
+/*******************************************************************************
+* put_dod()
+*
+* Append the zigzag varint of the delta-of-delta of x. The arithmetic wraps
+* in uint64 on purpose, decoding wraps back the same way.
+*******************************************************************************/
+static inline void put_dod(mip_codec_t* c, int64_t x){
+	uint64_t delta = (uint64_t)x - (uint64_t)c->prev;
+	int64_t dod = (int64_t)(delta - (uint64_t)c->prev_delta);
+	uint64_t z = ((uint64_t)dod << 1) ^ (uint64_t)(dod >> 63);
+	uint8_t* p = c->data + c->len;
+	while(z >= 0x80){
+		*p++ = (uint8_t)z | 0x80;
+		z >>= 7;
+	}
+	*p++ = (uint8_t)z;
+	c->len = p - c->data;
+	c->prev = x;
+	c->prev_delta = (int64_t)delta;
+}
+
+/*******************************************************************************
+* int mip_codec_init()
+*
+* Set up a channel codec and allocate buffers for max_samples per block. This
+* is the only place the codec allocates.
+*******************************************************************************/
+int mip_codec_init(mip_codec_t* c, mip_codec_type_t type, float error_bound,
+															int max_samples){
+	memset(c, 0, sizeof(*c));
+	c->type = type;
+	c->max_samples = max_samples;
+	if(type==MIP_CODEC_QUANT){
+		if(!(error_bound>0)){
+			printf("ERROR: MIP_CODEC_QUANT needs an error bound > 0\n");
+			return -1;
+		}
+		c->step = 2.0f*error_bound;
+		c->inv_step = 1.0/c->step;
+	}
+	c->tags = mip_arena_calloc(max_samples/2+1, 1);
+	c->data = mip_arena_calloc(max_samples, VARINT_MAX_BYTES);
+	if(c->tags==NULL || c->data==NULL){
+		printf("ERROR: mip_codec failed to allocate\n");
+		mip_codec_free(c);
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_codec_free()
+*******************************************************************************/
+int mip_codec_free(mip_codec_t* c){
+	mip_arena_free(c->tags);
+	mip_arena_free(c->data);
+	c->tags = NULL;
+	c->data = NULL;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_codec_reset()
+*
+* Start a new block, forgetting all history.
+*******************************************************************************/
+int mip_codec_reset(mip_codec_t* c){
+	// xor tags are or'ed in so they have to be cleared
+	memset(c->tags, 0, (c->n+1)/2);
+	c->n = 0;
+	c->len = 0;
+	c->prev = 0;
+	c->prev_delta = 0;
+	c->prev_bits = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_codec_put()
+*
+* Encode one sample. Returns -1 if the block is already full.
+*******************************************************************************/
+int mip_codec_put(mip_codec_t* c, float v){
+	uint32_t bits, x;
+	int lz, tz, nb, i;
+	uint8_t tag;
+
+	if(c->n >= c->max_samples) return -1;
+	switch(c->type){
+	case MIP_CODEC_INT:
+		put_dod(c, isfinite(v) ? llrintf(v) : 0);
+		break;
+	case MIP_CODEC_QUANT:
+		put_dod(c, isfinite(v) ? llrint(v*c->inv_step) : 0);
+		break;
+	case MIP_CODEC_XOR:
+		bits = float_bits(v);
+		x = bits ^ c->prev_bits;
+		c->prev_bits = bits;
+		if(x==0) tag = 0;
+		else{
+			lz = __builtin_clz(x)>>3;
+			tz = __builtin_ctz(x)>>3;
+			nb = 4-lz-tz;
+			tag = 1 + (lz<<2) + (nb-1);
+			x >>= tz*8;
+			for(i=0;i<nb;i++){
+				c->data[c->len++] = (uint8_t)x;
+				x >>= 8;
+			}
+		}
+		c->tags[c->n>>1] |= (c->n & 1) ? (tag<<4) : tag;
+		break;
+	case MIP_CODEC_RAW:
+	default:
+		memcpy(c->data + c->len, &v, 4);
+		c->len += 4;
+		break;
+	}
+	c->n++;
+	return 0;
+}
+
+/*******************************************************************************
+* size_t mip_codec_size()
+*
+* Bytes mip_codec_finish() will produce for the current block.
+*******************************************************************************/
+size_t mip_codec_size(const mip_codec_t* c){
+	if(c->type==MIP_CODEC_XOR) return (c->n+1)/2 + c->len;
+	return c->len;
+}
+
+/*******************************************************************************
+* size_t mip_codec_finish()
+*
+* Copy the encoded block to out and return its size. Call mip_codec_reset()
+* before putting the next block.
+*******************************************************************************/
+size_t mip_codec_finish(const mip_codec_t* c, uint8_t* out){
+	size_t ntags = 0;
+	if(c->type==MIP_CODEC_XOR){
+		ntags = (c->n+1)/2;
+		memcpy(out, c->tags, ntags);
+	}
+	memcpy(out+ntags, c->data, c->len);
+	return ntags + c->len;
+}
+
+/*******************************************************************************
+* int mip_codec_decode()
+*
+* Decode n samples from one block into out[0], out[out_stride], ...
+* Returns 0 on success or -1 if the block is corrupt.
+*******************************************************************************/
+int mip_codec_decode(mip_codec_type_t type, float step, const uint8_t* in,
+							size_t len, int n, float* out, int out_stride){
+	const uint8_t* p = in;
+	const uint8_t* end = in+len;
+	const uint8_t* tags;
+	uint64_t prev = 0, delta = 0, z;
+	uint32_t bits = 0, x;
+	int i, shift, lz, nb, b;
+	uint8_t tag;
+
+	switch(type){
+	case MIP_CODEC_INT:
+	case MIP_CODEC_QUANT:
+		for(i=0;i<n;i++){
+			// fast path for the common one byte varint
+			if(p<end && *p<0x80) z = *p++;
+			else{
+				z = 0;
+				shift = 0;
+				do{
+					if(p>=end || shift>63) return -1;
+					z |= (uint64_t)(*p & 0x7f) << shift;
+					shift += 7;
+				}while(*p++ & 0x80);
+			}
+			delta += (z>>1) ^ (0-(z&1));
+			prev += delta;
+			if(type==MIP_CODEC_INT) out[i*out_stride] = (float)(int64_t)prev;
+			else out[i*out_stride] = (double)(int64_t)prev * step;
+		}
+		break;
+	case MIP_CODEC_XOR:
+		tags = p;
+		p += (n+1)/2;
+		if(p>end) return -1;
+		for(i=0;i<n;i++){
+			tag = (i & 1) ? (tags[i>>1]>>4) : (tags[i>>1] & 0x0f);
+			if(tag){
+				lz = (tag-1)>>2;
+				nb = ((tag-1)&3)+1;
+				if(lz+nb>4 || p+nb>end) return -1;
+				x = 0;
+				for(b=0;b<nb;b++) x |= (uint32_t)p[b] << (8*b);
+				p += nb;
+				bits ^= x << (8*(4-lz-nb));
+			}
+			out[i*out_stride] = bits_float(bits);
+		}
+		break;
+	case MIP_CODEC_RAW:
+	default:
+		if(len < (size_t)n*4) return -1;
+		for(i=0;i<n;i++) memcpy(&out[i*out_stride], p+4*i, 4);
+		p += 4*n;
+		break;
+	}
+	return (p==end) ? 0 : -1;
+}
+
+/*******************************************************************************
+* const char* mip_codec_name()
+*******************************************************************************/
+const char* mip_codec_name(mip_codec_type_t type){
+	switch(type){
+	case MIP_CODEC_RAW:		return "raw";
+	case MIP_CODEC_INT:		return "int";
+	case MIP_CODEC_XOR:		return "xor";
+	case MIP_CODEC_QUANT:	return "quant";
+	default:				return "unknown";
+	}
+}
@@ -0,0 +1,65 @@
+/*******************************************************************************
+* mip_codec.h
+* By: Stuart Sonatina
+*
+* Streaming per-channel compression for the MIP log.
+*
+* Samples go in one at a time with mip_codec_put(), which does a fixed small
+* amount of work per sample so it can sit in the logging path. Every
+* MIP_LOG_BLOCK_ROWS samples the writer takes the encoded block and resets the
+* codec, so each block decodes on its own and a truncated file loses at most
+* the block being written.
+*
+* MIP_CODEC_INT	integer valued channels such as encoder counts. Stored as
+*				delta-of-delta, zigzag, varint. Lossless.
+* MIP_CODEC_XOR	float bits xor the previous sample, only the non-zero bytes
+*				are kept with a 4 bit tag per sample. Lossless.
+* MIP_CODEC_QUANT	round to a multiple of 2*error_bound then code like INT.
+*				Every decoded sample is within error_bound of the input.
+*				Non-finite samples are stored as 0.
+*******************************************************************************/
+
+#ifndef MIP_CODEC_H
+#define MIP_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum mip_codec_type_t{
+	MIP_CODEC_RAW = 0,
+	MIP_CODEC_INT,
+	MIP_CODEC_XOR,
+	MIP_CODEC_QUANT
+}mip_codec_type_t;
+
+/*******************************************************************************
+* mip_codec_t
+*
+* Encoder state for one channel plus the buffers for one block.
+*******************************************************************************/
+typedef struct mip_codec_t{
+	mip_codec_type_t type;
+	float step;				// QUANT quantization step, 2*error_bound
+	double inv_step;
+	int max_samples;		// block size the buffers were sized for
+	int n;					// samples in the current block
+	int64_t prev;			// INT/QUANT last value
+	int64_t prev_delta;		// INT/QUANT last delta
+	uint32_t prev_bits;		// XOR/RAW last float bits
+	uint8_t* tags;			// XOR 4 bit tags, two per byte
+	uint8_t* data;			// encoded bytes
+	size_t len;				// bytes used in data
+}mip_codec_t;
+
+int mip_codec_init(mip_codec_t* c, mip_codec_type_t type, float error_bound,
+															int max_samples);
+int mip_codec_free(mip_codec_t* c);
+int mip_codec_reset(mip_codec_t* c);
+int mip_codec_put(mip_codec_t* c, float v);
+size_t mip_codec_size(const mip_codec_t* c);
+size_t mip_codec_finish(const mip_codec_t* c, uint8_t* out);
+int mip_codec_decode(mip_codec_type_t type, float step, const uint8_t* in,
+							size_t len, int n, float* out, int out_stride);
+const char* mip_codec_name(mip_codec_type_t type);
+
+#endif //MIP_CODEC_H
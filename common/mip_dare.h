@@ -0,0 +1,156 @@
+/*******************************************************************************
+* mip_dare.h
+* By: Stuart Sonatina
+*
+* LQR design for one size of system, built from the mip_mat.h kernels.
+*
+* This is a template, define the sizes and a name macro and include it once
+* per size:
+*
+*	#define MIP_DARE_N		4			// states
+*	#define MIP_DARE_M		1			// inputs
+*	#define MIP_DARE_NAME(f)	lqr4_##f
+*	#include "../common/mip_dare.h"
+*
+* which defines, all in double:
+*
+*	lqr4_c2d(A, B, dt, Ad, Bd)	zero order hold discretization of x' = Ax+Bu
+*	lqr4_dare(Ad, Bd, Q, R, K, P)	iterate the discrete Riccati equation to
+*		its fixed point P and the gain K for u = -Kx, returns the number
+*		of iterations or -1 if it didn't converge
+*	lqr4_radius(Ad, Bd, K)		spectral radius of Ad-Bd*K, under 1 is
+*		stable
+*
+* The parameter macros are undefined at the end so the next size can follow.
+*******************************************************************************/
+
+#include <math.h>
+
+#include "mip_mat.h"
+
+#ifndef MIP_DARE_ITERATIONS
+#define MIP_DARE_ITERATIONS	200000
+#define MIP_DARE_TOLERANCE	1e-11		// relative change of P
+#endif
+
+#define N_	MIP_DARE_N
+#define M_	MIP_DARE_M
+#define NM_	(MIP_DARE_N+MIP_DARE_M)
+
+/*******************************************************************************
+* c2d()
+*
+* exp([A B; 0 0]*dt) = [Ad Bd; 0 I], by Taylor series after scaling dt down
+* until the norm is small, then squaring back up.
+*******************************************************************************/
+static int MIP_DARE_NAME(c2d)(const double A[N_][N_], const double B[N_][M_],
+							double dt, double Ad[N_][N_], double Bd[N_][M_]){
+	double S[NM_][NM_], E[NM_][NM_], T[NM_][NM_], U[NM_][NM_], norm = 0;
+	int i, j, k, squarings = 0;
+
+	MIP_MAT_ZERO(S, NM_, NM_);
+	for(i=0;i<N_;i++){
+		for(j=0;j<N_;j++) S[i][j] = A[i][j]*dt;
+		for(j=0;j<M_;j++) S[i][N_+j] = B[i][j]*dt;
+	}
+	for(i=0;i<NM_;i++) for(j=0;j<NM_;j++) norm += fabs(S[i][j]);
+	while(norm>0.1){
+		norm /= 2;
+		squarings++;
+	}
+	for(i=0;i<NM_;i++) for(j=0;j<NM_;j++) S[i][j] /= (1<<squarings);
+
+	// E = I + S + S^2/2! + ...
+	MIP_MAT_IDENTITY(E, NM_);
+	MIP_MAT_IDENTITY(T, NM_);
+	for(k=1;k<=16;k++){
+		MIP_MAT_MUL(U, T, S, NM_, NM_, NM_);
+		MIP_MAT_COPY(T, U, NM_, NM_);
+		for(i=0;i<NM_;i++) for(j=0;j<NM_;j++) T[i][j] /= k;
+		MIP_MAT_ADD_SCALED(E, E, 1.0, T, NM_, NM_);
+	}
+	for(k=0;k<squarings;k++){
+		MIP_MAT_MUL(U, E, E, NM_, NM_, NM_);
+		MIP_MAT_COPY(E, U, NM_, NM_);
+	}
+	for(i=0;i<N_;i++){
+		for(j=0;j<N_;j++) Ad[i][j] = E[i][j];
+		for(j=0;j<M_;j++) Bd[i][j] = E[i][N_+j];
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* dare()
+*
+* P = Q + A'PA - A'PB (R + B'PB)^-1 B'PA, starting from P = Q.
+*******************************************************************************/
+static int MIP_DARE_NAME(dare)(const double A[N_][N_], const double B[N_][M_],
+						const double Q[N_][N_], const double R[M_][M_],
+						double K[M_][N_], double P[N_][N_]){
+	double PA[N_][N_], PB[N_][M_], BPA[M_][N_], S[M_][M_], Si[M_][M_];
+	double Pn[N_][N_], APA[N_][N_], BPB[M_][M_], diff, scale;
+	int it, i, j, ok;
+
+	MIP_MAT_COPY(P, Q, N_, N_);
+	for(it=1;it<=MIP_DARE_ITERATIONS;it++){
+		MIP_MAT_MUL(PA, P, A, N_, N_, N_);
+		MIP_MAT_MUL(PB, P, B, N_, N_, M_);
+		MIP_MAT_TMUL(BPA, B, PA, N_, M_, N_);
+		MIP_MAT_TMUL(BPB, B, PB, N_, M_, M_);
+		MIP_MAT_ADD_SCALED(S, R, 1.0, BPB, M_, M_);
+		MIP_MAT_INV(Si, S, M_, double, ok);
+		if(!ok) return -1;
+		MIP_MAT_MUL(K, Si, BPA, M_, M_, N_);
+		MIP_MAT_TMUL(APA, A, PA, N_, N_, N_);
+		// A'PB K = BPA' K
+		MIP_MAT_TMUL(Pn, BPA, K, M_, N_, N_);
+		for(i=0;i<N_;i++) for(j=0;j<N_;j++){
+			Pn[i][j] = Q[i][j] + APA[i][j] - Pn[i][j];
+		}
+		// keep it symmetric against rounding
+		for(i=0;i<N_;i++) for(j=0;j<i;j++){
+			Pn[i][j] = Pn[j][i] = (Pn[i][j]+Pn[j][i])/2;
+		}
+		MIP_MAT_MAX_DIFF(diff, Pn, P, N_, N_);
+		scale = 0;
+		for(i=0;i<N_;i++) if(fabs(Pn[i][i])>scale) scale = fabs(Pn[i][i]);
+		MIP_MAT_COPY(P, Pn, N_, N_);
+		if(!isfinite(diff)) return -1;
+		if(diff<=MIP_DARE_TOLERANCE*scale) return it;
+	}
+	return -1;
+}
+
+/*******************************************************************************
+* radius()
+*
+* ||(A-BK)^(2^j)||^(1/2^j) for 2^30 steps of the closed loop, renormalizing
+* every squaring so nothing overflows or underflows.
+*******************************************************************************/
+static double MIP_DARE_NAME(radius)(const double A[N_][N_],
+							const double B[N_][M_], const double K[M_][N_]){
+	double C[N_][N_], T[N_][N_], norm, log_r = 0, w = 1;
+	int i, j, k;
+
+	MIP_MAT_MUL(C, B, K, N_, M_, N_);
+	MIP_MAT_ADD_SCALED(C, A, -1.0, C, N_, N_);
+	for(k=0;k<30;k++){
+		norm = 0;
+		for(i=0;i<N_;i++) for(j=0;j<N_;j++) norm += fabs(C[i][j]);
+		if(norm==0) return 0;
+		for(i=0;i<N_;i++) for(j=0;j<N_;j++) C[i][j] /= norm;
+		log_r += w*log(norm);
+		w /= 2;
+		MIP_MAT_MUL(T, C, C, N_, N_, N_);
+		MIP_MAT_COPY(C, T, N_, N_);
+	}
+	return exp(log_r);
+}
+
+#undef N_
+#undef M_
+#undef NM_
+#undef MIP_DARE_N
+#undef MIP_DARE_M
+#undef MIP_DARE_NAME
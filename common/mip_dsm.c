@@ -0,0 +1,123 @@
+/*******************************************************************************
+* mip_dsm.c
+* By: Stuart Sonatina
+*
+* DSM frame capture and latency statistics, see mip_dsm.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdatomic.h>
+
+#ifdef MIP_SIM
+#include "../mipsim/mipsim.h"
+#else
+#include <roboticscape.h>
+#endif
+
+#include "mip_dsm.h"
+#include "mip_ring.h"
+#include "mip_latency.h"
+
+static mip_ring_t ring;
+static _Atomic uint64_t latest_ns = 0;
+static _Atomic uint32_t n_frames = 0;
+static _Atomic uint32_t n_dropped = 0;
+
+static mip_latency_t latency;	// only touched by the control step
+
+/*******************************************************************************
+* uint64_t mip_dsm_now_ns()
+*******************************************************************************/
+uint64_t mip_dsm_now_ns(){
+	return mip_latency_now();
+}
+
+/*******************************************************************************
+* int on_new_frame()
+*
+* Runs on the library's DSM thread, copies the frame into the ring.
+*******************************************************************************/
+static int on_new_frame(){
+	mip_dsm_frame_t* f = mip_ring_claim(&ring);
+	uint64_t t = mip_dsm_now_ns();
+	int i;
+	atomic_fetch_add(&n_frames, 1);
+	atomic_store(&latest_ns, t);
+	if(f==NULL){
+		atomic_fetch_add(&n_dropped, 1);
+		return 0;
+	}
+	f->t_ns = t;
+	f->ch[0] = 0;
+	for(i=1;i<=MIP_DSM_CHANNELS;i++) f->ch[i] = get_dsm_ch_normalized(i);
+	mip_ring_publish(&ring);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_dsm_start()
+*******************************************************************************/
+int mip_dsm_start(){
+	if(mip_ring_init(&ring, sizeof(mip_dsm_frame_t), MIP_DSM_QUEUE_LEN)){
+		return -1;
+	}
+	mip_latency_init(&latency, "dsm frame to motor latency", 100000);
+	if(initialize_dsm()){
+		printf("WARNING: failed to start DSM, no radio control\n");
+		return -1;
+	}
+	set_new_dsm_data_func(&on_new_frame);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_dsm_stop()
+*
+* The ring stays allocated, the DSM thread may still be inside the callback.
+*******************************************************************************/
+int mip_dsm_stop(){
+	set_new_dsm_data_func(NULL);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_dsm_pop()
+*
+* Consumer side. Copies the newest frame into frame and discards any older
+* ones still queued. Returns 1 if there was a frame, 0 if nothing new.
+*******************************************************************************/
+int mip_dsm_pop(mip_dsm_frame_t* frame){
+	int got = 0;
+	if(ring.buf==NULL) return 0;
+	while(mip_ring_pop(&ring, frame)==0) got = 1;
+	return got;
+}
+
+/*******************************************************************************
+* uint64_t mip_dsm_latest_ns()
+*
+* Arrival time of the newest frame, 0 if none yet. Safe from any thread.
+*******************************************************************************/
+uint64_t mip_dsm_latest_ns(){
+	return atomic_load(&latest_ns);
+}
+
+/*******************************************************************************
+* int mip_dsm_latency_add()
+*
+* Call from the control step right after the motors were written with a
+* setpoint from the frame that arrived at frame_t_ns.
+*******************************************************************************/
+int mip_dsm_latency_add(uint64_t frame_t_ns){
+	return mip_latency_add(&latency, frame_t_ns);
+}
+
+/*******************************************************************************
+* int mip_dsm_print_stats()
+*******************************************************************************/
+int mip_dsm_print_stats(){
+	printf("dsm: %u frames, %u dropped\n", atomic_load(&n_frames), \
+											atomic_load(&n_dropped));
+	if(latency.n) mip_latency_print(&latency);
+	return 0;
+}
@@ -0,0 +1,42 @@
+/*******************************************************************************
+* mip_dsm.h
+* By: Stuart Sonatina
+*
+* Timestamped DSM radio frames for the control step.
+*
+* mip_dsm_start() registers a callback with the library's DSM thread that
+* copies every channel of a new frame, stamps it with its arrival time and
+* pushes it onto an SPSC ring. The control step pops the newest frame with
+* mip_dsm_pop() on its own schedule, so stick input no longer waits for a
+* polling thread.
+*
+* Latency is measured from frame arrival to the motor write that first used
+* it: the program calls mip_dsm_latency_add() with the frame's timestamp
+* right after set_motor().
+*******************************************************************************/
+
+#ifndef MIP_DSM_H
+#define MIP_DSM_H
+
+#include <stdint.h>
+
+#define MIP_DSM_CHANNELS	9		// channels 1 to 9 like the library
+#define MIP_DSM_QUEUE_LEN	16		// power of 2
+
+/*******************************************************************************
+* mip_dsm_frame_t
+*******************************************************************************/
+typedef struct mip_dsm_frame_t{
+	uint64_t t_ns;						// arrival, CLOCK_MONOTONIC
+	float ch[MIP_DSM_CHANNELS+1];		// normalized, [0] unused
+}mip_dsm_frame_t;
+
+int mip_dsm_start();
+int mip_dsm_stop();
+int mip_dsm_pop(mip_dsm_frame_t* frame);
+uint64_t mip_dsm_latest_ns();
+uint64_t mip_dsm_now_ns();
+int mip_dsm_latency_add(uint64_t frame_t_ns);
+int mip_dsm_print_stats();
+
+#endif //MIP_DSM_H
@@ -0,0 +1,161 @@
+/*******************************************************************************
+* mip_estimator.h
+* By: Stuart Sonatina
+*
+* Estimator pipelines, declared as a list of stages and compiled into one
+* straight line step function.
+*
+* This is a template, define a name macro, the inputs and the stages and
+* include it once per pipeline:
+*
+*	#define MIP_EST_NAME(f)		cf_##f
+*	#define MIP_EST_INPUTS(X)	X(gyro_x) X(accel_y) X(accel_z) X(dt)
+*	#define MIP_EST_STAGES(X) \
+*		X(AFFINE,		theta_dot,	gyro_x,		offset,		DEG_TO_RAD) \
+*		X(INTEGRATE,	theta_g,	theta_dot,	dt,			0) \
+*		X(HIGHPASS,		theta_gh,	theta_g,	2.0,		0) \
+*		...
+*	#include "../common/mip_estimator.h"
+*
+* Every stage is X(kind, out, a, b, c) and makes the signal out from a and
+* the kind's parameters b and c:
+*
+*	AFFINE		(a-b)*c
+*	INTEGRATE	running sum of a*b, Euler's method with b as dt
+*	LOWPASS		first order lowpass of a, time constant b
+*	HIGHPASS	first order highpass of a, time constant b
+*	ATAN2		atan2(a, b) + c
+*	SUM			a + b + c
+*
+* a, b and c are expressions of the inputs, the outputs of earlier stages
+* and anything else in scope where the pipeline is included, like a global
+* offset. They may be evaluated more than once, so no side effects. Stage
+* outputs are local constants, so using one before the stage that makes it
+* or making it twice is a compile error. The filters do the arithmetic of
+* the cape library's create_first_order_lowpass() and highpass() run by
+* march_filter(), in the same order and precision.
+*
+* which defines:
+*
+*	cf_in_t			one float per input
+*	cf_out_t		one float per stage output
+*	cf_t			the state of every INTEGRATE and filter, 64 byte aligned
+*					so it's one cache line for a small pipeline
+*	cf_init(s, dt)	zero the state and work out the filter coefficients
+*					for samples dt apart
+*	cf_step(s, in, out)		one sample through every stage, always
+*					inlined into the caller as one block of arithmetic. With
+*					out a local gcc drops the outputs nobody reads.
+*	cf_batch(s, in, out, n)	n samples in order, for logs and offline use,
+*					out may be NULL
+*
+* The parameter macros are undefined at the end so the next pipeline can
+* follow.
+*******************************************************************************/
+
+#include <math.h>
+#include <string.h>
+
+#ifndef MIP_ESTIMATOR_H
+#define MIP_ESTIMATOR_H
+
+// what each kind keeps between samples
+#define MIP_EST_STATE_AFFINE(o, a, b, c)
+#define MIP_EST_STATE_INTEGRATE(o, a, b, c)	float o;
+#define MIP_EST_STATE_LOWPASS(o, a, b, c)	float o##_k, o##_y;
+#define MIP_EST_STATE_HIGHPASS(o, a, b, c)	float o##_k, o##_x, o##_y;
+#define MIP_EST_STATE_ATAN2(o, a, b, c)
+#define MIP_EST_STATE_SUM(o, a, b, c)
+
+// coefficients, dt in scope
+#define MIP_EST_INIT_AFFINE(o, a, b, c)
+#define MIP_EST_INIT_INTEGRATE(o, a, b, c)
+#define MIP_EST_INIT_LOWPASS(o, a, b, c)	s->o##_k = dt/(float)(b);
+#define MIP_EST_INIT_HIGHPASS(o, a, b, c)	s->o##_k = dt/(float)(b);
+#define MIP_EST_INIT_ATAN2(o, a, b, c)
+#define MIP_EST_INIT_SUM(o, a, b, c)
+
+// one sample, in the order march_filter() does its arithmetic
+#define MIP_EST_STEP_AFFINE(o, a, b, c) \
+	const float o = ((a) - (b))*(c);
+#define MIP_EST_STEP_INTEGRATE(o, a, b, c) \
+	const float o = s->o = s->o + (b)*(a);
+#define MIP_EST_STEP_LOWPASS(o, a, b, c) \
+	const float o = s->o##_y = s->o##_k*(a) - (s->o##_k-1)*s->o##_y;
+#define MIP_EST_STEP_HIGHPASS(o, a, b, c) \
+	const float o = (1-s->o##_k)*(a) + (s->o##_k-1)*s->o##_x \
+										- (s->o##_k-1)*s->o##_y; \
+	s->o##_x = (a); \
+	s->o##_y = o;
+#define MIP_EST_STEP_ATAN2(o, a, b, c) \
+	const float o = atan2((a), (b)) + (c);
+#define MIP_EST_STEP_SUM(o, a, b, c) \
+	const float o = (a) + (b) + (c);
+
+#define MIP_EST_FIELD(name)					float name;
+#define MIP_EST_LOAD(name) \
+	const float name __attribute__((unused)) = in->name;
+#define MIP_EST_OUT_FIELD(k, o, a, b, c)	float o;
+#define MIP_EST_SAVE(k, o, a, b, c)			out->o = o;
+#define MIP_EST_STATE(k, o, a, b, c)		MIP_EST_STATE_##k(o, a, b, c)
+#define MIP_EST_INIT(k, o, a, b, c)			MIP_EST_INIT_##k(o, a, b, c)
+#define MIP_EST_STEP(k, o, a, b, c)			MIP_EST_STEP_##k(o, a, b, c)
+
+#endif //MIP_ESTIMATOR_H
+
+typedef struct MIP_EST_NAME(in_t){
+	MIP_EST_INPUTS(MIP_EST_FIELD)
+}MIP_EST_NAME(in_t);
+
+typedef struct MIP_EST_NAME(out_t){
+	MIP_EST_STAGES(MIP_EST_OUT_FIELD)
+}MIP_EST_NAME(out_t);
+
+typedef struct MIP_EST_NAME(t){
+	char unused_;		// a pipeline with no state is still a struct
+	MIP_EST_STAGES(MIP_EST_STATE)
+}__attribute__((aligned(64))) MIP_EST_NAME(t);
+
+/*******************************************************************************
+* init()
+*******************************************************************************/
+static inline int MIP_EST_NAME(init)(MIP_EST_NAME(t)* s, float dt){
+	memset(s, 0, sizeof(*s));
+	MIP_EST_STAGES(MIP_EST_INIT)
+	return 0;
+}
+
+/*******************************************************************************
+* step()
+*
+* Every stage in the order they were declared, each output a local.
+*******************************************************************************/
+static inline __attribute__((always_inline)) void MIP_EST_NAME(step)(
+						MIP_EST_NAME(t)* restrict s,
+						const MIP_EST_NAME(in_t)* restrict in,
+						MIP_EST_NAME(out_t)* restrict out){
+	MIP_EST_INPUTS(MIP_EST_LOAD)
+	MIP_EST_STAGES(MIP_EST_STEP)
+	MIP_EST_STAGES(MIP_EST_SAVE)
+}
+
+/*******************************************************************************
+* batch()
+*
+* The state stays in registers across samples where gcc can manage it.
+*******************************************************************************/
+static inline void MIP_EST_NAME(batch)(MIP_EST_NAME(t)* restrict s,
+						const MIP_EST_NAME(in_t)* restrict in,
+						MIP_EST_NAME(out_t)* restrict out, int n){
+	MIP_EST_NAME(t) l = *s;
+	MIP_EST_NAME(out_t) o;
+	int i;
+	for(i=0;i<n;i++){
+		MIP_EST_NAME(step)(&l, &in[i], out!=NULL ? &out[i] : &o);
+	}
+	*s = l;
+}
+
+#undef MIP_EST_NAME
+#undef MIP_EST_INPUTS
+#undef MIP_EST_STAGES
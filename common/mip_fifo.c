@@ -0,0 +1,351 @@
+/*******************************************************************************
+* mip_fifo.c
+* By: Stuart Sonatina
+*
+* MPU-9250 FIFO reader and decimating FIR, see mip_fifo.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "mip_fifo.h"
+#include "mip_trace.h"
+
+// MPU-9250 registers
+#define SMPLRT_DIV		0x19
+#define CONFIG			0x1A
+#define GYRO_CONFIG		0x1B
+#define ACCEL_CONFIG	0x1C
+#define ACCEL_CONFIG2	0x1D
+#define FIFO_EN			0x23
+#define INT_ENABLE		0x38
+#define USER_CTRL		0x6A
+#define PWR_MGMT_1		0x6B
+#define FIFO_COUNTH		0x72
+#define FIFO_R_W		0x74
+#define WHO_AM_I		0x75
+
+#define FIFO_MODE		0x40	// CONFIG, stop writing when full
+#define DLPF_184HZ		0x01	// CONFIG and ACCEL_CONFIG2
+#define FIFO_ACCEL_GYRO	0x78	// FIFO_EN, accel then gyro xyz
+#define USER_FIFO_EN	0x40
+#define USER_FIFO_RST	0x04
+#define PWR_SLEEP		0x40
+#define PWR_CLK_PLL		0x01
+#define MPU9250_ID		0x71
+
+#define FRAME			12		// bytes per sample, 6 big endian int16
+#define FIFO_BYTES		512
+
+static pthread_t thread;
+static volatile int running = 0;
+static imu_data_t* imu;
+static int (*imu_func)(void);
+static int raw_hz;
+static mip_fifo_fir_t fir;
+static uint8_t buf[MIP_FIFO_BURST*FRAME];
+
+// reading thread only, printed at exit
+static uint64_t n_raw, n_out, n_late, n_polls, n_reads, n_overflows;
+static int max_burst;
+
+/*******************************************************************************
+* int mip_fifo_fir_init()
+*
+* cutoff is a fraction of the output rate's Nyquist frequency.
+*******************************************************************************/
+int mip_fifo_fir_init(mip_fifo_fir_t* f, int n_taps, int decimation,
+																float cutoff){
+	double fc, x, w, sum = 0;
+	int i;
+	if(n_taps<1 || n_taps>MIP_FIFO_MAX_TAPS || decimation<1 || \
+											cutoff<=0 || cutoff>1){
+		printf("ERROR: mip_fifo_fir_init, need 1 to %d taps, decimation " \
+					">= 1 and 0 < cutoff <= 1\n", MIP_FIFO_MAX_TAPS);
+		return -1;
+	}
+	memset(f, 0, sizeof(*f));
+	f->n_taps = n_taps;
+	f->decimation = decimation;
+	fc = cutoff/(2.0*decimation);		// cycles per raw sample
+	for(i=0;i<n_taps;i++){
+		x = i - (n_taps-1)/2.0;
+		w = n_taps>1 ? 0.54 - 0.46*cos(2*M_PI*i/(n_taps-1)) : 1;
+		f->taps[i] = w*(x==0 ? 2*fc : sin(2*M_PI*fc*x)/(M_PI*x));
+		sum += f->taps[i];
+	}
+	for(i=0;i<n_taps;i++) f->taps[i] /= sum;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_fifo_fir_push()
+*
+* One raw sample of MIP_FIFO_CHANNELS in, returns 1 when an output is due.
+* The first sample fills the whole delay line so the output starts there
+* instead of ramping up from 0.
+*******************************************************************************/
+int mip_fifo_fir_push(mip_fifo_fir_t* f, const float* x){
+	mip_fifo_v4_t a = {x[0], x[1], x[2], 0};
+	mip_fifo_v4_t b = {x[3], x[4], x[5], 0};
+	int i, n = f->n_taps;
+	if(!f->primed){
+		for(i=0;i<2*n;i++){
+			f->hist[i][0] = a;
+			f->hist[i][1] = b;
+		}
+		f->primed = 1;
+		f->phase = f->decimation-1;
+	}
+	f->pos = f->pos ? f->pos-1 : n-1;
+	f->hist[f->pos][0] = f->hist[f->pos+n][0] = a;
+	f->hist[f->pos][1] = f->hist[f->pos+n][1] = b;
+	if(++f->phase<f->decimation) return 0;
+	f->phase = 0;
+	return 1;
+}
+
+/*******************************************************************************
+* int mip_fifo_fir_output()
+*
+* The filtered value at the newest sample, newest first against the taps.
+*******************************************************************************/
+int mip_fifo_fir_output(mip_fifo_fir_t* f, float* y){
+	const mip_fifo_v4_t (*x)[2] = &f->hist[f->pos];
+	mip_fifo_v4_t a = {0, 0, 0, 0}, b = {0, 0, 0, 0};
+	int k;
+	for(k=0;k<f->n_taps;k++){
+		a += f->taps[k]*x[k][0];
+		b += f->taps[k]*x[k][1];
+	}
+	y[0] = a[0];
+	y[1] = a[1];
+	y[2] = a[2];
+	y[3] = b[0];
+	y[4] = b[1];
+	y[5] = b[2];
+	return 0;
+}
+
+/*******************************************************************************
+* float mip_fifo_fir_delay(), float mip_fifo_fir_noise()
+*
+* Group delay in raw samples, and the fraction of white noise power that
+* gets through.
+*******************************************************************************/
+float mip_fifo_fir_delay(mip_fifo_fir_t* f){
+	return (f->n_taps-1)/2.0f;
+}
+
+float mip_fifo_fir_noise(mip_fifo_fir_t* f){
+	float s = 0;
+	int i;
+	for(i=0;i<f->n_taps;i++) s += f->taps[i]*f->taps[i];
+	return s;
+}
+
+/*******************************************************************************
+* int mpu_setup()
+*
+* Wake the MPU on its PLL, sample at raw_hz behind the 184 Hz DLPF and
+* queue accel and gyro in a freshly reset FIFO. No DMP, no interrupt pin.
+*******************************************************************************/
+static int mpu_setup(){
+	uint8_t id = 0;
+	int err = 0;
+	if(i2c_init(MIP_FIFO_BUS, MIP_FIFO_ADDR)){
+		printf("ERROR: mip_fifo can't open the IMU's I2C bus\n");
+		return -1;
+	}
+	i2c_claim_bus(MIP_FIFO_BUS);
+	if(i2c_read_byte(MIP_FIFO_BUS, WHO_AM_I, &id)<0 || id!=MPU9250_ID){
+		printf("ERROR: mip_fifo, no MPU-9250 (WHO_AM_I 0x%02x)\n", id);
+		i2c_release_bus(MIP_FIFO_BUS);
+		return -1;
+	}
+	err |= i2c_write_byte(MIP_FIFO_BUS, PWR_MGMT_1, PWR_CLK_PLL);
+	err |= i2c_write_byte(MIP_FIFO_BUS, USER_CTRL, 0);
+	err |= i2c_write_byte(MIP_FIFO_BUS, FIFO_EN, 0);
+	err |= i2c_write_byte(MIP_FIFO_BUS, INT_ENABLE, 0);
+	err |= i2c_write_byte(MIP_FIFO_BUS, SMPLRT_DIV, 1000/raw_hz-1);
+	err |= i2c_write_byte(MIP_FIFO_BUS, CONFIG, FIFO_MODE|DLPF_184HZ);
+	err |= i2c_write_byte(MIP_FIFO_BUS, GYRO_CONFIG, 2<<3);	// 1000 deg/s
+	err |= i2c_write_byte(MIP_FIFO_BUS, ACCEL_CONFIG, 1<<3);	// 4 g
+	err |= i2c_write_byte(MIP_FIFO_BUS, ACCEL_CONFIG2, DLPF_184HZ);
+	err |= i2c_write_byte(MIP_FIFO_BUS, USER_CTRL, USER_FIFO_RST);
+	err |= i2c_write_byte(MIP_FIFO_BUS, FIFO_EN, FIFO_ACCEL_GYRO);
+	err |= i2c_write_byte(MIP_FIFO_BUS, USER_CTRL, USER_FIFO_EN);
+	i2c_release_bus(MIP_FIFO_BUS);
+	if(err){
+		printf("ERROR: mip_fifo failed to configure the MPU\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int drain()
+*
+* Everything in the FIFO through the FIR, the newest output into y.
+* Returns the number of outputs, -1 if the FIFO overflowed and was reset.
+*******************************************************************************/
+static int drain(float* y){
+	const float a_scale = MIP_FIFO_ACCEL_FSR*9.80665f/32768.0f;
+	const float g_scale = MIP_FIFO_GYRO_FSR/32768.0f;
+	uint8_t c[2];
+	float x[MIP_FIFO_CHANNELS];
+	int n, k, i, j, outs = 0;
+
+	i2c_claim_bus(MIP_FIFO_BUS);
+	if(i2c_read_bytes(MIP_FIFO_BUS, FIFO_COUNTH, 2, c)<0){
+		i2c_release_bus(MIP_FIFO_BUS);
+		return 0;
+	}
+	n = ((c[0]&0x1F)<<8 | c[1]);
+	// full means samples were lost and the frames may not line up anymore
+	if(n>FIFO_BYTES-FRAME){
+		i2c_write_byte(MIP_FIFO_BUS, USER_CTRL, USER_FIFO_RST|USER_FIFO_EN);
+		i2c_release_bus(MIP_FIFO_BUS);
+		n_overflows++;
+		return -1;
+	}
+	n /= FRAME;
+	if(n>max_burst) max_burst = n;
+	while(n>0){
+		k = n<MIP_FIFO_BURST ? n : MIP_FIFO_BURST;
+		if(i2c_read_bytes(MIP_FIFO_BUS, FIFO_R_W, k*FRAME, buf)<0) break;
+		n_reads++;
+		for(i=0;i<k;i++){
+			for(j=0;j<MIP_FIFO_CHANNELS;j++){
+				x[j] = (int16_t)(buf[i*FRAME+2*j]<<8 | buf[i*FRAME+2*j+1]);
+				x[j] *= j<3 ? a_scale : g_scale;
+			}
+			n_raw++;
+			if(mip_fifo_fir_push(&fir, x)){
+				mip_fifo_fir_output(&fir, y);
+				outs++;
+			}
+		}
+		n -= k;
+	}
+	i2c_release_bus(MIP_FIFO_BUS);
+	return outs;
+}
+
+static void add_ns(struct timespec* t, long ns){
+	t->tv_nsec += ns;
+	while(t->tv_nsec>=1000000000L){
+		t->tv_nsec -= 1000000000L;
+		t->tv_sec++;
+	}
+}
+
+/*******************************************************************************
+* void* fifo_loop()
+*
+* Wakes a quarter sample after the next output should have landed, polls
+* one raw sample at a time if it hasn't yet, hands the output on and sets
+* the next wake from the samples already past it.
+*******************************************************************************/
+static void* fifo_loop(void* ptr){
+	const long raw_ns = 1000000000L/raw_hz;
+	struct sched_param param = {.sched_priority = 80};
+	struct timespec next, poll = {0, raw_ns};
+	float y[MIP_FIFO_CHANNELS] = {0};
+	int outs, tries;
+
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	mip_trace_thread_name("imu_fifo");
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while(running){
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		MIP_TRACE_BEGIN("fifo_drain");
+		outs = 0;
+		for(tries=0;running && tries<=fir.decimation;tries++){
+			if((outs=drain(y))) break;
+			n_polls++;
+			nanosleep(&poll, NULL);
+		}
+		MIP_TRACE_END("fifo_drain");
+		clock_gettime(CLOCK_MONOTONIC, &next);
+		add_ns(&next, (fir.decimation-fir.phase)*raw_ns + raw_ns/4);
+		if(outs<=0 || !running) continue;
+		n_out++;
+		n_late += outs-1;
+		imu->accel[0] = y[0];
+		imu->accel[1] = y[1];
+		imu->accel[2] = y[2];
+		imu->gyro[0] = y[3];
+		imu->gyro[1] = y[4];
+		imu->gyro[2] = y[5];
+		if(imu_func!=NULL) imu_func();
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* int mip_fifo_start()
+*
+* Sets up the MPU and starts calling func at out_hz, which has to divide
+* rate_hz (1000 Hz or a divisor of it). cutoff is the FIR's corner as a
+* fraction of out_hz/2.
+*******************************************************************************/
+int mip_fifo_start(imu_data_t* data, int rate_hz, int out_hz, int n_taps,
+									float cutoff, int (*func)(void)){
+	if(running) return 0;
+	if(rate_hz<4 || rate_hz>1000 || 1000%rate_hz || out_hz<1 || \
+												rate_hz%out_hz){
+		printf("ERROR: mip_fifo_start, rate_hz must divide 1000 and " \
+												"out_hz divide rate_hz\n");
+		return -1;
+	}
+	if(mip_fifo_fir_init(&fir, n_taps, rate_hz/out_hz, cutoff)) return -1;
+	imu = data;
+	imu_func = func;
+	raw_hz = rate_hz;
+	if(mpu_setup()) return -1;
+	printf("imu fifo: %d Hz decimated to %d Hz, %d taps, delay %.2f ms, " \
+			"noise power x%.3f\n", raw_hz, out_hz, n_taps, \
+			mip_fifo_fir_delay(&fir)*1e3/raw_hz, mip_fifo_fir_noise(&fir));
+	running = 1;
+	if(pthread_create(&thread, NULL, fifo_loop, NULL)){
+		printf("ERROR: failed to start imu fifo thread\n");
+		running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_fifo_stop()
+*
+* Stops the thread and puts the MPU to sleep.
+*******************************************************************************/
+int mip_fifo_stop(){
+	if(!running) return 0;
+	running = 0;
+	pthread_join(thread, NULL);
+	i2c_claim_bus(MIP_FIFO_BUS);
+	i2c_write_byte(MIP_FIFO_BUS, USER_CTRL, 0);
+	i2c_write_byte(MIP_FIFO_BUS, PWR_MGMT_1, PWR_SLEEP);
+	i2c_release_bus(MIP_FIFO_BUS);
+	i2c_close(MIP_FIFO_BUS);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_fifo_print()
+*******************************************************************************/
+int mip_fifo_print(){
+	printf("imu fifo: %llu samples in %llu reads, %llu outputs, %llu late, " \
+			"%llu polls, %llu overflows, largest burst %d\n", \
+			(unsigned long long)n_raw, (unsigned long long)n_reads, \
+			(unsigned long long)n_out, (unsigned long long)n_late, \
+			(unsigned long long)n_polls, (unsigned long long)n_overflows, \
+			max_burst);
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*******************************************************************************
+* mip_fifo.h
+* By: Stuart Sonatina
+*
+* Raw IMU mode: accel and gyro read from the MPU-9250's FIFO in bursts and
+* decimated down to the control rate, in place of one DMP sample per
+* interrupt.
+*
+* The MPU samples at rate_hz (1 kHz) into its FIFO by its own clock. A
+* thread wakes when the next output is due, reads everything that arrived
+* over I2C in bursts of up to MIP_FIFO_BURST samples and pushes each one
+* through an anti-aliasing FIR. Every decimation samples the FIR gives one
+* output, which goes into the imu_data_t the program passed in before its
+* function is called, like the cape library's IMU interrupt. If a late
+* wake finds more than one output only the newest is handed on and the
+* others count as late. The samples left over after the last output tell
+* how far the sensor's clock is along, the next wake is set from those so
+* the thread follows the MPU rather than the CPU clock.
+*
+* Without the DMP there is no dmp_TaitBryan, this mode is for programs that
+* estimate the angle themselves. Orientation isn't applied, accel and gyro
+* come in the board's frame like the cape library reports them.
+*
+* The FIR keeps its delay line twice, so the taps always see one contiguous
+* window, and each sample as 8 floats, the six channels and two of padding.
+* One tap is then two multiply-adds of 4 wide GCC vectors over all channels
+* at once, SSE on a desktop. On the BeagleBone they are NEON only because
+* the Makefile builds this file alone with -funsafe-math-optimizations,
+* without it GCC won't use NEON's flush to zero arithmetic for float
+* vectors and splits them into scalar VFP instructions.
+* The taps are a Hamming windowed sinc with unity DC gain. A filter of
+* n_taps delays the signal by (n_taps-1)/2 raw samples and cuts white noise
+* power to the sum of the squared taps, both printed at start.
+*******************************************************************************/
+
+#ifndef MIP_FIFO_H
+#define MIP_FIFO_H
+
+#include <stdint.h>
+
+#ifdef MIP_SIM
+#include "../mipsim/mipsim.h"
+#else
+#include <roboticscape.h>
+#endif
+
+#define MIP_FIFO_MAX_TAPS	64
+#define MIP_FIFO_CHANNELS	6		// accel xyz, gyro xyz
+#define MIP_FIFO_BURST		21		// samples per I2C read, 252 bytes
+#define MIP_FIFO_BUS		2		// the cape's IMU, i2c2 at 0x68
+#define MIP_FIFO_ADDR		0x68
+#define MIP_FIFO_ACCEL_FSR	4		// g full scale
+#define MIP_FIFO_GYRO_FSR	1000	// deg/s full scale
+
+typedef float mip_fifo_v4_t __attribute__((vector_size(16)));
+
+/*******************************************************************************
+* mip_fifo_fir_t
+*
+* Decimating FIR over the six channels.
+*******************************************************************************/
+typedef struct mip_fifo_fir_t{
+	int n_taps;
+	int decimation;
+	int phase;						// samples since the last output
+	int pos;						// newest sample in hist
+	int primed;
+	float taps[MIP_FIFO_MAX_TAPS];
+	mip_fifo_v4_t hist[2*MIP_FIFO_MAX_TAPS][2];
+}mip_fifo_fir_t;
+
+int mip_fifo_fir_init(mip_fifo_fir_t* f, int n_taps, int decimation,
+																float cutoff);
+int mip_fifo_fir_push(mip_fifo_fir_t* f, const float* x);
+int mip_fifo_fir_output(mip_fifo_fir_t* f, float* y);
+float mip_fifo_fir_delay(mip_fifo_fir_t* f);
+float mip_fifo_fir_noise(mip_fifo_fir_t* f);
+
+// the reading thread, one per program
+int mip_fifo_start(imu_data_t* data, int rate_hz, int out_hz, int n_taps,
+									float cutoff, int (*func)(void));
+int mip_fifo_stop();
+int mip_fifo_print();
+
+#endif //MIP_FIFO_H
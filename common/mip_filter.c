@@ -0,0 +1,267 @@
+/*******************************************************************************
+* mip_filter.c
+* By: Stuart Sonatina
+*
+* Split step transfer function controller, see mip_filter.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "mip_filter.h"
+
+/*******************************************************************************
+* void sum_past()
+*
+* Everything the next output needs except the new input.
+*******************************************************************************/
+static void sum_past(mip_filter_t* f){
+	float pn = 0, pd = 0;
+	int i;
+	for(i=1;i<=f->order;i++){
+		pn += f->num[i]*f->in[i-1];
+		pd += f->den[i]*f->out[i-1];
+	}
+	f->past_num = pn;
+	f->past_den = pd;
+}
+
+/*******************************************************************************
+* int mip_filter_init()
+*
+* Transfer function num/den in z^-1 with order+1 coefficients each, same
+* arguments as the library's create_filter().
+*******************************************************************************/
+int mip_filter_init(mip_filter_t* f, int order, float dt, float* num,
+																float* den){
+	int i;
+	memset(f, 0, sizeof(*f));
+	if(order<0 || order>MIP_FILTER_MAX_ORDER){
+		printf("ERROR: mip_filter_init, order must be 0 to %d\n", \
+												MIP_FILTER_MAX_ORDER);
+		return -1;
+	}
+	if(den[0]==0){
+		printf("ERROR: mip_filter_init, den[0] must not be 0\n");
+		return -1;
+	}
+	f->order = order;
+	f->dt = dt;
+	f->gain = 1.0;
+	for(i=0;i<=order;i++){
+		f->num[i] = num[i]/den[0];
+		f->den[i] = den[i]/den[0];
+	}
+	f->initialized = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_filter_pid()
+*
+* kp + ki/s + kd*s/(Tf*s+1) discretized with forward euler like the
+* library's create_pid().
+*******************************************************************************/
+int mip_filter_pid(mip_filter_t* f, float kp, float ki, float kd, float Tf,
+																	float dt){
+	float num[3], den[3];
+	float c, d;
+	if(kd==0){
+		num[0] = kp + ki*dt;
+		num[1] = -kp;
+		den[0] = 1;
+		den[1] = -1;
+		return mip_filter_init(f, 1, dt, num, den);
+	}
+	if(Tf<=dt/2){
+		printf("ERROR: mip_filter_pid, Tf must be > dt/2 for stability\n");
+		Tf = dt;
+	}
+	c = Tf;
+	d = dt-Tf;
+	num[0] = kp*c + kd;
+	num[1] = kp*(d-c) + ki*dt*c - 2*kd;
+	num[2] = -kp*d + ki*dt*d + kd;
+	den[0] = c;
+	den[1] = d-c;
+	den[2] = -d;
+	return mip_filter_init(f, 2, dt, num, den);
+}
+
+/*******************************************************************************
+* saturation and soft start
+*******************************************************************************/
+int mip_filter_saturation(mip_filter_t* f, float min, float max){
+	if(min>=max){
+		printf("ERROR: mip_filter_saturation, max must be more than min\n");
+		return -1;
+	}
+	f->sat_en = 1;
+	f->sat_min = min;
+	f->sat_max = max;
+	return 0;
+}
+
+int mip_filter_soft_start(mip_filter_t* f, float seconds){
+	if(!f->sat_en){
+		printf("ERROR: enable saturation before soft start\n");
+		return -1;
+	}
+	f->ss_steps = seconds/f->dt;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_filter_reset()
+*******************************************************************************/
+int mip_filter_reset(mip_filter_t* f){
+	memset(f->in, 0, sizeof(f->in));
+	memset(f->out, 0, sizeof(f->out));
+	f->past_num = 0;
+	f->past_den = 0;
+	f->newest_input = 0;
+	f->newest_output = 0;
+	f->pending = 0;
+	f->sat_flag = 0;
+	f->step = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_filter_prefill()
+*
+* Fill the history as if the filter had sat at input in and output out
+* forever, like the library's prefill_filter_inputs() and outputs() together.
+*******************************************************************************/
+int mip_filter_prefill(mip_filter_t* f, float in, float out){
+	int i;
+	for(i=0;i<=f->order;i++){
+		f->in[i] = in;
+		f->out[i] = out;
+	}
+	f->pending = 0;
+	sum_past(f);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_filter_transfer()
+*
+* Hand the running state of src to dst, which has new coefficients for the
+* same signals, without a bump. dst picks up src's input and output
+* history, the oldest values held if dst is longer, and its soft start
+* position. Then the history is back-solved so that dst, at its own gain
+* and given the input src saw last, outputs exactly what src did last:
+*
+*	y = gain*(num[0]*u + sum(num[i]*in[i-1])) - sum(den[i]*out[i-1])
+*
+* The output history is shifted by the one offset that makes that true.
+* Any filter with an integrator has sum(den[i]) = -1 for i>=1, so the
+* integrator simply carries on from src's output. A filter with no
+* feedback shifts its input history instead. A pure gain has no history
+* and still steps. Call between commit() and the next output().
+*******************************************************************************/
+int mip_filter_transfer(mip_filter_t* dst, const mip_filter_t* src){
+	float y, a = 0, b = 0, shift;
+	int i, j;
+	for(i=0;i<=dst->order;i++){
+		j = i<=src->order ? i : src->order;
+		dst->in[i] = src->in[j];
+		dst->out[i] = src->out[j];
+	}
+	dst->newest_input = src->newest_input;
+	dst->newest_output = src->newest_output;
+	dst->pending = 0;
+	dst->sat_flag = src->sat_flag;
+	dst->step = src->step;
+	sum_past(dst);
+
+	// what dst would output now against what src did
+	y = dst->gain*(dst->num[0]*src->newest_input + dst->past_num) \
+														- dst->past_den;
+	for(i=1;i<=dst->order;i++){
+		a += dst->den[i];
+		b += dst->num[i];
+	}
+	if(fabsf(a)>MIP_FILTER_TRANSFER_MIN){
+		shift = (y - src->newest_output)/a;
+		for(i=0;i<=dst->order;i++) dst->out[i] += shift;
+	}
+	else if(fabsf(dst->gain*b)>MIP_FILTER_TRANSFER_MIN){
+		shift = (src->newest_output - y)/(dst->gain*b);
+		for(i=0;i<=dst->order;i++) dst->in[i] += shift;
+	}
+	sum_past(dst);
+	return 0;
+}
+
+/*******************************************************************************
+* float mip_filter_output()
+*
+* First half of a step, the only part that has to happen before set_motor().
+* Call mip_filter_commit() once the motors are written.
+*******************************************************************************/
+float mip_filter_output(mip_filter_t* f, float input){
+	float out, a, b;
+	if(!f->initialized){
+		printf("ERROR: mip_filter_output, filter not initialized\n");
+		return 0;
+	}
+	out = f->gain*(f->num[0]*input + f->past_num) - f->past_den;
+
+	// soft start ramps the saturation limits up from 0
+	if(f->step<f->ss_steps){
+		a = f->sat_max*(f->step/f->ss_steps);
+		b = f->sat_min*(f->step/f->ss_steps);
+		if(out>a) out = a;
+		if(out<b) out = b;
+	}
+	f->sat_flag = 0;
+	if(f->sat_en){
+		if(out>f->sat_max){
+			out = f->sat_max;
+			f->sat_flag = 1;
+		}
+		else if(out<f->sat_min){
+			out = f->sat_min;
+			f->sat_flag = 1;
+		}
+	}
+	f->newest_input = input;
+	f->newest_output = out;
+	f->pending = 1;
+	return out;
+}
+
+/*******************************************************************************
+* int mip_filter_commit()
+*
+* Second half: shift the newest input and output into the history and sum
+* the past terms for the next step.
+*******************************************************************************/
+int mip_filter_commit(mip_filter_t* f){
+	int i;
+	if(!f->pending) return -1;
+	for(i=f->order;i>0;i--){
+		f->in[i] = f->in[i-1];
+		f->out[i] = f->out[i-1];
+	}
+	f->in[0] = f->newest_input;
+	f->out[0] = f->newest_output;
+	f->pending = 0;
+	f->step++;
+	sum_past(f);
+	return 0;
+}
+
+/*******************************************************************************
+* float mip_filter_march()
+*
+* Whole step at once, same result as output() then commit().
+*******************************************************************************/
+float mip_filter_march(mip_filter_t* f, float input){
+	float out = mip_filter_output(f, input);
+	mip_filter_commit(f);
+	return out;
+}
@@ -0,0 +1,68 @@
+/*******************************************************************************
+* mip_filter.h
+* By: Stuart Sonatina
+*
+* Discrete transfer function controller that can run in two halves.
+*
+* For y[k] = gain*sum(num[i]*u[k-i]) - sum(den[i]*y[k-i]) everything except
+* num[0]*u[k] is known as soon as the previous step is done. mip_filter_commit()
+* files away the last step and adds up those past terms right after the
+* motors are written, so when the next IMU sample arrives
+* mip_filter_output() is one multiply-add plus saturation. mip_filter_march()
+* does both halves back to back like the library's march_filter().
+*
+* Gain, saturation and soft start behave like the library's d_filter_t. The
+* gain is applied at output time so battery compensation can change it every
+* step.
+*******************************************************************************/
+
+#ifndef MIP_FILTER_H
+#define MIP_FILTER_H
+
+#include <stdint.h>
+
+#define MIP_FILTER_MAX_ORDER	8
+#define MIP_FILTER_TRANSFER_MIN	1e-3	// smallest history sum to solve with
+
+/*******************************************************************************
+* mip_filter_t
+*******************************************************************************/
+typedef struct mip_filter_t{
+	int order;
+	float dt;
+	float gain;
+	float num[MIP_FILTER_MAX_ORDER+1];	// normalized so den[0] is 1
+	float den[MIP_FILTER_MAX_ORDER+1];
+	float in[MIP_FILTER_MAX_ORDER+1];	// [0] newest
+	float out[MIP_FILTER_MAX_ORDER+1];
+	float past_num;						// num terms of the next step, no u[k]
+	float past_den;						// den terms of the next step
+	float newest_input;
+	float newest_output;
+	int pending;						// output() ran, commit() not yet
+	int sat_en;
+	float sat_min, sat_max;
+	int sat_flag;
+	float ss_steps;						// soft start length, 0 for none
+	uint64_t step;
+	int initialized;
+}mip_filter_t;
+
+int mip_filter_init(mip_filter_t* f, int order, float dt, float* num,
+																float* den);
+int mip_filter_pid(mip_filter_t* f, float kp, float ki, float kd, float Tf,
+																	float dt);
+int mip_filter_saturation(mip_filter_t* f, float min, float max);
+int mip_filter_soft_start(mip_filter_t* f, float seconds);
+int mip_filter_reset(mip_filter_t* f);
+int mip_filter_prefill(mip_filter_t* f, float in, float out);
+int mip_filter_transfer(mip_filter_t* dst, const mip_filter_t* src);
+float mip_filter_output(mip_filter_t* f, float input);
+int mip_filter_commit(mip_filter_t* f);
+float mip_filter_march(mip_filter_t* f, float input);
+
+static inline int mip_filter_saturated(mip_filter_t* f){
+	return f->sat_flag;
+}
+
+#endif //MIP_FILTER_H
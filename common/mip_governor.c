@@ -0,0 +1,270 @@
+/*******************************************************************************
+* mip_governor.c
+* By: Stuart Sonatina
+*
+* Slack aware frequency governor, see mip_governor.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#include "mip_governor.h"
+
+const int mip_governor_mhz[MIP_GOVERNOR_LEVELS] = {300, 600, 800, 1000};
+const float mip_governor_volts[MIP_GOVERNOR_LEVELS] = {0.95, 1.10, 1.26, 1.325};
+
+#define TOP (MIP_GOVERNOR_LEVELS-1)
+
+/*******************************************************************************
+* int mip_governor_init()
+*
+* Starts at the highest clock.
+*******************************************************************************/
+int mip_governor_init(mip_governor_t* g, float period_s, float margin,
+															float hold_s){
+	if(period_s<=0 || margin<0 || margin>=1){
+		printf("ERROR: mip_governor_init, need period > 0, 0 <= margin < 1\n");
+		return -1;
+	}
+	memset(g, 0, sizeof(*g));
+	g->period_s = period_s;
+	g->margin = margin;
+	g->hold_s = hold_s;
+	g->level = TOP;
+	return 0;
+}
+
+/*******************************************************************************
+* double mip_governor_energy()
+*
+* Energy proxy for one window spent busy_s computing at level.
+*******************************************************************************/
+double mip_governor_energy(int level, double busy_s, double window_s){
+	double v = mip_governor_volts[level];
+	double cycles = busy_s*mip_governor_mhz[level]*1e6;
+	return cycles*v*v*1e-9 + MIP_GOVERNOR_LEAK*v*window_s;
+}
+
+static int set_level(mip_governor_t* g, int level){
+	if(level!=g->level){
+		g->level = level;
+		g->switches++;
+	}
+	g->calm_s = 0;
+	return level;
+}
+
+/*******************************************************************************
+* int mip_governor_update()
+*
+* Account one window at the current level and return the level for the
+* next. wcet_s and busy_s are the worst step and total step time measured
+* at the current clock.
+*******************************************************************************/
+int mip_governor_update(mip_governor_t* g, float wcet_s, float busy_s,
+											float window_s, int overruns){
+	int want, i;
+
+	g->energy += mip_governor_energy(g->level, busy_s, window_s);
+	g->cycles += busy_s*mip_governor_mhz[g->level]*1e6;
+	g->time_at[g->level] += window_s;
+	if(overruns){
+		g->overruns += overruns;
+		return set_level(g, TOP);
+	}
+
+	// lowest clock whose scaled worst case still leaves the margin
+	want = TOP;
+	for(i=0;i<TOP;i++){
+		if(wcet_s*mip_governor_mhz[g->level]/mip_governor_mhz[i] \
+										<= (1-g->margin)*g->period_s){
+			want = i;
+			break;
+		}
+	}
+	if(want>g->level) return set_level(g, want);
+	if(want==g->level){
+		g->calm_s = 0;
+		return g->level;
+	}
+	g->calm_s += window_s;
+	if(g->calm_s>=g->hold_s) return set_level(g, want);
+	return g->level;
+}
+
+/*******************************************************************************
+* int mip_governor_boost()
+*******************************************************************************/
+int mip_governor_boost(mip_governor_t* g){
+	return set_level(g, TOP);
+}
+
+/*******************************************************************************
+* int mip_governor_print()
+*
+* Energy is also given relative to the same work at a fixed top clock.
+*******************************************************************************/
+int mip_governor_print(mip_governor_t* g){
+	double total = 0, fixed, v = mip_governor_volts[TOP];
+	int i;
+	for(i=0;i<MIP_GOVERNOR_LEVELS;i++) total += g->time_at[i];
+	if(total<=0){
+		printf("governor: no windows\n");
+		return 0;
+	}
+	printf("governor: %llu overruns, %llu switches, time at", \
+		(unsigned long long)g->overruns, (unsigned long long)g->switches);
+	for(i=0;i<MIP_GOVERNOR_LEVELS;i++){
+		printf(" %d MHz %.0f%%%s", mip_governor_mhz[i], \
+				100*g->time_at[i]/total, i<TOP ? "," : "\n");
+	}
+	fixed = g->cycles*v*v*1e-9 + MIP_GOVERNOR_LEAK*v*total;
+	printf("governor: energy proxy %.3f, %.0f%% of the same work at %d MHz\n",\
+						g->energy, 100*g->energy/fixed, mip_governor_mhz[TOP]);
+	return 0;
+}
+
+/*******************************************************************************
+* governor thread
+*
+* The interrupt side only touches atomics and posts a semaphore, both safe
+* from any context, and the thread owns the mip_governor_t.
+*******************************************************************************/
+static mip_governor_t gov;
+static pthread_t thread;
+static sem_t wake;
+static volatile int running = 0;
+static float window_len;
+static int (*set_func)(int level) = NULL;
+static _Atomic uint64_t wcet_ns = 0;
+static _Atomic uint64_t busy_ns = 0;
+static _Atomic uint32_t n_overruns = 0;
+static _Atomic int boost = 0;
+static uint64_t last_start = 0;		// interrupt side only
+
+static uint64_t now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void* governor_loop(void* ptr){
+	struct timespec ts;
+	uint64_t t_last = now_ns(), t;
+	int level, old;
+
+	while(running){
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += (long)(window_len*1e9);
+		while(ts.tv_nsec>=1000000000L){
+			ts.tv_nsec -= 1000000000L;
+			ts.tv_sec++;
+		}
+		while(sem_timedwait(&wake, &ts)==-1 && errno==EINTR);
+		if(!running) break;
+
+		t = now_ns();
+		old = gov.level;
+		level = mip_governor_update(&gov, atomic_exchange(&wcet_ns, 0)/1e9, \
+						atomic_exchange(&busy_ns, 0)/1e9, \
+						(t-t_last)/1e9, atomic_exchange(&n_overruns, 0));
+		if(atomic_exchange(&boost, 0)) level = mip_governor_boost(&gov);
+		t_last = t;
+		if(level!=old && set_func!=NULL) set_func(level);
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* int mip_governor_start()
+*
+* set_level(i) should switch the CPU to mip_governor_mhz[i]. The clock is
+* set to the top level right away.
+*******************************************************************************/
+int mip_governor_start(float period_s, float margin, float hold_s,
+								float window_s, int (*set_level)(int level)){
+	if(running) return 0;
+	if(mip_governor_init(&gov, period_s, margin, hold_s)) return -1;
+	if(window_s<=0 || set_level==NULL){
+		printf("ERROR: mip_governor_start, need a window and set_level\n");
+		return -1;
+	}
+	window_len = window_s;
+	set_func = set_level;
+	set_func(gov.level);
+	sem_init(&wake, 0, 0);
+	running = 1;
+	if(pthread_create(&thread, NULL, governor_loop, NULL)){
+		printf("ERROR: failed to start governor thread\n");
+		running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_governor_step()
+*
+* Call at the end of every control step with when it started and ended. A
+* step longer than the period, or one that started over 1.5 periods after
+* the last, counts as an overrun and wakes the governor at once.
+*******************************************************************************/
+int mip_governor_step(uint64_t t_start_ns, uint64_t t_end_ns){
+	uint64_t d = t_end_ns - t_start_ns;
+	uint64_t w = atomic_load(&wcet_ns);
+	uint64_t period = gov.period_s*1e9;
+	int late;
+	if(!running) return 0;
+	while(d>w && !atomic_compare_exchange_weak(&wcet_ns, &w, d));
+	atomic_fetch_add(&busy_ns, d);
+	late = last_start && t_start_ns-last_start > period*3/2;
+	last_start = t_start_ns;
+	if(d>period || late){
+		atomic_fetch_add(&n_overruns, 1);
+		sem_post(&wake);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_governor_skip()
+*
+* Call from the interrupt instead of mip_governor_step() for samples that
+* are deliberately not run, so the next step isn't counted as late.
+*******************************************************************************/
+int mip_governor_skip(){
+	last_start = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_governor_request_boost()
+*
+* Top clock now, from any thread, e.g. when the controller arms.
+*******************************************************************************/
+int mip_governor_request_boost(){
+	if(!running) return 0;
+	atomic_store(&boost, 1);
+	sem_post(&wake);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_governor_stop()
+*
+* Stops the thread and prints its statistics.
+*******************************************************************************/
+int mip_governor_stop(){
+	if(!running) return 0;
+	running = 0;
+	sem_post(&wake);
+	pthread_join(thread, NULL);
+	sem_destroy(&wake);
+	mip_governor_print(&gov);
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*******************************************************************************
+* mip_governor.h
+* By: Stuart Sonatina
+*
+* Slack aware CPU frequency governor for a periodic control step.
+*
+* Each window the governor takes the worst step execution time, scales it to
+* every operating point by clock ratio and picks the lowest clock that still
+* leaves margin*period free. Going up happens right away, going down only
+* after hold_s of windows that all allowed it. An overrun, meaning a step
+* longer than the period or a late step, and mip_governor_boost() (call it
+* when arming) both jump straight to the highest clock.
+*
+* The decision is separate from how the clock gets set:
+* mip_governor_update() is a pure step that the host tool governor_sim
+* drives with a simulated clock. mip_governor_start() runs it in a thread
+* fed by mip_governor_step() from the IMU interrupt and applies the choice
+* through the set_level function the program passes in.
+*
+* Energy is a proxy, not a measurement: cycles*V^2 for switching plus
+* MIP_GOVERNOR_LEAK*V per second for leakage, in units where one billion
+* cycles at 1 V is 1.
+*******************************************************************************/
+
+#ifndef MIP_GOVERNOR_H
+#define MIP_GOVERNOR_H
+
+#include <stdint.h>
+
+#define MIP_GOVERNOR_LEVELS	4
+#define MIP_GOVERNOR_LEAK	0.4		// leakage weight, see above
+
+// AM335x operating points the cape library can select
+extern const int mip_governor_mhz[MIP_GOVERNOR_LEVELS];
+extern const float mip_governor_volts[MIP_GOVERNOR_LEVELS];
+
+/*******************************************************************************
+* mip_governor_t
+*******************************************************************************/
+typedef struct mip_governor_t{
+	float period_s;
+	float margin;				// fraction of the period to keep free
+	float hold_s;
+	int level;					// index into mip_governor_mhz
+	float calm_s;				// time lower clocks have been enough
+	// statistics
+	uint64_t overruns;
+	uint64_t switches;
+	double energy;
+	double cycles;
+	double time_at[MIP_GOVERNOR_LEVELS];
+}mip_governor_t;
+
+int mip_governor_init(mip_governor_t* g, float period_s, float margin,
+															float hold_s);
+int mip_governor_update(mip_governor_t* g, float wcet_s, float busy_s,
+											float window_s, int overruns);
+int mip_governor_boost(mip_governor_t* g);
+double mip_governor_energy(int level, double busy_s, double window_s);
+int mip_governor_print(mip_governor_t* g);
+
+// running in a thread off the IMU interrupt
+int mip_governor_start(float period_s, float margin, float hold_s,
+								float window_s, int (*set_level)(int level));
+int mip_governor_step(uint64_t t_start_ns, uint64_t t_end_ns);
+int mip_governor_skip();
+int mip_governor_request_boost();
+int mip_governor_stop();
+
+#endif //MIP_GOVERNOR_H
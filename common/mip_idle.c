@@ -0,0 +1,219 @@
+/*******************************************************************************
+* mip_idle.c
+* By: Stuart Sonatina
+*
+* Idle mode switch, sleeps and per mode usage, see mip_idle.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+#include "mip_idle.h"
+
+typedef struct usage_t{
+	double wall;		// s
+	double cpu;			// s, user + system
+	long wakeups;		// voluntary context switches
+}usage_t;
+
+// idle is only entered with the lock held and only left by the CAS from
+// IDLE to LEAVING, which mip_idle_exit() does lock free. LEAVING counts as
+// active, the lock holder that sees it finishes the exit.
+enum{
+	ACTIVE,
+	IDLE,
+	LEAVING
+};
+
+static _Atomic int state = ACTIVE;
+static int decimation = 1;
+static unsigned int tick_count = 0;		// interrupt side only
+static void (*change_func)(int idle) = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static sem_t wake;						// parked threads
+static _Atomic int n_parked = 0;
+static _Atomic double left_at = 0;		// wall time of the last exit
+static int initialized = 0;
+static usage_t mode[2];					// [0] active, [1] idle
+static usage_t mark;					// at the last switch
+
+static double now_s(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void sample(usage_t* u){
+	struct rusage r;
+	getrusage(RUSAGE_SELF, &r);
+	u->wall = now_s();
+	u->cpu = r.ru_utime.tv_sec + r.ru_utime.tv_usec/1e6 \
+			+ r.ru_stime.tv_sec + r.ru_stime.tv_usec/1e6;
+	u->wakeups = r.ru_nvcsw;
+}
+
+// charge the time since the last switch to mode m, lock held
+static void account(int m){
+	usage_t now;
+	sample(&now);
+	mode[m].wall += now.wall - mark.wall;
+	mode[m].cpu += now.cpu - mark.cpu;
+	mode[m].wakeups += now.wakeups - mark.wakeups;
+	mark = now;
+}
+
+// the rest of an exit the interrupt started, lock held. Nothing may have
+// come through for a while, so the wall time is split where the exit really
+// was and the usage shared out in the same proportion.
+static void finish_exit(){
+	int leaving = LEAVING;
+	usage_t now;
+	double left, f;
+	if(!atomic_compare_exchange_strong(&state, &leaving, ACTIVE)) return;
+	sample(&now);
+	left = atomic_load(&left_at);
+	if(left<mark.wall || left>now.wall) left = now.wall;
+	f = now.wall>mark.wall ? (left-mark.wall)/(now.wall-mark.wall) : 1;
+	mode[1].wall += left - mark.wall;
+	mode[1].cpu += f*(now.cpu - mark.cpu);
+	mode[1].wakeups += f*(now.wakeups - mark.wakeups);
+	mark.wall = left;
+	mark.cpu += f*(now.cpu - mark.cpu);
+	mark.wakeups += f*(now.wakeups - mark.wakeups);
+	account(0);
+	if(change_func!=NULL) change_func(0);
+}
+
+/*******************************************************************************
+* int mip_idle_init()
+*
+* Starts active. on_change may be NULL, it runs on the thread that entered
+* idle or the helper thread that finished leaving it, with the idle lock
+* held, so keep it short and don't call back in here.
+*******************************************************************************/
+int mip_idle_init(int dec, void (*on_change)(int idle)){
+	if(dec<1){
+		printf("ERROR: mip_idle_init, decimation must be >= 1\n");
+		return -1;
+	}
+	decimation = dec;
+	change_func = on_change;
+	sem_init(&wake, 0, 0);
+	sample(&mark);
+	initialized = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* enter and exit
+*******************************************************************************/
+int mip_idle_enter(){
+	if(!initialized) return -1;
+	pthread_mutex_lock(&lock);
+	finish_exit();
+	if(atomic_load(&state)==ACTIVE){
+		account(0);
+		atomic_store(&state, IDLE);
+		if(change_func!=NULL) change_func(1);
+	}
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+// from any thread including the IMU interrupt, never takes the lock
+int mip_idle_exit(){
+	int idle = IDLE;
+	if(!initialized) return -1;
+	if(atomic_load(&state)!=IDLE) return 0;
+	atomic_store(&left_at, now_s());
+	if(!atomic_compare_exchange_strong(&state, &idle, LEAVING)) return 0;
+	sem_post(&wake);
+	return 0;
+}
+
+int mip_idle_is_idle(){
+	return atomic_load(&state)==IDLE;
+}
+
+/*******************************************************************************
+* int mip_idle_tick()
+*
+* First thing in the IMU interrupt function, returns 1 if this sample should
+* be processed. Only call it from the interrupt.
+*******************************************************************************/
+int mip_idle_tick(){
+	if(atomic_load(&state)!=IDLE){
+		tick_count = 0;
+		return 1;
+	}
+	return (tick_count++ % decimation)==0;
+}
+
+/*******************************************************************************
+* int mip_idle_sleep()
+*
+* Sleep active_us, or idle_us while idle. idle_us 0 parks the thread until
+* idle ends, checking back every MIP_IDLE_PARK_US so it still sees EXITING.
+* Returns early as soon as idle ends. The first thread through after an
+* exit finishes it.
+*******************************************************************************/
+int mip_idle_sleep(uint64_t active_us, uint64_t idle_us){
+	struct timespec ts;
+	if(!initialized) return usleep(active_us);
+	if(atomic_load(&state)==LEAVING){
+		pthread_mutex_lock(&lock);
+		finish_exit();
+		pthread_mutex_unlock(&lock);
+	}
+	if(atomic_load(&state)!=IDLE) return usleep(active_us);
+
+	if(idle_us==0 || idle_us>MIP_IDLE_PARK_US) idle_us = MIP_IDLE_PARK_US;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += idle_us/1000000;
+	ts.tv_nsec += (idle_us%1000000)*1000;
+	if(ts.tv_nsec>=1000000000L){
+		ts.tv_nsec -= 1000000000L;
+		ts.tv_sec++;
+	}
+	atomic_fetch_add(&n_parked, 1);
+	while(atomic_load(&state)==IDLE){
+		if(sem_timedwait(&wake, &ts) && errno!=EINTR) break;
+	}
+	// one post wakes one thread, pass it on to the next one parked
+	if(atomic_fetch_sub(&n_parked, 1)>1 && atomic_load(&state)!=IDLE){
+		sem_post(&wake);
+	}
+	pthread_mutex_lock(&lock);
+	finish_exit();
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_idle_print()
+*
+* CPU use and wakeups per second in each mode, counting every thread of the
+* process.
+*******************************************************************************/
+int mip_idle_print(){
+	const char* names[2] = {"active", "idle"};
+	int m;
+	if(!initialized) return -1;
+	pthread_mutex_lock(&lock);
+	finish_exit();
+	account(atomic_load(&state)==IDLE);
+	for(m=0;m<2;m++){
+		if(mode[m].wall<0.1) continue;	// too short to mean anything
+		printf("%-6s %7.2f s, cpu %5.1f%%, %6.0f wakeups/s\n", names[m], \
+				mode[m].wall, 100*mode[m].cpu/mode[m].wall, \
+				mode[m].wakeups/mode[m].wall);
+	}
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
@@ -0,0 +1,43 @@
+/*******************************************************************************
+* mip_idle.h
+* By: Stuart Sonatina
+*
+* Low power idle while nothing is being controlled.
+*
+* The program calls mip_idle_enter() when it disarms and mip_idle_exit()
+* when the robot looks like it is being picked up. While idle:
+*	mip_idle_tick() passes only one IMU sample in every `decimation` to the
+*		interrupt function, the rest return straight away
+*	mip_idle_sleep() puts helper threads to sleep for their idle period, or
+*		parks them completely, and wakes them all the moment idle ends
+*	on_change(1) lets the program slow down anything else, like the battery
+*		thread or the logger
+*
+* Exiting is safe from the IMU interrupt, so full rate is back for the very
+* next sample after the one that saw the robot upright. From there it only
+* notes the time, flips an atomic and posts a semaphore, no lock and no
+* system call beyond the wakeup. The usage bookkeeping and on_change(0) run
+* on the first helper thread to wake or sleep after that, with the time up
+* to the exit still charged to idle.
+*
+* CPU time and voluntary context switches (each one is a thread going to
+* sleep and waking again) are summed per mode from getrusage() and printed
+* by mip_idle_print().
+*******************************************************************************/
+
+#ifndef MIP_IDLE_H
+#define MIP_IDLE_H
+
+#include <stdint.h>
+
+#define MIP_IDLE_PARK_US	1000000	// longest a parked thread goes unchecked
+
+int mip_idle_init(int decimation, void (*on_change)(int idle));
+int mip_idle_enter();
+int mip_idle_exit();
+int mip_idle_is_idle();
+int mip_idle_tick();
+int mip_idle_sleep(uint64_t active_us, uint64_t idle_us);
+int mip_idle_print();
+
+#endif //MIP_IDLE_H
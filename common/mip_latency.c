@@ -0,0 +1,104 @@
+/*******************************************************************************
+* mip_latency.c
+* By: Stuart Sonatina
+*
+* Latency histogram, see mip_latency.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mip_latency.h"
+
+/*******************************************************************************
+* int mip_latency_init()
+*
+* bucket_ns sets the resolution of the percentile, anything over
+* MIP_LATENCY_BUCKETS*bucket_ns only counts towards the max and mean.
+*******************************************************************************/
+int mip_latency_init(mip_latency_t* l, const char* name, uint64_t bucket_ns){
+	if(bucket_ns==0){
+		printf("ERROR: mip_latency_init, bucket_ns must be > 0\n");
+		return -1;
+	}
+	memset(l, 0, sizeof(*l));
+	l->name = name;
+	l->bucket_ns = bucket_ns;
+	l->min = UINT64_MAX;
+	return 0;
+}
+
+/*******************************************************************************
+* uint64_t mip_latency_now()
+*
+* CLOCK_MONOTONIC in ns, the time base every sample is measured in.
+*******************************************************************************/
+uint64_t mip_latency_now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/*******************************************************************************
+* int mip_latency_add()
+*
+* Record the time from t0_ns until now.
+*******************************************************************************/
+int mip_latency_add(mip_latency_t* l, uint64_t t0_ns){
+	return mip_latency_add_ns(l, mip_latency_now() - t0_ns);
+}
+
+int mip_latency_add_ns(mip_latency_t* l, uint64_t d_ns){
+	uint64_t b = d_ns/l->bucket_ns;
+	if(b>=MIP_LATENCY_BUCKETS) b = MIP_LATENCY_BUCKETS-1;
+	l->hist[b]++;
+	l->n++;
+	l->sum += d_ns;
+	if(d_ns<l->min) l->min = d_ns;
+	if(d_ns>l->max) l->max = d_ns;
+	return 0;
+}
+
+/*******************************************************************************
+* uint64_t mip_latency_percentile()
+*
+* Upper edge of the bucket holding percentile p (0 to 100), capped at max.
+*******************************************************************************/
+uint64_t mip_latency_percentile(mip_latency_t* l, float p){
+	uint64_t want, seen = 0, edge;
+	int i;
+	if(l->n==0) return 0;
+	want = (uint64_t)(l->n*p/100.0f);
+	if(want<1) want = 1;
+	for(i=0;i<MIP_LATENCY_BUCKETS;i++){
+		seen += l->hist[i];
+		if(seen>=want) break;
+	}
+	edge = (i+1)*l->bucket_ns;
+	return edge<l->max ? edge : l->max;
+}
+
+/*******************************************************************************
+* int mip_latency_print()
+*
+* One line, in us or ms depending on the size of the mean.
+*******************************************************************************/
+int mip_latency_print(mip_latency_t* l){
+	double mean, scale = 1e3;
+	const char* unit = "us";
+	if(l->n==0){
+		printf("%s: no samples\n", l->name);
+		return 0;
+	}
+	mean = l->sum/l->n;
+	if(mean>=1e6){
+		scale = 1e6;
+		unit = "ms";
+	}
+	printf("%s over %llu samples: min %.2f %s, mean %.2f %s, p99 %.2f %s, " \
+			"max %.2f %s\n", l->name, (unsigned long long)l->n, \
+			l->min/scale, unit, mean/scale, unit, \
+			mip_latency_percentile(l, 99)/scale, unit, l->max/scale, unit);
+	return 0;
+}
@@ -0,0 +1,36 @@
+/*******************************************************************************
+* mip_latency.h
+* By: Stuart Sonatina
+*
+* Latency statistics for one path through the program, like interrupt to
+* set_motor(). Samples go into a fixed histogram so mip_latency_add() is cheap
+* enough for the IMU interrupt and never allocates. Min, mean, 99th
+* percentile and max are printed at exit.
+*
+* Only one thread may add samples to a mip_latency_t.
+*******************************************************************************/
+
+#ifndef MIP_LATENCY_H
+#define MIP_LATENCY_H
+
+#include <stdint.h>
+
+#define MIP_LATENCY_BUCKETS	1000	// the last bucket collects everything over
+
+typedef struct mip_latency_t{
+	const char* name;
+	uint64_t bucket_ns;				// width of one histogram bucket
+	uint64_t n;
+	double sum;
+	uint64_t min, max;
+	uint32_t hist[MIP_LATENCY_BUCKETS];
+}mip_latency_t;
+
+int mip_latency_init(mip_latency_t* l, const char* name, uint64_t bucket_ns);
+uint64_t mip_latency_now();
+int mip_latency_add(mip_latency_t* l, uint64_t t0_ns);
+int mip_latency_add_ns(mip_latency_t* l, uint64_t d_ns);
+uint64_t mip_latency_percentile(mip_latency_t* l, float p);
+int mip_latency_print(mip_latency_t* l);
+
+#endif //MIP_LATENCY_H
@@ -0,0 +1,467 @@
+/*******************************************************************************
+* mip_log.c
+* By: Stuart Sonatina
+*
+* Write and read the binary MIP log format described in mip_log.h
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mip_log.h"
+#include "mip_arena.h"
+
+_Static_assert(sizeof(mip_log_header_t)==MIP_LOG_HEADER_SIZE,
+										"mip_log_header_t must be 512 bytes");
+
+/*******************************************************************************
+* int mip_log_header_init()
+*
+* Fill in a header for n_channels named channels. Names longer than
+* MIP_LOG_NAME_LEN-1 are truncated.
+*******************************************************************************/
+int mip_log_header_init(mip_log_header_t* h, const char* const* names,
+										int n_channels, float sample_rate_hz){
+	int i;
+	if(n_channels<1 || n_channels>MIP_LOG_MAX_CHANNELS){
+		printf("ERROR: mip_log supports 1 to %d channels\n",
+													MIP_LOG_MAX_CHANNELS);
+		return -1;
+	}
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, MIP_LOG_MAGIC, 4);
+	h->version = MIP_LOG_VERSION;
+	h->n_channels = n_channels;
+	h->sample_rate_hz = sample_rate_hz;
+	for(i=0;i<n_channels;i++){
+		strncpy(h->names[i], names[i], MIP_LOG_NAME_LEN-1);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_log_header_check()
+*
+* Returns 0 if the header looks like one of ours, -1 otherwise.
+*******************************************************************************/
+int mip_log_header_check(const mip_log_header_t* h){
+	if(memcmp(h->magic, MIP_LOG_MAGIC, 4)) return -1;
+	if(h->version!=MIP_LOG_VERSION) return -1;
+	if(h->n_channels<1 || h->n_channels>MIP_LOG_MAX_CHANNELS) return -1;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_log_open()
+*
+* Create a log file and write its header. The row count in the header gets
+* filled in by mip_log_close().
+*******************************************************************************/
+int mip_log_open(mip_log_t* log, const char* path, const char* const* names,
+										int n_channels, float sample_rate_hz){
+	memset(log, 0, sizeof(*log));
+	if(mip_log_header_init(&log->header,names,n_channels,sample_rate_hz)){
+		return -1;
+	}
+	log->fp = fopen(path, "wb");
+	if(log->fp==NULL){
+		printf("ERROR: failed to open %s for writing\n", path);
+		return -1;
+	}
+	if(fwrite(&log->header, sizeof(log->header), 1, log->fp)!=1){
+		fclose(log->fp);
+		log->fp = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_log_open_compressed()
+*
+* Like mip_log_open() but every channel is encoded with its own codec.
+* error_bounds is only used for MIP_CODEC_QUANT channels and may be NULL if
+* there are none.
+*******************************************************************************/
+int mip_log_open_compressed(mip_log_t* log, const char* path,
+				const char* const* names, int n_channels, float sample_rate_hz,
+				const mip_codec_type_t* codecs, const float* error_bounds){
+	int i;
+	memset(log, 0, sizeof(*log));
+	if(mip_log_header_init(&log->header,names,n_channels,sample_rate_hz)){
+		return -1;
+	}
+	log->header.flags = MIP_LOG_COMPRESSED;
+	for(i=0;i<n_channels;i++){
+		if(mip_codec_init(&log->codec[i], codecs[i], \
+					error_bounds ? error_bounds[i] : 0, MIP_LOG_BLOCK_ROWS)){
+			goto fail;
+		}
+		log->header.codec[i] = codecs[i];
+		log->header.quant_step[i] = log->codec[i].step;
+	}
+	// worst case is a 10 byte varint for every sample
+	log->block = mip_arena_calloc(8 + 4*n_channels + \
+								10*n_channels*MIP_LOG_BLOCK_ROWS, 1);
+	if(log->block==NULL) goto fail;
+	log->fp = fopen(path, "wb");
+	if(log->fp==NULL){
+		printf("ERROR: failed to open %s for writing\n", path);
+		goto fail;
+	}
+	if(fwrite(&log->header, sizeof(log->header), 1, log->fp)!=1) goto fail;
+	return 0;
+
+fail:
+	if(log->fp!=NULL) fclose(log->fp);
+	log->fp = NULL;
+	for(i=0;i<n_channels;i++) mip_codec_free(&log->codec[i]);
+	mip_arena_free(log->block);
+	log->block = NULL;
+	return -1;
+}
+
+static uint64_t now_ns(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec*1000000000ULL + t.tv_nsec;
+}
+
+// finish the block being encoded and start the next, returns its length
+static size_t seal_block(mip_log_t* log){
+	uint32_t* words = (uint32_t*)log->block;
+	int i, nch = log->header.n_channels;
+	size_t len = 8 + 4*nch;
+	words[0] = MIP_LOG_BLOCK_MAGIC;
+	words[1] = log->block_rows;
+	for(i=0;i<nch;i++){
+		words[2+i] = mip_codec_finish(&log->codec[i], log->block+len);
+		len += words[2+i];
+		mip_codec_reset(&log->codec[i]);
+	}
+	log->block_rows = 0;
+	return len;
+}
+
+// the file side, fwrite and with flush fflush, timed apart from encoding
+static int write_out(mip_log_t* log, const void* p, size_t len, int flush){
+	uint64_t t = now_ns();
+	int ret = 0;
+	if(len>0 && fwrite(p, 1, len, log->fp)!=len) ret = -1;
+	else log->bytes_out += len;
+	if(ret==0 && flush && fflush(log->fp)) ret = -1;
+	log->io_ns += now_ns() - t;
+	return ret;
+}
+
+/*******************************************************************************
+* int mip_log_write_row()
+*
+* Append one row of n_channels floats.
+*******************************************************************************/
+int mip_log_write_row(mip_log_t* log, const float* row){
+	uint64_t t = now_ns();
+	size_t len;
+	int i, ret = 0;
+	int nch = log->header.n_channels;
+
+	if(log->block==NULL) ret = write_out(log, row, sizeof(float)*nch, 0);
+	else{
+		for(i=0;i<nch;i++) mip_codec_put(&log->codec[i], row[i]);
+		log->block_rows++;
+		if(log->block_rows==MIP_LOG_BLOCK_ROWS){
+			len = seal_block(log);
+			log->encode_ns += now_ns() - t;
+			ret = write_out(log, log->block, len, 1);
+		}
+		else log->encode_ns += now_ns() - t;
+	}
+	if(ret==0) log->header.n_rows++;
+	return ret;
+}
+
+/*******************************************************************************
+* int mip_log_flush()
+*
+* For compressed logs write out the block being encoded, even if it isn't
+* full, then push everything to the file.
+*******************************************************************************/
+int mip_log_flush(mip_log_t* log){
+	uint64_t t = now_ns();
+	size_t len = 0;
+	if(log->block!=NULL && log->block_rows>0){
+		len = seal_block(log);
+		log->encode_ns += now_ns() - t;
+	}
+	return write_out(log, log->block, len, 1);
+}
+
+/*******************************************************************************
+* int mip_log_print_stats()
+*
+* Print compression ratio and the cost so far, encoding apart from the
+* fwrite and fflush time.
+*******************************************************************************/
+int mip_log_print_stats(const mip_log_t* log){
+	uint64_t n = log->header.n_rows;
+	uint64_t raw = n*log->header.n_channels*sizeof(float);
+	uint64_t out = log->bytes_out;
+	// ratio is only right once pending rows are flushed
+	if(n==0 || out==0) return 0;
+	printf("log: %llu rows, %llu bytes raw, %llu bytes written, ratio %.2f, ",
+					(unsigned long long)n, (unsigned long long)raw, \
+					(unsigned long long)out, (double)raw/out);
+	printf("encoding %.0f ns/row, %.1f ns/sample, writing %.0f ns/row\n", \
+				(double)log->encode_ns/n, \
+				(double)log->encode_ns/(n*log->header.n_channels), \
+				(double)log->io_ns/n);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_log_close()
+*
+* Write any partial block, patch the final row count into the header and
+* close the file.
+*******************************************************************************/
+int mip_log_close(mip_log_t* log){
+	int i, ret = 0;
+	if(log->fp==NULL) return -1;
+	if(mip_log_flush(log)) ret = -1;
+	if(fseek(log->fp, 0, SEEK_SET) || \
+		fwrite(&log->header, sizeof(log->header), 1, log->fp)!=1) ret = -1;
+	if(fclose(log->fp)) ret = -1;
+	log->fp = NULL;
+	if(log->block!=NULL){
+		for(i=0;i<(int)log->header.n_channels;i++){
+			mip_codec_free(&log->codec[i]);
+		}
+		mip_arena_free(log->block);
+		log->block = NULL;
+	}
+	return ret;
+}
+
+/*******************************************************************************
+* int next_block()
+*
+* Check the block at r->block_pos. Returns its row count and sets *len to the
+* whole block size, or returns 0 if there is no complete block there.
+*******************************************************************************/
+static int next_block(const mip_log_reader_t* r, size_t* len){
+	const uint32_t* words;
+	size_t pos = r->block_pos;
+	size_t need;
+	int i, nch = r->header.n_channels;
+
+	need = 8 + 4*nch;
+	if(pos+need > r->map_len) return 0;
+	words = (const uint32_t*)(r->map+pos);
+	if(words[0]!=MIP_LOG_BLOCK_MAGIC || words[1]==0 || \
+									words[1]>MIP_LOG_BLOCK_ROWS) return 0;
+	for(i=0;i<nch;i++) need += words[2+i];
+	if(pos+need > r->map_len) return 0;
+	*len = need;
+	return words[1];
+}
+
+/*******************************************************************************
+* int decode_block()
+*
+* Decode the block at r->block_pos into r->rows and move past it. Returns the
+* rows decoded, 0 at the end of the log or -1 if the block is corrupt.
+*******************************************************************************/
+static int decode_block(mip_log_reader_t* r){
+	const uint32_t* words;
+	size_t len, pos;
+	int i, nch = r->header.n_channels;
+
+	r->block_rows = next_block(r, &len);
+	r->block_next = 0;
+	if(r->block_rows==0) return 0;
+	words = (const uint32_t*)(r->map+r->block_pos);
+	pos = r->block_pos + 8 + 4*nch;
+	for(i=0;i<nch;i++){
+		if(mip_codec_decode(r->header.codec[i], r->header.quant_step[i], \
+						r->map+pos, words[2+i], r->block_rows, r->rows+i, nch)){
+			printf("ERROR: corrupt block in MIP log\n");
+			r->block_rows = 0;
+			return -1;
+		}
+		pos += words[2+i];
+	}
+	r->block_pos += len;
+	return r->block_rows;
+}
+
+/*******************************************************************************
+* int mip_log_open_read()
+*
+* Map a log file for reading. Any partial row at the end is ignored.
+*******************************************************************************/
+int mip_log_open_read(mip_log_reader_t* r, const char* path){
+	struct stat st;
+	int fd;
+	memset(r, 0, sizeof(*r));
+	fd = open(path, O_RDONLY);
+	if(fd<0){
+		printf("ERROR: failed to open %s\n", path);
+		return -1;
+	}
+	if(fstat(fd,&st) || st.st_size<MIP_LOG_HEADER_SIZE){
+		printf("ERROR: %s is too short to be a MIP log\n", path);
+		close(fd);
+		return -1;
+	}
+	r->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(r->map==MAP_FAILED){
+		r->map = NULL;
+		printf("ERROR: failed to map %s\n", path);
+		return -1;
+	}
+	r->map_len = st.st_size;
+	madvise((void*)r->map, r->map_len, MADV_SEQUENTIAL);
+	memcpy(&r->header, r->map, sizeof(r->header));
+	if(mip_log_header_check(&r->header)){
+		printf("ERROR: %s is not a MIP log\n", path);
+		mip_log_close_read(r);
+		return -1;
+	}
+	if(r->header.flags & MIP_LOG_COMPRESSED){
+		size_t len;
+		uint32_t cap = 0;
+		int n;
+		r->rows = malloc(sizeof(float)*MIP_LOG_BLOCK_ROWS*r->header.n_channels);
+		if(r->rows==NULL){
+			mip_log_close_read(r);
+			return -1;
+		}
+		// walk the block headers once to count rows and index the blocks
+		r->block_pos = MIP_LOG_HEADER_SIZE;
+		while((n=next_block(r,&len))>0){
+			if(r->n_blocks==cap){
+				cap = cap ? 2*cap : 64;
+				r->block_row = realloc(r->block_row, sizeof(uint64_t)*cap);
+				r->block_off = realloc(r->block_off, sizeof(size_t)*cap);
+				if(r->block_row==NULL || r->block_off==NULL){
+					mip_log_close_read(r);
+					return -1;
+				}
+			}
+			r->block_row[r->n_blocks] = r->n_rows;
+			r->block_off[r->n_blocks] = r->block_pos;
+			r->n_blocks++;
+			r->n_rows += n;
+			r->block_pos += len;
+		}
+		r->block_pos = MIP_LOG_HEADER_SIZE;
+		return 0;
+	}
+	r->data = (const float*)(r->map + MIP_LOG_HEADER_SIZE);
+	r->n_rows = (r->map_len-MIP_LOG_HEADER_SIZE) \
+							/ (sizeof(float)*r->header.n_channels);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_log_read()
+*
+* Copy up to max_rows rows into rows[] (row major). Returns the number of rows
+* copied, 0 at the end of the log.
+*******************************************************************************/
+int mip_log_read(mip_log_reader_t* r, float* rows, int max_rows){
+	uint64_t left = r->n_rows - r->next_row;
+	int n = (left < (uint64_t)max_rows) ? (int)left : max_rows;
+	int nch = r->header.n_channels;
+	int got, take;
+
+	if(n<=0) return 0;
+	if(r->header.flags & MIP_LOG_COMPRESSED){
+		got = 0;
+		while(got<n){
+			// decode the next block when this one is used up
+			if(r->block_next==r->block_rows && decode_block(r)<=0){
+				r->n_rows = r->next_row + got;
+				break;
+			}
+			take = r->block_rows - r->block_next;
+			if(take > n-got) take = n-got;
+			memcpy(rows + (size_t)got*nch, \
+						r->rows + (size_t)r->block_next*nch, \
+						sizeof(float)*nch*take);
+			r->block_next += take;
+			got += take;
+		}
+		r->next_row += got;
+		return got;
+	}
+	memcpy(rows, r->data + r->next_row*nch, sizeof(float)*nch*n);
+	r->next_row += n;
+	return n;
+}
+
+/*******************************************************************************
+* int mip_log_seek()
+*
+* Move the read position to row. For compressed logs this decodes only the
+* one block holding that row.
+*******************************************************************************/
+int mip_log_seek(mip_log_reader_t* r, uint64_t row){
+	uint32_t lo, hi, mid;
+	if(row>r->n_rows) return -1;
+	r->next_row = row;
+	if(!(r->header.flags & MIP_LOG_COMPRESSED)) return 0;
+	r->block_rows = 0;
+	r->block_next = 0;
+	if(row==r->n_rows){
+		r->block_pos = r->map_len;
+		return 0;
+	}
+	// last block starting at or before row
+	lo = 0;
+	hi = r->n_blocks;
+	while(hi-lo>1){
+		mid = (lo+hi)/2;
+		if(r->block_row[mid]<=row) lo = mid;
+		else hi = mid;
+	}
+	r->block_pos = r->block_off[lo];
+	if(decode_block(r)<=0) return -1;
+	r->block_next = row - r->block_row[lo];
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_log_rewind()
+*
+* Go back to the first row.
+*******************************************************************************/
+int mip_log_rewind(mip_log_reader_t* r){
+	r->next_row = 0;
+	r->block_pos = MIP_LOG_HEADER_SIZE;
+	r->block_rows = 0;
+	r->block_next = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_log_close_read()
+*******************************************************************************/
+int mip_log_close_read(mip_log_reader_t* r){
+	if(r->map!=NULL) munmap((void*)r->map, r->map_len);
+	free(r->rows);
+	free(r->block_row);
+	free(r->block_off);
+	r->rows = NULL;
+	r->block_row = NULL;
+	r->block_off = NULL;
+	r->map = NULL;
+	r->data = NULL;
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*******************************************************************************
+* mip_log.h
+* By: Stuart Sonatina
+*
+* Binary log format shared by the MIP programs and the host side tools.
+*
+* A log is a fixed 512 byte header followed by rows of little-endian 32 bit
+* floats, one float per channel, written in the order the samples happened.
+* The row count is not trusted from the header: readers take whatever whole
+* rows are in the file so a log left behind by a killed process still opens.
+*
+* With MIP_LOG_COMPRESSED set in the header flags the rows are instead stored
+* in blocks of up to MIP_LOG_BLOCK_ROWS rows:
+*
+*	uint32 MIP_LOG_BLOCK_MAGIC
+*	uint32 rows in this block
+*	uint32 encoded size of each channel, n_channels of them
+*	encoded channels one after the other, see mip_codec.h
+*
+* Each block decodes on its own. Readers stop at the first block that is cut
+* short, which again is what a killed process leaves.
+*******************************************************************************/
+
+#ifndef MIP_LOG_H
+#define MIP_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mip_codec.h"
+
+#define MIP_LOG_MAGIC			"MIPL"
+#define MIP_LOG_VERSION			1
+#define MIP_LOG_HEADER_SIZE		512
+#define MIP_LOG_MAX_CHANNELS	16
+#define MIP_LOG_NAME_LEN		24
+#define MIP_LOG_COMPRESSED		0x0001	// header flag
+#define MIP_LOG_BLOCK_ROWS		256
+#define MIP_LOG_BLOCK_MAGIC		0x4250494d	// "MIPB"
+
+/*******************************************************************************
+* mip_log_header_t
+*
+* On-disk header, exactly MIP_LOG_HEADER_SIZE bytes.
+*******************************************************************************/
+typedef struct mip_log_header_t{
+	char magic[4];			// "MIPL"
+	uint16_t version;		// MIP_LOG_VERSION
+	uint16_t flags;			// MIP_LOG_COMPRESSED or 0
+	uint32_t n_channels;	// floats per row
+	float sample_rate_hz;	// 0 if unknown
+	uint64_t n_rows;		// rows written at close, 0 if never closed
+	char names[MIP_LOG_MAX_CHANNELS][MIP_LOG_NAME_LEN];
+	uint8_t codec[MIP_LOG_MAX_CHANNELS];	// mip_codec_type_t per channel
+	float quant_step[MIP_LOG_MAX_CHANNELS];	// MIP_CODEC_QUANT step
+	uint8_t reserved[MIP_LOG_HEADER_SIZE - 24 \
+						- MIP_LOG_MAX_CHANNELS*(MIP_LOG_NAME_LEN+5)];
+}mip_log_header_t;
+
+/*******************************************************************************
+* mip_log_t
+*
+* Streaming writer, rows are buffered by stdio. Compressed logs encode each
+* row as it arrives and write a whole block every MIP_LOG_BLOCK_ROWS rows.
+*******************************************************************************/
+typedef struct mip_log_t{
+	FILE* fp;
+	mip_log_header_t header;
+	mip_codec_t codec[MIP_LOG_MAX_CHANNELS];	// compressed logs only
+	uint8_t* block;			// one encoded block, compressed logs only
+	int block_rows;			// rows in the block being encoded
+	uint64_t bytes_out;		// bytes written after the header
+	uint64_t encode_ns;		// total time encoding rows and sealing blocks
+	uint64_t io_ns;			// total time in fwrite and fflush
+}mip_log_t;
+
+/*******************************************************************************
+* mip_log_reader_t
+*
+* Read side, the whole file is mapped and rows are handed out in order.
+*******************************************************************************/
+typedef struct mip_log_reader_t{
+	mip_log_header_t header;
+	const uint8_t* map;		// whole file
+	size_t map_len;
+	const float* data;		// first row, uncompressed logs only
+	uint64_t n_rows;		// whole rows present in the file
+	uint64_t next_row;		// read position
+	size_t block_pos;		// offset of the next block, compressed logs only
+	float* rows;			// decoded block, compressed logs only
+	int block_rows;			// rows in rows[]
+	int block_next;			// next row of rows[] to hand out
+	uint64_t* block_row;	// first row of every block, compressed logs only
+	size_t* block_off;		// file offset of every block
+	uint32_t n_blocks;
+}mip_log_reader_t;
+
+// header helpers
+int mip_log_header_init(mip_log_header_t* h, const char* const* names,
+										int n_channels, float sample_rate_hz);
+int mip_log_header_check(const mip_log_header_t* h);
+
+// writer
+int mip_log_open(mip_log_t* log, const char* path, const char* const* names,
+										int n_channels, float sample_rate_hz);
+int mip_log_open_compressed(mip_log_t* log, const char* path,
+				const char* const* names, int n_channels, float sample_rate_hz,
+				const mip_codec_type_t* codecs, const float* error_bounds);
+int mip_log_write_row(mip_log_t* log, const float* row);
+int mip_log_flush(mip_log_t* log);
+int mip_log_print_stats(const mip_log_t* log);
+int mip_log_close(mip_log_t* log);
+
+// reader
+int mip_log_open_read(mip_log_reader_t* r, const char* path);
+int mip_log_read(mip_log_reader_t* r, float* rows, int max_rows);
+int mip_log_seek(mip_log_reader_t* r, uint64_t row);
+int mip_log_rewind(mip_log_reader_t* r);
+int mip_log_close_read(mip_log_reader_t* r);
+
+#endif //MIP_LOG_H
@@ -0,0 +1,114 @@
+/*******************************************************************************
+* mip_logger.c
+* By: Stuart Sonatina
+*
+* Background logger for the control loop, see mip_logger.h
+*******************************************************************************/
+
+#include <unistd.h>
+
+#include "mip_logger.h"
+
+#define LOGGER_SLEEP_US 20000	// how long the writer naps when idle
+#define LOGGER_PARK_US	500000	// and while parked
+
+static void* logger_thread(void* ptr);
+
+/*******************************************************************************
+* int mip_logger_start()
+*
+* Open the log file and start the writer thread. Arguments are the same as
+* mip_log_open_compressed().
+*******************************************************************************/
+int mip_logger_start(mip_logger_t* lg, const char* path,
+				const char* const* names, int n_channels, float sample_rate_hz,
+				const mip_codec_type_t* codecs, const float* error_bounds){
+	lg->dropped = 0;
+	if(mip_ring_init(&lg->ring, sizeof(float)*n_channels, \
+												MIP_LOGGER_RING_ROWS)){
+		return -1;
+	}
+	if(mip_log_open_compressed(&lg->log, path, names, n_channels, \
+								sample_rate_hz, codecs, error_bounds)){
+		mip_ring_free(&lg->ring);
+		return -1;
+	}
+	lg->running = 1;
+	if(pthread_create(&lg->thread, NULL, logger_thread, lg)){
+		lg->running = 0;
+		mip_log_close(&lg->log);
+		mip_ring_free(&lg->ring);
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_logger_push()
+*
+* Called from the control loop. Never blocks, returns -1 if the row had to be
+* dropped.
+*******************************************************************************/
+int mip_logger_push(mip_logger_t* lg, const float* row){
+	if(!lg->running) return -1;
+	if(mip_ring_push(&lg->ring, row)){
+		lg->dropped++;
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_logger_stop()
+*
+* Stop the writer after it drains the ring, close the file and print how
+* well it compressed.
+*******************************************************************************/
+int mip_logger_stop(mip_logger_t* lg){
+	int ret;
+	if(!lg->running) return -1;
+	lg->running = 0;
+	pthread_join(lg->thread, NULL);
+	mip_log_flush(&lg->log);
+	mip_log_print_stats(&lg->log);
+	if(lg->dropped){
+		printf("log: %llu rows dropped, logger fell behind\n", \
+										(unsigned long long)lg->dropped);
+	}
+	ret = mip_log_close(&lg->log);
+	mip_ring_free(&lg->ring);
+	return ret;
+}
+
+/*******************************************************************************
+* int mip_logger_park()
+*
+* While parked the writer wakes up 2 times a second instead of 50. Rows
+* pushed meanwhile still get written, just later.
+*******************************************************************************/
+int mip_logger_park(mip_logger_t* lg, int parked){
+	lg->parked = parked;
+	return 0;
+}
+
+/*******************************************************************************
+* void* logger_thread()
+*
+* Drain the ring into the log until told to stop, then drain what is left.
+*******************************************************************************/
+static void* logger_thread(void* ptr){
+	mip_logger_t* lg = (mip_logger_t*)ptr;
+	const void* row;
+	int stopping;
+	for(;;){
+		// check before draining so rows pushed just before the stop get out
+		stopping = !lg->running;
+		while((row=mip_ring_peek(&lg->ring))!=NULL){
+			mip_log_write_row(&lg->log, row);
+			mip_ring_release(&lg->ring);
+		}
+		if(stopping) break;
+		usleep(lg->parked ? LOGGER_PARK_US : LOGGER_SLEEP_US);
+	}
+	return NULL;
+}
@@ -0,0 +1,40 @@
+/*******************************************************************************
+* mip_logger.h
+* By: Stuart Sonatina
+*
+* Background logger for the control loop.
+*
+* The IMU interrupt function hands a row to mip_logger_push(), which copies
+* it into a lock free ring and returns. A separate thread drains the ring and
+* writes compressed blocks with mip_log, so encoding and file system time
+* never land in the control step. If the ring fills up rows are dropped and
+* counted rather than blocking the controller.
+*******************************************************************************/
+
+#ifndef MIP_LOGGER_H
+#define MIP_LOGGER_H
+
+#include <pthread.h>
+
+#include "mip_log.h"
+#include "mip_ring.h"
+
+#define MIP_LOGGER_RING_ROWS	1024	// ~5 s of slack at 200 Hz
+
+typedef struct mip_logger_t{
+	mip_log_t log;
+	mip_ring_t ring;
+	pthread_t thread;
+	volatile int running;
+	volatile int parked;	// nothing is being logged, check in less often
+	uint64_t dropped;		// rows lost to a full ring, control side count
+}mip_logger_t;
+
+int mip_logger_start(mip_logger_t* lg, const char* path,
+				const char* const* names, int n_channels, float sample_rate_hz,
+				const mip_codec_type_t* codecs, const float* error_bounds);
+int mip_logger_push(mip_logger_t* lg, const float* row);
+int mip_logger_stop(mip_logger_t* lg);
+int mip_logger_park(mip_logger_t* lg, int parked);
+
+#endif //MIP_LOGGER_H
@@ -0,0 +1,126 @@
+/*******************************************************************************
+* mip_mat.h
+* By: Stuart Sonatina
+*
+* Small fixed size matrix kernels for the controllers.
+*
+* Matrices are plain 2D arrays like float K[2][6] and every dimension is
+* passed to the macros as a compile time constant, so with -O2 gcc unrolls
+* the loops completely and nothing is ever allocated. The macros work for
+* float and double alike. Arguments are evaluated more than once, pass
+* array names, not expressions with side effects. Outputs must not alias
+* inputs unless noted.
+*
+* mip_dare.h builds the discretization and Riccati solver for one size of
+* system out of these.
+*******************************************************************************/
+
+#ifndef MIP_MAT_H
+#define MIP_MAT_H
+
+// Y = 0, R by C
+#define MIP_MAT_ZERO(Y, R, C) do{ \
+	for(int i_=0;i_<(R);i_++) for(int j_=0;j_<(C);j_++) (Y)[i_][j_] = 0; \
+}while(0)
+
+// Y = I, N by N
+#define MIP_MAT_IDENTITY(Y, N) do{ \
+	for(int i_=0;i_<(N);i_++) for(int j_=0;j_<(N);j_++) \
+		(Y)[i_][j_] = (i_==j_); \
+}while(0)
+
+// Y = A, may alias
+#define MIP_MAT_COPY(Y, A, R, C) do{ \
+	for(int i_=0;i_<(R);i_++) for(int j_=0;j_<(C);j_++) \
+		(Y)[i_][j_] = (A)[i_][j_]; \
+}while(0)
+
+// Y = A', A is R by C
+#define MIP_MAT_TRANSPOSE(Y, A, R, C) do{ \
+	for(int i_=0;i_<(R);i_++) for(int j_=0;j_<(C);j_++) \
+		(Y)[j_][i_] = (A)[i_][j_]; \
+}while(0)
+
+// Y = A + s*B, may alias
+#define MIP_MAT_ADD_SCALED(Y, A, s, B, R, C) do{ \
+	for(int i_=0;i_<(R);i_++) for(int j_=0;j_<(C);j_++) \
+		(Y)[i_][j_] = (A)[i_][j_] + (s)*(B)[i_][j_]; \
+}while(0)
+
+// Y = A*B, A is R by K, B is K by C
+#define MIP_MAT_MUL(Y, A, B, R, K, C) do{ \
+	for(int i_=0;i_<(R);i_++) for(int j_=0;j_<(C);j_++){ \
+		(Y)[i_][j_] = 0; \
+		for(int k_=0;k_<(K);k_++) (Y)[i_][j_] += (A)[i_][k_]*(B)[k_][j_]; \
+	} \
+}while(0)
+
+// Y = A'*B, A is K by R, B is K by C
+#define MIP_MAT_TMUL(Y, A, B, K, R, C) do{ \
+	for(int i_=0;i_<(R);i_++) for(int j_=0;j_<(C);j_++){ \
+		(Y)[i_][j_] = 0; \
+		for(int k_=0;k_<(K);k_++) (Y)[i_][j_] += (A)[k_][i_]*(B)[k_][j_]; \
+	} \
+}while(0)
+
+// y = A*x, A is R by C
+#define MIP_MAT_VEC(y, A, x, R, C) do{ \
+	for(int i_=0;i_<(R);i_++){ \
+		(y)[i_] = 0; \
+		for(int k_=0;k_<(C);k_++) (y)[i_] += (A)[i_][k_]*(x)[k_]; \
+	} \
+}while(0)
+
+// m = largest |A - B|
+#define MIP_MAT_MAX_DIFF(m, A, B, R, C) do{ \
+	(m) = 0; \
+	for(int i_=0;i_<(R);i_++) for(int j_=0;j_<(C);j_++){ \
+		double d_ = (A)[i_][j_] - (B)[i_][j_]; \
+		if(d_<0) d_ = -d_; \
+		if(d_>(m)) (m) = d_; \
+	} \
+}while(0)
+
+/*******************************************************************************
+* MIP_MAT_INV(Y, A, N, T, ok)
+*
+* Y = inverse of A by Gauss-Jordan with partial pivoting, T is the element
+* type for the scratch copy. ok is set to 0 if A is singular.
+*******************************************************************************/
+#define MIP_MAT_INV(Y, A, N, T, ok) do{ \
+	T a_[N][N], t_; \
+	int p_; \
+	(ok) = 1; \
+	MIP_MAT_COPY(a_, A, N, N); \
+	MIP_MAT_IDENTITY(Y, N); \
+	for(int c_=0;c_<(N) && (ok);c_++){ \
+		p_ = c_; \
+		for(int i_=c_+1;i_<(N);i_++){ \
+			if((a_[i_][c_]<0?-a_[i_][c_]:a_[i_][c_]) > \
+					(a_[p_][c_]<0?-a_[p_][c_]:a_[p_][c_])) p_ = i_; \
+		} \
+		if(a_[p_][c_]==0){ \
+			(ok) = 0; \
+			break; \
+		} \
+		for(int j_=0;j_<(N);j_++){ \
+			t_ = a_[c_][j_]; a_[c_][j_] = a_[p_][j_]; a_[p_][j_] = t_; \
+			t_ = (Y)[c_][j_]; (Y)[c_][j_] = (Y)[p_][j_]; (Y)[p_][j_] = t_; \
+		} \
+		t_ = 1/a_[c_][c_]; \
+		for(int j_=0;j_<(N);j_++){ \
+			a_[c_][j_] *= t_; \
+			(Y)[c_][j_] *= t_; \
+		} \
+		for(int i_=0;i_<(N);i_++){ \
+			if(i_==c_) continue; \
+			t_ = a_[i_][c_]; \
+			for(int j_=0;j_<(N);j_++){ \
+				a_[i_][j_] -= t_*a_[c_][j_]; \
+				(Y)[i_][j_] -= t_*(Y)[c_][j_]; \
+			} \
+		} \
+	} \
+}while(0)
+
+#endif //MIP_MAT_H
@@ -0,0 +1,62 @@
+/*******************************************************************************
+* mip_model.c
+* By: Stuart Sonatina
+*
+* Linearized eduMiP for the model based controllers, see mip_model.h
+*******************************************************************************/
+
+#include "mip_model.h"
+#include "mip_mat.h"
+
+/*******************************************************************************
+* int mip_model_linear()
+*
+* Linearized eduMiP about upright, the equations in mipsim/mip_plant.c with
+* cos(theta) = 1, sin(theta) = theta and no theta_dot^2 term. States are
+* theta, theta_dot, phi, phi_dot, gamma, gamma_dot. Inputs are the average
+* duty u and the steering duty, left wheel u-u_steer and right u+u_steer.
+*******************************************************************************/
+int mip_model_linear(double A[6][6], double B[6][2]){
+	const double R = MIP_WHEEL_RADIUS, L = MIP_BODY_COM, G = MIP_GEARBOX;
+	const double s = MIP_MOTOR_STALL_TORQUE, w_f = MIP_MOTOR_FREE_SPEED;
+	const double m_w1 = MIP_MASS_WHEELS/2.0;
+	const double I_w = 2.0*(0.5*m_w1*R*R);
+	const double J = 2.0*MIP_MOTOR_INERTIA*G*G;
+	const double a = I_w + (MIP_MASS_BODY+MIP_MASS_WHEELS)*R*R;
+	const double b = MIP_MASS_BODY*R*L;
+	const double c = MIP_BODY_INERTIA + MIP_MASS_BODY*L*L;
+	const double J_d = 2.0*(0.5*m_w1*R*R + m_w1*R*R) + J \
+						+ 4.0*MIP_YAW_INERTIA*R*R \
+						/(MIP_TRACK_WIDTH*MIP_TRACK_WIDTH);
+	const double mgL = MIP_MASS_BODY*MIP_GRAVITY*L;
+	const double k_u = 2.0*G*s;				// torque per duty
+	const double k_w = 2.0*G*G*s/w_f;		// back emf torque per rad/s
+	const double k_g = 2.0*R/MIP_TRACK_WIDTH;	// gamma per psi
+	double M[2][2], Mi[2][2], p_tau, t_tau;
+	int ok;
+
+	M[0][0] = a+J;	M[0][1] = b-J;
+	M[1][0] = b-J;	M[1][1] = c+J;
+	MIP_MAT_INV(Mi, M, 2, double, ok);
+	if(!ok) return -1;
+	// phi'' and theta'' per unit of motor torque tau
+	p_tau = Mi[0][0] - Mi[0][1];
+	t_tau = Mi[1][0] - Mi[1][1];
+
+	MIP_MAT_ZERO(A, 6, 6);
+	MIP_MAT_ZERO(B, 6, 2);
+	A[0][1] = 1;
+	A[1][0] = Mi[1][1]*mgL;
+	A[1][1] = t_tau*k_w;
+	A[1][3] = -t_tau*k_w;
+	B[1][0] = t_tau*k_u;
+	A[2][3] = 1;
+	A[3][0] = Mi[0][1]*mgL;
+	A[3][1] = p_tau*k_w;
+	A[3][3] = -p_tau*k_w;
+	B[3][0] = p_tau*k_u;
+	A[4][5] = 1;
+	A[5][5] = -2.0*G*G*s/(w_f*J_d);
+	B[5][1] = k_g*2.0*G*s/J_d;
+	return 0;
+}
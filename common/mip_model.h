@@ -0,0 +1,42 @@
+/*******************************************************************************
+* mip_model.h
+* By: Stuart Sonatina
+*
+* Physical parameters of the eduMiP, shared by the simulator, the host side
+* controller design tools and the model predictive controller. Values are
+* from the eduMiP dynamics notes (J. Strawson) and match the hookups in
+* stubalance_config.h.
+*
+* Coordinates:
+*	theta	body lean from vertical, positive tipping forward
+*	phi		average wheel angle in the global frame, positive rolling forward
+*	psi		half the difference of right and left wheel angles, so the body
+*			turns by gamma = 2*psi*R/track_width
+*******************************************************************************/
+
+#ifndef MIP_MODEL_H
+#define MIP_MODEL_H
+
+#define MIP_GRAVITY				9.81	// m/s^2
+#define MIP_MASS_BODY			0.263	// kg
+#define MIP_MASS_WHEELS			0.027	// kg, both wheels together
+#define MIP_BODY_COM			0.0477	// m, axle to body center of mass
+#define MIP_BODY_INERTIA		0.0004	// kg m^2, body about its center of mass
+#define MIP_YAW_INERTIA			0.0002	// kg m^2, whole robot about vertical
+#define MIP_WHEEL_RADIUS		0.034	// m
+#define MIP_TRACK_WIDTH			0.035	// m
+#define MIP_GEARBOX				35.577
+#define MIP_ENCODER_RES			60		// counts per motor revolution
+#define MIP_MOTOR_STALL_TORQUE	0.003	// N m at the motor shaft, at V_NOMINAL
+#define MIP_MOTOR_FREE_SPEED	1760.0	// rad/s at the motor shaft, at V_NOMINAL
+#define MIP_MOTOR_INERTIA		3.6e-8	// kg m^2, one rotor
+#define MIP_MOTOR_STALL_CURRENT	1.1		// A, one motor at V_NOMINAL
+#define MIP_V_NOMINAL			7.4		// V, 2 cell lipo
+#define MIP_BATTERY_RESISTANCE	0.25	// ohm, cells plus wiring
+#define MIP_BOARD_CURRENT		0.35	// A, BeagleBone and cape at idle
+#define MIP_CAPE_MOUNT_ANGLE	0.40	// rad, board pitch when body is vertical
+
+// linearized about upright, see mip_model.c
+int mip_model_linear(double A[6][6], double B[6][2]);
+
+#endif //MIP_MODEL_H
@@ -0,0 +1,245 @@
+/*******************************************************************************
+* mip_mpc.c
+* By: Stuart Sonatina
+*
+* Model predictive balance controller, see mip_mpc.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "mip_mpc.h"
+#include "mip_model.h"
+#include "mip_latency.h"
+
+#define MIP_DARE_N		MIP_MPC_STATES
+#define MIP_DARE_M		1
+#define MIP_DARE_NAME(f)	mpc4_##f
+#include "mip_dare.h"
+
+#define N_	MIP_MPC_STATES
+
+/*******************************************************************************
+* int mip_mpc_init()
+*
+* Discretizes the balance part of the model at dt and builds the QP over
+* horizon duties. Weights are Bryson style like lqr_design: x_max is the
+* largest acceptable theta, theta_dot, phi, phi_dot and u_weight the duty,
+* so lqr_design -q with the same numbers prints the terminal gain.
+*
+* With x_k = Ad^k x0 + sum over j<k of Ad^(k-1-j) Bd u_j the cost
+* sum x_k'Q x_k + x_N'P x_N + r*u_k^2 is U'HU + 2U'F x0 + const.
+*******************************************************************************/
+int mip_mpc_init(mip_mpc_t* m, int horizon, double dt,
+						const double x_max[MIP_MPC_STATES], double u_weight,
+						int max_iter){
+	double A6[6][6], B6[6][2], A[N_][N_], B[N_][1], Ad[N_][N_], Bd[N_][1];
+	double Q[N_][N_], R[1][1], P[N_][N_], K[1][N_], T[N_][N_];
+	double V[MIP_MPC_MAX_HORIZON][N_];		// Ad^d Bd
+	double Ak[MIP_MPC_MAX_HORIZON+1][N_][N_];	// Ad^k
+	double QV[N_], H, F, v[MIP_MPC_MAX_HORIZON], w[MIP_MPC_MAX_HORIZON];
+	double lambda = 0, norm;
+	int i, j, k, a, b;
+
+	if(horizon<1 || horizon>MIP_MPC_MAX_HORIZON){
+		printf("ERROR: mip_mpc_init, horizon must be 1 to %d\n", \
+														MIP_MPC_MAX_HORIZON);
+		return -1;
+	}
+	if(dt<=0 || u_weight<=0 || max_iter<1){
+		printf("ERROR: mip_mpc_init, dt, u_weight and max_iter must be > 0\n");
+		return -1;
+	}
+	memset(m, 0, sizeof(*m));
+	m->horizon = horizon;
+	m->max_iter = max_iter;
+	m->u_min = -1;
+	m->u_max = 1;
+
+	if(mip_model_linear(A6, B6)) return -1;
+	MIP_MAT_ZERO(Q, N_, N_);
+	for(i=0;i<N_;i++){
+		for(j=0;j<N_;j++) A[i][j] = A6[i][j];
+		B[i][0] = B6[i][0];
+		Q[i][i] = x_max[i]>0 ? 1/(x_max[i]*x_max[i]) : 0;
+	}
+	R[0][0] = 1/(u_weight*u_weight);
+	mpc4_c2d(A, B, dt, Ad, Bd);
+	if(mpc4_dare(Ad, Bd, Q, R, K, P)<0 || mpc4_radius(Ad, Bd, K)>=1){
+		printf("ERROR: mip_mpc_init, no stabilizing terminal cost\n");
+		return -1;
+	}
+	for(i=0;i<N_;i++) m->K[i] = K[0][i];
+
+	// step responses and powers of Ad
+	MIP_MAT_IDENTITY(Ak[0], N_);
+	for(k=1;k<=horizon;k++) MIP_MAT_MUL(Ak[k], Ak[k-1], Ad, N_, N_, N_);
+	for(k=0;k<horizon;k++) for(i=0;i<N_;i++){
+		V[k][i] = 0;
+		for(j=0;j<N_;j++) V[k][i] += Ak[k][i][j]*Bd[j][0];
+	}
+
+	// x_k depends on u_i through V[k-1-i], weighted by Q or P at the end
+	for(a=0;a<horizon;a++){
+		for(b=0;b<=a;b++){
+			H = a==b ? R[0][0] : 0;
+			for(k=a+1;k<=horizon;k++){
+				const double (*W)[N_] = k==horizon ? P : Q;
+				for(i=0;i<N_;i++){
+					QV[i] = 0;
+					for(j=0;j<N_;j++) QV[i] += W[i][j]*V[k-1-b][j];
+				}
+				for(i=0;i<N_;i++) H += V[k-1-a][i]*QV[i];
+			}
+			m->H[a][b] = m->H[b][a] = H;
+		}
+		for(j=0;j<N_;j++){
+			F = 0;
+			for(k=a+1;k<=horizon;k++){
+				const double (*W)[N_] = k==horizon ? P : Q;
+				MIP_MAT_MUL(T, W, Ak[k], N_, N_, N_);
+				for(i=0;i<N_;i++) F += V[k-1-a][i]*T[i][j];
+			}
+			m->F[a][j] = F;
+		}
+	}
+
+	// largest eigenvalue of H by power iteration, a little margin on top
+	// since it approaches from below
+	for(i=0;i<horizon;i++) v[i] = 1;
+	for(k=0;k<200;k++){
+		norm = 0;
+		for(i=0;i<horizon;i++){
+			w[i] = 0;
+			for(j=0;j<horizon;j++) w[i] += m->H[i][j]*v[j];
+			norm += w[i]*w[i];
+		}
+		norm = sqrt(norm);
+		lambda = 0;
+		for(i=0;i<horizon;i++){
+			lambda += v[i]*w[i];
+			v[i] = w[i]/norm;
+		}
+		if(k==0) lambda = norm;		// v wasn't normalized yet
+	}
+	m->step = 1/(1.02*lambda);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_mpc_limits()
+*
+* Duty limits for the whole plan, may change every step.
+*******************************************************************************/
+int mip_mpc_limits(mip_mpc_t* m, float u_min, float u_max){
+	if(u_min>u_max){
+		printf("ERROR: mip_mpc_limits, u_min > u_max\n");
+		return -1;
+	}
+	m->u_min = u_min;
+	m->u_max = u_max;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_mpc_reset()
+*
+* Forget the previous plan, the next solve starts from zero duty.
+*******************************************************************************/
+int mip_mpc_reset(mip_mpc_t* m){
+	memset(m->U, 0, sizeof(m->U));
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_mpc_solve()
+*
+* Plan from state x0, deviations from the setpoint. Iterates
+*	U = clip(Y - step*(H*Y + F*x0))
+*	Y = U + (t-1)/t_next * (U - U_last)
+* restarting the momentum whenever it points uphill. deadline_ns is a
+* mip_latency_now() time, 0 for none. Returns the iterations used and
+* writes the first duty to u0. At max_iter the plan is still within the
+* limits and used, just not optimal. Returns -1 without touching u0 if the
+* deadline passed first.
+*******************************************************************************/
+int mip_mpc_solve(mip_mpc_t* m, const float x0[MIP_MPC_STATES],
+										uint64_t deadline_ns, float* u0){
+	const int n = m->horizon;
+	float g, d, diff, up, t = 1, t_next, beta;
+	int i, j, it;
+
+	m->solves++;
+	for(i=0;i<n;i++){
+		m->f[i] = 0;
+		for(j=0;j<N_;j++) m->f[i] += m->F[i][j]*x0[j];
+	}
+	// warm start, the last plan one sample on
+	for(i=0;i<n;i++){
+		m->Y[i] = i<n-1 ? m->U[i+1] : m->U[n-1];
+		if(m->Y[i] > m->u_max) m->Y[i] = m->u_max;
+		if(m->Y[i] < m->u_min) m->Y[i] = m->u_min;
+		m->U[i] = m->Y[i];
+	}
+
+	for(it=1;it<=m->max_iter;it++){
+		diff = 0;
+		up = 0;
+		for(i=0;i<n;i++){
+			g = m->f[i];
+			for(j=0;j<n;j++) g += m->H[i][j]*m->Y[j];
+			m->U_last[i] = m->U[i];
+			m->U[i] = m->Y[i] - m->step*g;
+			if(m->U[i] > m->u_max) m->U[i] = m->u_max;
+			if(m->U[i] < m->u_min) m->U[i] = m->u_min;
+			d = m->U[i] - m->U_last[i];
+			if(fabsf(d)>diff) diff = fabsf(d);
+			up += (m->Y[i]-m->U[i])*d;
+		}
+		if(diff<MIP_MPC_TOLERANCE){
+			m->converged++;
+			break;
+		}
+		if(up>0){
+			t = 1;
+			beta = 0;
+		}
+		else{
+			t_next = (1+sqrtf(1+4*t*t))/2;
+			beta = (t-1)/t_next;
+			t = t_next;
+		}
+		for(i=0;i<n;i++) m->Y[i] = m->U[i] + beta*(m->U[i]-m->U_last[i]);
+
+		if(deadline_ns && it%MIP_MPC_CLOCK_EVERY==0 \
+								&& mip_latency_now()>deadline_ns){
+			m->timeouts++;
+			m->iterations += it;
+			return -1;
+		}
+	}
+	if(it>m->max_iter){
+		it = m->max_iter;
+		m->capped++;
+	}
+	m->iterations += it;
+	if(it>m->max_seen) m->max_seen = it;
+	*u0 = m->U[0];
+	return it;
+}
+
+/*******************************************************************************
+* int mip_mpc_print()
+*
+* Solver statistics since init.
+*******************************************************************************/
+int mip_mpc_print(mip_mpc_t* m){
+	if(m->solves==0) return 0;
+	printf("mpc: %llu solves, %.1f iterations mean, %d max, %llu converged, " \
+			"%llu at max_iter, %llu over deadline\n", \
+			(unsigned long long)m->solves, (double)m->iterations/m->solves, \
+			m->max_seen, (unsigned long long)m->converged, \
+			(unsigned long long)m->capped, (unsigned long long)m->timeouts);
+	return 0;
+}
@@ -0,0 +1,59 @@
+/*******************************************************************************
+* mip_mpc.h
+* By: Stuart Sonatina
+*
+* Model predictive balance controller. Every step it plans the drive duty
+* for the next horizon samples of the linearized eduMiP (theta, theta_dot,
+* phi, phi_dot, see mip_model.c) under hard duty limits, and the first duty
+* of the plan is applied. The cost is the LQR cost of lqr_design with its
+* Riccati solution as the terminal cost, so without active limits the first
+* duty is exactly the LQR's.
+*
+* The plan is a small dense QP in the duties only, its Hessian is built
+* once by mip_mpc_init(). mip_mpc_solve() runs accelerated projected
+* gradient (FISTA) on it, warm started from the previous plan shifted by one
+* sample. Everything lives in mip_mpc_t, nothing is allocated per step.
+* A solve ends when the plan stops moving, at max_iter, or at a deadline, in
+* which case the caller has to use something else for this step.
+*
+* Only one thread may use a mip_mpc_t.
+*******************************************************************************/
+
+#ifndef MIP_MPC_H
+#define MIP_MPC_H
+
+#include <stdint.h>
+
+#define MIP_MPC_STATES		4
+#define MIP_MPC_MAX_HORIZON	40
+#define MIP_MPC_TOLERANCE	3e-4	// largest duty change of a converged step
+#define MIP_MPC_CLOCK_EVERY	4		// iterations between deadline checks
+
+typedef struct mip_mpc_t{
+	int horizon;
+	int max_iter;
+	float u_min, u_max;				// duty limits for every planned sample
+	float H[MIP_MPC_MAX_HORIZON][MIP_MPC_MAX_HORIZON];	// Hessian
+	float F[MIP_MPC_MAX_HORIZON][MIP_MPC_STATES];		// gradient per x0
+	float step;						// 1/largest eigenvalue of H
+	float K[MIP_MPC_STATES];		// terminal LQR, u = -Kx
+	// workspace
+	float U[MIP_MPC_MAX_HORIZON];	// plan, kept as the next warm start
+	float U_last[MIP_MPC_MAX_HORIZON];
+	float Y[MIP_MPC_MAX_HORIZON];
+	float f[MIP_MPC_MAX_HORIZON];
+	// statistics
+	uint64_t solves, converged, capped, timeouts, iterations;
+	int max_seen;
+}mip_mpc_t;
+
+int mip_mpc_init(mip_mpc_t* m, int horizon, double dt,
+						const double x_max[MIP_MPC_STATES], double u_weight,
+						int max_iter);
+int mip_mpc_limits(mip_mpc_t* m, float u_min, float u_max);
+int mip_mpc_reset(mip_mpc_t* m);
+int mip_mpc_solve(mip_mpc_t* m, const float x0[MIP_MPC_STATES],
+										uint64_t deadline_ns, float* u0);
+int mip_mpc_print(mip_mpc_t* m);
+
+#endif //MIP_MPC_H
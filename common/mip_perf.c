@@ -0,0 +1,270 @@
+/*******************************************************************************
+* mip_perf.c
+* By: Stuart Sonatina
+*
+* perf_event_open counter group and per-section statistics, see mip_perf.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "mip_perf.h"
+
+static const char* value_names[MIP_PERF_N_VALUES] = {
+	"cycles", "instructions", "cache-misses", "branch-misses", "ns"
+};
+static const uint64_t event_config[MIP_PERF_N_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static volatile sig_atomic_t report_requested = 0;
+
+/*******************************************************************************
+* int open_counter()
+*
+* One hardware counter on the calling thread, any cpu, user space only so it
+* works with the default perf_event_paranoid.
+*******************************************************************************/
+static int open_counter(uint64_t config, int group){
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	attr.disabled = (group==-1);
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+/*******************************************************************************
+* int open_group()
+*
+* First counter that opens leads the group, the rest join it. Runs in the
+* thread being measured since perf counts the thread that opened it.
+*******************************************************************************/
+static int open_group(mip_perf_t* p){
+	int i, fd;
+	p->opened = 1;
+	for(i=0;i<MIP_PERF_N_COUNTERS;i++){
+		fd = open_counter(event_config[i], p->leader);
+		if(fd<0) continue;
+		if(p->leader<0) p->leader = fd;
+		p->fd[i] = fd;
+		p->slot[i] = p->n_open++;
+	}
+	if(p->leader<0){
+		printf("mip_perf: hardware counters unavailable, wall clock only\n");
+		return -1;
+	}
+	ioctl(p->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(p->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return 0;
+}
+
+/*******************************************************************************
+* void read_values()
+*
+* The whole group in one read(), then the clock.
+*******************************************************************************/
+static void read_values(mip_perf_t* p, uint64_t* v){
+	uint64_t buf[1+MIP_PERF_N_COUNTERS];
+	struct timespec ts;
+	int i;
+	if(p->leader>=0 && read(p->leader, buf, sizeof(buf))>0){
+		for(i=0;i<MIP_PERF_N_COUNTERS;i++){
+			v[i] = (p->fd[i]>=0) ? buf[1+p->slot[i]] : 0;
+		}
+	}
+	else for(i=0;i<MIP_PERF_N_COUNTERS;i++) v[i] = 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	v[MIP_PERF_WALL_NS] = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/*******************************************************************************
+* void add_sample()
+*******************************************************************************/
+static void add_sample(mip_perf_section_t* s, const uint64_t* from,
+														const uint64_t* to){
+	mip_perf_stat_t* st;
+	uint64_t x;
+	double d;
+	int i;
+	for(i=0;i<MIP_PERF_N_VALUES;i++){
+		st = &s->stat[i];
+		x = to[i]-from[i];
+		st->n++;
+		d = x - st->mean;
+		st->mean += d/st->n;
+		st->m2 += d*(x - st->mean);
+		if(st->n==1 || x<st->min) st->min = x;
+		if(x>st->max) st->max = x;
+	}
+}
+
+/*******************************************************************************
+* mip_perf_section_t* find_section()
+*
+* Sections are looked up by name pointer first since the marks are always
+* called with the same literal, new names get the next free slot.
+*******************************************************************************/
+static mip_perf_section_t* find_section(mip_perf_t* p, const char* name){
+	int i;
+	for(i=1;i<p->n_sections;i++){
+		if(p->section[i].name==name) return &p->section[i];
+	}
+	for(i=1;i<p->n_sections;i++){
+		if(!strcmp(p->section[i].name, name)) return &p->section[i];
+	}
+	if(p->n_sections>=MIP_PERF_MAX_SECTIONS) return NULL;
+	p->section[p->n_sections].name = name;
+	return &p->section[p->n_sections++];
+}
+
+/*******************************************************************************
+* int mip_perf_init()
+*
+* Counters are opened on the first mip_perf_begin() so they count the
+* thread running the control step, not the one calling init.
+*******************************************************************************/
+int mip_perf_init(mip_perf_t* p){
+	int i;
+	memset(p, 0, sizeof(*p));
+	p->leader = -1;
+	for(i=0;i<MIP_PERF_N_COUNTERS;i++) p->fd[i] = -1;
+	p->section[0].name = "step";
+	p->n_sections = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_perf_begin()
+*
+* Start of a control step. A step left open by an early return is dropped.
+*******************************************************************************/
+int mip_perf_begin(mip_perf_t* p){
+	if(!p->opened) open_group(p);
+	read_values(p, p->start);
+	memcpy(p->last, p->start, sizeof(p->last));
+	p->in_step = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_perf_mark()
+*
+* Charge everything since the last begin or mark to section.
+*******************************************************************************/
+int mip_perf_mark(mip_perf_t* p, const char* section){
+	uint64_t now[MIP_PERF_N_VALUES];
+	mip_perf_section_t* s;
+	if(!p->in_step) return -1;
+	read_values(p, now);
+	s = find_section(p, section);
+	if(s!=NULL) add_sample(s, p->last, now);
+	memcpy(p->last, now, sizeof(p->last));
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_perf_end()
+*
+* End of a control step, time since the last mark is not charged to any
+* section but is part of "step".
+*******************************************************************************/
+int mip_perf_end(mip_perf_t* p){
+	uint64_t now[MIP_PERF_N_VALUES];
+	if(!p->in_step) return -1;
+	read_values(p, now);
+	add_sample(&p->section[0], p->start, now);
+	p->in_step = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_perf_print()
+*
+* Mean, standard deviation and max of every value for every section. Called
+* from another thread while the step runs the numbers may be one sample
+* stale, which is fine for a report.
+*******************************************************************************/
+int mip_perf_print(const mip_perf_t* p){
+	const mip_perf_section_t* s;
+	const mip_perf_stat_t* st;
+	double ipc;
+	int i, j, first;
+
+	printf("\nperf: %d of %d hardware counters\n", p->n_open, \
+												MIP_PERF_N_COUNTERS);
+	printf("%-10s %-14s %8s %12s %12s %12s %12s\n", "section", "value", \
+								"n", "mean", "stddev", "min", "max");
+	for(i=0;i<p->n_sections;i++){
+		s = &p->section[i];
+		if(s->stat[0].n==0) continue;
+		first = 1;
+		for(j=0;j<MIP_PERF_N_VALUES;j++){
+			st = &s->stat[j];
+			if(j<MIP_PERF_N_COUNTERS && p->fd[j]<0) continue;
+			printf("%-10s %-14s %8llu %12.1f %12.1f %12llu %12llu\n", \
+				first ? s->name : "", value_names[j], \
+				(unsigned long long)st->n, \
+				st->mean, st->n>1 ? sqrt(st->m2/(st->n-1)) : 0.0, \
+				(unsigned long long)st->min, (unsigned long long)st->max);
+			first = 0;
+		}
+		if(p->fd[MIP_PERF_CYCLES]>=0 && p->fd[MIP_PERF_INSTRUCTIONS]>=0 \
+									&& s->stat[MIP_PERF_CYCLES].mean>0){
+			ipc = s->stat[MIP_PERF_INSTRUCTIONS].mean \
+										/s->stat[MIP_PERF_CYCLES].mean;
+			printf("%-10s %-14s %8s %12.2f\n", "", "ipc", "", ipc);
+		}
+	}
+	fflush(stdout);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_perf_close()
+*******************************************************************************/
+int mip_perf_close(mip_perf_t* p){
+	int i;
+	for(i=0;i<MIP_PERF_N_COUNTERS;i++){
+		if(p->fd[i]>=0) close(p->fd[i]);
+		p->fd[i] = -1;
+	}
+	p->leader = -1;
+	return 0;
+}
+
+/*******************************************************************************
+* SIGUSR1 asks for a report, printing is left to a thread that can block
+*******************************************************************************/
+static void on_sigusr1(int sig){
+	report_requested = 1;
+}
+
+int mip_perf_install_signal(){
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_sigusr1;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	return sigaction(SIGUSR1, &sa, NULL);
+}
+
+int mip_perf_report_requested(){
+	if(!report_requested) return 0;
+	report_requested = 0;
+	return 1;
+}
@@ -0,0 +1,93 @@
+/*******************************************************************************
+* mip_perf.h
+* By: Stuart Sonatina
+*
+* Hardware performance counters around the control step.
+*
+* A perf_event_open group of cycles, instructions, cache misses and branch
+* misses counts the thread that calls mip_perf_begin(). Each mark reads the
+* whole group in one read() and charges the difference since the last read
+* to a named section, so one control step can be split into estimation,
+* filters, motor writes and so on. Every section keeps a running mean,
+* standard deviation, min and max of each counter plus wall clock time.
+*
+*	mip_perf_begin(&perf);
+*	... state estimate ...
+*	mip_perf_mark(&perf, "estimate");
+*	... D1 ...
+*	mip_perf_mark(&perf, "D1");
+*	mip_perf_end(&perf);		// also records the whole step as "step"
+*
+* If the kernel refuses the counters (no PMU, perf_event_paranoid, a VM)
+* the missing ones read as 0 and only wall clock time is kept.
+* mip_perf_print() reports, mip_perf_install_signal() makes SIGUSR1 set a
+* flag that mip_perf_report_requested() returns so a slow thread can print.
+*******************************************************************************/
+
+#ifndef MIP_PERF_H
+#define MIP_PERF_H
+
+#include <stdint.h>
+
+#define MIP_PERF_MAX_SECTIONS	16
+
+/*******************************************************************************
+* mip_perf_counter_t
+*
+* Column order of every value array, MIP_PERF_WALL_NS comes from the clock.
+*******************************************************************************/
+typedef enum mip_perf_counter_t{
+	MIP_PERF_CYCLES,
+	MIP_PERF_INSTRUCTIONS,
+	MIP_PERF_CACHE_MISSES,
+	MIP_PERF_BRANCH_MISSES,
+	MIP_PERF_WALL_NS,
+	MIP_PERF_N_VALUES
+}mip_perf_counter_t;
+
+#define MIP_PERF_N_COUNTERS MIP_PERF_WALL_NS
+
+/*******************************************************************************
+* mip_perf_stat_t
+*
+* Welford running statistics of one value.
+*******************************************************************************/
+typedef struct mip_perf_stat_t{
+	uint64_t n;
+	double mean;
+	double m2;
+	uint64_t min;
+	uint64_t max;
+}mip_perf_stat_t;
+
+typedef struct mip_perf_section_t{
+	const char* name;
+	mip_perf_stat_t stat[MIP_PERF_N_VALUES];
+}mip_perf_section_t;
+
+/*******************************************************************************
+* mip_perf_t
+*******************************************************************************/
+typedef struct mip_perf_t{
+	int opened;						// tried to open in the counting thread
+	int leader;						// group leader fd, -1 for clock only
+	int fd[MIP_PERF_N_COUNTERS];	// -1 where unavailable
+	int slot[MIP_PERF_N_COUNTERS];	// position in the group read
+	int n_open;
+	uint64_t start[MIP_PERF_N_VALUES];
+	uint64_t last[MIP_PERF_N_VALUES];
+	int in_step;
+	int n_sections;
+	mip_perf_section_t section[MIP_PERF_MAX_SECTIONS];	// [0] is "step"
+}mip_perf_t;
+
+int mip_perf_init(mip_perf_t* p);
+int mip_perf_begin(mip_perf_t* p);
+int mip_perf_mark(mip_perf_t* p, const char* section);
+int mip_perf_end(mip_perf_t* p);
+int mip_perf_print(const mip_perf_t* p);
+int mip_perf_close(mip_perf_t* p);
+int mip_perf_install_signal();
+int mip_perf_report_requested();
+
+#endif //MIP_PERF_H
@@ -0,0 +1,348 @@
+/*******************************************************************************
+* mip_pyramid.c
+* By: Stuart Sonatina
+*
+* Build, save, open and query min/max/mean pyramids, see mip_pyramid.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mip_pyramid.h"
+
+#define RAW_CHUNK_ROWS 256	// rows read at a time for raw level queries
+
+/*******************************************************************************
+* acc_clear()
+*******************************************************************************/
+static void acc_clear(mip_pyr_acc_t* a, int nch){
+	int c;
+	for(c=0;c<nch;c++){
+		a->min[c] = INFINITY;
+		a->max[c] = -INFINITY;
+		a->sum[c] = 0;
+	}
+	a->count = 0;
+}
+
+/*******************************************************************************
+* emit()
+*
+* Close the bin being filled at level L: store it and fold it into L+1. The
+* level above is closed too once it has collected its 2^(L+1) rows.
+*******************************************************************************/
+static int emit(mip_pyramid_t* p, int L){
+	int nch = p->header.n_channels;
+	int i = L - MIP_PYR_BASE_LEVEL;
+	mip_pyr_acc_t* a = &p->acc[i];
+	mip_pyr_acc_t* up = NULL;
+	mip_pyr_bin_t* bin;
+	int c;
+
+	// grow this level if needed
+	if(p->header.n_bins[i]==p->cap[i]){
+		uint64_t cap = p->cap[i] ? 2*p->cap[i] : 64;
+		mip_pyr_bin_t* lvl = realloc(p->level[i], \
+										sizeof(mip_pyr_bin_t)*nch*cap);
+		if(lvl==NULL){
+			printf("ERROR: mip_pyramid out of memory\n");
+			return -1;
+		}
+		p->level[i] = lvl;
+		p->cap[i] = cap;
+	}
+	bin = p->level[i] + p->header.n_bins[i]*nch;
+	for(c=0;c<nch;c++){
+		bin[c].min = a->min[c];
+		bin[c].max = a->max[c];
+		bin[c].mean = a->sum[c]/a->count;
+	}
+	p->header.n_bins[i]++;
+
+	// fold into the level above
+	if(i+1<MIP_PYR_MAX_LEVELS){
+		up = &p->acc[i+1];
+		for(c=0;c<nch;c++){
+			if(a->min[c]<up->min[c]) up->min[c] = a->min[c];
+			if(a->max[c]>up->max[c]) up->max[c] = a->max[c];
+			up->sum[c] += a->sum[c];
+		}
+		up->count += a->count;
+	}
+	acc_clear(a, nch);
+	if(up!=NULL && up->count==(2ULL<<L)) return emit(p, L+1);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_pyramid_init()
+*
+* Start building a pyramid for a log with n_channels channels.
+*******************************************************************************/
+int mip_pyramid_init(mip_pyramid_t* p, int n_channels, float sample_rate_hz){
+	int i;
+	if(n_channels<1 || n_channels>MIP_LOG_MAX_CHANNELS) return -1;
+	memset(p, 0, sizeof(*p));
+	memcpy(p->header.magic, MIP_PYR_MAGIC, 4);
+	p->header.version = MIP_PYR_VERSION;
+	p->header.n_channels = n_channels;
+	p->header.sample_rate_hz = sample_rate_hz;
+	p->header.base_level = MIP_PYR_BASE_LEVEL;
+	for(i=0;i<MIP_PYR_MAX_LEVELS;i++) acc_clear(&p->acc[i], n_channels);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_pyramid_add_row()
+*
+* Fold one log row into the pyramid. Constant work except when bins close,
+* which is amortized to less than one extra bin per row.
+*******************************************************************************/
+int mip_pyramid_add_row(mip_pyramid_t* p, const float* row){
+	mip_pyr_acc_t* a = &p->acc[0];
+	int c, nch = p->header.n_channels;
+	for(c=0;c<nch;c++){
+		if(row[c]<a->min[c]) a->min[c] = row[c];
+		if(row[c]>a->max[c]) a->max[c] = row[c];
+		a->sum[c] += row[c];
+	}
+	a->count++;
+	p->header.n_rows++;
+	if(a->count==(1ULL<<MIP_PYR_BASE_LEVEL)){
+		return emit(p, MIP_PYR_BASE_LEVEL);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_pyramid_finish()
+*
+* Close the partial bins left at the end of the log and work out how many
+* levels there are. The top level is the first one with a single bin.
+*******************************************************************************/
+int mip_pyramid_finish(mip_pyramid_t* p){
+	int i;
+	for(i=0;i<MIP_PYR_MAX_LEVELS;i++){
+		if(p->acc[i].count>0 && emit(p, i+MIP_PYR_BASE_LEVEL)) return -1;
+		if(p->header.n_bins[i]<=1) break;
+	}
+	p->header.n_levels = (i<MIP_PYR_MAX_LEVELS) ? i+1 : MIP_PYR_MAX_LEVELS;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_pyramid_build()
+*
+* Build a whole pyramid from a log in one pass.
+*******************************************************************************/
+int mip_pyramid_build(mip_pyramid_t* p, mip_log_reader_t* log){
+	float rows[MIP_LOG_BLOCK_ROWS*MIP_LOG_MAX_CHANNELS];
+	int i, n, nch = log->header.n_channels;
+
+	if(mip_pyramid_init(p, nch, log->header.sample_rate_hz)) return -1;
+	mip_log_rewind(log);
+	while((n=mip_log_read(log, rows, MIP_LOG_BLOCK_ROWS))>0){
+		for(i=0;i<n;i++){
+			if(mip_pyramid_add_row(p, rows+i*nch)) return -1;
+		}
+	}
+	p->log = log;
+	return mip_pyramid_finish(p);
+}
+
+/*******************************************************************************
+* int mip_pyramid_save()
+*
+* Write the header and every level to path.
+*******************************************************************************/
+int mip_pyramid_save(const mip_pyramid_t* p, const char* path){
+	mip_pyr_header_t h = p->header;
+	uint64_t off = sizeof(h);
+	int i, nch = h.n_channels;
+	FILE* fp;
+
+	for(i=0;i<(int)h.n_levels;i++){
+		h.offset[i] = off;
+		off += sizeof(mip_pyr_bin_t)*nch*h.n_bins[i];
+	}
+	fp = fopen(path, "wb");
+	if(fp==NULL){
+		printf("ERROR: failed to open %s for writing\n", path);
+		return -1;
+	}
+	if(fwrite(&h, sizeof(h), 1, fp)!=1) goto fail;
+	for(i=0;i<(int)h.n_levels;i++){
+		if(fwrite(p->level[i], sizeof(mip_pyr_bin_t)*nch, h.n_bins[i], fp) \
+												!=h.n_bins[i]) goto fail;
+	}
+	return fclose(fp) ? -1 : 0;
+
+fail:
+	printf("ERROR: failed to write %s\n", path);
+	fclose(fp);
+	return -1;
+}
+
+/*******************************************************************************
+* int mip_pyramid_open()
+*
+* Map a saved pyramid. log may be NULL, then queries finer than the base
+* level fall back to the base level.
+*******************************************************************************/
+int mip_pyramid_open(mip_pyramid_t* p, const char* path,
+													mip_log_reader_t* log){
+	struct stat st;
+	int i, fd;
+	uint64_t need;
+
+	memset(p, 0, sizeof(*p));
+	fd = open(path, O_RDONLY);
+	if(fd<0 || fstat(fd,&st) || st.st_size<(off_t)sizeof(p->header)){
+		printf("ERROR: can't open %s\n", path);
+		if(fd>=0) close(fd);
+		return -1;
+	}
+	p->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p->map==MAP_FAILED){
+		p->map = NULL;
+		printf("ERROR: failed to map %s\n", path);
+		return -1;
+	}
+	p->map_len = st.st_size;
+	memcpy(&p->header, p->map, sizeof(p->header));
+	if(memcmp(p->header.magic, MIP_PYR_MAGIC, 4) || \
+				p->header.version!=MIP_PYR_VERSION || \
+				p->header.base_level!=MIP_PYR_BASE_LEVEL || \
+				p->header.n_levels>MIP_PYR_MAX_LEVELS || \
+				p->header.n_channels<1 || \
+				p->header.n_channels>MIP_LOG_MAX_CHANNELS){
+		printf("ERROR: %s is not a MIP pyramid\n", path);
+		mip_pyramid_free(p);
+		return -1;
+	}
+	for(i=0;i<(int)p->header.n_levels;i++){
+		need = p->header.offset[i] + \
+			sizeof(mip_pyr_bin_t)*p->header.n_channels*p->header.n_bins[i];
+		if(need>p->map_len){
+			printf("ERROR: %s is truncated\n", path);
+			mip_pyramid_free(p);
+			return -1;
+		}
+		p->level[i] = (mip_pyr_bin_t*)((uint8_t*)p->map + p->header.offset[i]);
+	}
+	if(log!=NULL && log->n_rows>=p->header.n_rows && \
+						log->header.n_channels==p->header.n_channels){
+		p->log = log;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_pyramid_level_for()
+*
+* Pick the level to draw rows t0..t1 seconds into pixels columns: the
+* coarsest one with a bin no wider than a pixel. Returns 0 for the raw log.
+*******************************************************************************/
+int mip_pyramid_level_for(const mip_pyramid_t* p, double t0, double t1,
+															int pixels){
+	double rows_per_px = (t1-t0)*p->header.sample_rate_hz/pixels;
+	int L = MIP_PYR_BASE_LEVEL + p->header.n_levels - 1;
+	while(L>=MIP_PYR_BASE_LEVEL && (double)(1ULL<<L)>rows_per_px) L--;
+	if(L<MIP_PYR_BASE_LEVEL) return (p->log!=NULL) ? 0 : MIP_PYR_BASE_LEVEL;
+	return L;
+}
+
+/*******************************************************************************
+* int mip_pyramid_query()
+*
+* Fill out[0..pixels-1] with the min/max/mean of channel over each pixel's
+* slice of t0..t1 seconds. Pixels with no data are NAN. Returns the level
+* used, 0 meaning raw log rows, or -1 on error.
+*******************************************************************************/
+int mip_pyramid_query(mip_pyramid_t* p, int channel, double t0, double t1,
+											int pixels, mip_pyr_bin_t* out){
+	float rows[RAW_CHUNK_ROWS*MIP_LOG_MAX_CHANNELS];
+	int nch = p->header.n_channels;
+	uint64_t n_rows = p->header.n_rows;
+	uint64_t r0, r1, ra, rb, b, b0, b1, w, r, got;
+	double sum, count;
+	float mn, mx, v;
+	int L, i, n, k;
+
+	if(channel<0 || channel>=nch || pixels<1 || !(t1>t0)) return -1;
+	if(t0<0) t0 = 0;
+	r0 = (uint64_t)floor(t0*p->header.sample_rate_hz);
+	r1 = (uint64_t)ceil(t1*p->header.sample_rate_hz);
+	L = mip_pyramid_level_for(p, t0, t1, pixels);
+
+	for(i=0;i<pixels;i++){
+		// pixels past the end of the log come back empty
+		ra = r0 + (r1-r0)*i/pixels;
+		rb = r0 + (r1-r0)*(i+1)/pixels;
+		if(ra>n_rows) ra = n_rows;
+		if(rb>n_rows) rb = n_rows;
+		mn = INFINITY;
+		mx = -INFINITY;
+		sum = 0;
+		count = 0;
+		if(L==0){
+			// fine zoom, read the rows themselves
+			if(rb>ra && mip_log_seek(p->log, ra)) return -1;
+			for(r=ra; r<rb; r+=got){
+				n = (rb-r<RAW_CHUNK_ROWS) ? (int)(rb-r) : RAW_CHUNK_ROWS;
+				got = mip_log_read(p->log, rows, n);
+				if(got==0) break;
+				for(k=0;k<(int)got;k++){
+					v = rows[k*nch+channel];
+					if(v<mn) mn = v;
+					if(v>mx) mx = v;
+					sum += v;
+					count++;
+				}
+			}
+		}
+		else{
+			// bins starting inside this pixel, a bin is never wider than a
+			// pixel so every pixel gets one and none is counted twice
+			const mip_pyr_bin_t* lvl = p->level[L-MIP_PYR_BASE_LEVEL];
+			b0 = (ra+(1ULL<<L)-1)>>L;
+			b1 = (rb+(1ULL<<L)-1)>>L;
+			for(b=b0;b<b1;b++){
+				const mip_pyr_bin_t* bin = lvl + b*nch + channel;
+				// the last bin may hold fewer rows
+				w = n_rows - (b<<L);
+				if(w>(1ULL<<L)) w = 1ULL<<L;
+				if(bin->min<mn) mn = bin->min;
+				if(bin->max>mx) mx = bin->max;
+				sum += (double)bin->mean*w;
+				count += w;
+			}
+		}
+		if(count>0){
+			out[i].min = mn;
+			out[i].max = mx;
+			out[i].mean = sum/count;
+		}
+		else out[i].min = out[i].max = out[i].mean = NAN;
+	}
+	return L;
+}
+
+/*******************************************************************************
+* int mip_pyramid_free()
+*******************************************************************************/
+int mip_pyramid_free(mip_pyramid_t* p){
+	int i;
+	if(p->map!=NULL) munmap(p->map, p->map_len);
+	else for(i=0;i<MIP_PYR_MAX_LEVELS;i++) free(p->level[i]);
+	p->map = NULL;
+	memset(p->level, 0, sizeof(p->level));
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*******************************************************************************
+* mip_pyramid.h
+* By: Stuart Sonatina
+*
+* Min/max/mean pyramid over a MIP log for fast plotting of long recordings.
+*
+* Level L holds one bin per 2^L rows of the log for every channel. Levels
+* start at MIP_PYR_BASE_LEVEL so the whole pyramid is a fraction of the log
+* size, anything finer than that is read straight from the log. The pyramid
+* is built in one streaming pass and saved next to the log as <log>.pyr.
+*
+* A query asks for a time window and a pixel width and gets back one
+* min/max/mean per pixel, taken from the coarsest level that still has at
+* least one bin per pixel, so it only touches about as many bins as pixels
+* no matter how long the recording is.
+*******************************************************************************/
+
+#ifndef MIP_PYRAMID_H
+#define MIP_PYRAMID_H
+
+#include <stdint.h>
+
+#include "mip_log.h"
+
+#define MIP_PYR_MAGIC		"MIPP"
+#define MIP_PYR_VERSION		1
+#define MIP_PYR_BASE_LEVEL	3		// finest stored level, 8 rows per bin
+#define MIP_PYR_MAX_LEVELS	48
+
+/*******************************************************************************
+* mip_pyr_bin_t
+*******************************************************************************/
+typedef struct mip_pyr_bin_t{
+	float min;
+	float max;
+	float mean;
+}mip_pyr_bin_t;
+
+/*******************************************************************************
+* mip_pyr_header_t
+*
+* Start of a .pyr file. Level data follows, each level is n_bins rows of
+* n_channels bins starting at offset bytes into the file.
+*******************************************************************************/
+typedef struct mip_pyr_header_t{
+	char magic[4];			// "MIPP"
+	uint32_t version;
+	uint32_t n_channels;
+	uint32_t n_levels;		// levels MIP_PYR_BASE_LEVEL.. stored
+	uint64_t n_rows;		// rows of the log this was built from
+	float sample_rate_hz;
+	uint32_t base_level;
+	uint64_t offset[MIP_PYR_MAX_LEVELS];
+	uint64_t n_bins[MIP_PYR_MAX_LEVELS];
+}mip_pyr_header_t;
+
+/*******************************************************************************
+* mip_pyr_acc_t
+*
+* Running min/max/sum for the bin being filled at one level.
+*******************************************************************************/
+typedef struct mip_pyr_acc_t{
+	float min[MIP_LOG_MAX_CHANNELS];
+	float max[MIP_LOG_MAX_CHANNELS];
+	double sum[MIP_LOG_MAX_CHANNELS];
+	uint64_t count;			// log rows folded in so far
+}mip_pyr_acc_t;
+
+/*******************************************************************************
+* mip_pyramid_t
+*
+* Either being built (levels live in growing arrays) or opened from a file
+* (levels point into the mapping). log is only needed for queries finer than
+* the base level.
+*******************************************************************************/
+typedef struct mip_pyramid_t{
+	mip_pyr_header_t header;
+	mip_pyr_bin_t* level[MIP_PYR_MAX_LEVELS];	// [bin*n_channels + channel]
+	uint64_t cap[MIP_PYR_MAX_LEVELS];			// build side allocation
+	mip_pyr_acc_t acc[MIP_PYR_MAX_LEVELS];		// build side accumulators
+	void* map;
+	size_t map_len;
+	mip_log_reader_t* log;
+}mip_pyramid_t;
+
+// build
+int mip_pyramid_init(mip_pyramid_t* p, int n_channels, float sample_rate_hz);
+int mip_pyramid_add_row(mip_pyramid_t* p, const float* row);
+int mip_pyramid_finish(mip_pyramid_t* p);
+int mip_pyramid_save(const mip_pyramid_t* p, const char* path);
+int mip_pyramid_build(mip_pyramid_t* p, mip_log_reader_t* log);
+
+// query
+int mip_pyramid_open(mip_pyramid_t* p, const char* path,
+													mip_log_reader_t* log);
+int mip_pyramid_level_for(const mip_pyramid_t* p, double t0, double t1,
+															int pixels);
+int mip_pyramid_query(mip_pyramid_t* p, int channel, double t0, double t1,
+											int pixels, mip_pyr_bin_t* out);
+int mip_pyramid_free(mip_pyramid_t* p);
+
+#endif //MIP_PYRAMID_H
@@ -0,0 +1,44 @@
+/*******************************************************************************
+* mip_ring.c
+* By: Stuart Sonatina
+*
+* Setup and teardown for the lock free ring in mip_ring.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mip_ring.h"
+#include "mip_arena.h"
+
+/*******************************************************************************
+* int mip_ring_init()
+*
+* Allocate room for capacity elements, from the arena once there is one.
+* Capacity must be a power of two.
+*******************************************************************************/
+int mip_ring_init(mip_ring_t* r, uint32_t elem_size, uint32_t capacity){
+	if(capacity<2 || (capacity & (capacity-1))){
+		printf("ERROR: mip_ring capacity must be a power of 2\n");
+		return -1;
+	}
+	r->buf = mip_arena_calloc(capacity, elem_size);
+	if(r->buf==NULL){
+		printf("ERROR: mip_ring failed to allocate\n");
+		return -1;
+	}
+	r->elem_size = elem_size;
+	r->mask = capacity-1;
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_ring_free()
+*******************************************************************************/
+int mip_ring_free(mip_ring_t* r){
+	mip_arena_free(r->buf);
+	r->buf = NULL;
+	return 0;
+}
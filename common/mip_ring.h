@@ -0,0 +1,108 @@
+/*******************************************************************************
+* mip_ring.h
+* By: Stuart Sonatina
+*
+* Single producer, single consumer ring buffer of fixed size elements.
+*
+* Nothing here locks or allocates after mip_ring_init() so the producer side
+* is safe to call from the IMU interrupt function. Exactly one thread may
+* push and exactly one other thread may pop.
+*******************************************************************************/
+
+#ifndef MIP_RING_H
+#define MIP_RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+/*******************************************************************************
+* mip_ring_t
+*
+* head is only written by the producer and tail only by the consumer, they
+* live on separate cache lines so the two sides don't fight over one.
+*******************************************************************************/
+typedef struct mip_ring_t{
+	uint8_t* buf;
+	uint32_t elem_size;
+	uint32_t mask;						// capacity-1, capacity is a power of 2
+	_Alignas(64) _Atomic uint32_t head;	// next slot to write
+	_Alignas(64) _Atomic uint32_t tail;	// next slot to read
+}mip_ring_t;
+
+int mip_ring_init(mip_ring_t* r, uint32_t elem_size, uint32_t capacity);
+int mip_ring_free(mip_ring_t* r);
+
+/*******************************************************************************
+* void* mip_ring_claim()
+*
+* Producer: returns the next free slot to fill in place, or NULL if the ring
+* is full. The slot isn't visible to the consumer until mip_ring_publish().
+*******************************************************************************/
+static inline void* mip_ring_claim(mip_ring_t* r){
+	uint32_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint32_t t = atomic_load_explicit(&r->tail, memory_order_acquire);
+	if(h-t > r->mask) return NULL;
+	return r->buf + (size_t)(h & r->mask)*r->elem_size;
+}
+
+static inline void mip_ring_publish(mip_ring_t* r){
+	uint32_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+	atomic_store_explicit(&r->head, h+1, memory_order_release);
+}
+
+/*******************************************************************************
+* int mip_ring_push()
+*
+* Producer: copy one element in. Returns -1 without blocking if full.
+*******************************************************************************/
+static inline int mip_ring_push(mip_ring_t* r, const void* elem){
+	void* slot = mip_ring_claim(r);
+	if(slot==NULL) return -1;
+	memcpy(slot, elem, r->elem_size);
+	mip_ring_publish(r);
+	return 0;
+}
+
+/*******************************************************************************
+* const void* mip_ring_peek()
+*
+* Consumer: returns the oldest element without removing it, or NULL if the
+* ring is empty. Call mip_ring_release() when done with it.
+*******************************************************************************/
+static inline const void* mip_ring_peek(mip_ring_t* r){
+	uint32_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	uint32_t h = atomic_load_explicit(&r->head, memory_order_acquire);
+	if(h==t) return NULL;
+	return r->buf + (size_t)(t & r->mask)*r->elem_size;
+}
+
+static inline void mip_ring_release(mip_ring_t* r){
+	uint32_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	atomic_store_explicit(&r->tail, t+1, memory_order_release);
+}
+
+/*******************************************************************************
+* int mip_ring_pop()
+*
+* Consumer: copy the oldest element out. Returns -1 if empty.
+*******************************************************************************/
+static inline int mip_ring_pop(mip_ring_t* r, void* elem){
+	const void* slot = mip_ring_peek(r);
+	if(slot==NULL) return -1;
+	memcpy(elem, slot, r->elem_size);
+	mip_ring_release(r);
+	return 0;
+}
+
+/*******************************************************************************
+* uint32_t mip_ring_count()
+*
+* Number of elements waiting, exact from either side, approximate otherwise.
+*******************************************************************************/
+static inline uint32_t mip_ring_count(mip_ring_t* r){
+	return atomic_load_explicit(&r->head, memory_order_acquire) \
+			- atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+#endif //MIP_RING_H
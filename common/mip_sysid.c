@@ -0,0 +1,404 @@
+/*******************************************************************************
+* mip_sysid.c
+* By: Stuart Sonatina
+*
+* Online system identification, see mip_sysid.h
+*******************************************************************************/
+
+#define _GNU_SOURCE		// SCHED_IDLE
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "mip_sysid.h"
+#include "mip_ring.h"
+
+#define SYSID_SLEEP_US	20000	// how long the estimator naps when idle
+#define SYSID_P0		1e8		// initial covariance, signals are small so
+							// anything less pulls the fit to zero
+#define SYSID_WARMUP	200		// updates before the fit is scored
+#define SYSID_N			(2*MIP_SYSID_MAX_ORDER)
+
+typedef struct sysid_sample_t{
+	float u, theta, phi;
+	int start;
+}sysid_sample_t;
+
+/*******************************************************************************
+* rls_t
+*
+* One ARX fit. w holds a1..an then b1..bn, the histories are newest first.
+*******************************************************************************/
+typedef struct rls_t{
+	int order;
+	double w[SYSID_N];
+	double P[SYSID_N][SYSID_N];
+	double y_hist[MIP_SYSID_MAX_ORDER];
+	double u_hist[MIP_SYSID_MAX_ORDER];
+	int filled;
+	uint64_t updates;
+	double err2, diff2;		// a priori error and sample to sample change
+}rls_t;
+
+static mip_ring_t ring;
+static pthread_t thread;
+static pthread_mutex_t model_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile int running = 0;
+static rls_t rls[2];
+static float dt;
+static uint64_t samples;			// estimator side
+static uint64_t dropped;			// control side
+static int resync;					// control side, a sample was dropped
+
+static void* sysid_thread(void* ptr);
+
+/*******************************************************************************
+* int mip_excite_init()
+*
+* amplitude in duty, the chirp sweeps f0 to f1 Hz over duration seconds,
+* the PRBS holds each bit for hold samples and ignores f0 and f1.
+*******************************************************************************/
+int mip_excite_init(mip_excite_t* e, mip_excite_type_t type, float amplitude,
+						float f0, float f1, float duration, float rate_hz,
+						int hold){
+	if(amplitude<0 || duration<=0 || rate_hz<=0 || hold<1){
+		printf("ERROR: mip_excite_init, bad amplitude, duration, rate " \
+															"or hold\n");
+		return -1;
+	}
+	if(type==MIP_EXCITE_CHIRP && (f0<=0 || f1<=f0)){
+		printf("ERROR: mip_excite_init, need 0 < f0 < f1\n");
+		return -1;
+	}
+	e->type = type;
+	e->amplitude = amplitude;
+	e->f0 = f0;
+	e->f1 = f1;
+	e->duration = duration;
+	e->dt = 1.0f/rate_hz;
+	e->hold = hold;
+	return mip_excite_reset(e);
+}
+
+/*******************************************************************************
+* int mip_excite_reset()
+*
+* Start the signal over.
+*******************************************************************************/
+int mip_excite_reset(mip_excite_t* e){
+	e->k = 0;
+	e->lfsr = 0x1ff;
+	return 0;
+}
+
+/*******************************************************************************
+* float mip_excite_step()
+*
+* Next sample of the signal, 0 once duration is over. The chirp phase is
+* 2*pi*f0*T*(r^(t/T)-1)/ln(r) with r = f1/f0, so the frequency rises
+* exponentially. The PRBS is x^9+x^5+1, 511 bits before it repeats.
+*******************************************************************************/
+float mip_excite_step(mip_excite_t* e){
+	float t, r, phase, out;
+	int bit;
+
+	if(mip_excite_done(e)) return 0;
+	t = e->k*e->dt;
+	if(e->type==MIP_EXCITE_CHIRP){
+		r = e->f1/e->f0;
+		phase = 2*M_PI*e->f0*e->duration*(powf(r, t/e->duration)-1)/logf(r);
+		out = e->amplitude*sinf(phase);
+	}
+	else{
+		if(e->k % e->hold == 0){
+			bit = ((e->lfsr>>8) ^ (e->lfsr>>4)) & 1;
+			e->lfsr = ((e->lfsr<<1) | bit) & 0x1ff;
+		}
+		out = (e->lfsr & 1) ? e->amplitude : -e->amplitude;
+	}
+	e->k++;
+	return out;
+}
+
+int mip_excite_done(mip_excite_t* e){
+	return e->k*e->dt >= e->duration;
+}
+
+/*******************************************************************************
+* rls_init(), rls_add()
+*
+* Textbook RLS with exponential forgetting:
+*	e = y - w'x,  k = Px/(lambda + x'Px),  w += k*e,  P = (P - k*x'P)/lambda
+* where x is -y[k-1..k-n] then u[k-1..k-n].
+*******************************************************************************/
+static void rls_init(rls_t* r, int order){
+	int i;
+	memset(r, 0, sizeof(*r));
+	r->order = order;
+	for(i=0;i<2*order;i++) r->P[i][i] = SYSID_P0;
+}
+
+static void rls_add(rls_t* r, double y, double u){
+	const int n = 2*r->order;
+	double x[SYSID_N], Px[SYSID_N], k[SYSID_N], e, den;
+	int i, j;
+
+	if(r->filled>=r->order){
+		for(i=0;i<r->order;i++){
+			x[i] = -r->y_hist[i];
+			x[r->order+i] = r->u_hist[i];
+		}
+		e = y;
+		den = MIP_SYSID_FORGET;
+		for(i=0;i<n;i++){
+			e -= r->w[i]*x[i];
+			Px[i] = 0;
+			for(j=0;j<n;j++) Px[i] += r->P[i][j]*x[j];
+			den += x[i]*Px[i];
+		}
+		for(i=0;i<n;i++){
+			k[i] = Px[i]/den;
+			r->w[i] += k[i]*e;
+		}
+		// P is symmetric so x'P is Px transposed
+		for(i=0;i<n;i++) for(j=0;j<=i;j++){
+			r->P[i][j] = r->P[j][i] = (r->P[i][j] - k[i]*Px[j]) \
+														/MIP_SYSID_FORGET;
+		}
+		r->updates++;
+		if(r->updates>SYSID_WARMUP){
+			r->err2 += e*e;
+			r->diff2 += (y-r->y_hist[0])*(y-r->y_hist[0]);
+		}
+	}
+	else r->filled++;
+
+	for(i=r->order-1;i>0;i--){
+		r->y_hist[i] = r->y_hist[i-1];
+		r->u_hist[i] = r->u_hist[i-1];
+	}
+	r->y_hist[0] = y;
+	r->u_hist[0] = u;
+}
+
+/*******************************************************************************
+* int mip_sysid_start()
+*
+* Starts the estimator thread at idle priority, it only runs when nothing
+* else wants the CPU. Falls back to a normal thread if the policy can't be
+* set.
+*******************************************************************************/
+int mip_sysid_start(float rate_hz){
+	pthread_attr_t attr;
+	struct sched_param param = {0};
+	int ret;
+
+	if(running) return 0;
+	if(rate_hz<=0){
+		printf("ERROR: mip_sysid_start, rate_hz must be > 0\n");
+		return -1;
+	}
+	if(mip_ring_init(&ring, sizeof(sysid_sample_t), MIP_SYSID_RING)){
+		return -1;
+	}
+	dt = 1.0f/rate_hz;
+	rls_init(&rls[MIP_SYSID_THETA], MIP_SYSID_ORDER_THETA);
+	rls_init(&rls[MIP_SYSID_PHI], MIP_SYSID_ORDER_PHI);
+	samples = 0;
+	dropped = 0;
+	resync = 1;
+	running = 1;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_IDLE);
+	pthread_attr_setschedparam(&attr, &param);
+	ret = pthread_create(&thread, &attr, sysid_thread, NULL);
+	pthread_attr_destroy(&attr);
+	if(ret) ret = pthread_create(&thread, NULL, sysid_thread, NULL);
+	if(ret){
+		printf("ERROR: failed to start sysid thread\n");
+		running = 0;
+		mip_ring_free(&ring);
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_sysid_push()
+*
+* Called from the control loop. Never blocks, returns -1 if the sample had
+* to be dropped. The sample after a drop starts a new record.
+*******************************************************************************/
+int mip_sysid_push(float u, float theta, float phi, int start){
+	sysid_sample_t s = {u, theta, phi, start || resync};
+	if(!running) return -1;
+	if(mip_ring_push(&ring, &s)){
+		dropped++;
+		resync = 1;
+		return -1;
+	}
+	resync = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_sysid_stop()
+*
+* Stops the thread after it drains the ring, the models stay readable.
+*******************************************************************************/
+int mip_sysid_stop(){
+	if(!running) return 0;
+	running = 0;
+	pthread_join(thread, NULL);
+	mip_ring_free(&ring);
+	return 0;
+}
+
+/*******************************************************************************
+* void* sysid_thread()
+*******************************************************************************/
+static void* sysid_thread(void* ptr){
+	sysid_sample_t s;
+	int stopping;
+	for(;;){
+		// check before draining so samples pushed just before the stop count
+		stopping = !running;
+		pthread_mutex_lock(&model_mutex);
+		while(mip_ring_pop(&ring, &s)==0){
+			if(s.start){
+				rls[MIP_SYSID_THETA].filled = 0;
+				rls[MIP_SYSID_PHI].filled = 0;
+			}
+			rls_add(&rls[MIP_SYSID_THETA], s.theta, s.u);
+			rls_add(&rls[MIP_SYSID_PHI], s.phi, s.u);
+			samples++;
+		}
+		pthread_mutex_unlock(&model_mutex);
+		if(stopping) break;
+		usleep(SYSID_SLEEP_US);
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* int mip_sysid_model()
+*
+* Copies the current fit of MIP_SYSID_THETA or MIP_SYSID_PHI into num and
+* den, order+1 coefficients each. Returns the order, or -1 before the first
+* update. Safe while the estimator runs.
+*******************************************************************************/
+int mip_sysid_model(int output, float* num, float* den){
+	rls_t* r;
+	int i, order;
+	if(output!=MIP_SYSID_THETA && output!=MIP_SYSID_PHI){
+		printf("ERROR: mip_sysid_model, no such output\n");
+		return -1;
+	}
+	r = &rls[output];
+	pthread_mutex_lock(&model_mutex);
+	order = r->updates ? r->order : -1;
+	if(order>0){
+		num[0] = 0;
+		den[0] = 1;
+		for(i=1;i<=order;i++){
+			den[i] = r->w[i-1];
+			num[i] = r->w[order+i-1];
+		}
+	}
+	pthread_mutex_unlock(&model_mutex);
+	return order;
+}
+
+/*******************************************************************************
+* int poles()
+*
+* Roots of z^n + den[1]z^(n-1) + ... + den[n] by Durand-Kerner, returned as
+* the equivalent continuous poles ln(z)/dt in rad/s.
+*******************************************************************************/
+static int poles(const float* den, int n, double complex* s){
+	double complex z[MIP_SYSID_MAX_ORDER], p, q;
+	int it, i, j;
+	for(i=0;i<n;i++) z[i] = cpow(0.4+0.9*I, i);
+	for(it=0;it<500;it++){
+		for(i=0;i<n;i++){
+			p = 1;
+			for(j=1;j<=n;j++) p = p*z[i] + den[j];
+			q = 1;
+			for(j=0;j<n;j++) if(j!=i) q *= z[i]-z[j];
+			if(q!=0) z[i] -= p/q;
+		}
+	}
+	for(i=0;i<n;i++) s[i] = clog(z[i])/dt;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_sysid_print()
+*
+* Samples used and for each model how much of the sample to sample change
+* the one step prediction explains, 100% is perfect and 0% no better than
+* assuming nothing changes. Then the poles in rad/s, an unstable theta
+* pole is the falling mode.
+*******************************************************************************/
+int mip_sysid_print(){
+	const char* names[2] = {"theta", "phi"};
+	float num[MIP_SYSID_MAX_ORDER+1], den[MIP_SYSID_MAX_ORDER+1];
+	double complex s[MIP_SYSID_MAX_ORDER];
+	double fit;
+	int i, o, n;
+
+	printf("sysid: %llu samples, %llu dropped\n", \
+			(unsigned long long)samples, (unsigned long long)dropped);
+	for(o=0;o<2;o++){
+		n = mip_sysid_model(o, num, den);
+		if(n<0 || rls[o].diff2==0) continue;
+		fit = 100*(1-sqrt(rls[o].err2/rls[o].diff2));
+		poles(den, n, s);
+		printf("sysid %s: one step fit %.0f%%, poles", names[o], fit);
+		for(i=0;i<n;i++){
+			if(fabs(cimag(s[i]))<1e-3) printf(" %.3g", creal(s[i]));
+			else printf(" %.3g%+.3gj", creal(s[i]), cimag(s[i]));
+		}
+		printf(" rad/s\n");
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_sysid_write()
+*
+* Writes both models as config lines, num and den are the transfer function
+* from duty at V_NOMINAL to theta or phi in z^-1.
+*******************************************************************************/
+int mip_sysid_write(const char* path){
+	const char* names[2] = {"THETA", "PHI"};
+	float num[MIP_SYSID_MAX_ORDER+1], den[MIP_SYSID_MAX_ORDER+1];
+	FILE* f;
+	int i, o, n;
+
+	f = fopen(path, "w");
+	if(f==NULL){
+		printf("ERROR: can't open %s\n", path);
+		return -1;
+	}
+	fprintf(f, "// ARX fits of duty to theta and phi, %llu samples at " \
+			"%.0f Hz\n", (unsigned long long)samples, 1/dt);
+	for(o=0;o<2;o++){
+		n = mip_sysid_model(o, num, den);
+		if(n<0) continue;
+		fprintf(f, "#define SYSID_%s_ORDER\t%d\n", names[o], n);
+		fprintf(f, "#define SYSID_%s_NUM\t{", names[o]);
+		for(i=0;i<=n;i++) fprintf(f, "%s%.6g", i ? ", " : "", num[i]);
+		fprintf(f, "}\n#define SYSID_%s_DEN\t{", names[o]);
+		for(i=0;i<=n;i++) fprintf(f, "%s%.6g", i ? ", " : "", den[i]);
+		fprintf(f, "}\n");
+	}
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,81 @@
+/*******************************************************************************
+* mip_sysid.h
+* By: Stuart Sonatina
+*
+* Online system identification while balancing.
+*
+* mip_excite_t makes the test signal the controller adds to its duty: a
+* logarithmic chirp from f0 to f1, so every decade gets the same time, or a
+* PRBS from a 9 bit LFSR holding each bit for hold samples, which is flat
+* up to about rate/(2*hold).
+*
+* mip_sysid_push() is called from the IMU interrupt with the duty that was
+* applied, normalized to the nominal battery voltage, and the measured theta
+* and phi. It copies them into a lock free ring and returns, or drops and
+* counts the sample if the ring is full. A SCHED_IDLE thread drains the ring
+* and updates recursive least squares fits of two ARX models
+*
+*	y[k] = -a1*y[k-1] - ... - an*y[k-n] + b1*u[k-1] + ... + bn*u[k-n]
+*
+* for y = theta with MIP_SYSID_ORDER_THETA terms and y = phi with
+* MIP_SYSID_ORDER_PHI. A push with start set begins a new record, the
+* regressors fill up again before the next update.
+*
+* Models come out as num and den in the form mip_filter and the config file
+* use, num[0] is 0 since the duty acts one sample later.
+*
+* ARX fits treat sensor noise as if it drove the plant, which pulls the
+* poles toward zero. Raise SYSID_AMPLITUDE until the one step fit printed at
+* exit is well above what the noise leaves.
+*******************************************************************************/
+
+#ifndef MIP_SYSID_H
+#define MIP_SYSID_H
+
+#include <stdint.h>
+
+#define MIP_SYSID_THETA			0
+#define MIP_SYSID_PHI			1
+#define MIP_SYSID_ORDER_THETA	3		// pendulum and motor
+#define MIP_SYSID_ORDER_PHI		4		// same plus the wheel integrator
+#define MIP_SYSID_MAX_ORDER		4
+#define MIP_SYSID_FORGET		0.9995	// RLS memory of 2000 samples
+#define MIP_SYSID_RING			1024	// samples, 5 s at 200 Hz
+
+/*******************************************************************************
+* mip_excite_t
+*******************************************************************************/
+typedef enum mip_excite_type_t{
+	MIP_EXCITE_CHIRP,
+	MIP_EXCITE_PRBS
+}mip_excite_type_t;
+
+typedef struct mip_excite_t{
+	mip_excite_type_t type;
+	float amplitude;
+	float f0, f1;			// Hz, chirp sweep
+	float duration;			// s
+	float dt;
+	int hold;				// samples per PRBS bit
+	int k;					// samples since start
+	uint16_t lfsr;
+}mip_excite_t;
+
+int mip_excite_init(mip_excite_t* e, mip_excite_type_t type, float amplitude,
+						float f0, float f1, float duration, float rate_hz,
+						int hold);
+int mip_excite_reset(mip_excite_t* e);
+float mip_excite_step(mip_excite_t* e);
+int mip_excite_done(mip_excite_t* e);
+
+/*******************************************************************************
+* estimator
+*******************************************************************************/
+int mip_sysid_start(float rate_hz);
+int mip_sysid_push(float u, float theta, float phi, int start);
+int mip_sysid_stop();
+int mip_sysid_model(int output, float* num, float* den);
+int mip_sysid_print();
+int mip_sysid_write(const char* path);
+
+#endif //MIP_SYSID_H
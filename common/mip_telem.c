@@ -0,0 +1,390 @@
+/*******************************************************************************
+* mip_telem.c
+* By: Stuart Sonatina
+*
+* Telemetry ring and its socket server, see mip_telem.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mip_telem.h"
+#include "mip_trace.h"
+
+// a stream only stays framed if every message goes out whole, so the tail
+// of one the socket took part of waits here and goes first
+typedef struct client_t{
+	int fd;						// -1 for a free slot
+	uint32_t decimation;		// 0 until subscribed
+	uint64_t t_ok;				// connected or last frame taken
+	int blocked;				// frames dropped since then
+	uint64_t sent, dropped;
+	mip_telem_sub_t rx;			// subscription coming in
+	size_t n_rx;
+	char tx[sizeof(mip_telem_hello_t)];	// the unsent tail of a message
+	size_t tx_at, n_tx;
+}client_t;
+
+static pthread_t thread;
+static volatile int running = 0;
+static mip_telem_ring_t* ring = NULL;
+static int n_channels;
+static long serve_us;
+static int listen_fd = -1;
+static char sock_path[108];
+static char shm_name[32];
+static client_t clients[MIP_TELEM_MAX_CLIENTS];
+
+// server thread only, printed at exit
+static uint64_t n_sent, n_dropped, n_lost;
+static int n_subscribers, n_stalled, n_refused;
+
+static uint64_t now_ns(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec*1000000000ULL + t.tv_nsec;
+}
+
+/*******************************************************************************
+* int mip_telem_publish()
+*
+* Control thread: one frame of v[n_channels] into the ring. Returns -1 if
+* telemetry isn't running.
+*******************************************************************************/
+int mip_telem_publish(uint64_t t_ns, int state, uint32_t flags,
+													const float* v){
+	mip_telem_slot_t* s;
+	uint64_t h;
+	if(ring==NULL) return -1;
+	h = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	s = &ring->slots[h&(MIP_TELEM_FRAMES-1)];
+	atomic_store_explicit(&s->lock, 2*h+1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	s->frame.seq = h;
+	s->frame.t_ns = t_ns;
+	s->frame.state = state;
+	s->frame.flags = flags;
+	memcpy(s->frame.v, v, n_channels*sizeof(float));
+	atomic_store_explicit(&s->lock, 2*h+2, memory_order_release);
+	atomic_store_explicit(&ring->head, h+1, memory_order_release);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_telem_read()
+*
+* Any reader: frame seq out of the ring. Returns -1 if it was overwritten,
+* isn't published yet or changed while being copied.
+*******************************************************************************/
+int mip_telem_read(const mip_telem_ring_t* r, uint64_t seq,
+													mip_telem_frame_t* f){
+	const mip_telem_slot_t* s = &r->slots[seq&(MIP_TELEM_FRAMES-1)];
+	uint64_t l = atomic_load_explicit(&s->lock, memory_order_acquire);
+	if(l!=2*seq+2) return -1;
+	memcpy(f, &s->frame, sizeof(*f));
+	atomic_thread_fence(memory_order_acquire);
+	if(atomic_load_explicit(&s->lock, memory_order_relaxed)!=l) return -1;
+	return 0;
+}
+
+/*******************************************************************************
+* static void drop()
+*******************************************************************************/
+static void drop(client_t* c){
+	close(c->fd);
+	c->fd = -1;
+	c->decimation = 0;
+}
+
+/*******************************************************************************
+* static int put()
+*
+* Whole message or nothing, unless the socket takes part of it and the rest
+* waits in tx. A tail still waiting from before goes first and if it can't
+* all go the message is turned away. Returns 0 when the message is taken, 1
+* when it isn't and -1 if the socket is gone.
+*******************************************************************************/
+static int full(){
+	return errno==EAGAIN || errno==EWOULDBLOCK || errno==ENOBUFS;
+}
+
+static int put(client_t* c, const void* msg, size_t len){
+	ssize_t n;
+	while(c->tx_at<c->n_tx){
+		n = send(c->fd, c->tx+c->tx_at, c->n_tx-c->tx_at, \
+											MSG_DONTWAIT|MSG_NOSIGNAL);
+		if(n<0) return full() ? 1 : -1;
+		c->tx_at += n;
+	}
+	n = send(c->fd, msg, len, MSG_DONTWAIT|MSG_NOSIGNAL);
+	if(n<0) return full() ? 1 : -1;
+	c->tx_at = 0;
+	c->n_tx = len - n;
+	memcpy(c->tx, (const char*)msg+n, c->n_tx);
+	return 0;
+}
+
+/*******************************************************************************
+* static void accept_clients()
+*
+* Everyone waiting to connect, refused once every slot is taken.
+*******************************************************************************/
+static void accept_clients(uint64_t t){
+	int fd, i;
+	while((fd=accept(listen_fd, NULL, NULL))>=0){
+		for(i=0;i<MIP_TELEM_MAX_CLIENTS && clients[i].fd>=0;i++);
+		if(i==MIP_TELEM_MAX_CLIENTS){
+			close(fd);
+			n_refused++;
+			continue;
+		}
+		memset(&clients[i], 0, sizeof(client_t));
+		clients[i].fd = fd;
+		clients[i].t_ok = t;
+	}
+}
+
+/*******************************************************************************
+* static void read_clients()
+*
+* Subscriptions, a later one changes the decimation, and hangups.
+*******************************************************************************/
+static void read_clients(uint64_t t){
+	mip_telem_hello_t hello = ring->hello;
+	client_t* c;
+	ssize_t n;
+	int i;
+	for(i=0;i<MIP_TELEM_MAX_CLIENTS;i++){
+		c = &clients[i];
+		if(c->fd<0) continue;
+		while((n=recv(c->fd, (char*)&c->rx+c->n_rx, sizeof(c->rx)-c->n_rx, \
+														MSG_DONTWAIT))>0){
+			c->n_rx += n;
+			if(c->n_rx<sizeof(c->rx)) continue;
+			c->n_rx = 0;
+			if(c->rx.magic!=MIP_TELEM_MAGIC){
+				n = 0;
+				break;
+			}
+			if(c->decimation==0){
+				// nothing sent yet, the socket takes it all
+				hello.decimation = c->rx.decimation ? c->rx.decimation : 1;
+				if(put(c, &hello, sizeof(hello)) || c->n_tx){
+					n = 0;
+					break;
+				}
+				n_subscribers++;
+				c->t_ok = t;
+			}
+			c->decimation = c->rx.decimation ? c->rx.decimation : 1;
+		}
+		if(n==0 || (n<0 && errno!=EAGAIN && errno!=EWOULDBLOCK)) drop(c);
+		else if((c->blocked || !c->decimation) && \
+								t - c->t_ok > MIP_TELEM_STALL_SEC*1e9){
+			if(c->decimation) n_stalled++;
+			drop(c);
+		}
+	}
+}
+
+/*******************************************************************************
+* static void send_frame()
+*
+* To every subscriber due this frame. A full socket loses the whole frame.
+*******************************************************************************/
+static void send_frame(const mip_telem_frame_t* f, uint64_t t){
+	client_t* c;
+	int i, r;
+	for(i=0;i<MIP_TELEM_MAX_CLIENTS;i++){
+		c = &clients[i];
+		if(c->fd<0 || c->decimation==0 || f->seq%c->decimation) continue;
+		r = put(c, f, sizeof(*f));
+		if(r==0){
+			c->sent++;
+			c->t_ok = t;
+			c->blocked = 0;
+			n_sent++;
+		}
+		else if(r==1){
+			c->blocked = 1;
+			c->dropped++;
+			n_dropped++;
+		}
+		else drop(c);
+	}
+}
+
+/*******************************************************************************
+* void* serve_loop()
+*
+* Everything published since the last pass, then sleep.
+*******************************************************************************/
+static void* serve_loop(void* ptr){
+	mip_telem_frame_t f;
+	uint64_t next, h, t;
+	int i;
+	mip_trace_thread_name("telem_server");
+	next = atomic_load_explicit(&ring->head, memory_order_acquire);
+	while(running){
+		MIP_TRACE_BEGIN("telem_serve");
+		t = now_ns();
+		accept_clients(t);
+		read_clients(t);
+		h = atomic_load_explicit(&ring->head, memory_order_acquire);
+		if(h-next>MIP_TELEM_FRAMES){
+			n_lost += h - MIP_TELEM_FRAMES - next;
+			next = h - MIP_TELEM_FRAMES;
+		}
+		for(;next<h;next++){
+			if(mip_telem_read(ring, next, &f)) n_lost++;
+			else send_frame(&f, t);
+		}
+		MIP_TRACE_END("telem_serve");
+		usleep(serve_us);
+	}
+	for(i=0;i<MIP_TELEM_MAX_CLIENTS;i++){
+		if(clients[i].fd>=0) drop(&clients[i]);
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* static int map_ring()
+*
+* Named shared memory so other processes can map it, or anonymous if that
+* isn't available.
+*******************************************************************************/
+static int map_ring(){
+	int fd;
+	void* p = MAP_FAILED;
+	snprintf(shm_name, sizeof(shm_name), "/mip_telem_%d", (int)getpid());
+	fd = shm_open(shm_name, O_CREAT|O_EXCL|O_RDWR, 0644);
+	if(fd>=0){
+		if(ftruncate(fd, sizeof(mip_telem_ring_t))==0){
+			p = mmap(NULL, sizeof(mip_telem_ring_t), PROT_READ|PROT_WRITE, \
+														MAP_SHARED, fd, 0);
+		}
+		close(fd);
+		if(p==MAP_FAILED) shm_unlink(shm_name);
+	}
+	if(p==MAP_FAILED){
+		printf("WARNING: telemetry ring not in shared memory\n");
+		shm_name[0] = 0;
+		p = mmap(NULL, sizeof(mip_telem_ring_t), PROT_READ|PROT_WRITE, \
+										MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if(p==MAP_FAILED) return -1;
+	}
+	// touch every page now, not in the control step
+	memset(p, 0, sizeof(mip_telem_ring_t));
+	ring = p;
+	return 0;
+}
+
+static void unmap_ring(){
+	mip_telem_ring_t* r = ring;
+	ring = NULL;
+	munmap(r, sizeof(mip_telem_ring_t));
+	if(shm_name[0]) shm_unlink(shm_name);
+}
+
+/*******************************************************************************
+* int mip_telem_start()
+*
+* Maps the ring, listens on socket_path and starts serving at serve_hz.
+* rate_hz is how often the program publishes, for the viewers.
+*******************************************************************************/
+int mip_telem_start(const char* socket_path, const char* program,
+					const char* const* names, int n, float rate_hz,
+					float serve_hz){
+	struct sockaddr_un addr;
+	mip_telem_hello_t* h;
+	int i;
+	if(running) return 0;
+	if(n<1 || n>MIP_TELEM_MAX_CHANNELS || rate_hz<=0 || serve_hz<=0 || \
+							strlen(socket_path)>=sizeof(addr.sun_path)){
+		printf("ERROR: mip_telem_start, need 1 to %d channels, rates > 0 " \
+				"and a socket path under %d characters\n", \
+				MIP_TELEM_MAX_CHANNELS, (int)sizeof(addr.sun_path));
+		return -1;
+	}
+	if(map_ring()){
+		printf("ERROR: can't map the telemetry ring\n");
+		return -1;
+	}
+	n_channels = n;
+	serve_us = 1000000/serve_hz;
+	h = &ring->hello;
+	h->magic = MIP_TELEM_MAGIC;
+	h->n_channels = n;
+	h->rate_hz = rate_hz;
+	snprintf(h->program, sizeof(h->program), "%s", program);
+	snprintf(h->shm, sizeof(h->shm), "%s", shm_name);
+	for(i=0;i<n;i++){
+		snprintf(h->names[i], MIP_TELEM_NAME_LEN, "%s", names[i]);
+	}
+	for(i=0;i<MIP_TELEM_MAX_CLIENTS;i++) clients[i].fd = -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+	snprintf(sock_path, sizeof(sock_path), "%s", socket_path);
+	unlink(sock_path);
+	listen_fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK, 0);
+	if(listen_fd<0 || bind(listen_fd, (struct sockaddr*)&addr, \
+													sizeof(addr)) || \
+						listen(listen_fd, MIP_TELEM_MAX_CLIENTS)){
+		printf("ERROR: telemetry can't listen on %s\n", sock_path);
+		if(listen_fd>=0) close(listen_fd);
+		listen_fd = -1;
+		unmap_ring();
+		return -1;
+	}
+	running = 1;
+	if(pthread_create(&thread, NULL, serve_loop, NULL)){
+		printf("ERROR: failed to start telemetry thread\n");
+		running = 0;
+		close(listen_fd);
+		unlink(sock_path);
+		unmap_ring();
+		return -1;
+	}
+	printf("telemetry: %d channels at %.0f Hz on %s\n", n, rate_hz, \
+															sock_path);
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_telem_stop()
+*
+* After the last mip_telem_publish(), the ring goes away.
+*******************************************************************************/
+int mip_telem_stop(){
+	if(!running) return 0;
+	running = 0;
+	pthread_join(thread, NULL);
+	close(listen_fd);
+	listen_fd = -1;
+	unlink(sock_path);
+	unmap_ring();
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_telem_print()
+*******************************************************************************/
+int mip_telem_print(){
+	printf("telemetry: %d subscribers, %llu frames sent, %llu dropped for " \
+			"full sockets, %llu lost, %d stalled, %d refused\n", \
+			n_subscribers, (unsigned long long)n_sent, \
+			(unsigned long long)n_dropped, (unsigned long long)n_lost, \
+			n_stalled, n_refused);
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*******************************************************************************
+* mip_telem.h
+* By: Stuart Sonatina
+*
+* Live telemetry for any number of viewers, in place of printing to the
+* console from the robot.
+*
+* The control step hands mip_telem_publish() a row of floats, the program's
+* state and flags. That row goes into a ring of MIP_TELEM_FRAMES frames in
+* shared memory and returns: no lock, no system call, and a full ring just
+* overwrites the oldest frame. Each frame carries a sequence number that is
+* odd while it's being written, so a reader that loses the race sees it
+* changed and skips the frame instead of waiting.
+*
+* A server thread reads the ring at serve_hz and passes frames to the
+* subscribers on a UNIX stream socket, so ssh -L can forward it to a host.
+* Every message is one of the structs below, fixed size with the same
+* layout on the BeagleBone and a 64 bit PC, and goes out whole or not at
+* all, so the reader just reads one struct at a time.
+* A subscriber connects and sends a mip_telem_sub_t with its decimation,
+* gets a mip_telem_hello_t with the channel names back and from then every
+* decimation-th frame. Sending another mip_telem_sub_t changes the
+* decimation. Sends never block. A subscriber whose socket is full loses
+* frames until it catches up, and one that stays full for
+* MIP_TELEM_STALL_SEC is dropped, as is one that connects and doesn't
+* subscribe in that time. None of that reaches the control thread.
+*
+* Any local process can also map the ring itself, its shm name is in the
+* hello. ../telem_view does the formatting on the host.
+*******************************************************************************/
+
+#ifndef MIP_TELEM_H
+#define MIP_TELEM_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define MIP_TELEM_MAGIC			0x4d495054	// "MIPT"
+#define MIP_TELEM_MAX_CHANNELS	16
+#define MIP_TELEM_NAME_LEN		16
+#define MIP_TELEM_FRAMES		256			// power of 2, 1.3 s at 200 Hz
+#define MIP_TELEM_MAX_CLIENTS	8
+#define MIP_TELEM_STALL_SEC		2.0
+
+// flags, the rest are the program's own
+#define MIP_TELEM_ARMED			0x0001
+#define MIP_TELEM_SHED(f)		(((f)>>8)&0xFF)	// watchdog level
+#define MIP_TELEM_SHED_FLAGS(l)	((l)<<8)
+
+typedef struct mip_telem_frame_t{
+	uint64_t seq;				// frames published before this one
+	uint64_t t_ns;				// CLOCK_MONOTONIC
+	int32_t state;				// cape library state_t
+	uint32_t flags;
+	float v[MIP_TELEM_MAX_CHANNELS];
+}mip_telem_frame_t;
+
+// subscriber to server
+typedef struct mip_telem_sub_t{
+	uint32_t magic;
+	uint32_t decimation;		// 1 for every frame
+}mip_telem_sub_t;
+
+// server to subscriber, once
+typedef struct mip_telem_hello_t{
+	uint32_t magic;
+	uint32_t n_channels;
+	float rate_hz;				// of frames before decimation
+	uint32_t decimation;
+	char program[32];
+	char shm[32];
+	char names[MIP_TELEM_MAX_CHANNELS][MIP_TELEM_NAME_LEN];
+}mip_telem_hello_t;
+
+/*******************************************************************************
+* mip_telem_ring_t
+*
+* The shared memory, head is written by the publisher only.
+*******************************************************************************/
+typedef struct mip_telem_slot_t{
+	_Atomic uint64_t lock;		// 2*seq+1 while writing, 2*seq+2 when done
+	mip_telem_frame_t frame;
+}mip_telem_slot_t;
+
+typedef struct mip_telem_ring_t{
+	mip_telem_hello_t hello;
+	_Alignas(64) _Atomic uint64_t head;
+	_Alignas(64) mip_telem_slot_t slots[MIP_TELEM_FRAMES];
+}mip_telem_ring_t;
+
+int mip_telem_start(const char* socket_path, const char* program,
+					const char* const* names, int n_channels, float rate_hz,
+					float serve_hz);
+int mip_telem_publish(uint64_t t_ns, int state, uint32_t flags,
+													const float* v);
+int mip_telem_read(const mip_telem_ring_t* r, uint64_t seq,
+													mip_telem_frame_t* f);
+int mip_telem_stop();
+int mip_telem_print();
+
+#endif //MIP_TELEM_H
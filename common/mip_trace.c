@@ -0,0 +1,222 @@
+/*******************************************************************************
+* mip_trace.c
+* By: Stuart Sonatina
+*
+* Per-thread event rings and Chrome trace JSON export, see mip_trace.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "mip_trace.h"
+#include "mip_arena.h"
+
+#define RING_MASK (MIP_TRACE_EVENTS_PER_THREAD-1)
+
+/*******************************************************************************
+* trace_buf_t
+*
+* One thread's ring. Only the owning thread writes events and head, the
+* exporter reads head with acquire so it sees whole events.
+*******************************************************************************/
+typedef struct trace_buf_t{
+	mip_trace_event_t* events;
+	_Atomic uint64_t head;		// events ever written
+	const char* name;			// thread name for the viewer
+	int tid;
+}trace_buf_t;
+
+volatile int mip_trace_on = 0;
+static int started = 0;
+
+static trace_buf_t bufs[MIP_TRACE_MAX_THREADS];
+static _Atomic int n_bufs = 0;
+static _Atomic int n_lost_threads = 0;
+static struct timespec t_start;
+static __thread trace_buf_t* my_buf = NULL;
+static __thread int my_buf_failed = 0;
+
+/*******************************************************************************
+* uint64_t now_ns()
+*******************************************************************************/
+static inline uint64_t now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)(ts.tv_sec-t_start.tv_sec)*1000000000ULL \
+											+ ts.tv_nsec - t_start.tv_nsec;
+}
+
+/*******************************************************************************
+* trace_buf_t* get_buf()
+*
+* The calling thread's ring, claimed from the pool on first use with one
+* atomic increment. Threads past MIP_TRACE_MAX_THREADS are not traced.
+*******************************************************************************/
+static inline trace_buf_t* get_buf(){
+	int i;
+	if(my_buf!=NULL) return my_buf;
+	if(my_buf_failed) return NULL;
+	i = atomic_fetch_add(&n_bufs, 1);
+	if(i>=MIP_TRACE_MAX_THREADS){
+		my_buf_failed = 1;
+		atomic_fetch_add(&n_lost_threads, 1);
+		return NULL;
+	}
+	my_buf = &bufs[i];
+	my_buf->tid = i+1;
+	return my_buf;
+}
+
+/*******************************************************************************
+* int mip_trace_start()
+*
+* Allocate every ring up front and turn recording on. Call this from main()
+* before starting threads.
+*******************************************************************************/
+int mip_trace_start(){
+	int i;
+	for(i=0;i<MIP_TRACE_MAX_THREADS;i++){
+		bufs[i].events = mip_arena_calloc(MIP_TRACE_EVENTS_PER_THREAD, \
+											sizeof(mip_trace_event_t));
+		if(bufs[i].events==NULL){
+			printf("ERROR: mip_trace failed to allocate\n");
+			return -1;
+		}
+		atomic_init(&bufs[i].head, 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	started = 1;
+	mip_trace_on = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_trace_stop()
+*
+* Stop recording, events already recorded are kept for export.
+*******************************************************************************/
+int mip_trace_stop(){
+	started = 0;
+	mip_trace_on = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_trace_pause()
+*
+* Stop or resume recording between start and stop, from any thread. Scopes
+* open across a pause lose their end event.
+*******************************************************************************/
+int mip_trace_pause(int paused){
+	if(!started) return -1;
+	mip_trace_on = !paused;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_trace_thread_name()
+*
+* Label the calling thread in the trace viewer.
+*******************************************************************************/
+int mip_trace_thread_name(const char* name){
+	trace_buf_t* b;
+	if(!mip_trace_on) return -1;
+	b = get_buf();
+	if(b==NULL) return -1;
+	b->name = name;
+	return 0;
+}
+
+/*******************************************************************************
+* void mip_trace_event()
+*
+* Record one event on the calling thread's ring.
+*******************************************************************************/
+void mip_trace_event(char type, const char* name, double value){
+	trace_buf_t* b = get_buf();
+	mip_trace_event_t* e;
+	uint64_t h;
+	if(b==NULL) return;
+	h = atomic_load_explicit(&b->head, memory_order_relaxed);
+	e = &b->events[h & RING_MASK];
+	e->ts_ns = now_ns();
+	e->name = name;
+	e->value = value;
+	e->type = type;
+	atomic_store_explicit(&b->head, h+1, memory_order_release);
+}
+
+/*******************************************************************************
+* MIP_TRACE_SCOPE helpers
+*******************************************************************************/
+const char* mip_trace_scope_begin(const char* name){
+	if(mip_trace_on) mip_trace_event('B', name, 0);
+	return name;
+}
+
+void mip_trace_scope_end(const char** name){
+	if(mip_trace_on) mip_trace_event('E', *name, 0);
+}
+
+/*******************************************************************************
+* int mip_trace_write_json()
+*
+* Write every ring to path as Chrome trace JSON. Rings that wrapped start
+* with their oldest surviving event, an end without its begin is dropped so
+* the viewer doesn't draw nonsense.
+*******************************************************************************/
+int mip_trace_write_json(const char* path){
+	FILE* fp;
+	trace_buf_t* b;
+	mip_trace_event_t* e;
+	uint64_t h, first, k, total = 0;
+	int i, n, depth, first_out = 1;
+
+	fp = fopen(path, "w");
+	if(fp==NULL){
+		printf("ERROR: failed to open %s for writing\n", path);
+		return -1;
+	}
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	n = atomic_load(&n_bufs);
+	if(n>MIP_TRACE_MAX_THREADS) n = MIP_TRACE_MAX_THREADS;
+	for(i=0;i<n;i++){
+		b = &bufs[i];
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+				"\"tid\":%d,\"args\":{\"name\":\"%s\"}}", \
+				first_out ? "" : ",\n", b->tid, b->name ? b->name : "thread");
+		first_out = 0;
+		h = atomic_load_explicit(&b->head, memory_order_acquire);
+		first = (h>MIP_TRACE_EVENTS_PER_THREAD) ? \
+									h-MIP_TRACE_EVENTS_PER_THREAD : 0;
+		depth = 0;
+		for(k=first;k<h;k++){
+			e = &b->events[k & RING_MASK];
+			if(e->type=='E'){
+				if(depth==0) continue;
+				depth--;
+			}
+			else if(e->type=='B') depth++;
+			fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+					"\"pid\":1,\"tid\":%d", e->name, e->type, \
+					e->ts_ns/1000.0, b->tid);
+			if(e->type=='C'){
+				fprintf(fp, ",\"args\":{\"value\":%g}", e->value);
+			}
+			else if(e->type=='i') fprintf(fp, ",\"s\":\"t\"");
+			fprintf(fp, "}");
+			total++;
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	printf("trace: wrote %llu events from %d threads to %s\n", \
+									(unsigned long long)total, n, path);
+	if(atomic_load(&n_lost_threads)){
+		printf("trace: %d threads not traced, raise MIP_TRACE_MAX_THREADS\n", \
+									atomic_load(&n_lost_threads));
+	}
+	return 0;
+}
@@ -0,0 +1,71 @@
+/*******************************************************************************
+* mip_trace.h
+* By: Stuart Sonatina
+*
+* Lightweight event tracing for the balance programs.
+*
+* Every thread records into its own fixed size ring of events, so recording
+* is a clock read plus a few stores with no locks, no allocation and no
+* syscalls besides the vdso clock. The rings keep the most recent events and
+* overwrite the oldest, like a flight recorder. At exit the rings are written
+* out as Chrome trace JSON, which chrome://tracing and ui.perfetto.dev open
+* directly, one row per thread.
+*
+* Names must be string literals (or otherwise live forever), only the
+* pointer is stored.
+*
+*	MIP_TRACE_SCOPE("name");		begin now, end when the block exits
+*	MIP_TRACE_BEGIN("name");		begin/end pair by hand
+*	MIP_TRACE_END("name");
+*	MIP_TRACE_INSTANT("tip");		a single point in time
+*	MIP_TRACE_COUNTER("vBatt", v);	a value plotted over time
+*******************************************************************************/
+
+#ifndef MIP_TRACE_H
+#define MIP_TRACE_H
+
+#include <stdint.h>
+
+#define MIP_TRACE_MAX_THREADS		16
+#define MIP_TRACE_EVENTS_PER_THREAD	32768	// power of 2, 1 MB per thread
+
+/*******************************************************************************
+* mip_trace_event_t
+*******************************************************************************/
+typedef struct mip_trace_event_t{
+	uint64_t ts_ns;			// since mip_trace_start()
+	const char* name;
+	double value;			// counters only
+	char type;				// 'B' begin, 'E' end, 'C' counter, 'i' instant
+}mip_trace_event_t;
+
+extern volatile int mip_trace_on;
+
+int mip_trace_start();
+int mip_trace_stop();
+int mip_trace_pause(int paused);
+int mip_trace_thread_name(const char* name);
+void mip_trace_event(char type, const char* name, double value);
+int mip_trace_write_json(const char* path);
+
+// helpers for MIP_TRACE_SCOPE, not meant to be called directly
+const char* mip_trace_scope_begin(const char* name);
+void mip_trace_scope_end(const char** name);
+
+#define MIP_TRACE_CAT2(a,b) a##b
+#define MIP_TRACE_CAT(a,b) MIP_TRACE_CAT2(a,b)
+
+#define MIP_TRACE_BEGIN(name) \
+	do{ if(mip_trace_on) mip_trace_event('B', name, 0); }while(0)
+#define MIP_TRACE_END(name) \
+	do{ if(mip_trace_on) mip_trace_event('E', name, 0); }while(0)
+#define MIP_TRACE_INSTANT(name) \
+	do{ if(mip_trace_on) mip_trace_event('i', name, 0); }while(0)
+#define MIP_TRACE_COUNTER(name, value) \
+	do{ if(mip_trace_on) mip_trace_event('C', name, value); }while(0)
+#define MIP_TRACE_SCOPE(name) \
+	const char* MIP_TRACE_CAT(mip_trace_scope_,__LINE__) \
+		__attribute__((cleanup(mip_trace_scope_end))) = \
+		mip_trace_scope_begin(name)
+
+#endif //MIP_TRACE_H
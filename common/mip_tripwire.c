@@ -0,0 +1,168 @@
+/*******************************************************************************
+* mip_tripwire.c
+* By: Stuart Sonatina
+*
+* Allocation and lock tripwire for the control thread, see mip_tripwire.h
+*******************************************************************************/
+
+#define _GNU_SOURCE		// dladdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+#include "mip_tripwire.h"
+
+enum{
+	TRIP_MALLOC,
+	TRIP_CALLOC,
+	TRIP_REALLOC,
+	TRIP_FREE,
+	TRIP_MUTEX,
+	TRIPS
+};
+
+typedef struct trip_t{
+	const char* name;
+	_Atomic uint32_t n;
+	_Atomic(void*) first;		// return address of the first trip
+}trip_t;
+
+static trip_t trips[TRIPS] = {
+	{"malloc"}, {"calloc"}, {"realloc"}, {"free"}, {"pthread_mutex_lock"}
+};
+static _Atomic int armed = 0;
+static int abort_on = 0;
+static __thread int watched = 0;
+
+// the real calls, linked with -Wl,--wrap. The simulator always is, the
+// robot only with make tripwire, otherwise nothing here is called and a
+// __real_ reference would fail the link.
+#if defined(MIP_SIM) || defined(MIP_TRIPWIRE)
+#define WRAPPED 1
+#else
+#define WRAPPED 0
+#endif
+
+#if WRAPPED
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+void __real_free(void* p);
+int __real_pthread_mutex_lock(pthread_mutex_t* m);
+#endif
+
+/*******************************************************************************
+* int mip_tripwire_watch()
+*
+* The calling thread is the one to watch from now on.
+*******************************************************************************/
+int mip_tripwire_watch(int abort_on_trip){
+	abort_on = abort_on_trip;
+	watched = 1;
+	return 0;
+}
+
+int mip_tripwire_arm(int on){
+	atomic_store(&armed, on);
+	return 0;
+}
+
+int mip_tripwire_count(){
+	int i, n = 0;
+	for(i=0;i<TRIPS;i++) n += atomic_load(&trips[i].n);
+	return n;
+}
+
+#if WRAPPED
+/*******************************************************************************
+* void trip()
+*
+* Only write() before abort(), the heap may be what is broken.
+*******************************************************************************/
+static void say(const char* s){
+	if(write(2, s, strlen(s))<0) return;
+}
+
+static void trip(int k, void* caller){
+	void* none = NULL;
+	atomic_fetch_add(&trips[k].n, 1);
+	atomic_compare_exchange_strong(&trips[k].first, &none, caller);
+	if(abort_on){
+		say("\nmip_tripwire: control thread called ");
+		say(trips[k].name);
+		say(" while armed\n");
+		abort();
+	}
+}
+
+static inline int tripped(){
+	return watched && atomic_load_explicit(&armed, memory_order_relaxed);
+}
+
+/*******************************************************************************
+* wrapped calls
+*******************************************************************************/
+void* __wrap_malloc(size_t size){
+	if(tripped()) trip(TRIP_MALLOC, __builtin_return_address(0));
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size){
+	if(tripped()) trip(TRIP_CALLOC, __builtin_return_address(0));
+	return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* p, size_t size){
+	if(tripped()) trip(TRIP_REALLOC, __builtin_return_address(0));
+	return __real_realloc(p, size);
+}
+
+void __wrap_free(void* p){
+	if(tripped()) trip(TRIP_FREE, __builtin_return_address(0));
+	__real_free(p);
+}
+
+int __wrap_pthread_mutex_lock(pthread_mutex_t* m){
+	if(tripped()) trip(TRIP_MUTEX, __builtin_return_address(0));
+	return __real_pthread_mutex_lock(m);
+}
+#endif
+
+/*******************************************************************************
+* int mip_tripwire_print()
+*
+* Trips per call and where the first came from, as function+offset or
+* file+offset for addr2line -f -e.
+*******************************************************************************/
+int mip_tripwire_print(){
+	Dl_info info;
+	void* at;
+	int i;
+	if(!WRAPPED){
+		printf("tripwire: not linked in, nothing was watched\n");
+		return 0;
+	}
+	printf("tripwire: %d calls from the control thread while armed\n", \
+														mip_tripwire_count());
+	for(i=0;i<TRIPS;i++){
+		if(!atomic_load(&trips[i].n)) continue;
+		at = atomic_load(&trips[i].first);
+		printf("  %-20s %6u, first from ", trips[i].name, \
+											atomic_load(&trips[i].n));
+		if(dladdr(at, &info) && info.dli_sname){
+			printf("%s+0x%lx\n", info.dli_sname, \
+					(unsigned long)((char*)at-(char*)info.dli_saddr));
+		}
+		else if(dladdr(at, &info)){
+			printf("%s+0x%lx\n", info.dli_fname, \
+					(unsigned long)((char*)at-(char*)info.dli_fbase));
+		}
+		else printf("%p\n", at);
+	}
+	return 0;
+}
@@ -0,0 +1,31 @@
+/*******************************************************************************
+* mip_tripwire.h
+* By: Stuart Sonatina
+*
+* Catches the control thread allocating or locking while the robot is armed.
+*
+* Built with make tripwire the program is linked with -Wl,--wrap for
+* malloc, calloc, realloc, free and pthread_mutex_lock (see the Makefiles,
+* the simulator always is), every call to them from the program and the
+* common modules comes through here first. Other robot builds leave
+* MIP_TRIPWIRE out and the calls go straight to libc. A call from the
+* watched thread while armed is a trip: it is counted along with where the
+* first one came from, or with abort_on_trip the program stops right there
+* for a core dump or the debugger. Anything else passes straight through
+* after a thread local and an atomic load.
+*
+* mip_tripwire_watch() is called from the control thread, the IMU interrupt
+* function, and mip_tripwire_arm() when arming and disarming. Calls libc
+* makes inside itself, printf filling its buffer say, don't go through the
+* wrap and aren't seen.
+*******************************************************************************/
+
+#ifndef MIP_TRIPWIRE_H
+#define MIP_TRIPWIRE_H
+
+int mip_tripwire_watch(int abort_on_trip);
+int mip_tripwire_arm(int armed);
+int mip_tripwire_count();
+int mip_tripwire_print();
+
+#endif //MIP_TRIPWIRE_H
@@ -0,0 +1,528 @@
+/*******************************************************************************
+* mip_tune.c
+* By: Stuart Sonatina
+*
+* Runtime controller coefficients, see mip_tune.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "mip_tune.h"
+#include "mip_trace.h"
+
+#define TUNE_KEY	32
+#define TUNE_LINE	256
+#define TUNE_PATH	256
+#define TUNE_TERMS	(MIP_FILTER_MAX_ORDER+1)
+
+/*******************************************************************************
+* tune_coef_t
+*
+* One filter's coefficients as the file gives them, the thread's copy.
+*******************************************************************************/
+typedef struct tune_coef_t{
+	char name[MIP_TUNE_NAME];
+	char sat_key[TUNE_KEY];				// empty for a fixed saturation
+	float sat_limit;
+	int order;
+	float num[TUNE_TERMS];				// normalized so den[0] is 1
+	float den[TUNE_TERMS];
+	float gain;
+	float sat;
+	int pid;
+	float kp, ki, kd, Tf;
+}tune_coef_t;
+
+// fixed once the thread starts
+static mip_filter_t tmpl[MIP_TUNE_MAX_FILTERS];	// as registered, no state
+static int n_filters = 0;
+static char path[TUNE_PATH];
+static int period_us;
+
+// thread only
+static tune_coef_t coef[MIP_TUNE_MAX_FILTERS];
+static int version = 0;
+
+// handed between the thread and the interrupt
+static mip_tune_set_t bank[2];
+static _Atomic(mip_tune_set_t*) live = &bank[0];
+static _Atomic(mip_tune_set_t*) staged = NULL;
+static _Atomic int n_staged = 0, n_rejected = 0, n_swaps = 0;
+
+static pthread_t thread;
+static volatile int running = 0;
+
+/*******************************************************************************
+* int stable()
+*
+* Jury's test in Schur-Cohn form on den as a polynomial in z, den[0] the
+* leading term. Each pass divides out the reflection coefficient k, every
+* |k| under 1 means every root is inside the unit circle. The roots are
+* first pulled in by MIP_TUNE_POLE_MARGIN so poles on the circle pass.
+*******************************************************************************/
+static int stable(const float* den, int order){
+	double a[TUNE_TERMS], b[TUNE_TERMS], r = 1, k;
+	int i, n;
+	for(i=0;i<=order;i++){
+		a[i] = den[i]*r;
+		r /= 1+MIP_TUNE_POLE_MARGIN;
+	}
+	for(n=order;n>0;n--){
+		if(a[0]==0) return 0;
+		k = a[n]/a[0];
+		if(fabs(k)>=1) return 0;
+		for(i=0;i<n;i++) b[i] = a[i] - k*a[n-i];
+		for(i=0;i<n;i++) a[i] = b[i];
+	}
+	return 1;
+}
+
+/*******************************************************************************
+* int mip_tune_add()
+*
+* Registers a filter, set up with its coefficients, saturation and soft
+* start, as the next entry of every set. sat_key names the symmetric
+* saturation in the file, NULL to keep it fixed. Returns the index into
+* mip_tune_set_t.f or -1.
+*******************************************************************************/
+int mip_tune_add(const char* name, const mip_filter_t* f, const char* sat_key,
+															float sat_limit){
+	tune_coef_t* c;
+	int i, n = n_filters;
+
+	if(running || n>=MIP_TUNE_MAX_FILTERS){
+		printf("ERROR: mip_tune_add, register up to %d filters before " \
+									"starting\n", MIP_TUNE_MAX_FILTERS);
+		return -1;
+	}
+	if(!f->initialized || strlen(name)>=MIP_TUNE_NAME || \
+				(sat_key && (strlen(sat_key)>=TUNE_KEY || !f->sat_en))){
+		printf("ERROR: mip_tune_add, bad filter %s\n", name);
+		return -1;
+	}
+	c = &coef[n];
+	memset(c, 0, sizeof(*c));
+	strcpy(c->name, name);
+	if(sat_key) strcpy(c->sat_key, sat_key);
+	c->sat_limit = sat_limit;
+	c->order = f->order;
+	for(i=0;i<=f->order;i++){
+		c->num[i] = f->num[i];
+		c->den[i] = f->den[i];
+	}
+	c->gain = f->gain;
+	c->sat = f->sat_max;
+
+	tmpl[n] = *f;
+	mip_filter_reset(&tmpl[n]);
+	for(i=0;i<2;i++){
+		bank[i].f[n] = tmpl[n];
+		bank[i].gain[n] = f->gain;
+	}
+	n_filters++;
+	return n;
+}
+
+/*******************************************************************************
+* int mip_tune_add_pid()
+*
+* Same for a filter made by mip_filter_pid(), the file can then give it
+* KP, KI and KD.
+*******************************************************************************/
+int mip_tune_add_pid(const char* name, const mip_filter_t* f, float kp,
+						float ki, float kd, float Tf, const char* sat_key,
+															float sat_limit){
+	int n = mip_tune_add(name, f, sat_key, sat_limit);
+	if(n<0) return -1;
+	coef[n].pid = 1;
+	coef[n].kp = kp;
+	coef[n].ki = ki;
+	coef[n].kd = kd;
+	coef[n].Tf = Tf;
+	return n;
+}
+
+/*******************************************************************************
+* int parse_values()
+*
+* Numbers after the key, braces, commas and whitespace between them are
+* skipped. Returns how many or -1.
+*******************************************************************************/
+static int parse_values(char* s, float* v, int max){
+	char* end;
+	int n = 0;
+	while(1){
+		while(*s && (isspace((unsigned char)*s) || strchr("{},\\", *s))) s++;
+		if(!*s) return n;
+		if(n==max) return -1;
+		v[n] = strtod(s, &end);
+		if(end==s || !isfinite(v[n])) return -1;
+		s = end;
+		n++;
+	}
+}
+
+/*******************************************************************************
+* int check()
+*
+* Merges what the file gave for one filter into c and checks the result.
+* Returns 0 or prints why not and returns -1.
+*******************************************************************************/
+static int check(tune_coef_t* c, float dt, float* num, int n_num, float* den,
+										int n_den, int order, int pid_given){
+	float nn[TUNE_TERMS] = {0}, dd[TUNE_TERMS] = {0};
+	mip_filter_t f;
+	int i, n;
+
+	if(pid_given && (n_num || n_den)){
+		printf("tune: %s given both as a PID and as num/den\n", c->name);
+		return -1;
+	}
+	if(pid_given){
+		if(mip_filter_pid(&f, c->kp, c->ki, c->kd, c->Tf, dt)) return -1;
+		n_num = n_den = f.order+1;
+		num = f.num;
+		den = f.den;
+	}
+	if(n_num && n_den && n_num!=n_den){
+		printf("tune: %s_NUM and %s_DEN have %d and %d terms\n", c->name, \
+											c->name, n_num, n_den);
+		return -1;
+	}
+	if(n_num+n_den && !(n_num && n_den) && n_num+n_den!=c->order+1){
+		printf("tune: %s needs %d terms to keep its order, or both num and " \
+							"den\n", c->name, c->order+1);
+		return -1;
+	}
+	if(n_num || n_den){
+		n = n_num ? n_num : n_den;
+		if(!n_den) den = c->den;
+		if(!n_num) num = c->num;
+		if(den[0]==0){
+			printf("tune: %s_DEN must not start with 0\n", c->name);
+			return -1;
+		}
+		// normalize into temporaries, num or den may be c's own
+		for(i=0;i<n;i++){
+			nn[i] = num[i]/den[0];
+			dd[i] = den[i]/den[0];
+		}
+		c->order = n-1;
+		memcpy(c->num, nn, sizeof(nn));
+		memcpy(c->den, dd, sizeof(dd));
+	}
+	if(order>=0 && order!=c->order){
+		printf("tune: %s_ORDER is %d but the terms make it %d\n", c->name, \
+														order, c->order);
+		return -1;
+	}
+	if(!stable(c->den, c->order)){
+		printf("tune: %s_DEN has a pole outside the unit circle\n", c->name);
+		return -1;
+	}
+	if(c->sat_key[0] && (c->sat<=0 || c->sat>c->sat_limit)){
+		printf("tune: %s must be more than 0 and at most %g\n", c->sat_key, \
+														c->sat_limit);
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int load()
+*
+* Parses the file into next, starting from the current coefficients.
+*******************************************************************************/
+static int load(tune_coef_t* next){
+	static const char* suffix[] = {"GAIN", "NUM", "DEN", "ORDER", "KP", "KI",
+																"KD"};
+	float num[MIP_TUNE_MAX_FILTERS][TUNE_TERMS];
+	float den[MIP_TUNE_MAX_FILTERS][TUNE_TERMS];
+	int n_num[MIP_TUNE_MAX_FILTERS] = {0}, n_den[MIP_TUNE_MAX_FILTERS] = {0};
+	int order[MIP_TUNE_MAX_FILTERS], pid[MIP_TUNE_MAX_FILTERS] = {0};
+	char line[TUNE_LINE], key[TUNE_KEY], *s, *c;
+	float v[TUNE_TERMS];
+	int i, j, n, len, line_no = 0, err = 0;
+	FILE* fd;
+
+	if((fd=fopen(path, "r"))==NULL){
+		printf("tune: can't open %s\n", path);
+		return -1;
+	}
+	memcpy(next, coef, sizeof(coef));
+	for(i=0;i<MIP_TUNE_MAX_FILTERS;i++) order[i] = -1;
+
+	while(!err && fgets(line, sizeof(line), fd)){
+		line_no++;
+		if((c=strstr(line, "//"))) *c = 0;
+		s = line;
+		while(isspace((unsigned char)*s)) s++;
+		if(strncmp(s, "#define", 7)==0) s += 7;
+		else if(*s=='#') continue;
+		while(isspace((unsigned char)*s)) s++;
+		if(!*s) continue;
+		for(len=0;(isalnum((unsigned char)s[len]) || s[len]=='_') && \
+											len<TUNE_KEY-1;len++){
+			key[len] = s[len];
+		}
+		key[len] = 0;
+		n = parse_values(s+len, v, TUNE_TERMS);
+		if(len==0 || n<=0){
+			printf("tune: %s line %d, expected a name and numbers\n", \
+														path, line_no);
+			err = 1;
+			break;
+		}
+
+		// which filter and which of its values
+		for(i=0;i<n_filters;i++){
+			if(next[i].sat_key[0] && !strcmp(key, next[i].sat_key)) break;
+			len = strlen(next[i].name);
+			if(!strncmp(key, next[i].name, len) && key[len]=='_') break;
+		}
+		j = -1;
+		if(i<n_filters && !(next[i].sat_key[0] && \
+										!strcmp(key, next[i].sat_key))){
+			for(j=0;j<7;j++) if(!strcmp(key+len+1, suffix[j])) break;
+			if(j>=4 && !next[i].pid) j = 7;
+			if(j==7) i = n_filters;
+		}
+		if(i==n_filters){
+			printf("tune: %s line %d, unknown name %s\n", path, line_no, key);
+			err = 1;
+			break;
+		}
+		if(j!=1 && j!=2 && n!=1){
+			printf("tune: %s line %d, %s takes one number\n", path, line_no, \
+																	key);
+			err = 1;
+			break;
+		}
+		switch(j){
+		case -1: next[i].sat = v[0]; break;
+		case 0: next[i].gain = v[0]; break;
+		case 1: memcpy(num[i], v, sizeof(v)); n_num[i] = n; break;
+		case 2: memcpy(den[i], v, sizeof(v)); n_den[i] = n; break;
+		case 3: order[i] = v[0]; break;
+		case 4: next[i].kp = v[0]; pid[i] = 1; break;
+		case 5: next[i].ki = v[0]; pid[i] = 1; break;
+		case 6: next[i].kd = v[0]; pid[i] = 1; break;
+		}
+	}
+	fclose(fd);
+	if(err) return -1;
+
+	for(i=0;i<n_filters;i++){
+		if(check(&next[i], tmpl[i].dt, num[i], n_num[i], den[i], n_den[i], \
+											order[i], pid[i])) return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* void build()
+*
+* Fills a set from coefficients, each filter otherwise as registered.
+*******************************************************************************/
+static void build(mip_tune_set_t* set, const tune_coef_t* next){
+	mip_filter_t* f;
+	int i, j;
+	for(i=0;i<n_filters;i++){
+		f = &set->f[i];
+		*f = tmpl[i];
+		f->order = next[i].order;
+		for(j=0;j<TUNE_TERMS;j++){
+			f->num[j] = j<=f->order ? next[i].num[j] : 0;
+			f->den[j] = j<=f->order ? next[i].den[j] : 0;
+		}
+		f->gain = next[i].gain;
+		if(next[i].sat_key[0]){
+			f->sat_min = -next[i].sat;
+			f->sat_max = next[i].sat;
+		}
+		set->gain[i] = next[i].gain;
+	}
+}
+
+/*******************************************************************************
+* mip_tune_set_t* stage()
+*
+* Loads the file and stages it, returns the set waiting for the interrupt.
+* A set that is still waiting is taken back and replaced, one the interrupt
+* already took is waited for so the spare is really free.
+*******************************************************************************/
+static mip_tune_set_t* stage(mip_tune_set_t* pending){
+	tune_coef_t next[MIP_TUNE_MAX_FILTERS];
+	mip_tune_set_t* spare;
+
+	if(load(next)){
+		printf("tune: %s rejected, nothing changed\n", path);
+		n_rejected++;
+		return pending;
+	}
+	if(pending){
+		if(atomic_exchange(&staged, NULL)){
+			printf("tune: version %d replaced before going live\n", \
+														pending->version);
+		}
+		else{
+			while(atomic_load(&live)!=pending) usleep(1000);
+			printf("tune: version %d live\n", pending->version);
+		}
+	}
+	spare = atomic_load(&live)==&bank[0] ? &bank[1] : &bank[0];
+	build(spare, next);
+	spare->version = ++version;
+	memcpy(coef, next, sizeof(coef));
+	atomic_store(&staged, spare);
+	n_staged++;
+	MIP_TRACE_INSTANT("tune staged");
+	printf("tune: version %d staged from %s\n", version, path);
+	return spare;
+}
+
+/*******************************************************************************
+* void* tune_loop()
+*
+* A change has to hold still for one check before it is read, so a file
+* caught halfway through being saved isn't.
+*******************************************************************************/
+static void* tune_loop(void* ptr){
+	struct stat st;
+	struct timespec seen = {0, 0}, cand = {0, 0};
+	off_t seen_size = -1, cand_size = -1;
+	mip_tune_set_t* pending = NULL;
+
+	mip_trace_thread_name("tune");
+	while(running){
+		if(pending && atomic_load(&live)==pending){
+			printf("tune: version %d live\n", pending->version);
+			pending = NULL;
+		}
+		if(stat(path, &st)==0 && (st.st_mtim.tv_sec!=seen.tv_sec || \
+				st.st_mtim.tv_nsec!=seen.tv_nsec || st.st_size!=seen_size)){
+			if(st.st_mtim.tv_sec==cand.tv_sec && \
+					st.st_mtim.tv_nsec==cand.tv_nsec && \
+					st.st_size==cand_size){
+				seen = cand;
+				seen_size = cand_size;
+				pending = stage(pending);
+			}
+			cand = st.st_mtim;
+			cand_size = st.st_size;
+		}
+		usleep(period_us);
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* int mip_tune_start()
+*
+* Checks path hz times a second. A file that is already there when it
+* starts is loaded right away, it doesn't have to exist at all.
+*******************************************************************************/
+int mip_tune_start(const char* file, float hz){
+	if(running) return 0;
+	if(hz<=0 || n_filters==0 || strlen(file)>=TUNE_PATH){
+		printf("ERROR: mip_tune_start, needs filters, a path and hz > 0\n");
+		return -1;
+	}
+	strcpy(path, file);
+	period_us = 1000000/hz;
+	running = 1;
+	if(pthread_create(&thread, NULL, tune_loop, NULL)){
+		printf("ERROR: failed to start tune thread\n");
+		running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_tune_stop()
+*******************************************************************************/
+int mip_tune_stop(){
+	if(!running) return 0;
+	running = 0;
+	pthread_join(thread, NULL);
+	return 0;
+}
+
+/*******************************************************************************
+* mip_tune_set_t* mip_tune_live()
+*******************************************************************************/
+mip_tune_set_t* mip_tune_live(){
+	return atomic_load(&live);
+}
+
+/*******************************************************************************
+* mip_tune_set_t* mip_tune_tick()
+*
+* The plain load keeps the usual step to one read, the exchange only runs
+* when something is staged. The thread never writes the live set or the
+* one it lost the race for, so the copy needs no lock.
+*******************************************************************************/
+mip_tune_set_t* mip_tune_tick(){
+	mip_tune_set_t* l = atomic_load_explicit(&live, memory_order_relaxed);
+	mip_tune_set_t* s;
+	int i;
+
+	if(atomic_load_explicit(&staged, memory_order_relaxed)==NULL) return l;
+	s = atomic_exchange_explicit(&staged, NULL, memory_order_acquire);
+	if(s==NULL) return l;
+	for(i=0;i<n_filters;i++){
+		// the owner's rescaling of the old gain carries over to the new
+		if(l->gain[i]!=0){
+			s->f[i].gain = s->gain[i]*(l->f[i].gain/l->gain[i]);
+		}
+		mip_filter_transfer(&s->f[i], &l->f[i]);
+	}
+	atomic_store_explicit(&live, s, memory_order_release);
+	n_swaps++;
+	return s;
+}
+
+/*******************************************************************************
+* int mip_tune_print()
+*
+* Counts, and the last coefficients loaded as config lines to keep.
+*******************************************************************************/
+int mip_tune_print(){
+	const tune_coef_t* c;
+	int i, j;
+
+	printf("tune: version %d live, %d staged, %d rejected, %d swaps\n", \
+			mip_tune_live()->version, atomic_load(&n_staged), \
+			atomic_load(&n_rejected), atomic_load(&n_swaps));
+	if(version==0) return 0;
+	printf("// mip_tune version %d%s\n", version, \
+			mip_tune_live()->version==version ? "" : ", never went live");
+	for(i=0;i<n_filters;i++){
+		c = &coef[i];
+		if(c->pid){
+			printf("#define %s_KP\t%g\n", c->name, c->kp);
+			printf("#define %s_KI\t%g\n", c->name, c->ki);
+			printf("#define %s_KD\t%g\n", c->name, c->kd);
+		}
+		else{
+			printf("#define %s_GAIN\t%g\n#define %s_ORDER\t%d\n", c->name, \
+											c->gain, c->name, c->order);
+			printf("#define %s_NUM\t{", c->name);
+			for(j=0;j<=c->order;j++) printf("%s%g", j ? ", " : "", c->num[j]);
+			printf("}\n#define %s_DEN\t{", c->name);
+			for(j=0;j<=c->order;j++) printf("%s%g", j ? ", " : "", c->den[j]);
+			printf("}\n");
+		}
+		if(c->sat_key[0]) printf("#define %s\t%g\n", c->sat_key, c->sat);
+	}
+	return 0;
+}
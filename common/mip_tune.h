@@ -0,0 +1,73 @@
+/*******************************************************************************
+* mip_tune.h
+* By: Stuart Sonatina
+*
+* Controller coefficients from a file, changed while the robot balances.
+*
+* The program registers its filters once with mip_tune_add(), which makes
+* them the first live set. mip_tune_start() runs a thread that checks the
+* file's modification time a few times a second. A changed file is parsed,
+* validated and built into a spare set of filters, then staged. Nothing is
+* changed if any line is wrong, the reason is printed instead.
+*
+* The file uses the config header's names, so lines can be pasted back and
+* forth, "#define" and the braces and commas are optional:
+*
+*	D1_GAIN		0.8
+*	D1_NUM		{-6.289, 11.910, -5.634}
+*	D1_DEN		{ 1.000, -1.702,  0.702}
+*	D3_KP		1.2
+*	THETA_REF_MAX	0.3
+*
+* For a filter registered as D1 the keys are D1_GAIN, D1_NUM, D1_DEN and
+* D1_ORDER, which only has to agree with them, plus D1_KP, D1_KI, D1_KD if
+* it was registered as a PID. Its saturation key is whatever name it was
+* registered with. Keys that aren't in the file keep their value, other
+* keys are an error so a typo can't look like a tune that took.
+*
+* Checks: numbers are finite, num and den have order+1 terms, no pole is
+* outside the unit circle (Jury's test, a pole on it like an integrator's
+* is allowed) and each saturation is within 0 to the registered limit.
+*
+* mip_tune_tick() is for the control interrupt at a step boundary. It takes
+* a staged set with one atomic exchange, hands each filter's state to its
+* replacement with mip_filter_transfer(), which back-solves the new history
+* so the next output carries on from the last one without a bump, and
+* returns the live set. Whatever the owner last scaled the old gain by,
+* the new gain starts out scaled by the same. It never parses, allocates or
+* locks.
+*******************************************************************************/
+
+#ifndef MIP_TUNE_H
+#define MIP_TUNE_H
+
+#include "mip_filter.h"
+
+#define MIP_TUNE_MAX_FILTERS	4
+#define MIP_TUNE_NAME			16
+#define MIP_TUNE_POLE_MARGIN	1e-4	// |z| allowed past 1 for rounding
+
+/*******************************************************************************
+* mip_tune_set_t
+*
+* One complete set of filters. gain[] is the gain from the file, the owner
+* may rescale f[].gain every step, for battery voltage say.
+*******************************************************************************/
+typedef struct mip_tune_set_t{
+	mip_filter_t f[MIP_TUNE_MAX_FILTERS];
+	float gain[MIP_TUNE_MAX_FILTERS];
+	int version;							// 0 is the compiled in set
+}mip_tune_set_t;
+
+int mip_tune_add(const char* name, const mip_filter_t* f, const char* sat_key,
+															float sat_limit);
+int mip_tune_add_pid(const char* name, const mip_filter_t* f, float kp,
+						float ki, float kd, float Tf, const char* sat_key,
+															float sat_limit);
+int mip_tune_start(const char* path, float hz);
+int mip_tune_stop();
+mip_tune_set_t* mip_tune_live();
+mip_tune_set_t* mip_tune_tick();
+int mip_tune_print();
+
+#endif //MIP_TUNE_H
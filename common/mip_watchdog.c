@@ -0,0 +1,157 @@
+/*******************************************************************************
+* mip_watchdog.c
+* By: Stuart Sonatina
+*
+* Deadline watchdog, see mip_watchdog.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mip_watchdog.h"
+
+static const char* names[MIP_WATCHDOG_LEVELS] = {
+	"none", "console", "log", "telemetry", "outer", "disarm"
+};
+
+/*******************************************************************************
+* int mip_watchdog_init()
+*
+* recover is the slack, as a fraction of the period, every step of a clean
+* window has to keep. Starts with nothing shed.
+*******************************************************************************/
+int mip_watchdog_init(mip_watchdog_t* w, float period_s, int window, int trip,
+												float recover, int hold){
+	if(period_s<=0 || window<1 || trip<1 || recover<0 || recover>=1 || \
+																hold<1){
+		printf("ERROR: mip_watchdog_init, need period > 0, window, trip " \
+						"and hold >= 1 and 0 <= recover < 1\n");
+		return -1;
+	}
+	memset(w, 0, sizeof(*w));
+	w->period_ns = period_s*1e9;
+	w->window = window;
+	w->trip = trip;
+	w->recover_ns = recover*w->period_ns;
+	w->hold = hold;
+	atomic_init(&w->level, MIP_SHED_NONE);
+	w->worst_ns = INT64_MAX;
+	w->min_slack_ns = INT64_MAX;
+	return mip_latency_init(&w->step, "control step", 10000);
+}
+
+/*******************************************************************************
+* static int set_level()
+*******************************************************************************/
+static int set_level(mip_watchdog_t* w, int to, uint64_t t_ns){
+	int from = atomic_load(&w->level);
+	mip_watchdog_event_t* e;
+	if(to>from) w->n_shed[to]++;
+	else w->n_restore[from]++;
+	if(w->n_events<MIP_WATCHDOG_EVENTS){
+		e = &w->events[w->n_events];
+		e->t_ns = t_ns - w->t0_ns;
+		e->from = from;
+		e->to = to;
+		e->overruns = w->overruns;
+		e->slack_ns = w->worst_ns;
+	}
+	w->n_events++;
+	atomic_store(&w->level, to);
+	return to;
+}
+
+/*******************************************************************************
+* int mip_watchdog_step()
+*
+* Call from the interrupt once per sample with when its step started and
+* ended, and how many samples were missed right before it. Returns the
+* level to run the next step at.
+*******************************************************************************/
+int mip_watchdog_step(mip_watchdog_t* w, uint64_t t_start_ns,
+											uint64_t t_end_ns, int missed){
+	int level = atomic_load(&w->level);
+	int64_t d = t_end_ns - t_start_ns;
+	int64_t slack = w->period_ns - d;
+
+	if(w->n_steps==0) w->t0_ns = t_start_ns;
+	w->n_steps++;
+	w->steps_at[level]++;
+	mip_latency_add_ns(&w->step, d);
+	if(slack<w->min_slack_ns) w->min_slack_ns = slack;
+	if(slack<w->recover_ns) w->n_tight++;
+	if(slack<0) w->overruns++;
+	if(missed>0) w->overruns += missed;
+	if(slack<w->worst_ns) w->worst_ns = slack;
+	if(++w->steps<w->window) return level;
+
+	// end of a window
+	w->n_overruns += w->overruns;
+	if(w->overruns>=w->trip){
+		w->clean = 0;
+		if(level<MIP_SHED_DISARM) level = set_level(w, level+1, t_end_ns);
+	}
+	else if(w->overruns==0 && w->worst_ns>=w->recover_ns){
+		if(++w->clean>=w->hold && level>MIP_SHED_NONE){
+			w->clean = 0;
+			level = set_level(w, level-1, t_end_ns);
+		}
+	}
+	else w->clean = 0;
+	w->steps = 0;
+	w->overruns = 0;
+	w->worst_ns = INT64_MAX;
+	return level;
+}
+
+/*******************************************************************************
+* int mip_watchdog_level()
+*
+* What is shed right now, from any thread.
+*******************************************************************************/
+int mip_watchdog_level(mip_watchdog_t* w){
+	return atomic_load(&w->level);
+}
+
+const char* mip_watchdog_name(int level){
+	if(level<0 || level>=MIP_WATCHDOG_LEVELS) return "?";
+	return names[level];
+}
+
+/*******************************************************************************
+* int mip_watchdog_print()
+*
+* Slack, time at each level and the transitions.
+*******************************************************************************/
+int mip_watchdog_print(mip_watchdog_t* w){
+	const mip_watchdog_event_t* e;
+	uint32_t i, n;
+	if(w->n_steps==0){
+		printf("watchdog: no steps\n");
+		return 0;
+	}
+	printf("watchdog: %llu steps, %llu overruns, %llu under %.2f ms of " \
+			"slack, least slack %.3f ms\n", (unsigned long long)w->n_steps, \
+			(unsigned long long)w->n_overruns, \
+			(unsigned long long)w->n_tight, w->recover_ns/1e6, \
+			w->min_slack_ns/1e6);
+	mip_latency_print(&w->step);
+	if(w->n_events==0) return 0;
+	printf("watchdog: steps, shed and restored at each level\n");
+	for(i=MIP_SHED_NONE;i<MIP_WATCHDOG_LEVELS;i++){
+		printf("  %-10s %10llu %5u %5u\n", names[i], \
+				(unsigned long long)w->steps_at[i], w->n_shed[i], \
+				w->n_restore[i]);
+	}
+	n = w->n_events<MIP_WATCHDOG_EVENTS ? w->n_events : MIP_WATCHDOG_EVENTS;
+	for(i=0;i<n;i++){
+		e = &w->events[i];
+		printf("  %9.3f s  %-9s -> %-9s  %2d overruns, " \
+				"worst slack %.3f ms\n", e->t_ns/1e9, names[e->from], \
+				names[e->to], e->overruns, e->slack_ns/1e6);
+	}
+	if(w->n_events>n){
+		printf("  and %u more\n", w->n_events-n);
+	}
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*******************************************************************************
+* mip_watchdog.h
+* By: Stuart Sonatina
+*
+* Deadline watchdog for a periodic control step, sheds work under overload.
+*
+* Every sample the interrupt reports when its step started and ended. The
+* slack is the period minus the step's time, a step with negative slack or
+* one that follows missed samples is an overrun. Each window of steps
+* decides once:
+*
+*	trip or more overruns	shed the next level of work
+*	no overruns and every	a clean window, hold clean windows in a row
+*	slack over recover		restore the last level shed
+*
+* The levels go in the order the work is given up, each one includes the
+* ones before it:
+*
+*	MIP_SHED_CONSOLE	no console output
+*	MIP_SHED_LOG		no log rows
+*	MIP_SHED_TELEMETRY	no tracing or telemetry frames
+*	MIP_SHED_OUTER		outer loops at half rate
+*	MIP_SHED_DISARM		disarmed, and not armed again until it recovers
+*
+* The watchdog only decides, the program does the shedding by checking
+* mip_watchdog_level(), which any thread may call. mip_watchdog_step() is
+* for the interrupt alone and never blocks or allocates.
+*
+* Every transition is counted and the first MIP_WATCHDOG_EVENTS are kept
+* with their time, the window's overruns and its worst slack. Together
+* with the step time histogram and the smallest slack seen, printed at
+* exit, they show how close a run came to the edge.
+*******************************************************************************/
+
+#ifndef MIP_WATCHDOG_H
+#define MIP_WATCHDOG_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "mip_latency.h"
+
+#define MIP_WATCHDOG_EVENTS	64		// transitions kept for the exit report
+
+typedef enum mip_shed_t{
+	MIP_SHED_NONE,
+	MIP_SHED_CONSOLE,
+	MIP_SHED_LOG,
+	MIP_SHED_TELEMETRY,
+	MIP_SHED_OUTER,
+	MIP_SHED_DISARM,
+	MIP_WATCHDOG_LEVELS
+}mip_shed_t;
+
+/*******************************************************************************
+* mip_watchdog_event_t
+*******************************************************************************/
+typedef struct mip_watchdog_event_t{
+	uint64_t t_ns;				// since the first step
+	int from, to;
+	int overruns;				// in the window that decided it
+	int64_t slack_ns;			// worst in that window
+}mip_watchdog_event_t;
+
+/*******************************************************************************
+* mip_watchdog_t
+*******************************************************************************/
+typedef struct mip_watchdog_t{
+	int64_t period_ns;
+	int window;					// steps per decision
+	int trip;					// overruns in a window that shed a level
+	int64_t recover_ns;			// slack every step of a clean window keeps
+	int hold;					// clean windows before restoring a level
+	_Atomic int level;
+	// the window so far
+	int steps, overruns, clean;
+	int64_t worst_ns;
+	// statistics
+	uint64_t t0_ns;
+	uint64_t n_steps, n_overruns, n_tight;	// tight, under recover_ns
+	int64_t min_slack_ns;
+	uint64_t steps_at[MIP_WATCHDOG_LEVELS];
+	uint32_t n_shed[MIP_WATCHDOG_LEVELS];		// times each level was shed
+	uint32_t n_restore[MIP_WATCHDOG_LEVELS];	// and restored
+	mip_watchdog_event_t events[MIP_WATCHDOG_EVENTS];
+	uint32_t n_events;
+	mip_latency_t step;
+}mip_watchdog_t;
+
+int mip_watchdog_init(mip_watchdog_t* w, float period_s, int window, int trip,
+												float recover, int hold);
+int mip_watchdog_step(mip_watchdog_t* w, uint64_t t_start_ns,
+											uint64_t t_end_ns, int missed);
+int mip_watchdog_level(mip_watchdog_t* w);
+const char* mip_watchdog_name(int level);
+int mip_watchdog_print(mip_watchdog_t* w);
+
+#endif //MIP_WATCHDOG_H
@@ -20,11 +20,28 @@ int print_data(); // prints IMU data
 
 // variable declarations
 imu_data_t data; //struct to hold new data from IMU
-float g_y, g_z, theta_a, filtered_theta_a, filtered_theta_g, sum; // gravity, thetas
-float theta_dot, theta_g = 0; // initialize starting angle for euler's method
 float offset = -0.5; // offset of gyro around X axis
 const float TIME_STEP = 1.0/(float)SAMPLE_RATE; // Calc dt from sample rate
-d_filter_t LP, HP; // Lowpass and Highpass filters structs
+
+// the filter, one step per IMU sample, see ../common/mip_estimator.h
+#define MIP_EST_NAME(f) cf_##f
+#define MIP_EST_INPUTS(X) X(gyro_x) X(accel_y) X(accel_z)
+#define MIP_EST_STAGES(X) \
+	/* Integrate gyro data to get absolute position of theta */ \
+	X(AFFINE,	theta_dot,	gyro_x,	offset,	DEG_TO_RAD) \
+	X(INTEGRATE,	theta_g,	theta_dot,	TIME_STEP,	0) \
+	/* filter low freq noise out of gyro data */ \
+	X(HIGHPASS,	filtered_theta_g,	theta_g,	TIME_CONSTANT,	0) \
+	/* calc theta from accelerometer, Y 0.1 and Z 0.45 too high */ \
+	X(AFFINE,	g_y,	accel_y,	0.1,	1) \
+	X(AFFINE,	g_z,	accel_z,	0.45,	1) \
+	X(ATAN2,	theta_a,	-g_z/9.8,	g_y/9.8,	0) \
+	/* filter high freq noise out of accelerometer data */ \
+	X(LOWPASS,	filtered_theta_a,	theta_a,	TIME_CONSTANT,	0) \
+	/* add them together */ \
+	X(SUM,		sum,	filtered_theta_a,	filtered_theta_g,	0)
+#include "../common/mip_estimator.h"
+cf_t cf; // filter state
 char filename[] = "HW6_Acc-Gyro-Sum"; // file name for csv
 FILE *fp; // Makes a file pointer to stream thing I have no idea really
 
@@ -49,11 +66,7 @@ int main(){
 
     
     // get yourself some filters
-	LP = create_first_order_lowpass(TIME_STEP, TIME_CONSTANT);
-	HP = create_first_order_highpass(TIME_STEP, TIME_CONSTANT);
-	// reset them filters
-	reset_filter(&LP);
-	reset_filter(&HP);
+	cf_init(&cf, TIME_STEP);
 
 	// set imu configuration to defaults
 	imu_config_t imu_config = get_default_imu_config();
@@ -97,32 +110,24 @@ int main(){
 *
 ******************************************************************************/
 int print_data(){
+	cf_in_t in;
+	cf_out_t out;
 	printf("\r ");
 
-	// Integrate gyro data to get absolute position of theta
-	theta_dot = (data.gyro[0] - offset)*DEG_TO_RAD; // spin rate in rad
-	theta_g = theta_g + TIME_STEP*theta_dot; // euler's method
-	// filter low freq noise out of gyro data
-	filtered_theta_g = march_filter(&HP,theta_g);
-
-    // calc theta from accelerometer G and Z components
-	g_y = data.accel[1]-0.1;  // Y direction is 0.1 too high
-	g_z = data.accel[2]-0.45; // Z direction is 0.45 too high
-	theta_a = atan2(-g_z/9.8,g_y/9.8); // angle to gravity
-	// filter high freq noise out of accelerometer data
-	filtered_theta_a = march_filter(&LP,theta_a);
-    
-    // add them togeter
-    sum = filtered_theta_a + filtered_theta_g;
+	in.gyro_x = data.gyro[0];
+	in.accel_y = data.accel[1];
+	in.accel_z = data.accel[2];
+	cf_step(&cf, &in, &out);
 	// Print data to console
 	printf("%6.2f %6.2f %6.2f   |",	data.accel[0],\
 									data.accel[1],\
 									data.accel[2]);
-	printf("        %6.2f      |", filtered_theta_g); // Print angle from acc
-	printf("        %6.2f      |", filtered_theta_a); // Print angle from gyro
-	printf("        %6.2f      |", sum); // Print sum
+	printf("        %6.2f      |", out.filtered_theta_g); // angle from gyro
+	printf("        %6.2f      |", out.filtered_theta_a); // angle from acc
+	printf("        %6.2f      |", out.sum); // Print sum
 	
-    fprintf(fp,"%6.2f,%6.2f,%6.2f\n",filtered_theta_g,filtered_theta_a,sum); // print
+    fprintf(fp,"%6.2f,%6.2f,%6.2f\n",out.filtered_theta_g,out.filtered_theta_a,\
+												out.sum); // print
 	
     fflush(fp); // flush to file
 	fflush(stdout); // flush to console (?)
@@ -0,0 +1,464 @@
+/*******************************************************************************
+* csv_ingest.c
+* By: Stuart Sonatina
+*
+* Host tool that turns the CSV files written by stufilter, complementary_filter
+* and my_read_sensors into columnar float arrays or a binary MIP log.
+*
+* The CSV is mapped instead of read, split into line aligned chunks and parsed
+* by one thread per chunk with a small hand rolled number parser (no strtod,
+* no locale). Output files are mapped too so every thread writes its rows
+* straight into place. A partial line at the end of the file, which is what a
+* killed logger leaves behind, is dropped and reported.
+*
+* usage: csv_ingest [-j threads] [-r rate_hz] [-o out.mipl | -c prefix] in.csv
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../common/mip_log.h"
+
+#define MAX_THREADS 64
+
+/*******************************************************************************
+* chunk_t
+*
+* One thread's share of the file. Rows are numbered globally so each thread
+* knows where its output goes once the line counts are in.
+*******************************************************************************/
+typedef struct chunk_t{
+	const char* begin;
+	const char* end;
+	uint64_t n_lines;	// filled by count pass
+	uint64_t first_row;	// filled after count pass
+	uint64_t bad_lines;	// lines that did not have n_cols numbers
+	pthread_t thread;
+}chunk_t;
+
+// function declarations
+const char* parse_float(const char* p, const char* end, float* out);
+int parse_header(const char* p, const char* end);
+void* count_lines(void* ptr);
+void* parse_chunk(void* ptr);
+float* map_output(const char* path, size_t len);
+double now_s();
+
+// variable declarations
+int n_cols = 0;								// floats per line
+char col_names[MIP_LOG_MAX_CHANNELS][MIP_LOG_NAME_LEN];
+float* col_base[MIP_LOG_MAX_CHANNELS];		// where column c of row 0 goes
+size_t row_stride = 1;						// floats between rows
+chunk_t chunks[MAX_THREADS];
+
+// exact powers of ten for the number parser
+static const double pow10_tab[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/******************************************************************************
+* int main()
+******************************************************************************/
+int main(int argc, char* argv[]){
+	const char* log_path = NULL;	// -o
+	const char* col_prefix = NULL;	// -c
+	float rate_hz = 0;
+	int n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int c, i, fd;
+	struct stat st;
+	const char *map, *data, *end, *p;
+	uint64_t n_rows = 0, bad_lines = 0;
+	size_t partial;
+	double t_start, t_end;
+	char path[512];
+
+	while((c=getopt(argc, argv, "j:r:o:c:h"))!=-1){
+		switch(c){
+		case 'j': n_threads = atoi(optarg); break;
+		case 'r': rate_hz = atof(optarg);	break;
+		case 'o': log_path = optarg;		break;
+		case 'c': col_prefix = optarg;		break;
+		default:
+			printf("usage: %s [-j threads] [-r rate_hz] "
+					"[-o out.mipl | -c prefix] in.csv\n", argv[0]);
+			return -1;
+		}
+	}
+	if(optind!=argc-1 || (log_path && col_prefix)){
+		printf("usage: %s [-j threads] [-r rate_hz] "
+					"[-o out.mipl | -c prefix] in.csv\n", argv[0]);
+		return -1;
+	}
+	if(n_threads<1) n_threads = 1;
+	if(n_threads>MAX_THREADS) n_threads = MAX_THREADS;
+
+	// map the whole csv
+	fd = open(argv[optind], O_RDONLY);
+	if(fd<0 || fstat(fd,&st)){
+		printf("ERROR: can't open %s\n", argv[optind]);
+		return -1;
+	}
+	if(st.st_size==0){
+		printf("ERROR: %s is empty\n", argv[optind]);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map==MAP_FAILED){
+		printf("ERROR: failed to map %s\n", argv[optind]);
+		return -1;
+	}
+	madvise((void*)map, st.st_size, MADV_SEQUENTIAL);
+	t_start = now_s();
+
+	// everything past the last newline is a line the logger never finished
+	end = map + st.st_size;
+	while(end>map && end[-1]!='\n') end--;
+	partial = (map + st.st_size) - end;
+
+	// my_read_sensors puts a theta_g,theta_a header on top, the others don't
+	data = map;
+	p = memchr(map, '\n', end-map);
+	if(p==NULL){
+		printf("ERROR: no complete lines in %s\n", argv[optind]);
+		return -1;
+	}
+	if(parse_header(map, p)){
+		data = p+1;
+	}
+	if(n_cols==0){
+		printf("ERROR: can't make sense of the first line\n");
+		return -1;
+	}
+
+	// default sample rates of the programs that write these files
+	if(rate_hz==0) rate_hz = (n_cols==2) ? 20 : 100;
+
+	// split into line aligned chunks
+	for(i=0;i<n_threads;i++){
+		chunks[i].begin = (i==0) ? data : chunks[i-1].end;
+		if(i==n_threads-1) chunks[i].end = end;
+		else{
+			p = data + (end-data)*(i+1)/n_threads;
+			if(p<chunks[i].begin) p = chunks[i].begin;
+			p = memchr(p, '\n', end-p);
+			chunks[i].end = (p==NULL) ? end : p+1;
+		}
+	}
+
+	// count pass so every chunk knows which rows it owns
+	for(i=0;i<n_threads;i++){
+		pthread_create(&chunks[i].thread, NULL, count_lines, &chunks[i]);
+	}
+	for(i=0;i<n_threads;i++){
+		pthread_join(chunks[i].thread, NULL);
+		chunks[i].first_row = n_rows;
+		n_rows += chunks[i].n_lines;
+	}
+
+	// set up where the numbers go
+	if(log_path!=NULL){
+		mip_log_header_t h;
+		const char* names[MIP_LOG_MAX_CHANNELS];
+		float* out;
+		for(i=0;i<n_cols;i++) names[i] = col_names[i];
+		mip_log_header_init(&h, names, n_cols, rate_hz);
+		h.n_rows = n_rows;
+		out = map_output(log_path, MIP_LOG_HEADER_SIZE \
+											+ n_rows*n_cols*sizeof(float));
+		if(out==NULL) return -1;
+		memcpy(out, &h, sizeof(h));
+		for(i=0;i<n_cols;i++){
+			col_base[i] = out + MIP_LOG_HEADER_SIZE/sizeof(float) + i;
+		}
+		row_stride = n_cols;
+	}
+	else{
+		for(i=0;i<n_cols;i++){
+			if(col_prefix!=NULL){
+				snprintf(path, sizeof(path), "%s_%s.f32", \
+												col_prefix, col_names[i]);
+				col_base[i] = map_output(path, n_rows*sizeof(float));
+			}
+			else{
+				col_base[i] = mmap(NULL, n_rows*sizeof(float)+1, \
+						PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+				if(col_base[i]==MAP_FAILED) col_base[i] = NULL;
+			}
+			if(col_base[i]==NULL) return -1;
+		}
+		row_stride = 1;
+	}
+
+	// parse pass
+	for(i=0;i<n_threads;i++){
+		pthread_create(&chunks[i].thread, NULL, parse_chunk, &chunks[i]);
+	}
+	for(i=0;i<n_threads;i++){
+		pthread_join(chunks[i].thread, NULL);
+		bad_lines += chunks[i].bad_lines;
+	}
+	t_end = now_s();
+
+	// report
+	printf("%s: %llu rows x %d columns (", argv[optind], \
+									(unsigned long long)n_rows, n_cols);
+	for(i=0;i<n_cols;i++) printf(i ? ",%s" : "%s", col_names[i]);
+	printf(")\n");
+	printf("%d threads, %.3f s, %.1f MB/s\n", n_threads, t_end-t_start, \
+								st.st_size/(t_end-t_start)/1000000.0);
+	if(bad_lines) printf("%llu malformed lines stored as NAN\n", \
+										(unsigned long long)bad_lines);
+	if(partial) printf("dropped %zu byte partial line at end of file\n", \
+																	partial);
+	// with no output file, summarize the columns so the run is useful
+	if(log_path==NULL && col_prefix==NULL && n_rows>0){
+		for(i=0;i<n_cols;i++){
+			double sum = 0;
+			float mn = INFINITY, mx = -INFINITY;
+			uint64_t r;
+			for(r=0;r<n_rows;r++){
+				float v = col_base[i][r];
+				if(v<mn) mn = v;
+				if(v>mx) mx = v;
+				sum += v;
+			}
+			printf("%-16s min %9.3f  max %9.3f  mean %9.3f\n", \
+									col_names[i], mn, mx, sum/n_rows);
+		}
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* const char* parse_float()
+*
+* Parse one number in the style printf("%6.2f") produces, including leading
+* padding, exponents and nan/inf. Returns a pointer just past the number or
+* NULL if there wasn't one.
+*******************************************************************************/
+const char* parse_float(const char* p, const char* end, float* out){
+	uint64_t mant = 0;
+	int exp10 = 0, sig = 0, any = 0, neg = 0;
+	double v;
+
+	while(p<end && (*p==' ' || *p=='\t')) p++;
+	if(p<end && (*p=='-' || *p=='+')){
+		neg = (*p=='-');
+		p++;
+	}
+	// printf spells these out
+	if(p+3<=end && (p[0]|0x20)=='n' && (p[1]|0x20)=='a' && (p[2]|0x20)=='n'){
+		*out = NAN;
+		return p+3;
+	}
+	if(p+3<=end && (p[0]|0x20)=='i' && (p[1]|0x20)=='n' && (p[2]|0x20)=='f'){
+		*out = neg ? -INFINITY : INFINITY;
+		return p+3;
+	}
+	// integer part, only 19 significant digits fit in the mantissa
+	while(p<end && (unsigned)(*p-'0')<10){
+		if(sig<19){
+			mant = mant*10 + (*p-'0');
+			if(mant) sig++;
+		}
+		else exp10++;
+		p++;
+		any = 1;
+	}
+	// fraction
+	if(p<end && *p=='.'){
+		p++;
+		while(p<end && (unsigned)(*p-'0')<10){
+			if(sig<19){
+				mant = mant*10 + (*p-'0');
+				if(mant) sig++;
+				exp10--;
+			}
+			p++;
+			any = 1;
+		}
+	}
+	if(!any) return NULL;
+	// exponent
+	if(p<end && (*p=='e' || *p=='E')){
+		int e = 0, eneg = 0;
+		const char* q = p+1;
+		if(q<end && (*q=='-' || *q=='+')){
+			eneg = (*q=='-');
+			q++;
+		}
+		if(q<end && (unsigned)(*q-'0')<10){
+			while(q<end && (unsigned)(*q-'0')<10){
+				if(e<10000) e = e*10 + (*q-'0');
+				q++;
+			}
+			exp10 += eneg ? -e : e;
+			p = q;
+		}
+	}
+	v = (double)mant;
+	while(exp10>22){ v *= 1e22; exp10 -= 22; }
+	while(exp10<-22){ v /= 1e22; exp10 += 22; }
+	if(exp10>=0) v *= pow10_tab[exp10];
+	else v /= pow10_tab[-exp10];
+	*out = neg ? -v : v;
+	return p;
+}
+
+/*******************************************************************************
+* int parse_header()
+*
+* Look at the first line. If it is all numbers it sets the column count and
+* returns 0. Otherwise it is taken as a header of column names and 1 is
+* returned.
+*******************************************************************************/
+int parse_header(const char* p, const char* end){
+	static const char* defaults[] = {"theta_g", "theta_a", "sum"};
+	const char* q = p;
+	float v;
+	int n = 0, len;
+
+	// try numbers first
+	while(n<MIP_LOG_MAX_CHANNELS){
+		q = parse_float(q, end, &v);
+		if(q==NULL) break;
+		while(q<end && (*q==' ' || *q=='\r')) q++;
+		n++;
+		if(q==end){
+			n_cols = n;
+			for(n=0;n<n_cols;n++){
+				if(n<3) strcpy(col_names[n], defaults[n]);
+				else sprintf(col_names[n], "col%d", n);
+			}
+			return 0;
+		}
+		if(*q!=',') break;
+		q++;
+	}
+
+	// must be a header then
+	n = 0;
+	while(p<end && n<MIP_LOG_MAX_CHANNELS){
+		q = p;
+		while(q<end && *q!=',') q++;
+		while(p<q && *p==' ') p++;
+		len = q-p;
+		while(len>0 && (p[len-1]==' ' || p[len-1]=='\r')) len--;
+		if(len>MIP_LOG_NAME_LEN-1) len = MIP_LOG_NAME_LEN-1;
+		memcpy(col_names[n], p, len);
+		col_names[n][len] = 0;
+		n++;
+		p = q+1;
+	}
+	n_cols = n;
+	return 1;
+}
+
+/*******************************************************************************
+* void* count_lines()
+*
+* Thread that counts the newlines in its chunk. Written as a plain loop so
+* the compiler vectorizes it.
+*******************************************************************************/
+void* count_lines(void* ptr){
+	chunk_t* ch = (chunk_t*)ptr;
+	const char* p;
+	uint64_t n = 0;
+	for(p=ch->begin; p<ch->end; p++) n += (*p=='\n');
+	ch->n_lines = n;
+	return NULL;
+}
+
+/*******************************************************************************
+* void* parse_chunk()
+*
+* Thread that parses every line of its chunk into the output columns. A line
+* that doesn't hold exactly n_cols numbers is stored as NAN so the row
+* numbering of everything after it stays correct.
+*******************************************************************************/
+void* parse_chunk(void* ptr){
+	chunk_t* ch = (chunk_t*)ptr;
+	const char* p = ch->begin;
+	const char* end = ch->end;
+	const char* line;
+	size_t row = ch->first_row;
+	float v[MIP_LOG_MAX_CHANNELS];
+	int c, ok;
+
+	while(p<end){
+		line = p;
+		ok = 1;
+		for(c=0;c<n_cols;c++){
+			p = parse_float(p, end, &v[c]);
+			if(p==NULL){
+				ok = 0;
+				break;
+			}
+			while(p<end && *p==' ') p++;
+			if(c<n_cols-1){
+				if(p==end || *p!=','){
+					ok = 0;
+					break;
+				}
+				p++;
+			}
+		}
+		if(ok){
+			if(p<end && *p=='\r') p++;
+			if(p==end || *p!='\n') ok = 0;
+		}
+		// resync on the next line
+		if(!ok){
+			ch->bad_lines++;
+			for(c=0;c<n_cols;c++) v[c] = NAN;
+			p = memchr(line, '\n', end-line);
+		}
+		for(c=0;c<n_cols;c++) col_base[c][row*row_stride] = v[c];
+		row++;
+		p++;
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* float* map_output()
+*
+* Create a file of len bytes and map it writable.
+*******************************************************************************/
+float* map_output(const char* path, size_t len){
+	void* out;
+	int fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+	if(fd<0 || ftruncate(fd, len)){
+		printf("ERROR: can't create %s\n", path);
+		return NULL;
+	}
+	// mapping zero bytes fails, give empty files one page
+	out = mmap(NULL, len ? len : 1, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(out==MAP_FAILED){
+		printf("ERROR: failed to map %s\n", path);
+		return NULL;
+	}
+	return (float*)out;
+}
+
+/*******************************************************************************
+* double now_s()
+*******************************************************************************/
+double now_s(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
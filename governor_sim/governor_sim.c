@@ -0,0 +1,320 @@
+/*******************************************************************************
+* governor_sim.c
+* By: Stuart Sonatina
+*
+* Host tool that runs CPU frequency policies against a simulated clock and
+* reports the energy proxy and deadline misses of each.
+*
+* usage: governor_sim [-s scenario | -f steps.csv] [-m margin] [-H hold_s]
+*                     [-w window_s] [-r rate_hz] [-S seed]
+*
+* A workload is a list of control steps, each with its cycle count and
+* whether the controller is armed. Step i is released at i/rate and runs
+* for cycles/clock after the previous step finishes. A step that has not
+* finished by the next release misses its deadline. Switching clocks stalls
+* the CPU for SWITCH_STALL.
+*
+* Policies:
+*	fixed		top clock all the time, what Jbalance did before
+*	ondemand	the kernel's load based rule, up at 80% busy, no boost on arm
+*	slack		mip_governor, the same code Jbalance runs
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "../common/mip_governor.h"
+
+#define MAX_STEPS		2000000
+#define SWITCH_STALL	300e-6	// s, cpufreq transition on the AM335x
+#define ONDEMAND_UP		0.8
+
+#define TOP (MIP_GOVERNOR_LEVELS-1)
+
+typedef enum policy_t{
+	FIXED,
+	ONDEMAND,
+	SLACK
+}policy_t;
+
+static const char* policy_names[] = {"fixed", "ondemand", "slack"};
+
+typedef struct step_t{
+	float cycles;
+	int armed;
+}step_t;
+
+typedef struct result_t{
+	double energy;
+	double time_at[MIP_GOVERNOR_LEVELS];
+	long misses;
+	double max_late;
+	long switches;
+}result_t;
+
+// function declarations
+int make_scenario(const char* name, float rate, uint64_t seed);
+int read_steps(const char* path);
+int run(policy_t policy, float rate, float margin, float hold, float window,
+															result_t* r);
+
+static step_t* steps;
+static long n_steps = 0;
+static uint64_t rng;
+
+/*******************************************************************************
+* random numbers for the scenarios
+*******************************************************************************/
+static double uniform(){
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return (rng >> 11)*(1.0/9007199254740992.0);
+}
+
+static double gaussian(){
+	return sqrt(-2*log(uniform()+1e-300))*cos(2*M_PI*uniform());
+}
+
+/******************************************************************************
+* int main()
+******************************************************************************/
+int main(int argc, char* argv[]){
+	const char* scenario = "balance";
+	const char* path = NULL;
+	float margin = 0.5, hold = 1.0, window = 0.1, rate = 200;
+	uint64_t seed = 1;
+	result_t r[3];
+	double e_fixed;
+	int c, p, i;
+
+	while((c=getopt(argc, argv, "s:f:m:H:w:r:S:h"))!=-1){
+		switch(c){
+		case 's': scenario = optarg; break;
+		case 'f': path = optarg; break;
+		case 'm': margin = atof(optarg); break;
+		case 'H': hold = atof(optarg); break;
+		case 'w': window = atof(optarg); break;
+		case 'r': rate = atof(optarg); break;
+		case 'S': seed = strtoull(optarg, NULL, 0); break;
+		default:
+			printf("usage: %s [-s balance|heavy|bursty | -f steps.csv] " \
+					"[-m margin] [-H hold_s] [-w window_s] [-r rate_hz] " \
+					"[-S seed]\n", argv[0]);
+			return -1;
+		}
+	}
+	if(rate<=0 || window<=0){
+		printf("ERROR: rate and window must be > 0\n");
+		return -1;
+	}
+	steps = malloc(MAX_STEPS*sizeof(step_t));
+	if(steps==NULL){
+		printf("ERROR: out of memory\n");
+		return -1;
+	}
+	if(path!=NULL){
+		if(read_steps(path)) return -1;
+		scenario = path;
+	}
+	else if(make_scenario(scenario, rate, seed)) return -1;
+
+	printf("%s: %ld steps at %.0f Hz, margin %.2f, hold %.1f s, " \
+			"window %.2f s\n", scenario, n_steps, rate, margin, hold, window);
+	printf("policy     energy  vs fixed  misses  max late(ms)  switches  " \
+			"time at 300/600/800/1000 MHz\n");
+	for(p=FIXED;p<=SLACK;p++){
+		if(run(p, rate, margin, hold, window, &r[p])) return -1;
+	}
+	e_fixed = r[FIXED].energy;
+	for(p=FIXED;p<=SLACK;p++){
+		printf("%-9s %7.3f  %7.1f%%  %6ld  %12.2f  %8ld ", policy_names[p], \
+				r[p].energy, 100*r[p].energy/e_fixed, r[p].misses, \
+				r[p].max_late*1e3, r[p].switches);
+		for(i=0;i<MIP_GOVERNOR_LEVELS;i++){
+			printf(" %3.0f%%", 100*r[p].time_at[i]*rate/n_steps);
+		}
+		printf("\n");
+	}
+	free(steps);
+	return 0;
+}
+
+/*******************************************************************************
+* int add_phase()
+*
+* seconds of steps around mean cycles with 10% jitter and rare spikes.
+*******************************************************************************/
+static int add_phase(float seconds, float rate, int armed, float cycles,
+										float spike_prob, float spike_gain){
+	long n = seconds*rate, i;
+	float c;
+	if(n_steps+n>MAX_STEPS){
+		printf("ERROR: scenario too long\n");
+		return -1;
+	}
+	for(i=0;i<n;i++){
+		c = cycles*(1 + 0.1*gaussian());
+		if(uniform()<spike_prob) c *= spike_gain;
+		if(c<0) c = 0;
+		steps[n_steps].cycles = c;
+		steps[n_steps].armed = armed;
+		n_steps++;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int make_scenario()
+*
+* balance	Jbalance as it is: disarmed, balancing, paused, balancing again
+* heavy		a controller that needs most of the period at 300 MHz
+* bursty	light steps with bursts that need the top clock
+*******************************************************************************/
+int make_scenario(const char* name, float rate, uint64_t seed){
+	rng = seed ? seed : 1;
+	n_steps = 0;
+	if(!strcmp(name, "balance")){
+		return add_phase(3, rate, 0, 15e3, 0, 1) \
+			|| add_phase(20, rate, 1, 60e3, 0.005, 5) \
+			|| add_phase(3, rate, 0, 15e3, 0, 1) \
+			|| add_phase(10, rate, 1, 60e3, 0.005, 5);
+	}
+	if(!strcmp(name, "heavy")){
+		return add_phase(3, rate, 0, 15e3, 0, 1) \
+			|| add_phase(30, rate, 1, 1.1e6, 0.02, 1.5);
+	}
+	if(!strcmp(name, "bursty")){
+		return add_phase(3, rate, 0, 15e3, 0, 1) \
+			|| add_phase(10, rate, 1, 200e3, 0.01, 12) \
+			|| add_phase(10, rate, 1, 2.5e6, 0, 1) \
+			|| add_phase(10, rate, 1, 200e3, 0.01, 12);
+	}
+	printf("ERROR: unknown scenario %s\n", name);
+	return -1;
+}
+
+/*******************************************************************************
+* int read_steps()
+*
+* csv with one step per line: cycles,armed
+*******************************************************************************/
+int read_steps(const char* path){
+	FILE* f = fopen(path, "r");
+	char line[256];
+	float c;
+	int a;
+	if(f==NULL){
+		printf("ERROR: can't open %s\n", path);
+		return -1;
+	}
+	n_steps = 0;
+	while(fgets(line, sizeof(line), f) && n_steps<MAX_STEPS){
+		if(sscanf(line, "%f,%d", &c, &a)!=2) continue;
+		steps[n_steps].cycles = c;
+		steps[n_steps].armed = a;
+		n_steps++;
+	}
+	fclose(f);
+	if(n_steps==0){
+		printf("ERROR: no steps in %s\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int ondemand()
+*
+* Kernel ondemand: top clock over ONDEMAND_UP busy, otherwise the lowest
+* clock that would bring the load under it.
+*******************************************************************************/
+static int ondemand(int level, double busy, double window){
+	double load = busy/window;
+	int i;
+	if(load>ONDEMAND_UP) return TOP;
+	for(i=0;i<TOP;i++){
+		if(load*mip_governor_mhz[level]/mip_governor_mhz[i]<ONDEMAND_UP){
+			return i;
+		}
+	}
+	return TOP;
+}
+
+/*******************************************************************************
+* int run()
+*
+* Play the steps through one policy, deciding at the end of every window.
+*******************************************************************************/
+int run(policy_t policy, float rate, float margin, float hold, float window,
+															result_t* r){
+	mip_governor_t g;
+	const double period = 1.0/rate;
+	double finish = 0, start, release, exec, late;
+	double wcet = 0, busy = 0, w_start = 0, stall = 0;
+	int level = TOP, next, overruns = 0, last_armed = 0;
+	long i;
+
+	memset(r, 0, sizeof(*r));
+	if(mip_governor_init(&g, period, margin, hold)) return -1;
+	for(i=0;i<n_steps;i++){
+		release = i*period;
+
+		// arming boosts right away, like arm_controller() does
+		if(policy==SLACK && steps[i].armed && !last_armed){
+			next = mip_governor_boost(&g);
+			if(next!=level){
+				level = next;
+				stall += SWITCH_STALL;
+				r->switches++;
+			}
+		}
+		last_armed = steps[i].armed;
+
+		start = release>finish ? release : finish;
+		exec = stall + steps[i].cycles/(mip_governor_mhz[level]*1e6);
+		stall = 0;
+		finish = start + exec;
+		late = finish - (release+period);
+		if(late>0){
+			r->misses++;
+			if(late>r->max_late) r->max_late = late;
+		}
+		if(exec>wcet) wcet = exec;
+		busy += exec;
+		if(exec>period || start-release>period/2) overruns++;
+		r->energy += mip_governor_energy(level, exec, 0);
+		r->energy += mip_governor_energy(level, 0, period);
+		r->time_at[level] += period;
+
+		// window boundary, or right away on an overrun like the thread
+		if(release+period-w_start<window && !(policy==SLACK && overruns)){
+			continue;
+		}
+		switch(policy){
+		case FIXED:
+			next = TOP;
+			break;
+		case ONDEMAND:
+			next = ondemand(level, busy, release+period-w_start);
+			break;
+		default:
+			next = mip_governor_update(&g, wcet, busy, \
+										release+period-w_start, overruns);
+			break;
+		}
+		if(next!=level){
+			level = next;
+			stall += SWITCH_STALL;
+			r->switches++;
+		}
+		wcet = 0;
+		busy = 0;
+		overruns = 0;
+		w_start = release+period;
+	}
+	return 0;
+}
@@ -0,0 +1,268 @@
+/*******************************************************************************
+* log_codec.c
+* By: Stuart Sonatina
+*
+* Host tool to compress, decompress and benchmark MIP logs.
+*
+* usage: log_codec [-q error_bound] [-x] [-i channel]... in.mipl out.mipl
+*        log_codec -d in.mipl out.mipl
+*        log_codec -b [-q error_bound] [-x] [-i channel]... in.mipl
+*
+* By default channels are stored with the lossless xor codec. -q switches all
+* channels to quantize-then-delta with the given error bound, -i marks a
+* channel as integer valued (encoder counts) and -x forces xor again for the
+* channels after it. -b encodes and decodes in memory and reports compression
+* ratio, encode ns/sample and decode throughput.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "../common/mip_log.h"
+#include "../common/mip_codec.h"
+
+#define DECODE_PASSES 5
+
+// function declarations
+int compress_log(mip_log_reader_t* r, const char* path);
+int decompress_log(mip_log_reader_t* r, const char* path);
+int bench_log(mip_log_reader_t* r);
+int find_channel(const mip_log_header_t* h, const char* name);
+double now_s();
+
+// variable declarations
+mip_codec_type_t codecs[MIP_LOG_MAX_CHANNELS];
+float error_bounds[MIP_LOG_MAX_CHANNELS];
+float rows[MIP_LOG_BLOCK_ROWS*MIP_LOG_MAX_CHANNELS];
+
+/******************************************************************************
+* int main()
+******************************************************************************/
+int main(int argc, char* argv[]){
+	mip_log_reader_t r;
+	mip_codec_type_t default_codec = MIP_CODEC_XOR;
+	float default_bound = 0;
+	const char* int_channels[MIP_LOG_MAX_CHANNELS];
+	int n_int = 0, decompress = 0, bench = 0;
+	int c, i, ch, ret;
+
+	while((c=getopt(argc, argv, "q:xi:dbh"))!=-1){
+		switch(c){
+		case 'q':
+			default_codec = MIP_CODEC_QUANT;
+			default_bound = atof(optarg);
+			break;
+		case 'x':
+			default_codec = MIP_CODEC_XOR;
+			break;
+		case 'i':
+			if(n_int<MIP_LOG_MAX_CHANNELS) int_channels[n_int++] = optarg;
+			break;
+		case 'd': decompress = 1;	break;
+		case 'b': bench = 1;		break;
+		default:
+			printf("usage: %s [-q error_bound] [-x] [-i channel]... "
+					"in.mipl out.mipl\n", argv[0]);
+			printf("       %s -d in.mipl out.mipl\n", argv[0]);
+			printf("       %s -b [-q error_bound] [-x] [-i channel]... "
+					"in.mipl\n", argv[0]);
+			return -1;
+		}
+	}
+	if(optind!=argc-(bench ? 1 : 2)){
+		printf("ERROR: wrong number of files, try -h\n");
+		return -1;
+	}
+	if(mip_log_open_read(&r, argv[optind])) return -1;
+
+	// pick a codec for every channel
+	for(i=0;i<(int)r.header.n_channels;i++){
+		codecs[i] = default_codec;
+		error_bounds[i] = default_bound;
+	}
+	for(i=0;i<n_int;i++){
+		ch = find_channel(&r.header, int_channels[i]);
+		if(ch<0){
+			printf("ERROR: no channel named %s\n", int_channels[i]);
+			return -1;
+		}
+		codecs[ch] = MIP_CODEC_INT;
+	}
+
+	if(bench) ret = bench_log(&r);
+	else if(decompress) ret = decompress_log(&r, argv[optind+1]);
+	else ret = compress_log(&r, argv[optind+1]);
+	mip_log_close_read(&r);
+	return ret;
+}
+
+/*******************************************************************************
+* int compress_log()
+*
+* Write every row of r to a compressed log using the chosen codecs.
+*******************************************************************************/
+int compress_log(mip_log_reader_t* r, const char* path){
+	mip_log_t log;
+	const char* names[MIP_LOG_MAX_CHANNELS];
+	int i, n, nch = r->header.n_channels;
+
+	for(i=0;i<nch;i++) names[i] = r->header.names[i];
+	if(mip_log_open_compressed(&log, path, names, nch, \
+				r->header.sample_rate_hz, codecs, error_bounds)) return -1;
+	while((n=mip_log_read(r, rows, MIP_LOG_BLOCK_ROWS))>0){
+		for(i=0;i<n;i++) mip_log_write_row(&log, rows+i*nch);
+	}
+	mip_log_flush(&log);
+	mip_log_print_stats(&log);
+	return mip_log_close(&log);
+}
+
+/*******************************************************************************
+* int decompress_log()
+*
+* Write every row of r to a plain log.
+*******************************************************************************/
+int decompress_log(mip_log_reader_t* r, const char* path){
+	mip_log_t log;
+	const char* names[MIP_LOG_MAX_CHANNELS];
+	int i, n, nch = r->header.n_channels;
+
+	for(i=0;i<nch;i++) names[i] = r->header.names[i];
+	if(mip_log_open(&log, path, names, nch, r->header.sample_rate_hz)){
+		return -1;
+	}
+	while((n=mip_log_read(r, rows, MIP_LOG_BLOCK_ROWS))>0){
+		for(i=0;i<n;i++) mip_log_write_row(&log, rows+i*nch);
+	}
+	printf("wrote %llu rows\n", (unsigned long long)log.header.n_rows);
+	return mip_log_close(&log);
+}
+
+/*******************************************************************************
+* int bench_log()
+*
+* Encode the whole log in memory channel by channel, then decode it a few
+* times. Prints per channel ratio, encode cost and max error, then decode
+* throughput in MB/s of floats produced.
+*******************************************************************************/
+int bench_log(mip_log_reader_t* r){
+	uint64_t n_rows = r->n_rows;
+	int nch = r->header.n_channels;
+	uint64_t n_blocks = (n_rows+MIP_LOG_BLOCK_ROWS-1)/MIP_LOG_BLOCK_ROWS;
+	float* in;
+	float* out;
+	uint8_t* enc;
+	uint32_t* sizes;
+	mip_codec_t codec;
+	size_t pos, total = 0, cap;
+	uint64_t b, row;
+	int ch, i, n, pass;
+	double t0, t_enc, t_dec = 0, err, max_err;
+
+	if(n_rows==0){
+		printf("log is empty\n");
+		return -1;
+	}
+	in = malloc(sizeof(float)*n_rows*nch);
+	out = malloc(sizeof(float)*n_rows);
+	cap = (size_t)n_rows*10 + 16;
+	enc = malloc(cap);
+	sizes = malloc(sizeof(uint32_t)*n_blocks);
+	if(in==NULL || out==NULL || enc==NULL || sizes==NULL){
+		printf("ERROR: out of memory\n");
+		return -1;
+	}
+	mip_log_read(r, in, n_rows);
+
+	printf("%llu rows, %d channels, %d rows per block\n", \
+				(unsigned long long)n_rows, nch, MIP_LOG_BLOCK_ROWS);
+	printf("%-16s %6s %10s %8s %10s %12s\n", "channel", "codec", \
+					"bytes", "ratio", "enc ns/s", "max error");
+	for(ch=0;ch<nch;ch++){
+		if(mip_codec_init(&codec, codecs[ch], error_bounds[ch], \
+												MIP_LOG_BLOCK_ROWS)) return -1;
+		// encode
+		t0 = now_s();
+		pos = 0;
+		for(b=0;b<n_blocks;b++){
+			n = MIP_LOG_BLOCK_ROWS;
+			if((b+1)*MIP_LOG_BLOCK_ROWS > n_rows) n = n_rows-b*MIP_LOG_BLOCK_ROWS;
+			for(i=0;i<n;i++){
+				mip_codec_put(&codec, in[(b*MIP_LOG_BLOCK_ROWS+i)*nch+ch]);
+			}
+			sizes[b] = mip_codec_finish(&codec, enc+pos);
+			pos += sizes[b];
+			mip_codec_reset(&codec);
+		}
+		t_enc = now_s()-t0;
+
+		// decode a few times for a stable number
+		for(pass=0;pass<DECODE_PASSES;pass++){
+			t0 = now_s();
+			pos = 0;
+			for(b=0;b<n_blocks;b++){
+				n = MIP_LOG_BLOCK_ROWS;
+				if((b+1)*MIP_LOG_BLOCK_ROWS > n_rows){
+					n = n_rows-b*MIP_LOG_BLOCK_ROWS;
+				}
+				if(mip_codec_decode(codecs[ch], codec.step, enc+pos, sizes[b],\
+								n, out+b*MIP_LOG_BLOCK_ROWS, 1)){
+					printf("ERROR: %s failed to decode\n", r->header.names[ch]);
+					return -1;
+				}
+				pos += sizes[b];
+			}
+			t_dec += now_s()-t0;
+		}
+
+		// check it came back
+		max_err = 0;
+		for(row=0;row<n_rows;row++){
+			float v = in[row*nch+ch];
+			if(!isfinite(v)) continue;
+			err = fabs((double)out[row]-v);
+			if(err>max_err) max_err = err;
+		}
+		total += pos;
+		printf("%-16s %6s %10zu %8.2f %10.1f %12.6g\n", r->header.names[ch], \
+				mip_codec_name(codecs[ch]), pos, 4.0*n_rows/pos, \
+				t_enc*1e9/n_rows, max_err);
+		mip_codec_free(&codec);
+	}
+	printf("total: %zu bytes from %llu, ratio %.2f\n", total, \
+					(unsigned long long)(4*n_rows*nch), 4.0*n_rows*nch/total);
+	printf("decode: %.0f MB/s\n", \
+			4.0*n_rows*nch*DECODE_PASSES/t_dec/1000000.0);
+	free(in);
+	free(out);
+	free(enc);
+	free(sizes);
+	return 0;
+}
+
+/*******************************************************************************
+* int find_channel()
+*
+* Returns the index of the channel called name, or -1.
+*******************************************************************************/
+int find_channel(const mip_log_header_t* h, const char* name){
+	int i;
+	for(i=0;i<(int)h->n_channels;i++){
+		if(!strncmp(h->names[i], name, MIP_LOG_NAME_LEN)) return i;
+	}
+	return -1;
+}
+
+/*******************************************************************************
+* double now_s()
+*******************************************************************************/
+double now_s(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
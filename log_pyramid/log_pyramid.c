@@ -0,0 +1,136 @@
+/*******************************************************************************
+* log_pyramid.c
+* By: Stuart Sonatina
+*
+* Host tool that builds a min/max/mean pyramid next to a MIP log and answers
+* plot queries from it.
+*
+* usage: log_pyramid build log.mipl
+*        log_pyramid query log.mipl channel t0 t1 pixels
+*
+* build reads the log once and writes log.mipl.pyr. query prints one line per
+* pixel column (time, min, max, mean) for the window t0..t1 seconds, using
+* the coarsest pyramid level that still resolves every pixel.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../common/mip_log.h"
+#include "../common/mip_pyramid.h"
+
+#define MAX_PIXELS 100000
+
+// function declarations
+int build(const char* log_path);
+int query(const char* log_path, const char* channel, double t0, double t1,
+																int pixels);
+double now_s();
+
+/******************************************************************************
+* int main()
+******************************************************************************/
+int main(int argc, char* argv[]){
+	if(argc==3 && !strcmp(argv[1],"build")) return build(argv[2]);
+	if(argc==7 && !strcmp(argv[1],"query")){
+		return query(argv[2], argv[3], atof(argv[4]), atof(argv[5]), \
+															atoi(argv[6]));
+	}
+	printf("usage: %s build log.mipl\n", argv[0]);
+	printf("       %s query log.mipl channel t0 t1 pixels\n", argv[0]);
+	return -1;
+}
+
+/*******************************************************************************
+* int build()
+*
+* One pass over the log, then save the pyramid as <log>.pyr
+*******************************************************************************/
+int build(const char* log_path){
+	mip_log_reader_t log;
+	mip_pyramid_t pyr;
+	char path[512];
+	double t0;
+	int i;
+
+	if(mip_log_open_read(&log, log_path)) return -1;
+	t0 = now_s();
+	if(mip_pyramid_build(&pyr, &log)) return -1;
+	snprintf(path, sizeof(path), "%s.pyr", log_path);
+	if(mip_pyramid_save(&pyr, path)) return -1;
+	printf("%s: %llu rows, %u channels, %u levels in %.3f s\n", path, \
+				(unsigned long long)pyr.header.n_rows, pyr.header.n_channels, \
+				pyr.header.n_levels, now_s()-t0);
+	for(i=0;i<(int)pyr.header.n_levels;i++){
+		printf("  level %2d: %6llu rows/bin %10llu bins\n", \
+				i+MIP_PYR_BASE_LEVEL, 1ULL<<(i+MIP_PYR_BASE_LEVEL), \
+				(unsigned long long)pyr.header.n_bins[i]);
+	}
+	mip_pyramid_free(&pyr);
+	mip_log_close_read(&log);
+	return 0;
+}
+
+/*******************************************************************************
+* int query()
+*
+* Print pixels columns of channel between t0 and t1 seconds.
+*******************************************************************************/
+int query(const char* log_path, const char* channel, double t0, double t1,
+																int pixels){
+	static mip_pyr_bin_t out[MAX_PIXELS];
+	mip_log_reader_t log;
+	mip_pyramid_t pyr;
+	char path[512];
+	double t_start, t_query, dt;
+	int i, ch = -1, L;
+
+	if(pixels<1 || pixels>MAX_PIXELS){
+		printf("ERROR: pixels must be 1 to %d\n", MAX_PIXELS);
+		return -1;
+	}
+	if(mip_log_open_read(&log, log_path)) return -1;
+	snprintf(path, sizeof(path), "%s.pyr", log_path);
+	if(mip_pyramid_open(&pyr, path, &log)){
+		printf("run '%s build' first\n", "log_pyramid");
+		return -1;
+	}
+	for(i=0;i<(int)log.header.n_channels;i++){
+		if(!strncmp(log.header.names[i], channel, MIP_LOG_NAME_LEN)) ch = i;
+	}
+	if(ch<0){
+		printf("ERROR: no channel named %s\n", channel);
+		return -1;
+	}
+
+	t_start = now_s();
+	L = mip_pyramid_query(&pyr, ch, t0, t1, pixels, out);
+	t_query = now_s()-t_start;
+	if(L<0){
+		printf("ERROR: bad query\n");
+		return -1;
+	}
+	printf("# %s %.3f..%.3f s, %d pixels, level %d (%s), %.1f us\n", \
+			channel, t0, t1, pixels, L, L ? "pyramid" : "raw log", \
+			t_query*1e6);
+	printf("# time, min, max, mean\n");
+	dt = (t1-t0)/pixels;
+	for(i=0;i<pixels;i++){
+		printf("%.4f,%.4f,%.4f,%.4f\n", t0+dt*i, out[i].min, out[i].max, \
+																out[i].mean);
+	}
+	mip_pyramid_free(&pyr);
+	mip_log_close_read(&log);
+	return 0;
+}
+
+/*******************************************************************************
+* double now_s()
+*******************************************************************************/
+double now_s(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
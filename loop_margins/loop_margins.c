@@ -0,0 +1,697 @@
+/*******************************************************************************
+* loop_margins.c
+* By: Stuart Sonatina
+*
+* Host tool that checks the D1/D2 cascade against the linearized eduMiP
+* before new coefficients go on the robot.
+*
+* usage: loop_margins [-f candidates] [-d dt] [-n points] [-l lowest_hz]
+*                     [-z delay] [-r repeats] [-j]
+*
+* A design is the cascade in stubalance_config.h with whatever lines a
+* candidate changes. Its loop gain is evaluated over a log spaced grid up
+* to the Nyquist frequency and its closed loop poles are the roots of the
+* characteristic polynomial. Out come the crossover frequencies with their
+* phase and gain margins, the modulus margin and the poles, or one JSON
+* line per design with -j for a tuning search to read.
+*
+* The grid is kept as separate arrays of real and imaginary parts, so every
+* step of a polynomial evaluation is the same multiply-add across the whole
+* grid and the compiler vectorizes it (-O3 in the Makefile).
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "../common/mip_model.h"
+#include "../common/mip_filter.h"
+#include "../stubalance/stubalance_config.h"
+
+// only c2d is needed from the template
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#define MIP_DARE_N		4
+#define MIP_DARE_M		1
+#define MIP_DARE_NAME(f)	plant_##f
+#include "../common/mip_dare.h"
+#pragma GCC diagnostic pop
+
+#define TERMS			(MIP_FILTER_MAX_ORDER+1)
+#define PLANT_N			4		// theta, theta_dot, phi, phi_dot
+#define MAX_DELAY		4
+#define POLY			(PLANT_N + 2*MIP_FILTER_MAX_ORDER + MAX_DELAY + 1)
+#define MAX_POINTS		16384
+#define MAX_CROSS		8
+#define ROOT_ITERATIONS	500
+#define ROOT_STALL		10		// iterations without a smaller step
+#define LINE			1024
+
+/*******************************************************************************
+* design_t
+*
+* [0] is D1 and [1] is D2, coefficients normalized so den[0] is 1.
+*******************************************************************************/
+typedef struct design_t{
+	double gain[2];
+	double num[2][TERMS];
+	double den[2][TERMS];
+	int order[2];
+	int line;				// where it starts in the candidates, 0 for config
+}design_t;
+
+typedef struct margins_t{
+	int n_gc, n_pc;
+	double gc_hz[MAX_CROSS], pm_deg[MAX_CROSS];	// |L| = 1
+	double pc_hz[MAX_CROSS], gm_db[MAX_CROSS];	// L on the negative real axis
+	double mm, mm_hz;							// smallest |1+L|
+}margins_t;
+
+typedef struct result_t{
+	margins_t loop;			// broken at the motor duty, D1 and D2 closed
+	margins_t inner;		// D1 on theta only, position hold open
+	int n_poles;
+	double complex pole[POLY];
+	double radius;
+}result_t;
+
+// frequency grid, z = zr + i*zi on the unit circle
+static int n_points = 1024;
+static double dt_s = DT;
+static int delay = 0;
+static double hz[MAX_POINTS], zr[MAX_POINTS], zi[MAX_POINTS];
+static double nr[MAX_POINTS], ni[MAX_POINTS], dr[MAX_POINTS], di[MAX_POINTS];
+static double lr[MAX_POINTS], li[MAX_POINTS], m2[MAX_POINTS], e2[MAX_POINTS];
+
+// plant from duty to theta and to phi, over the same denominator
+static double p_den[PLANT_N+1], p_theta[PLANT_N+1], p_phi[PLANT_N+1];
+
+// function declarations
+int plant_init(double dt);
+int grid_init(double f_lo);
+int charpoly(const double A[PLANT_N][PLANT_N], double* p);
+int poly_mul(const double* a, int na, const double* b, int nb, double* out);
+int poly_add(double* y, int ny, double s, const double* x, int nx);
+int analyze(const design_t* d, result_t* r);
+int margins(const double* num, int nn, const double* den, int nd,
+															margins_t* m);
+int roots(const double* p, int n, double complex* r);
+int parse_values(char* s, double* v, int max);
+int load_next(FILE* fd, const char* path, const design_t* base, design_t* d,
+																int* line_no);
+int set_filter(design_t* d, int i, const double* num, int n_num,
+									const double* den, int n_den, int order);
+int print_result(const design_t* d, const result_t* r, int index);
+int print_json(const design_t* d, const result_t* r, int index);
+
+/******************************************************************************
+* int main()
+******************************************************************************/
+int main(int argc, char* argv[]){
+	static const double d1_num[] = D1_NUM, d1_den[] = D1_DEN;
+	static const double d2_num[] = D2_NUM, d2_den[] = D2_DEN;
+	const char* path = NULL;
+	double f_lo = 0.01, busy = 0;
+	design_t base, d;
+	result_t r;
+	struct timespec t0, t1;
+	int c, i, ret = 0, json = 0, repeats = 1, n = 0, line_no = 0;
+	FILE* fd = NULL;
+
+	while((c=getopt(argc, argv, "f:d:n:l:z:r:jh"))!=-1){
+		switch(c){
+		case 'f': path = optarg; break;
+		case 'd': dt_s = atof(optarg); break;
+		case 'n': n_points = atoi(optarg); break;
+		case 'l': f_lo = atof(optarg); break;
+		case 'z': delay = atoi(optarg); break;
+		case 'r': repeats = atoi(optarg); break;
+		case 'j': json = 1; break;
+		default:
+			printf("usage: %s [-f candidates] [-d dt] [-n points] " \
+					"[-l lowest_hz] [-z delay] [-r repeats] [-j]\n", argv[0]);
+			return -1;
+		}
+	}
+	if(dt_s<=0 || f_lo<=0 || f_lo>=0.5/dt_s){
+		printf("ERROR: need dt > 0 and 0 < lowest_hz < %g\n", 0.5/dt_s);
+		return -1;
+	}
+	if(n_points<16 || n_points>MAX_POINTS){
+		printf("ERROR: points must be 16 to %d\n", MAX_POINTS);
+		return -1;
+	}
+	if(delay<0 || delay>MAX_DELAY){
+		printf("ERROR: delay must be 0 to %d samples\n", MAX_DELAY);
+		return -1;
+	}
+	if(repeats<1) repeats = 1;
+	if(plant_init(dt_s) || grid_init(f_lo)) return -1;
+
+	// the compiled in cascade, candidates start from it
+	memset(&base, 0, sizeof(base));
+	base.gain[0] = D1_GAIN;
+	base.gain[1] = D2_GAIN;
+	set_filter(&base, 0, d1_num, D1_ORDER+1, d1_den, D1_ORDER+1, -1);
+	set_filter(&base, 1, d2_num, D2_ORDER+1, d2_den, D2_ORDER+1, -1);
+
+	if(path){
+		fd = strcmp(path, "-") ? fopen(path, "r") : stdin;
+		if(fd==NULL){
+			printf("ERROR: can't read %s\n", path);
+			return -1;
+		}
+	}
+	while(1){
+		if(fd){
+			ret = load_next(fd, path, &base, &d, &line_no);
+			if(ret<=0) break;
+		}
+		else if(n==0) d = base;
+		else break;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for(i=0;i<repeats;i++) analyze(&d, &r);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		busy += (t1.tv_sec-t0.tv_sec) + (t1.tv_nsec-t0.tv_nsec)*1e-9;
+		n++;
+		if(json) print_json(&d, &r, n);
+		else print_result(&d, &r, n);
+	}
+	if(fd && fd!=stdin) fclose(fd);
+	if(fd && ret<0) return -1;
+
+	// stdout may be going to a search script with -j
+	fprintf(json ? stderr : stdout, "%d designs x %d, %d points, %.0f " \
+				"designs/s\n", n, repeats, n_points, n*repeats/busy);
+	return 0;
+}
+
+/*******************************************************************************
+* int plant_init()
+*
+* Balance part of the linearized model, zero order hold at dt, as transfer
+* functions from duty to theta and to phi. For one input,
+* C*adj(zI-A)*B = det(zI-A+B*C) - det(zI-A), so both numerators come from
+* characteristic polynomials too.
+*******************************************************************************/
+int plant_init(double dt){
+	double A6[6][6], B6[6][2], A[4][4], B[4][1], Ad[4][4], Bd[4][1];
+	double T[4][4], p[PLANT_N+1];
+	int i, j, k;
+
+	if(mip_model_linear(A6, B6)) return -1;
+	for(i=0;i<4;i++){
+		for(j=0;j<4;j++) A[i][j] = A6[i][j];
+		B[i][0] = B6[i][0];
+	}
+	plant_c2d(A, B, dt, Ad, Bd);
+	charpoly(Ad, p_den);
+	for(k=0;k<2;k++){
+		memcpy(T, Ad, sizeof(T));
+		for(i=0;i<4;i++) T[i][2*k] -= Bd[i][0];	// C picks theta or phi
+		charpoly(T, p);
+		for(i=0;i<=PLANT_N;i++){
+			if(k==0) p_theta[i] = p[i] - p_den[i];
+			else p_phi[i] = p[i] - p_den[i];
+		}
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int grid_init()
+*
+* Log spaced from f_lo to Nyquist.
+*******************************************************************************/
+int grid_init(double f_lo){
+	double f_hi = 0.5/dt_s;
+	int k;
+	for(k=0;k<n_points;k++){
+		hz[k] = f_lo*pow(f_hi/f_lo, (double)k/(n_points-1));
+		zr[k] = cos(2*M_PI*hz[k]*dt_s);
+		zi[k] = sin(2*M_PI*hz[k]*dt_s);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int charpoly()
+*
+* det(zI-A) by Faddeev-LeVerrier, p[0] is the z^n coefficient.
+*******************************************************************************/
+int charpoly(const double A[PLANT_N][PLANT_N], double* p){
+	double M[PLANT_N][PLANT_N], AM[PLANT_N][PLANT_N], tr;
+	int i, k;
+
+	MIP_MAT_ZERO(M, PLANT_N, PLANT_N);
+	p[0] = 1;
+	for(k=1;k<=PLANT_N;k++){
+		for(i=0;i<PLANT_N;i++) M[i][i] += p[k-1];
+		MIP_MAT_MUL(AM, A, M, PLANT_N, PLANT_N, PLANT_N);
+		for(tr=0,i=0;i<PLANT_N;i++) tr += AM[i][i];
+		p[k] = -tr/k;
+		MIP_MAT_COPY(M, AM, PLANT_N, PLANT_N);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int poly_mul(), int poly_add()
+*
+* Highest power first. poly_mul returns the number of terms, poly_add adds
+* s*x to y lined up at the constant term, x no longer than y.
+*******************************************************************************/
+int poly_mul(const double* a, int na, const double* b, int nb, double* out){
+	int i, j;
+	for(i=0;i<na+nb-1;i++) out[i] = 0;
+	for(i=0;i<na;i++) for(j=0;j<nb;j++) out[i+j] += a[i]*b[j];
+	return na+nb-1;
+}
+
+int poly_add(double* y, int ny, double s, const double* x, int nx){
+	int i;
+	for(i=0;i<nx;i++) y[ny-nx+i] += s*x[i];
+	return ny;
+}
+
+/*******************************************************************************
+* void horner()
+*
+* p at every grid point. The inner loop has no dependence between points,
+* which is what lets it vectorize.
+*******************************************************************************/
+static void horner(const double* p, int n, double* restrict re,
+														double* restrict im){
+	double t;
+	int i, k;
+	for(k=0;k<n_points;k++){
+		re[k] = p[0];
+		im[k] = 0;
+	}
+	for(i=1;i<n;i++){
+		for(k=0;k<n_points;k++){
+			t = re[k]*zr[k] - im[k]*zi[k] + p[i];
+			im[k] = re[k]*zi[k] + im[k]*zr[k];
+			re[k] = t;
+		}
+	}
+}
+
+/*******************************************************************************
+* double complex eval()
+*
+* num/den at one frequency, to place a crossover between grid points.
+*******************************************************************************/
+static double complex eval(const double* num, int nn, const double* den,
+													int nd, double f){
+	double complex z = cexp(I*2*M_PI*f*dt_s), a = 0, b = 0;
+	int i;
+	for(i=0;i<nn;i++) a = a*z + num[i];
+	for(i=0;i<nd;i++) b = b*z + den[i];
+	return a/b;
+}
+
+/*******************************************************************************
+* int analyze()
+*
+* With refs at 0 Jbalance runs u = D1*(D2*(0-phi) - theta), so the loop gain
+* at the duty is L = D1*(Gtheta + D2*Gphi) and the closed loop poles are the
+* roots of den(L) + num(L). A delay of k samples multiplies the denominator
+* by z^k.
+*******************************************************************************/
+int analyze(const design_t* d, result_t* r){
+	double n1[TERMS], n2[TERMS], a[POLY], b[POLY], num[POLY], den[POLY];
+	int i, o1 = d->order[0]+1, o2 = d->order[1]+1, na, nb, nn, nd;
+
+	for(i=0;i<o1;i++) n1[i] = d->gain[0]*d->num[0][i];
+	for(i=0;i<o2;i++) n2[i] = d->gain[1]*d->num[1][i];
+
+	// inner loop, D1*Gtheta
+	nn = poly_mul(n1, o1, p_theta, PLANT_N+1, num);
+	nd = poly_mul(d->den[0], o1, p_den, PLANT_N+1, den);
+	for(i=0;i<delay;i++) den[nd++] = 0;
+	margins(num, nn, den, nd, &r->inner);
+
+	// both loops, D1*(Gtheta*den2 + num2*Gphi) / (den1*den2*Gden)
+	na = poly_mul(p_theta, PLANT_N+1, d->den[1], o2, a);
+	nb = poly_mul(p_phi, PLANT_N+1, n2, o2, b);
+	poly_add(a, na, 1, b, nb);
+	nn = poly_mul(n1, o1, a, na, num);
+	nb = poly_mul(p_den, PLANT_N+1, d->den[1], o2, b);
+	nd = poly_mul(d->den[0], o1, b, nb, den);
+	for(i=0;i<delay;i++) den[nd++] = 0;
+	margins(num, nn, den, nd, &r->loop);
+
+	poly_add(den, nd, 1, num, nn);
+	r->n_poles = roots(den, nd, r->pole);
+	r->radius = 0;
+	for(i=0;i<r->n_poles;i++){
+		if(cabs(r->pole[i])>r->radius) r->radius = cabs(r->pole[i]);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int margins()
+*
+* L = num/den over the grid, then the crossings between neighbouring points
+* are placed by interpolating in log frequency and evaluated exactly there.
+* Gain margins are in dB, negative ones are how far the gain can drop, as
+* for the open loop unstable pendulum. Only the first MAX_CROSS of each
+* kind are kept.
+*******************************************************************************/
+int margins(const double* num, int nn, const double* den, int nd,
+															margins_t* m){
+	double q, f, fa, pm;
+	double complex L;
+	int k, best = 0;
+
+	horner(num, nn, nr, ni);
+	horner(den, nd, dr, di);
+	for(k=0;k<n_points;k++){
+		q = dr[k]*dr[k] + di[k]*di[k];
+		lr[k] = (nr[k]*dr[k] + ni[k]*di[k])/q;
+		li[k] = (ni[k]*dr[k] - nr[k]*di[k])/q;
+		m2[k] = lr[k]*lr[k] + li[k]*li[k];
+		e2[k] = (1+lr[k])*(1+lr[k]) + li[k]*li[k];
+	}
+
+	m->n_gc = m->n_pc = 0;
+	for(k=0;k<n_points-1;k++){
+		if(e2[k+1]<e2[best]) best = k+1;
+		if((m2[k]-1)*(m2[k+1]-1)<0 && m->n_gc<MAX_CROSS){
+			fa = (1-m2[k])/(m2[k+1]-m2[k]);
+			f = hz[k]*pow(hz[k+1]/hz[k], fa);
+			L = eval(num, nn, den, nd, f);
+			pm = 180 + carg(L)*180/M_PI;
+			if(pm>180) pm -= 360;
+			m->gc_hz[m->n_gc] = f;
+			m->pm_deg[m->n_gc++] = pm;
+		}
+		if(li[k]*li[k+1]<0 && m->n_pc<MAX_CROSS){
+			fa = li[k]/(li[k]-li[k+1]);
+			f = hz[k]*pow(hz[k+1]/hz[k], fa);
+			L = eval(num, nn, den, nd, f);
+			if(creal(L)<0){
+				m->pc_hz[m->n_pc] = f;
+				m->gm_db[m->n_pc++] = -20*log10(cabs(L));
+			}
+		}
+	}
+	m->mm = sqrt(e2[best]);
+	m->mm_hz = hz[best];
+	return 0;
+}
+
+static int cmp_radius(const void* a, const void* b){
+	double x = cabs(*(const double complex*)a);
+	double y = cabs(*(const double complex*)b);
+	return (x<y) - (x>y);
+}
+
+/*******************************************************************************
+* int roots()
+*
+* All roots of the n term polynomial p by Durand-Kerner, largest |z| first.
+* Roots at 0 from trailing zeros are taken off first since repeated roots
+* converge slowly. The poles bunch up near z = 1, where rounding in p
+* leaves the steps at around 1e-8 rather than shrinking, so it also stops
+* once they stop getting smaller. Returns how many.
+*******************************************************************************/
+int roots(const double* p, int n, double complex* r){
+	double complex c[POLY], v, w, step;
+	double max, best = INFINITY;
+	int i, j, it, deg, stall = 0, zeros = 0;
+
+	while(n>1 && p[0]==0){
+		p++;
+		n--;
+	}
+	while(n>1 && p[n-1]==0){
+		n--;
+		zeros++;
+	}
+	deg = n-1;
+	for(i=0;i<n;i++) c[i] = p[i]/p[0];
+	for(i=0;i<deg;i++) r[i] = cpow(0.4+0.9*I, i);
+	for(it=0;it<ROOT_ITERATIONS;it++){
+		max = 0;
+		for(i=0;i<deg;i++){
+			v = c[0];
+			w = 1;
+			for(j=1;j<n;j++) v = v*r[i] + c[j];
+			for(j=0;j<deg;j++) if(j!=i) w *= r[i]-r[j];
+			if(w==0) continue;
+			step = v/w;
+			r[i] -= step;
+			if(cabs(step)>max) max = cabs(step);
+		}
+		if(max<1e-13) break;
+		if(max<best){
+			best = max;
+			stall = 0;
+		}
+		else if(++stall==ROOT_STALL) break;
+	}
+	for(i=0;i<deg;i++){
+		if(fabs(cimag(r[i]))<1e-9) r[i] = creal(r[i]);
+	}
+	for(i=0;i<zeros;i++) r[deg+i] = 0;
+	qsort(r, deg+zeros, sizeof(r[0]), cmp_radius);
+	return deg+zeros;
+}
+
+/*******************************************************************************
+* int parse_values()
+*
+* Numbers after the key, braces, commas and whitespace between them are
+* skipped, like mip_tune. Returns how many or -1.
+*******************************************************************************/
+int parse_values(char* s, double* v, int max){
+	char* end;
+	int n = 0;
+	while(1){
+		while(*s && (isspace((unsigned char)*s) || strchr("{},\\", *s))) s++;
+		if(!*s) return n;
+		if(n==max) return -1;
+		v[n] = strtod(s, &end);
+		if(end==s || !isfinite(v[n])) return -1;
+		s = end;
+		n++;
+	}
+}
+
+/*******************************************************************************
+* int load_next()
+*
+* The next candidate, lines in mip_tune's format up to an empty line or the
+* end of the file. D1_ and D2_ GAIN, NUM, DEN and ORDER change the design,
+* the other keys a tune file has don't touch the loop and are skipped.
+* Returns 1 for a candidate, 0 at the end or -1.
+*******************************************************************************/
+int load_next(FILE* fd, const char* path, const design_t* base, design_t* d,
+																int* line_no){
+	static const char* skip[] = {"D3_KP", "D3_KI", "D3_KD", "THETA_REF_MAX",
+													"STEERING_INPUT_MAX"};
+	double num[2][TERMS], den[2][TERMS], v[TERMS];
+	int n_num[2] = {0, 0}, n_den[2] = {0, 0}, order[2] = {-1, -1};
+	char line[LINE], key[32], *s, *c;
+	int i, j, n, len, seen = 0;
+
+	*d = *base;
+	while(fgets(line, sizeof(line), fd)){
+		(*line_no)++;
+		for(s=line;isspace((unsigned char)*s);s++);
+		if(!*s){
+			if(seen) break;
+			continue;
+		}
+		if((c=strstr(line, "//"))) *c = 0;
+		if(strncmp(s, "#define", 7)==0) s += 7;
+		else if(*s=='#') continue;
+		while(isspace((unsigned char)*s)) s++;
+		if(!*s) continue;
+		for(len=0;(isalnum((unsigned char)s[len]) || s[len]=='_') && \
+										len<(int)sizeof(key)-1;len++){
+			key[len] = s[len];
+		}
+		key[len] = 0;
+		n = parse_values(s+len, v, TERMS);
+		if(len==0 || n<=0){
+			printf("ERROR: %s line %d, expected a name and numbers\n", \
+														path, *line_no);
+			return -1;
+		}
+		if(!seen) d->line = *line_no;
+		seen = 1;
+		for(j=0;j<(int)(sizeof(skip)/sizeof(skip[0]));j++){
+			if(!strcmp(key, skip[j])) break;
+		}
+		if(j<(int)(sizeof(skip)/sizeof(skip[0]))) continue;
+
+		i = (key[0]=='D' && (key[1]=='1' || key[1]=='2') && key[2]=='_') ? \
+														key[1]-'1' : -1;
+		if(i>=0 && !strcmp(key+3, "GAIN") && n==1) d->gain[i] = v[0];
+		else if(i>=0 && !strcmp(key+3, "NUM")){
+			memcpy(num[i], v, n*sizeof(v[0]));
+			n_num[i] = n;
+		}
+		else if(i>=0 && !strcmp(key+3, "DEN")){
+			memcpy(den[i], v, n*sizeof(v[0]));
+			n_den[i] = n;
+		}
+		else if(i>=0 && !strcmp(key+3, "ORDER") && n==1) order[i] = v[0];
+		else{
+			printf("ERROR: %s line %d, unknown name %s or wrong count\n", \
+													path, *line_no, key);
+			return -1;
+		}
+	}
+	if(!seen) return 0;
+	for(i=0;i<2;i++){
+		if(set_filter(d, i, n_num[i] ? num[i] : NULL, n_num[i], \
+							n_den[i] ? den[i] : NULL, n_den[i], order[i])){
+			printf("ERROR: in the candidate at %s line %d\n", path, d->line);
+			return -1;
+		}
+	}
+	return 1;
+}
+
+/*******************************************************************************
+* int set_filter()
+*
+* New terms for D1 or D2, either of num and den may be left out (NULL) as
+* long as the order stays. Same rules as mip_tune.
+*******************************************************************************/
+int set_filter(design_t* d, int i, const double* num, int n_num,
+									const double* den, int n_den, int order){
+	double nn[TERMS], dd[TERMS];
+	int j, n;
+
+	if(n_num && n_den && n_num!=n_den){
+		printf("ERROR: D%d_NUM and D%d_DEN have %d and %d terms\n", i+1, \
+												i+1, n_num, n_den);
+		return -1;
+	}
+	if(n_num+n_den && !(n_num && n_den) && n_num+n_den!=d->order[i]+1){
+		printf("ERROR: D%d needs %d terms to keep its order, or both num " \
+								"and den\n", i+1, d->order[i]+1);
+		return -1;
+	}
+	if(n_num || n_den){
+		n = n_num ? n_num : n_den;
+		if(!num) num = d->num[i];
+		if(!den) den = d->den[i];
+		if(den[0]==0){
+			printf("ERROR: D%d_DEN must not start with 0\n", i+1);
+			return -1;
+		}
+		for(j=0;j<n;j++){
+			nn[j] = num[j]/den[0];
+			dd[j] = den[j]/den[0];
+		}
+		d->order[i] = n-1;
+		memcpy(d->num[i], nn, n*sizeof(nn[0]));
+		memcpy(d->den[i], dd, n*sizeof(dd[0]));
+	}
+	if(order>=0 && order!=d->order[i]){
+		printf("ERROR: D%d_ORDER is %d but the terms make it %d\n", i+1, \
+													order, d->order[i]);
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int print_result()
+*******************************************************************************/
+static void print_filter(const design_t* d, int i){
+	int j;
+	printf("  D%d  %g * {", i+1, d->gain[i]);
+	for(j=0;j<=d->order[i];j++) printf("%s%.4g", j ? ", " : "", d->num[i][j]);
+	printf("} / {");
+	for(j=0;j<=d->order[i];j++) printf("%s%.4g", j ? ", " : "", d->den[i][j]);
+	printf("}\n");
+}
+
+static void print_margins(const char* title, const margins_t* m){
+	int i;
+	printf("  %s\n", title);
+	for(i=0;i<m->n_gc;i++){
+		printf("    gain crossover  %7.3f Hz, phase margin %6.1f deg\n", \
+											m->gc_hz[i], m->pm_deg[i]);
+	}
+	for(i=0;i<m->n_pc;i++){
+		printf("    phase crossover %7.3f Hz, gain margin  %6.1f dB\n", \
+											m->pc_hz[i], m->gm_db[i]);
+	}
+	printf("    modulus margin  %7.3f at %.3f Hz\n", m->mm, m->mm_hz);
+}
+
+int print_result(const design_t* d, const result_t* r, int index){
+	double complex s;
+	int i;
+
+	if(d->line) printf("design %d, line %d\n", index, d->line);
+	else printf("design %d, stubalance_config.h\n", index);
+	print_filter(d, 0);
+	print_filter(d, 1);
+	print_margins("loop at the motor duty, D1 and D2 closed:", &r->loop);
+	print_margins("inner loop, D1 and theta only:", &r->inner);
+	printf("  closed loop poles, largest |z| %.4f, %s\n", r->radius, \
+									r->radius<1 ? "stable" : "UNSTABLE");
+	for(i=0;i<r->n_poles;i++){
+		if(cimag(r->pole[i])<0) continue;
+		printf("    z %8.4f", creal(r->pole[i]));
+		if(cimag(r->pole[i])>0) printf(" +-%7.4fi", cimag(r->pole[i]));
+		else printf("%11s", "");
+		if(cabs(r->pole[i])==0){
+			printf("\n");
+			continue;
+		}
+		// the s plane pole it would be sampled from
+		s = clog(r->pole[i])/dt_s;
+		printf("  %8.3f Hz, damping %6.3f\n", cabs(s)/(2*M_PI), \
+												-creal(s)/cabs(s));
+	}
+	printf("\n");
+	return 0;
+}
+
+/*******************************************************************************
+* int print_json()
+*******************************************************************************/
+static void json_list(const char* key, const double* v, int n){
+	int i;
+	printf(", \"%s\": [", key);
+	for(i=0;i<n;i++) printf("%s%.6g", i ? ", " : "", v[i]);
+	printf("]");
+}
+
+static void json_margins(const char* key, const margins_t* m){
+	printf(", \"%s\": {\"mm\": %.6g, \"mm_hz\": %.6g", key, m->mm, m->mm_hz);
+	json_list("gc_hz", m->gc_hz, m->n_gc);
+	json_list("pm_deg", m->pm_deg, m->n_gc);
+	json_list("pc_hz", m->pc_hz, m->n_pc);
+	json_list("gm_db", m->gm_db, m->n_pc);
+	printf("}");
+}
+
+int print_json(const design_t* d, const result_t* r, int index){
+	double mag[POLY];
+	int i;
+	printf("{\"design\": %d, \"line\": %d, \"stable\": %d, \"radius\": %.6g", \
+						index, d->line, r->radius<1, r->radius);
+	json_margins("loop", &r->loop);
+	json_margins("inner", &r->inner);
+	for(i=0;i<r->n_poles;i++) mag[i] = cabs(r->pole[i]);
+	json_list("pole_abs", mag, r->n_poles);
+	printf("}\n");
+	return 0;
+}
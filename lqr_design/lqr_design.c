@@ -0,0 +1,190 @@
+/*******************************************************************************
+* lqr_design.c
+* By: Stuart Sonatina
+*
+* Host tool that computes the state feedback gains for Jbalance's LQR
+* controller and prints them as stubalance_config.h lines.
+*
+* usage: lqr_design [-q th,th_dot,phi,phi_dot,gamma,gamma_dot] [-r u,u_steer]
+*                   [-d dt]
+*
+* The eduMiP model from mip_model.c is linearized about upright, the same
+* equations mipsim integrates, and discretized with a zero order hold at dt.
+* Weights are Bryson style: the largest acceptable value of each state and
+* of each duty cycle, Q and R are the inverse squares of them.
+*
+* Two designs come out: LQR_K4 balances and holds position with duty u on
+* both wheels, steering is left to D3. LQR_K6 adds gamma and gamma_dot and a
+* second row for the steering duty, which Jbalance uses with LQR_STEERING.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "../common/mip_model.h"
+
+#define MIP_DARE_N		4
+#define MIP_DARE_M		1
+#define MIP_DARE_NAME(f)	lqr4_##f
+#include "../common/mip_dare.h"
+
+#define MIP_DARE_N		6
+#define MIP_DARE_M		2
+#define MIP_DARE_NAME(f)	lqr6_##f
+#include "../common/mip_dare.h"
+
+#define BENCH_STEPS		10000000
+
+// function declarations
+int parse_list(const char* s, double* v, int n);
+int print_gains(const char* name, const double* K, int rows, int cols);
+double bench_ns(const float K[2][6]);
+
+/******************************************************************************
+* int main()
+******************************************************************************/
+int main(int argc, char* argv[]){
+	double x_max[6] = {0.05, 0.3, 1.0, 8.0, 0.5, 5.0};
+	double u_max[2] = {1.0, 0.5};
+	double dt = 0.005;
+	double A[6][6], B[6][2], Ad[6][6], Bd[6][2];
+	double A4[4][4], B4[4][1], Ad4[4][4], Bd4[4][1];
+	double Q[6][6], R[2][2], P[6][6], K[2][6];
+	double Q4[4][4], R4[1][1], P4[4][4], K4[1][4];
+	float Kf[2][6];
+	int c, i, j, it4, it6;
+
+	while((c=getopt(argc, argv, "q:r:d:h"))!=-1){
+		switch(c){
+		case 'q':
+			if(parse_list(optarg, x_max, 6)) return -1;
+			break;
+		case 'r':
+			if(parse_list(optarg, u_max, 2)) return -1;
+			break;
+		case 'd':
+			dt = atof(optarg);
+			break;
+		default:
+			printf("usage: %s [-q th,th_dot,phi,phi_dot,gamma,gamma_dot] " \
+						"[-r u,u_steer] [-d dt]\n", argv[0]);
+			return -1;
+		}
+	}
+	if(dt<=0){
+		printf("ERROR: dt must be > 0\n");
+		return -1;
+	}
+	for(i=0;i<6;i++) if(x_max[i]<=0) x_max[i] = 1e9;	// don't care
+	for(i=0;i<2;i++) if(u_max[i]<=0){
+		printf("ERROR: duty weights must be > 0\n");
+		return -1;
+	}
+
+	if(mip_model_linear(A, B)) return -1;
+	MIP_MAT_ZERO(Q, 6, 6);
+	MIP_MAT_ZERO(R, 2, 2);
+	for(i=0;i<6;i++) Q[i][i] = 1/(x_max[i]*x_max[i]);
+	for(i=0;i<2;i++) R[i][i] = 1/(u_max[i]*u_max[i]);
+
+	// balance only, the top left corner
+	for(i=0;i<4;i++){
+		for(j=0;j<4;j++){
+			A4[i][j] = A[i][j];
+			Q4[i][j] = Q[i][j];
+		}
+		B4[i][0] = B[i][0];
+	}
+	R4[0][0] = R[0][0];
+	lqr4_c2d(A4, B4, dt, Ad4, Bd4);
+	it4 = lqr4_dare(Ad4, Bd4, Q4, R4, K4, P4);
+	lqr6_c2d(A, B, dt, Ad, Bd);
+	it6 = lqr6_dare(Ad, Bd, Q, R, K, P);
+	if(it4<0 || it6<0){
+		printf("ERROR: Riccati iteration didn't converge, check weights\n");
+		return -1;
+	}
+
+	printf("// lqr_design -q %g,%g,%g,%g,%g,%g -r %g,%g -d %g\n", \
+			x_max[0], x_max[1], x_max[2], x_max[3], x_max[4], x_max[5], \
+			u_max[0], u_max[1], dt);
+	printf("// %d and %d iterations, closed loop spectral radius " \
+			"%.4f and %.4f\n", it4, it6, lqr4_radius(Ad4, Bd4, K4), \
+			lqr6_radius(Ad, Bd, K));
+	print_gains("LQR_K4", &K4[0][0], 1, 4);
+	print_gains("LQR_K6", &K[0][0], 2, 6);
+
+	MIP_MAT_COPY(Kf, K, 2, 6);
+	printf("// 2x6 gain step takes %.1f ns on this machine\n", bench_ns(Kf));
+	return 0;
+}
+
+/*******************************************************************************
+* int parse_list()
+*
+* n comma separated numbers, empty ones keep their default.
+*******************************************************************************/
+int parse_list(const char* s, double* v, int n){
+	char* end;
+	int i;
+	for(i=0;i<n && *s;i++){
+		if(*s!=','){
+			v[i] = strtod(s, &end);
+			if(end==s){
+				printf("ERROR: bad number in %s\n", s);
+				return -1;
+			}
+			s = end;
+		}
+		if(*s==',') s++;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int print_gains()
+*
+* As a config line, values lined up at column 32 with 4 space tabs.
+*******************************************************************************/
+int print_gains(const char* name, const double* K, int rows, int cols){
+	int i, j, col;
+	printf("#define %s", name);
+	for(col=8+strlen(name);col<32;col=(col/4+1)*4) printf("\t");
+	printf("{");
+	for(i=0;i<rows;i++){
+		if(i) printf(", \\\n\t\t\t\t\t\t\t\t ");
+		printf("{");
+		for(j=0;j<cols;j++) printf("%s%.4g", j ? ", " : "", K[i*cols+j]);
+		printf("}");
+	}
+	printf("}\n");
+	return 0;
+}
+
+/*******************************************************************************
+* double bench_ns()
+*
+* Time the controller's gain step, the same kernel Jbalance runs.
+*******************************************************************************/
+double bench_ns(const float K[2][6]){
+	volatile float x_in[6] = {0.01, 0.1, 0.2, 1.0, 0.05, 0.3};
+	volatile float sink;
+	float x[6], u[2];
+	struct timespec t0, t1;
+	long i;
+	int j;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i=0;i<BENCH_STEPS;i++){
+		for(j=0;j<6;j++) x[j] = x_in[j];
+		MIP_MAT_VEC(u, K, x, 2, 6);
+		sink = u[0] + u[1];
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	(void)sink;
+	return ((t1.tv_sec-t0.tv_sec)*1e9 + (t1.tv_nsec-t0.tv_nsec))/BENCH_STEPS;
+}
@@ -0,0 +1,754 @@
+/*******************************************************************************
+* microbench.c
+* By: Stuart Sonatina
+*
+* Times the per-sample kernels of the balance programs one at a time and
+* reports ns per call, optionally against an earlier run.
+*
+* usage: microbench [-d sim_dir] [-o results.jsonl] [-b baseline.jsonl]
+*                   [-t tolerance] [-T sim_tolerance] [-c cpu] [-r reps]
+*                   [-n batch] [-w warmup] [-s sim_seconds] [-R repeats]
+*                   [-k kernel,...]
+*
+* Host kernels run here on one pinned CPU: warmup batches first, then reps
+* batches of batch calls each over a table of sensor-like inputs, and one
+* ns/call figure per batch, the kernels taking turns a slice at a time.
+* The controller steps need their program's own setup, so they run in the
+* mipsim binaries instead, on the virtual clock and held in the hand so the
+* armed step runs every sample back to back, with the IMU thread pinned to
+* the same CPU, and each call is one sample. Everything is timed repeats
+* times keeping the least. The results file gets a JSON line per kernel,
+* with -b anything whose least grew by more than the tolerance, even after
+* being timed again, is listed and the exit status is 1.
+*******************************************************************************/
+
+#define _GNU_SOURCE		// sched_setaffinity
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../mipsim/mipsim.h"
+#include "../common/mip_latency.h"
+#include "../common/mip_fifo.h"
+#include "../common/mip_telem.h"
+#include "../stubalance/stubalance_config.h"
+
+// stubalance.c's complementary filter, the same stage list it runs
+static const float offset = 0, mount_angle = 0.4;
+#include "../stubalance/stubalance_estimator.h"
+
+#define INPUTS			1024	// power of 2, cycled through by every kernel
+#define MAX_RESULTS		32
+#define HOST_ROUNDS		10		// slices the host kernels take turns in
+#define CONFIRM			3		// times a kernel over the baseline is retimed
+#define LINE			1024
+
+// from ../stufilter/stufilter.c, built in with its main renamed
+float Low_Pass(float gain, float new_input);
+float Hi_Pass(float gain, float new_input);
+
+/*******************************************************************************
+* kernel_t
+*
+* A host kernel's batch() makes n calls and returns something depending on
+* all of them so nothing gets optimized away. A sim kernel has program set
+* instead and is timed by that mipsim binary. floor is the smallest change
+* in ns the comparison counts, below that it is timer noise.
+*******************************************************************************/
+typedef struct kernel_t{
+	const char* name;
+	float (*batch)(int n);
+	const char* program;
+	double floor;
+}kernel_t;
+
+typedef struct stats_t{
+	double min, p50, mean, p99, stddev;
+	long reps;
+}stats_t;
+
+typedef struct result_t{
+	char line[LINE];
+	char kernel[64];
+}result_t;
+
+// inputs, filled once with noise around a balancing robot's readings
+static float in_theta[INPUTS];
+static float in_accel_y[INPUTS], in_accel_z[INPUTS];
+static int in_enc[INPUTS];
+static d_filter_t LP, HP;
+static mip_fifo_fir_t fir;
+static cf_t cf;
+static cf_in_t in_cf[INPUTS];
+static cf_out_t out_cf[INPUTS];
+static volatile float sink;
+
+// function declarations
+int setup_inputs();
+float batch_low_pass(int n);
+float batch_hi_pass(int n);
+float batch_march_lowpass(int n);
+float batch_march_highpass(int n);
+float batch_accel_atan2(int n);
+float batch_encoder_stubalance(int n);
+float batch_encoder_jbalance(int n);
+float batch_fifo_fir(int n);
+float batch_estimator_step(int n);
+float batch_estimator_batch(int n);
+float batch_telem_publish(int n);
+int pin_cpu(int cpu);
+int get_stats(double* v, long n, stats_t* s);
+int time_host(const kernel_t* k, int warmup, int reps, int batch,
+																double* v);
+int time_sim(const kernel_t* k, const char* dir, int cpu, double seconds,
+																stats_t* s);
+int best_sim(const kernel_t* k, const char* dir, int cpu, double seconds,
+													int repeats, stats_t* s);
+int write_result(const char* path, const kernel_t* k, const stats_t* s);
+int in_list(const char* list, const char* name);
+int load(const char* path, result_t* r, int max);
+double get_num(const char* line, const char* key);
+int get_str(const char* line, const char* key, char* out, int size);
+double host_scale(const stats_t* s, const int* have, const result_t* base,
+																int n_base);
+int over_baseline(const kernel_t* k, const stats_t* s, double scale,
+		const result_t* base, int n_base, double tol, double sim_tol,
+																double* x);
+int compare(const stats_t* s, const int* have, const result_t* base,
+									int n_base, double tol, double sim_tol);
+
+static const kernel_t kernels[] = {
+	{"stufilter_Low_Pass",		batch_low_pass,				NULL, 0.5},
+	{"stufilter_Hi_Pass",		batch_hi_pass,				NULL, 0.5},
+	{"march_filter_lowpass",	batch_march_lowpass,		NULL, 0.5},
+	{"march_filter_highpass",	batch_march_highpass,		NULL, 0.5},
+	{"accel_atan2",				batch_accel_atan2,			NULL, 0.5},
+	{"encoder_rad_stubalance",	batch_encoder_stubalance,	NULL, 0.5},
+	{"encoder_rad_jbalance",	batch_encoder_jbalance,		NULL, 0.5},
+	{"fifo_fir_1k_to_200",		batch_fifo_fir,				NULL, 0.5},
+	{"estimator_step",			batch_estimator_step,		NULL, 0.5},
+	{"estimator_batch",			batch_estimator_batch,		NULL, 0.5},
+	{"telem_publish",			batch_telem_publish,		NULL, 0.5},
+	{"controller",				NULL,	"stubalance_sim",		200},
+	{"balance_controller",		NULL,	"jbalance_sim",			200},
+};
+#define N_KERNELS (int)(sizeof(kernels)/sizeof(kernels[0]))
+
+/*******************************************************************************
+* int main()
+*******************************************************************************/
+int main(int argc, char* argv[]){
+	const char* dir = "../mipsim";
+	const char* out = "microbench.jsonl";
+	const char* baseline = NULL;
+	const char* only = NULL;
+	static result_t base[MAX_RESULTS];
+	double* v[N_KERNELS] = {NULL};
+	double tol = 0.15, sim_tol = 0.5, seconds = 10, x;
+	int cpu = 0, reps = 2000, batch = 1000, warmup = 100, repeats = 3;
+	int have[N_KERNELS] = {0};
+	int c, i, j, n, n_base = 0, ret = 0;
+	long from, to;
+	stats_t st[N_KERNELS], s;
+	FILE* fd;
+
+	while((c=getopt(argc, argv, "d:o:b:t:T:c:r:n:w:s:R:k:h"))!=-1){
+		switch(c){
+		case 'd': dir = optarg; break;
+		case 'o': out = optarg; break;
+		case 'b': baseline = optarg; break;
+		case 't': tol = atof(optarg); break;
+		case 'T': sim_tol = atof(optarg); break;
+		case 'c': cpu = atoi(optarg); break;
+		case 'r': reps = atoi(optarg); break;
+		case 'n': batch = atoi(optarg); break;
+		case 'w': warmup = atoi(optarg); break;
+		case 's': seconds = atof(optarg); break;
+		case 'R': repeats = atoi(optarg); break;
+		case 'k': only = optarg; break;
+		default:
+			printf("usage: %s [-d sim_dir] [-o results.jsonl] " \
+					"[-b baseline.jsonl] [-t tolerance] [-T sim_tolerance] " \
+					"[-c cpu] [-r reps] [-n batch] [-w warmup] " \
+					"[-s sim_seconds] [-R repeats] [-k kernel,...]\n", \
+					argv[0]);
+			return -1;
+		}
+	}
+	if(reps<1 || batch<1 || warmup<0 || seconds<=0 || repeats<1){
+		printf("ERROR: reps, batch and repeats must be > 0, " \
+								"warmup >= 0, sim_seconds > 0\n");
+		return -1;
+	}
+	if((fd=fopen(out, "w"))==NULL){
+		printf("ERROR: can't write %s\n", out);
+		return -1;
+	}
+	fclose(fd);
+	if(cpu>=0) pin_cpu(cpu);
+	setup_inputs();
+
+	// the host kernels take a slice of reps at a time in turns, so a slow
+	// spell of the machine is shared out instead of landing on one kernel,
+	// and the whole pass is made repeats times a second apart keeping the
+	// least, as the controller steps are
+	for(i=0;i<N_KERNELS;i++){
+		if(kernels[i].program || (only && !in_list(only, kernels[i].name))){
+			continue;
+		}
+		if((v[i]=malloc(reps*sizeof(double)))==NULL){
+			printf("ERROR: out of memory\n");
+			return -1;
+		}
+	}
+	for(c=0;c<repeats;c++){
+		if(c) sleep(1);
+		for(j=0;j<HOST_ROUNDS;j++){
+			from = (long)reps*j/HOST_ROUNDS;
+			to = (long)reps*(j+1)/HOST_ROUNDS;
+			for(i=0;i<N_KERNELS;i++){
+				if(v[i]==NULL || to==from) continue;
+				time_host(&kernels[i], warmup, to-from, batch, v[i]+from);
+			}
+		}
+		for(i=0;i<N_KERNELS;i++){
+			if(v[i]==NULL) continue;
+			get_stats(v[i], reps, &s);
+			if(!have[i] || s.min<st[i].min) st[i] = s;
+			have[i] = 1;
+		}
+	}
+	for(i=0;i<N_KERNELS;i++){
+		if(!kernels[i].program || (only && !in_list(only, kernels[i].name))){
+			continue;
+		}
+		if(best_sim(&kernels[i], dir, cpu, seconds, repeats, &st[i])) ret = -1;
+		else have[i] = 1;
+	}
+
+	// anything over the baseline is timed again on its own, up to CONFIRM
+	// times 1, 2, 4.. s apart, keeping the least. A regression stays over,
+	// a slow spell of the machine passes.
+	if(baseline){
+		if((n_base=load(baseline, base, MAX_RESULTS))<0) return -1;
+		for(j=0;j<CONFIRM;j++){
+			for(n=0,i=0;i<N_KERNELS;i++){
+				if(!have[i] || !over_baseline(&kernels[i], &st[i], \
+					host_scale(st, have, base, n_base), base, n_base, tol, \
+														sim_tol, &x)){
+					continue;
+				}
+				if(n++==0) sleep(1<<j);
+				printf("retiming %s, %.2f ns/call against %.2f\n", \
+											kernels[i].name, st[i].min, x);
+				if(kernels[i].program){
+					if(best_sim(&kernels[i], dir, cpu, seconds, repeats, \
+												&s)) continue;
+				}
+				else{
+					time_host(&kernels[i], warmup, reps, batch, v[i]);
+					get_stats(v[i], reps, &s);
+				}
+				if(s.min<st[i].min) st[i] = s;
+			}
+			if(n==0) break;
+		}
+	}
+
+	printf("%-24s %9s %9s %9s %9s %9s %8s\n", "kernel", "ns/call", "min", \
+										"mean", "p99", "stddev", "reps");
+	for(i=0;i<N_KERNELS;i++){
+		free(v[i]);
+		if(!have[i]) continue;
+		printf("%-24s %9.2f %9.2f %9.2f %9.2f", kernels[i].name, st[i].p50, \
+										st[i].min, st[i].mean, st[i].p99);
+		if(isnan(st[i].stddev)) printf(" %9s %8ld\n", "-", st[i].reps);
+		else printf(" %9.2f %8ld\n", st[i].stddev, st[i].reps);
+		if(write_result(out, &kernels[i], &st[i])) ret = -1;
+	}
+	mip_telem_stop();
+
+	if(baseline && compare(st, have, base, n_base, tol, sim_tol)) ret = 1;
+	return ret;
+}
+
+/*******************************************************************************
+* int setup_inputs()
+*
+* Readings of a robot wobbling around upright, made once with a fixed seed
+* so every run feeds the kernels the same numbers, and the filters set up
+* as complementary_filter.c does.
+*******************************************************************************/
+int setup_inputs(){
+	float th;
+	int i;
+	srand(1);
+	for(i=0;i<INPUTS;i++){
+		th = 0.1*sin(i*0.05) + 0.002*(rand()/(float)RAND_MAX - 0.5);
+		in_theta[i] = th;
+		in_accel_y[i] = 9.8*cos(th - CAPE_MOUNT_ANGLE) + 0.1;
+		in_accel_z[i] = -9.8*sin(th - CAPE_MOUNT_ANGLE) + 0.45;
+		in_enc[i] = 2000*sin(i*0.01) + (rand()%9 - 4);
+	}
+	LP = create_first_order_lowpass(1.0/100, 2.0);
+	HP = create_first_order_highpass(1.0/100, 2.0);
+	reset_filter(&LP);
+	reset_filter(&HP);
+	mip_fifo_fir_init(&fir, IMU_FIFO_TAPS, IMU_FIFO_HZ/200, IMU_FIFO_CUTOFF);
+	cf_init(&cf, 1.0/100);
+	for(i=0;i<INPUTS;i++){
+		in_cf[i].gyro_x = 20*cos(i*0.05) + in_enc[i]%3;
+		in_cf[i].accel_y = in_accel_y[i];
+		in_cf[i].accel_z = in_accel_z[i];
+		in_cf[i].dt = 1.0/100;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* host kernels
+*
+* Each is the expression or call its program makes once per sample, the
+* gains and constants are the programs' own.
+*******************************************************************************/
+float batch_low_pass(int n){
+	float y = 0;
+	int i;
+	for(i=0;i<n;i++) y += Low_Pass(0.004988, in_theta[i&(INPUTS-1)]);
+	return y;
+}
+
+float batch_hi_pass(int n){
+	float y = 0;
+	int i;
+	for(i=0;i<n;i++) y += Hi_Pass(0.995, in_theta[i&(INPUTS-1)]);
+	return y;
+}
+
+float batch_march_lowpass(int n){
+	float y = 0;
+	int i;
+	for(i=0;i<n;i++) y += march_filter(&LP, in_theta[i&(INPUTS-1)]);
+	return y;
+}
+
+float batch_march_highpass(int n){
+	float y = 0;
+	int i;
+	for(i=0;i<n;i++) y += march_filter(&HP, in_theta[i&(INPUTS-1)]);
+	return y;
+}
+
+// stubalance.c controller(), accelerometer angle after the bias is removed
+float batch_accel_atan2(int n){
+	float y = 0, g_y, g_z;
+	int i;
+	for(i=0;i<n;i++){
+		g_y = in_accel_y[i&(INPUTS-1)]-0.1;
+		g_z = in_accel_z[i&(INPUTS-1)]-0.45;
+		y += atan2(-g_z/9.8,g_y/9.8) + 0.4;
+	}
+	return y;
+}
+
+// stubalance.c controller(), one wheel
+float batch_encoder_stubalance(int n){
+	float y = 0;
+	int i;
+	for(i=0;i<n;i++){
+		y += (float)in_enc[i&(INPUTS-1)] * TWO_PI/(GEARBOX*60.0);
+	}
+	return y;
+}
+
+// Jbalance.c balance_step(), one wheel
+float batch_encoder_jbalance(int n){
+	float y = 0;
+	int i;
+	for(i=0;i<n;i++){
+		y += (in_enc[i&(INPUTS-1)] * TWO_PI) \
+								/(ENCODER_POLARITY_R * GEARBOX * ENCODER_RES);
+	}
+	return y;
+}
+
+// mip_fifo.c, one raw sample of all six channels, an output every fifth
+float batch_fifo_fir(int n){
+	float x[MIP_FIFO_CHANNELS] = {0}, y[MIP_FIFO_CHANNELS], s = 0;
+	int i, j;
+	for(i=0;i<n;i++){
+		j = i&(INPUTS-1);
+		x[1] = in_accel_y[j];
+		x[2] = in_accel_z[j];
+		x[3] = in_theta[j]*RAD_TO_DEG;
+		if(mip_fifo_fir_push(&fir, x)){
+			mip_fifo_fir_output(&fir, y);
+			s += y[2] + y[3];
+		}
+	}
+	return s;
+}
+
+// stubalance.c controller(), the whole complementary filter one sample at
+// a time, and the same pipeline over the table at once like a log would be
+float batch_estimator_step(int n){
+	cf_out_t out;
+	float y = 0;
+	int i;
+	for(i=0;i<n;i++){
+		cf_step(&cf, &in_cf[i&(INPUTS-1)], &out);
+		y += out.theta;
+	}
+	return y;
+}
+
+float batch_estimator_batch(int n){
+	int i;
+	for(i=0;i+INPUTS<=n;i+=INPUTS) cf_batch(&cf, in_cf, out_cf, INPUTS);
+	cf_batch(&cf, in_cf, out_cf, n-i);
+	return out_cf[0].theta;
+}
+
+// Jbalance.c's telemetry frame into the ring, with the server running and
+// nobody subscribed
+float batch_telem_publish(int n){
+	static const char* names[8] = {"a", "b", "c", "d", "e", "f", "g", "h"};
+	float row[8] = {0};
+	int i, j;
+	if(mip_telem_start("microbench_telem.sock", "microbench", names, 8, \
+															200, 50)) return 0;
+	for(i=0;i<n;i++){
+		j = i&(INPUTS-1);
+		row[0] = in_theta[j];
+		row[2] = in_enc[j];
+		mip_telem_publish(i, 1, MIP_TELEM_ARMED, row);
+	}
+	return row[0];
+}
+
+/*******************************************************************************
+* int pin_cpu()
+*
+* Keeps this process on one CPU and, with root, above everything else so
+* migrations and preemption stay out of the numbers.
+*******************************************************************************/
+int pin_cpu(int cpu){
+	struct sched_param param = {.sched_priority = 80};
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	if(sched_setaffinity(0, sizeof(cpus), &cpus)){
+		printf("ERROR: can't pin to cpu %d, timing unpinned\n", cpu);
+		return -1;
+	}
+	// best effort, needs root
+	sched_setscheduler(0, SCHED_FIFO, &param);
+	return 0;
+}
+
+/*******************************************************************************
+* int cmp_double(), int get_stats()
+*******************************************************************************/
+static int cmp_double(const void* a, const void* b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x>y) - (x<y);
+}
+
+int get_stats(double* v, long n, stats_t* s){
+	double sum = 0, sum2 = 0;
+	long i;
+	qsort(v, n, sizeof(v[0]), cmp_double);
+	for(i=0;i<n;i++){
+		sum += v[i];
+		sum2 += v[i]*v[i];
+	}
+	s->reps = n;
+	s->min = v[0];
+	s->p50 = v[n/2];
+	s->p99 = v[(long)(0.99*(n-1))];
+	s->mean = sum/n;
+	s->stddev = n>1 ? sqrt(fmax(0, (sum2 - sum*sum/n)/(n-1))) : 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int time_host()
+*
+* warmup untimed batches to settle the caches, branch predictors and clock
+* frequency, then reps timed ones into v[]. The clock is read once per
+* batch, so its own cost is spread over batch calls.
+*******************************************************************************/
+int time_host(const kernel_t* k, int warmup, int reps, int batch,
+																double* v){
+	uint64_t t0;
+	int i;
+	for(i=0;i<warmup;i++) sink = k->batch(batch);
+	for(i=0;i<reps;i++){
+		t0 = mip_latency_now();
+		sink = k->batch(batch);
+		v[i] = (double)(mip_latency_now()-t0)/batch;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int time_sim()
+*
+* Runs the kernel's mipsim binary held in the hand for seconds on the
+* virtual clock and reads its per call CPU times back from the score line.
+* Nothing really sleeps between samples, so the steps run back to back
+* and warm instead of after a cold wakeup each, which is what made them
+* spread by 2x from run to run. The time before it arms is the warmup,
+* only armed calls are counted.
+*******************************************************************************/
+int time_sim(const kernel_t* k, const char* dir, int cpu, double seconds,
+																stats_t* s){
+	char path[PATH_MAX], score[] = "/tmp/microbench_XXXXXX", arg[32];
+	char line[LINE];
+	pid_t pid;
+	int status, fd;
+	FILE* f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, k->program);
+	if(access(path, X_OK)){
+		printf("ERROR: no %s, build it with make -C %s\n", path, dir);
+		return -1;
+	}
+	if((fd=mkstemp(score))<0){
+		printf("ERROR: can't make a temporary file\n");
+		return -1;
+	}
+	close(fd);
+	fflush(stdout);		// or the child writes out a copy of what's buffered
+	pid = fork();
+	if(pid<0){
+		printf("ERROR: fork failed\n");
+		unlink(score);
+		return -1;
+	}
+	if(pid==0){
+		setenv("MIPSIM_SCORE", score, 1);
+		setenv("MIPSIM_SCENARIO", "microbench", 1);
+		setenv("MIPSIM_HOLD", "1", 1);
+		setenv("MIPSIM_VIRTUAL", "1", 1);
+		snprintf(arg, sizeof(arg), "%g", seconds);
+		setenv("MIPSIM_DURATION", arg, 1);
+		snprintf(arg, sizeof(arg), "%d", cpu);
+		if(cpu>=0) setenv("MIPSIM_CPU", arg, 1);
+		if(freopen("/dev/null", "w", stdout)==NULL) _exit(127);
+		execl(path, k->program, (char*)NULL);
+		_exit(127);
+	}
+	line[0] = 0;
+	if(waitpid(pid, &status, 0)<0 || !WIFEXITED(status) || \
+											WEXITSTATUS(status)==127 || \
+			(f=fopen(score, "r"))==NULL){
+		printf("ERROR: %s didn't finish\n", k->program);
+		unlink(score);
+		return -1;
+	}
+	if(fgets(line, LINE, f)==NULL) line[0] = 0;
+	fclose(f);
+	unlink(score);
+
+	s->reps = get_num(line, "cpu_calls");
+	if(isnan(get_num(line, "cpu_p50_ns"))){
+		printf("ERROR: %s never armed\n", k->program);
+		return -1;
+	}
+	s->min = get_num(line, "cpu_min_ns");
+	s->p50 = get_num(line, "cpu_p50_ns");
+	s->mean = get_num(line, "cpu_mean_ns");
+	s->p99 = get_num(line, "cpu_p99_ns");
+	s->stddev = NAN;
+	return 0;
+}
+
+/*******************************************************************************
+* int best_sim()
+*
+* time_sim() repeats times, the run with the lowest min is the result so one
+* disturbed by the rest of the machine doesn't count.
+*******************************************************************************/
+int best_sim(const kernel_t* k, const char* dir, int cpu, double seconds,
+													int repeats, stats_t* s){
+	stats_t t;
+	int i;
+	for(i=0;i<repeats;i++){
+		if(time_sim(k, dir, cpu, seconds, &t)) return -1;
+		if(i==0 || t.min<s->min) *s = t;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int write_result()
+*
+* One JSON line per kernel, ns per call.
+*******************************************************************************/
+int write_result(const char* path, const kernel_t* k, const stats_t* s){
+	FILE* fd;
+	if((fd=fopen(path, "a"))==NULL){
+		printf("ERROR: can't append to %s\n", path);
+		return -1;
+	}
+	fprintf(fd, "{\"kernel\": \"%s\", \"where\": \"%s\", \"reps\": %ld, " \
+			"\"p50_ns\": %.6g, \"min_ns\": %.6g, \"mean_ns\": %.6g, " \
+			"\"p99_ns\": %.6g", k->name, k->program ? k->program : "host", \
+			s->reps, s->p50, s->min, s->mean, s->p99);
+	if(isnan(s->stddev)) fprintf(fd, ", \"stddev_ns\": null}\n");
+	else fprintf(fd, ", \"stddev_ns\": %.6g}\n", s->stddev);
+	fclose(fd);
+	return 0;
+}
+
+/*******************************************************************************
+* int in_list()
+*
+* Whether name is one of a comma separated list.
+*******************************************************************************/
+int in_list(const char* list, const char* name){
+	int len = strlen(name);
+	const char* s = list;
+	while((s=strstr(s, name))!=NULL){
+		if((s==list || s[-1]==',') && (s[len]==0 || s[len]==',')) return 1;
+		s += len;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int load()
+*
+* Reads a results file, returns how many lines or -1.
+*******************************************************************************/
+int load(const char* path, result_t* r, int max){
+	FILE* fd;
+	int n = 0;
+	if((fd=fopen(path, "r"))==NULL){
+		printf("ERROR: can't read %s\n", path);
+		return -1;
+	}
+	while(n<max && fgets(r[n].line, LINE, fd)){
+		if(get_str(r[n].line, "kernel", r[n].kernel, 64)) continue;
+		n++;
+	}
+	fclose(fd);
+	return n;
+}
+
+/*******************************************************************************
+* double get_num(), int get_str()
+*
+* Values out of the flat JSON lines, NAN for null or missing.
+*******************************************************************************/
+double get_num(const char* line, const char* key){
+	char pat[64];
+	const char* s;
+	snprintf(pat, sizeof(pat), "\"%s\": ", key);
+	if((s=strstr(line, pat))==NULL) return NAN;
+	s += strlen(pat);
+	if(!strncmp(s, "null", 4)) return NAN;
+	return strtod(s, NULL);
+}
+
+int get_str(const char* line, const char* key, char* out, int size){
+	char pat[64];
+	const char* s;
+	int i;
+	snprintf(pat, sizeof(pat), "\"%s\": \"", key);
+	if((s=strstr(line, pat))==NULL) return -1;
+	s += strlen(pat);
+	for(i=0;i<size-1 && s[i] && s[i]!='"';i++) out[i] = s[i];
+	out[i] = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* double host_scale()
+*
+* Median over the host kernels of the least now over the baseline's. A
+* shared or laptop CPU steps its clock for seconds at a time, which moves
+* every kernel together while a regression moves one or two, so the host
+* kernels' baseline is scaled by this before comparing. 1 with fewer than
+* three to go by.
+*******************************************************************************/
+double host_scale(const stats_t* s, const int* have, const result_t* base,
+																int n_base){
+	double r[N_KERNELS], x;
+	int i, j, n = 0;
+	for(i=0;i<N_KERNELS;i++){
+		if(!have[i] || kernels[i].program) continue;
+		for(x=NAN,j=0;j<n_base && isnan(x);j++){
+			if(!strcmp(kernels[i].name, base[j].kernel)){
+				x = get_num(base[j].line, "min_ns");
+			}
+		}
+		if(!isnan(x) && x>0) r[n++] = s[i].min/x;
+	}
+	if(n<3) return 1;
+	qsort(r, n, sizeof(double), cmp_double);
+	return n%2 ? r[n/2] : (r[n/2-1]+r[n/2])/2;
+}
+
+/*******************************************************************************
+* int over_baseline()
+*
+* 1 when the kernel's least ns per call grew past the baseline's, times
+* scale for a host kernel, by more than tol, sim_tol for the controller
+* steps, and by more than the kernel's floor. The median moves with
+* whatever else the machine is doing, the least only with the code. *x gets
+* the baseline's least scaled, NAN if it hasn't the kernel.
+*******************************************************************************/
+int over_baseline(const kernel_t* k, const stats_t* s, double scale,
+		const result_t* base, int n_base, double tol, double sim_tol,
+																double* x){
+	double t = k->program ? sim_tol : tol;
+	int j;
+	if(k->program) scale = 1;
+	*x = NAN;
+	for(j=0;j<n_base && isnan(*x);j++){
+		if(!strcmp(k->name, base[j].kernel)){
+			*x = get_num(base[j].line, "min_ns")*scale;
+		}
+	}
+	if(isnan(*x)) return 0;
+	return s->min>*x*(1+t) && s->min-*x>k->floor;
+}
+
+/*******************************************************************************
+* int compare()
+*
+* Lists the kernels still over the baseline after retiming, the host ones
+* against it scaled by host_scale(). Returns the number of regressions.
+*******************************************************************************/
+int compare(const stats_t* s, const int* have, const result_t* base,
+									int n_base, double tol, double sim_tol){
+	double x, scale = host_scale(s, have, base, n_base);
+	int i, bad = 0;
+
+	printf("\ncompared with the baseline, tolerance %.0f%%, sim %.0f%%\n", \
+													tol*100, sim_tol*100);
+	printf("  host kernels at %.0f%% of the baseline's time, scaled by that\n",\
+																scale*100);
+	for(i=0;i<N_KERNELS;i++){
+		if(!have[i]) continue;
+		if(over_baseline(&kernels[i], &s[i], scale, base, n_base, tol, \
+														sim_tol, &x)){
+			printf("  REGRESSION %s: %.2f -> %.2f ns/call\n", \
+										kernels[i].name, x, s[i].min);
+			bad++;
+		}
+		else if(isnan(x)){
+			printf("  %s: not in the baseline\n", kernels[i].name);
+		}
+	}
+	if(!bad) printf("  no regressions\n");
+	return bad;
+}
@@ -0,0 +1,161 @@
+/*******************************************************************************
+* mip_plant.c
+* By: Stuart Sonatina
+*
+* eduMiP equations of motion, see mip_plant.h
+*
+* With a = I_w + (m_b+m_w)R^2, b = m_b R L, c = I_b + m_b L^2 and the rotors
+* adding J = 2 I_m G^2 about the body/wheel joint:
+*
+*	(a+J) phi''   + (b cos(theta)-J) theta'' = tau + b sin(theta) theta'^2
+*	(b cos(theta)-J) phi'' + (c+J) theta''   = -tau + m_b g L sin(theta)
+*
+* where tau = 2 G s (u V/V_nom - G (phi'-theta')/w_f) is the torque of both
+* motors on the wheels at average duty u.
+*******************************************************************************/
+
+#include <math.h>
+
+#include "mip_plant.h"
+#include "../common/mip_model.h"
+
+#define R	MIP_WHEEL_RADIUS
+#define L	MIP_BODY_COM
+#define G	MIP_GEARBOX
+
+/*******************************************************************************
+* derivs()
+*
+* State derivative for the state vector {theta, theta', phi, phi', psi, psi'}
+*******************************************************************************/
+static void derivs(const double* x, double u_c, double u_d, double v_batt,
+										int enabled, double* dx){
+	const double m_w1 = MIP_MASS_WHEELS/2.0;
+	const double I_w = 2.0*(0.5*m_w1*R*R);
+	const double J = 2.0*MIP_MOTOR_INERTIA*G*G;
+	const double a = I_w + (MIP_MASS_BODY+MIP_MASS_WHEELS)*R*R;
+	const double b = MIP_MASS_BODY*R*L;
+	const double c = MIP_BODY_INERTIA + MIP_MASS_BODY*L*L;
+	const double J_d = 2.0*(0.5*m_w1*R*R + m_w1*R*R) + J \
+						+ 4.0*MIP_YAW_INERTIA*R*R \
+						/(MIP_TRACK_WIDTH*MIP_TRACK_WIDTH);
+	const double s = MIP_MOTOR_STALL_TORQUE;
+	double th = x[0], th_d = x[1], ph_d = x[3], ps_d = x[5];
+	double tau = 0, tau_d = 0, m12, r1, r2, det;
+
+	// disabled motors coast, enabled motors at zero duty brake
+	if(enabled){
+		tau   = 2.0*G*s*(u_c*v_batt/MIP_V_NOMINAL \
+							- G*(ph_d-th_d)/MIP_MOTOR_FREE_SPEED);
+		tau_d = G*s*(2.0*u_d*v_batt/MIP_V_NOMINAL \
+							- 2.0*G*ps_d/MIP_MOTOR_FREE_SPEED);
+	}
+
+	m12 = b*cos(th) - J;
+	r1 = tau + b*sin(th)*th_d*th_d;
+	r2 = -tau + MIP_MASS_BODY*MIP_GRAVITY*L*sin(th);
+	det = (a+J)*(c+J) - m12*m12;
+
+	dx[0] = th_d;
+	dx[1] = ((a+J)*r2 - m12*r1)/det;
+	dx[2] = ph_d;
+	dx[3] = ((c+J)*r1 - m12*r2)/det;
+	dx[4] = ps_d;
+	dx[5] = tau_d/J_d;
+}
+
+/*******************************************************************************
+* int mip_plant_reset()
+*
+* At rest with the body leaning at theta.
+*******************************************************************************/
+int mip_plant_reset(mip_plant_t* p, double theta){
+	p->theta = theta;
+	p->theta_dot = 0;
+	p->phi = 0;
+	p->phi_dot = 0;
+	p->psi = 0;
+	p->psi_dot = 0;
+	p->fallen = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int mip_plant_step()
+*
+* Advance dt seconds holding the duties constant, in RK4 steps no longer than
+* MIP_PLANT_SUBSTEP.
+*******************************************************************************/
+int mip_plant_step(mip_plant_t* p, double duty_l, double duty_r, double v_batt,
+											int motors_enabled, double dt){
+	double x[6], k1[6], k2[6], k3[6], k4[6], t[6], u_c, u_d, h, w_l, w_r;
+	int i, j, n;
+
+	if(duty_l> 1.0) duty_l =  1.0;
+	if(duty_l<-1.0) duty_l = -1.0;
+	if(duty_r> 1.0) duty_r =  1.0;
+	if(duty_r<-1.0) duty_r = -1.0;
+	u_c = (duty_l+duty_r)/2.0;
+	u_d = (duty_r-duty_l)/2.0;
+
+	if(p->fallen){
+		p->current = 0;
+		return 0;
+	}
+	x[0] = p->theta; x[1] = p->theta_dot;
+	x[2] = p->phi;   x[3] = p->phi_dot;
+	x[4] = p->psi;   x[5] = p->psi_dot;
+
+	n = (int)ceil(dt/MIP_PLANT_SUBSTEP - 1e-9);
+	if(n<1) n = 1;
+	h = dt/n;
+	for(j=0;j<n;j++){
+		derivs(x, u_c, u_d, v_batt, motors_enabled, k1);
+		for(i=0;i<6;i++) t[i] = x[i] + 0.5*h*k1[i];
+		derivs(t, u_c, u_d, v_batt, motors_enabled, k2);
+		for(i=0;i<6;i++) t[i] = x[i] + 0.5*h*k2[i];
+		derivs(t, u_c, u_d, v_batt, motors_enabled, k3);
+		for(i=0;i<6;i++) t[i] = x[i] + h*k3[i];
+		derivs(t, u_c, u_d, v_batt, motors_enabled, k4);
+		for(i=0;i<6;i++) x[i] += h/6.0*(k1[i] + 2*k2[i] + 2*k3[i] + k4[i]);
+	}
+
+	p->theta = x[0]; p->theta_dot = x[1];
+	p->phi   = x[2]; p->phi_dot   = x[3];
+	p->psi   = x[4]; p->psi_dot   = x[5];
+
+	// motor current follows torque, it loads the battery in the sim
+	p->current = 0;
+	if(motors_enabled){
+		w_l = G*(p->phi_dot - p->psi_dot - p->theta_dot);
+		w_r = G*(p->phi_dot + p->psi_dot - p->theta_dot);
+		p->current = MIP_MOTOR_STALL_CURRENT*( \
+				fabs(duty_l*v_batt/MIP_V_NOMINAL - w_l/MIP_MOTOR_FREE_SPEED) \
+			  + fabs(duty_r*v_batt/MIP_V_NOMINAL - w_r/MIP_MOTOR_FREE_SPEED));
+	}
+
+	// lying on the ground, wheels keep their angle relative to the body
+	if(fabs(p->theta)>MIP_PLANT_FALLEN){
+		p->theta = (p->theta>0) ? MIP_PLANT_FALLEN : -MIP_PLANT_FALLEN;
+		p->theta_dot = 0;
+		p->phi_dot = 0;
+		p->psi_dot = 0;
+		p->fallen = 1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* wheel angles relative to the body and body heading
+*******************************************************************************/
+double mip_plant_wheel_l(const mip_plant_t* p){
+	return p->phi - p->psi - p->theta;
+}
+
+double mip_plant_wheel_r(const mip_plant_t* p){
+	return p->phi + p->psi - p->theta;
+}
+
+double mip_plant_gamma(const mip_plant_t* p){
+	return 2.0*p->psi*MIP_WHEEL_RADIUS/MIP_TRACK_WIDTH;
+}
@@ -0,0 +1,39 @@
+/*******************************************************************************
+* mip_plant.h
+* By: Stuart Sonatina
+*
+* Nonlinear eduMiP dynamics for the simulator, integrated with fixed step
+* RK4. Pitch and forward motion are the coupled inverted pendulum on wheels,
+* turning is a separate rotational mode driven by the difference of the two
+* motor torques. Wheels roll without slipping. Once the body lean passes
+* MIP_PLANT_FALLEN it is lying on the ground and stays there.
+*******************************************************************************/
+
+#ifndef MIP_PLANT_H
+#define MIP_PLANT_H
+
+#define MIP_PLANT_SUBSTEP	0.001	// s, largest RK4 step
+#define MIP_PLANT_FALLEN	1.5		// rad
+
+/*******************************************************************************
+* mip_plant_t
+*
+* State is in the coordinates of mip_model.h, inputs are the motor duties
+* as seen by each wheel (positive drives that wheel forward).
+*******************************************************************************/
+typedef struct mip_plant_t{
+	double theta, theta_dot;
+	double phi, phi_dot;
+	double psi, psi_dot;
+	double current;			// A, both motors after the last step
+	int fallen;
+}mip_plant_t;
+
+int mip_plant_reset(mip_plant_t* p, double theta);
+int mip_plant_step(mip_plant_t* p, double duty_l, double duty_r, double v_batt,
+											int motors_enabled, double dt);
+double mip_plant_wheel_l(const mip_plant_t* p);	// wheel angle rel. to body
+double mip_plant_wheel_r(const mip_plant_t* p);
+double mip_plant_gamma(const mip_plant_t* p);
+
+#endif //MIP_PLANT_H
@@ -0,0 +1,799 @@
+/*******************************************************************************
+* mipsim.c
+* By: Stuart Sonatina
+*
+* Simulated cape: program state, motors, encoders, IMU interrupt thread and
+* battery wired to the plant in mip_plant.c. See mipsim.h for settings.
+*******************************************************************************/
+
+#define _GNU_SOURCE		// pthread_setaffinity_np
+#include <stdatomic.h>
+#include <sched.h>
+
+#include "mipsim.h"
+#include "mip_plant.h"
+#include "mipsim_score.h"
+#include "mipsim_vtime.h"
+#include "mipsim_mpu.h"
+#include "../common/mip_model.h"
+
+// default wiring is Jbalance's, see stubalance_config.h
+#ifndef MIPSIM_MOTOR_L
+#define MIPSIM_MOTOR_L			3
+#endif
+#ifndef MIPSIM_MOTOR_R
+#define MIPSIM_MOTOR_R			2
+#endif
+#ifndef MIPSIM_MOTOR_POL_L
+#define MIPSIM_MOTOR_POL_L		1
+#endif
+#ifndef MIPSIM_MOTOR_POL_R
+#define MIPSIM_MOTOR_POL_R		-1
+#endif
+#ifndef MIPSIM_ENCODER_L
+#define MIPSIM_ENCODER_L		3
+#endif
+#ifndef MIPSIM_ENCODER_R
+#define MIPSIM_ENCODER_R		2
+#endif
+#ifndef MIPSIM_ENCODER_POL_L
+#define MIPSIM_ENCODER_POL_L	1
+#endif
+#ifndef MIPSIM_ENCODER_POL_R
+#define MIPSIM_ENCODER_POL_R	-1
+#endif
+
+#define CHANNELS		5		// 1 to 4 like the cape, 0 unused
+#define DMP_NOISE		0.001	// rad rms
+#define VBATT_NOISE		0.01	// V rms
+#define MIPSIM_DSM_PERIOD	0.022	// s, DSM2 frame rate
+#define DSM_CHANNELS	9
+#ifndef MIPSIM_PROGRAM
+#define MIPSIM_PROGRAM	"mipsim"	// name in the score, set by the Makefile
+#endif
+// accelerometer offsets measured on the bench, stubalance.c removes them
+static const float accel_bias[3] = {0.0, 0.1, 0.45};
+
+/*******************************************************************************
+* settings from the environment
+*******************************************************************************/
+static double duration = 10.0;
+static double theta0 = 0.05;
+static double noise = 1.0;
+static double gyro_noise = 0.1;			// deg/s rms each sample
+static double accel_noise = 0.03;		// m/s^2 rms each sample
+static double v_batt = MIP_V_NOMINAL;
+static double v_drain = 0;				// V/min
+static uint64_t rng = 1;
+static int hold = 0;					// never let go
+static int cpu = -1;					// IMU thread's CPU, -1 any
+static int drop_every = 0;				// 1 in n interrupts never comes
+static int repeat_every = 0;			// 1 in n comes twice
+static double jitter = 0;				// s an interrupt can come late
+static const char* score_path = NULL;
+static const char* scenario = "";
+
+/*******************************************************************************
+* scripted button presses from MIPSIM_BUTTONS
+*******************************************************************************/
+#define MAX_BUTTON_EDGES 64
+typedef struct button_edge_t{
+	double t;				// s after initialize_cape()
+	int mode;				// 0 pause, 1 mode
+	int pressed;
+}button_edge_t;
+static button_edge_t button_edges[MAX_BUTTON_EDGES];
+static int n_button_edges = 0;
+static volatile button_state_t pause_button = RELEASED;
+static volatile button_state_t mode_button = RELEASED;
+static struct timespec t_init;
+
+/*******************************************************************************
+* scripted radio from MIPSIM_DSM
+*******************************************************************************/
+#define MAX_DSM_SEGMENTS 32
+typedef struct dsm_segment_t{
+	int ch;
+	float value;
+	double t0, t1;
+}dsm_segment_t;
+static dsm_segment_t dsm_segments[MAX_DSM_SEGMENTS];
+static int n_dsm_segments = 0;
+static _Atomic float dsm_ch[DSM_CHANNELS+1];
+static _Atomic int dsm_new = 0;
+static int dsm_running = 0;
+static int (*dsm_func)(void) = NULL;
+
+/*******************************************************************************
+* scripted pushes from MIPSIM_PUSH
+*******************************************************************************/
+#define MAX_PUSHES 16
+typedef struct push_t{
+	double t;
+	double dv;				// added to theta_dot (rad/s)
+	int done;
+}push_t;
+static push_t pushes[MAX_PUSHES];
+static int n_pushes = 0;
+
+/*******************************************************************************
+* scripted stalls from MIPSIM_STALL
+*******************************************************************************/
+#define MAX_STALLS 8
+typedef struct stall_t{
+	double t, dur;
+	long ns;				// each set_motor() from the interrupt takes this
+}stall_t;
+static stall_t stalls[MAX_STALLS];
+static int n_stalls = 0;
+
+/*******************************************************************************
+* hardware state, written from the program's threads and the IMU thread
+*******************************************************************************/
+static volatile state_t state = UNINITIALIZED;
+static _Atomic int motors_enabled = 0;
+static _Atomic int driven = 0;		// duty written since motors enabled
+static _Atomic float duty[CHANNELS];
+static _Atomic float v_term;			// battery terminal voltage
+static _Atomic int enc_raw[CHANNELS];
+static _Atomic int enc_offset[CHANNELS];
+static int (*imu_func)(void) = NULL;
+static int (*pause_pressed_func)(void) = NULL;
+static int (*pause_released_func)(void) = NULL;
+static int (*mode_pressed_func)(void) = NULL;
+static int (*mode_released_func)(void) = NULL;
+
+/*******************************************************************************
+* plant and IMU thread
+*******************************************************************************/
+static mip_plant_t plant;
+static imu_data_t* imu_data = NULL;
+static pthread_t imu_thread;
+static volatile int imu_running = 0;
+static int imu_rate = 100;
+static int held = 1;				// robot still in the hand
+
+// run summary
+static double sim_time = 0;
+static double time_enabled = 0;
+static double max_theta = 0;		// once out of the hand
+static int n_dropped = 0, n_repeated = 0, n_stalled = 0;
+
+/*******************************************************************************
+* random numbers for sensor noise
+*******************************************************************************/
+static double uniform(){
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return ((rng*0x2545F4914F6CDD1DULL) >> 11) * (1.0/9007199254740992.0);
+}
+
+static double gaussian(){
+	double u1 = uniform(), u2 = uniform();
+	if(u1<1e-300) u1 = 1e-300;
+	return sqrt(-2.0*log(u1))*cos(TWO_PI*u2);
+}
+
+static double env_or(const char* name, double def){
+	const char* s = getenv(name);
+	return (s!=NULL && *s) ? atof(s) : def;
+}
+
+/*******************************************************************************
+* int parse_buttons()
+*
+* "pause@1.0+0.1,mode@3+2.5" presses pause at 1.0 s for 0.1 s and mode at
+* 3 s for 2.5 s. Edges are kept sorted by time.
+*******************************************************************************/
+static int parse_buttons(const char* s){
+	char name[16];
+	double t, hold;
+	int n, i, j, mode;
+	button_edge_t e;
+	while(s!=NULL && *s){
+		if(sscanf(s, "%15[a-z]@%lf+%lf%n", name, &t, &hold, &n)!=3){
+			printf("ERROR: MIPSIM_BUTTONS wants name@time+hold,...\n");
+			return -1;
+		}
+		mode = !strcmp(name, "mode");
+		if(!mode && strcmp(name, "pause")){
+			printf("ERROR: MIPSIM_BUTTONS button must be pause or mode\n");
+			return -1;
+		}
+		for(i=0;i<2 && n_button_edges<MAX_BUTTON_EDGES;i++){
+			e.t = t + i*hold;
+			e.mode = mode;
+			e.pressed = !i;
+			for(j=n_button_edges;j>0 && button_edges[j-1].t>e.t;j--){
+				button_edges[j] = button_edges[j-1];
+			}
+			button_edges[j] = e;
+			n_button_edges++;
+		}
+		s += n;
+		if(*s==',') s++;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* void* button_loop()
+*
+* Plays the script like the library's button threads would, the level
+* changes first and then the callback runs.
+*******************************************************************************/
+static void* button_loop(void* ptr){
+	struct timespec ts;
+	double t;
+	int i, (*func)(void);
+	for(i=0;i<n_button_edges && state!=EXITING;i++){
+		t = button_edges[i].t;
+		ts = t_init;
+		ts.tv_sec += (time_t)t;
+		ts.tv_nsec += (long)((t - (time_t)t)*1e9);
+		if(ts.tv_nsec>=1000000000L){
+			ts.tv_nsec -= 1000000000L;
+			ts.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		if(button_edges[i].mode){
+			mode_button = button_edges[i].pressed ? PRESSED : RELEASED;
+			func = button_edges[i].pressed ? mode_pressed_func \
+											: mode_released_func;
+		}
+		else{
+			pause_button = button_edges[i].pressed ? PRESSED : RELEASED;
+			func = button_edges[i].pressed ? pause_pressed_func \
+											: pause_released_func;
+		}
+		if(func!=NULL) func();
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* double since_init()
+*******************************************************************************/
+static double since_init(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec-t_init.tv_sec) + (ts.tv_nsec-t_init.tv_nsec)/1e9;
+}
+
+/*******************************************************************************
+* int parse_dsm()
+*
+* "3=0.5@5+2,2=-1@8+1", channel=value@start+duration
+*******************************************************************************/
+static int parse_dsm(const char* s){
+	dsm_segment_t* g;
+	double dur;
+	int n;
+	while(s!=NULL && *s && n_dsm_segments<MAX_DSM_SEGMENTS){
+		g = &dsm_segments[n_dsm_segments];
+		if(sscanf(s, "%d=%f@%lf+%lf%n", &g->ch, &g->value, &g->t0, &dur, \
+																&n)!=4 \
+				|| g->ch<1 || g->ch>DSM_CHANNELS){
+			printf("ERROR: MIPSIM_DSM wants channel=value@time+hold,...\n");
+			return -1;
+		}
+		g->t1 = g->t0 + dur;
+		mipsim_score_event(g->t0);
+		mipsim_score_event(g->t1);
+		n_dsm_segments++;
+		s += n;
+		if(*s==',') s++;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* void* dsm_loop()
+*
+* One frame per MIPSIM_DSM_PERIOD with the sticks the script says, like the
+* library's serial thread: channels update, then the new data callback.
+*******************************************************************************/
+static void* dsm_loop(void* ptr){
+	struct timespec next;
+	const long period_ns = MIPSIM_DSM_PERIOD*1e9;
+	float v[DSM_CHANNELS+1];
+	double t;
+	int i, (*func)(void);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while(state!=EXITING){
+		next.tv_nsec += period_ns;
+		if(next.tv_nsec>=1000000000L){
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		t = since_init();
+		for(i=0;i<=DSM_CHANNELS;i++) v[i] = 0;
+		for(i=0;i<n_dsm_segments;i++){
+			if(t>=dsm_segments[i].t0 && t<dsm_segments[i].t1){
+				v[dsm_segments[i].ch] = dsm_segments[i].value;
+			}
+		}
+		for(i=0;i<=DSM_CHANNELS;i++) atomic_store(&dsm_ch[i], v[i]);
+		atomic_store(&dsm_new, 1);
+		func = dsm_func;
+		if(func!=NULL) func();
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* int parse_push()
+*
+* "1.5@6,-1@9", theta_dot change in rad/s @ time
+*******************************************************************************/
+static int parse_push(const char* s){
+	push_t* g;
+	int n;
+	while(s!=NULL && *s && n_pushes<MAX_PUSHES){
+		g = &pushes[n_pushes];
+		if(sscanf(s, "%lf@%lf%n", &g->dv, &g->t, &n)!=2){
+			printf("ERROR: MIPSIM_PUSH wants dv@time,...\n");
+			return -1;
+		}
+		g->done = 0;
+		mipsim_score_event(g->t);
+		n_pushes++;
+		s += n;
+		if(*s==',') s++;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int parse_stall()
+*
+* "6000@5+1,3000@8+0.5", set_motor() blocks 6000 us in the interrupt from
+* 5 s for 1 s, then 3000 us from 8 s for half a second
+*******************************************************************************/
+static int parse_stall(const char* s){
+	stall_t* g;
+	double us;
+	int n;
+	while(s!=NULL && *s && n_stalls<MAX_STALLS){
+		g = &stalls[n_stalls];
+		if(sscanf(s, "%lf@%lf+%lf%n", &us, &g->t, &g->dur, &n)!=3){
+			printf("ERROR: MIPSIM_STALL wants us@time+duration,...\n");
+			return -1;
+		}
+		g->ns = us*1000;
+		n_stalls++;
+		s += n;
+		if(*s==',') s++;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* void stall()
+*
+* Blocks the interrupt in set_motor() while a stall is scripted, the way a
+* driver write or a page fault would.
+*******************************************************************************/
+static void stall(){
+	struct timespec ts = {0, 0};
+	int i;
+	if(!pthread_equal(pthread_self(), imu_thread)) return;
+	for(i=0;i<n_stalls;i++){
+		if(sim_time>=stalls[i].t && sim_time<stalls[i].t+stalls[i].dur){
+			ts.tv_sec = stalls[i].ns/1000000000L;
+			ts.tv_nsec = stalls[i].ns%1000000000L;
+			nanosleep(&ts, NULL);
+			n_stalled++;
+			return;
+		}
+	}
+}
+
+/*******************************************************************************
+* void on_sigint()
+*******************************************************************************/
+static void on_sigint(int sig){
+	state = EXITING;
+}
+
+/*******************************************************************************
+* int initialize_cape()
+*******************************************************************************/
+int initialize_cape(){
+	pthread_t button_thread;
+	int i;
+	// before any thread starts or the clock is read
+	if(env_or("MIPSIM_VIRTUAL", 0)) mipsim_vtime_start();
+	duration = env_or("MIPSIM_DURATION", duration);
+	theta0 = env_or("MIPSIM_THETA0", theta0);
+	noise = env_or("MIPSIM_NOISE", noise);
+	gyro_noise = env_or("MIPSIM_GYRO_NOISE", gyro_noise);
+	accel_noise = env_or("MIPSIM_ACCEL_NOISE", accel_noise);
+	v_batt = env_or("MIPSIM_VBATT", v_batt);
+	v_drain = env_or("MIPSIM_VDRAIN", v_drain);
+	atomic_init(&v_term, v_batt);
+	rng = (uint64_t)env_or("MIPSIM_SEED", 1);
+	if(rng==0) rng = 1;
+	hold = env_or("MIPSIM_HOLD", hold);
+	cpu = env_or("MIPSIM_CPU", cpu);
+	drop_every = env_or("MIPSIM_DROP", drop_every);
+	repeat_every = env_or("MIPSIM_REPEAT", repeat_every);
+	jitter = env_or("MIPSIM_JITTER", jitter)*1e-6;
+	score_path = getenv("MIPSIM_SCORE");
+	if(getenv("MIPSIM_SCENARIO")) scenario = getenv("MIPSIM_SCENARIO");
+
+	for(i=0;i<CHANNELS;i++){
+		atomic_init(&duty[i], 0.0f);
+		atomic_init(&enc_raw[i], 0);
+		atomic_init(&enc_offset[i], 0);
+	}
+	mip_plant_reset(&plant, theta0);
+	signal(SIGINT, on_sigint);
+	clock_gettime(CLOCK_MONOTONIC, &t_init);
+	if(parse_buttons(getenv("MIPSIM_BUTTONS"))) return -1;
+	if(parse_dsm(getenv("MIPSIM_DSM"))) return -1;
+	if(parse_push(getenv("MIPSIM_PUSH"))) return -1;
+	if(parse_stall(getenv("MIPSIM_STALL"))) return -1;
+	for(i=0;i<=DSM_CHANNELS;i++) atomic_init(&dsm_ch[i], 0.0f);
+	if(n_button_edges){
+		pthread_create(&button_thread, NULL, button_loop, NULL);
+		pthread_detach(button_thread);
+	}
+	printf("mipsim: %.1f s, theta0 %.3f rad, noise %.2f, vbatt %.2f V%s\n", \
+					duration, theta0, noise, v_batt, \
+					mipsim_vtime_active() ? ", virtual time" : "");
+	return 0;
+}
+
+/*******************************************************************************
+* int cleanup_cape()
+*
+* Print how the run went.
+*******************************************************************************/
+int cleanup_cape(){
+	power_off_imu();
+	printf("\nmipsim: ran %.2f s, motors on %.2f s, max |theta| %.3f rad\n", \
+									sim_time, time_enabled, max_theta);
+	printf("mipsim: theta %.3f rad, phi %.2f rad, gamma %.2f rad, %s\n", \
+			plant.theta, plant.phi, mip_plant_gamma(&plant), \
+			plant.fallen ? "FELL OVER" : (held ? "never released" : "upright"));
+	if(drop_every || repeat_every){
+		printf("mipsim: dropped %d and repeated %d interrupts\n", \
+											n_dropped, n_repeated);
+	}
+	if(n_stalls) printf("mipsim: stalled %d motor writes\n", n_stalled);
+	mipsim_mpu_print();
+	if(score_path!=NULL && *score_path){
+		mipsim_score_write(score_path, MIPSIM_PROGRAM, scenario, &plant);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* state, LEDs, buttons, cpu
+*******************************************************************************/
+state_t get_state(){
+	return state;
+}
+
+int set_state(state_t new_state){
+	state = new_state;
+	return 0;
+}
+
+int set_led(led_t led, int on){
+	return 0;
+}
+
+int blink_led(led_t led, float hz, float period){
+	int i, n = period*100;
+	for(i=0;i<n && state!=EXITING;i++) usleep(10000);
+	return 0;
+}
+
+int set_pause_pressed_func(int (*func)(void)){
+	pause_pressed_func = func;
+	return 0;
+}
+
+int set_pause_released_func(int (*func)(void)){
+	pause_released_func = func;
+	return 0;
+}
+
+int set_mode_pressed_func(int (*func)(void)){
+	mode_pressed_func = func;
+	return 0;
+}
+
+int set_mode_released_func(int (*func)(void)){
+	mode_released_func = func;
+	return 0;
+}
+
+button_state_t get_pause_button(){
+	return pause_button;
+}
+
+button_state_t get_mode_button(){
+	return mode_button;
+}
+
+int set_cpu_frequency(cpu_frequency_t freq){
+	return 0;
+}
+
+/*******************************************************************************
+* motors and encoders
+*******************************************************************************/
+int enable_motors(){
+	atomic_store(&driven, 0);
+	atomic_store(&motors_enabled, 1);
+	return 0;
+}
+
+int disable_motors(){
+	atomic_store(&motors_enabled, 0);
+	return 0;
+}
+
+int set_motor(int motor, float d){
+	if(motor<1 || motor>=CHANNELS){
+		printf("ERROR: motor channel must be 1 to %d\n", CHANNELS-1);
+		return -1;
+	}
+	atomic_store(&duty[motor], d);
+	if(d!=0 && atomic_load(&motors_enabled)) atomic_store(&driven, 1);
+	if(n_stalls) stall();
+	return 0;
+}
+
+int set_motor_all(float d){
+	int i;
+	for(i=1;i<CHANNELS;i++) set_motor(i, d);
+	return 0;
+}
+
+int get_encoder_pos(int ch){
+	if(ch<1 || ch>=CHANNELS) return 0;
+	return atomic_load(&enc_raw[ch]) - atomic_load(&enc_offset[ch]);
+}
+
+int set_encoder_pos(int ch, int value){
+	if(ch<1 || ch>=CHANNELS) return -1;
+	atomic_store(&enc_offset[ch], atomic_load(&enc_raw[ch]) - value);
+	return 0;
+}
+
+/*******************************************************************************
+* battery
+*******************************************************************************/
+float get_battery_voltage(){
+	return atomic_load(&v_term) + noise*VBATT_NOISE*gaussian();
+}
+
+/*******************************************************************************
+* radio, a transmitter is only on when MIPSIM_DSM has a script
+*******************************************************************************/
+int initialize_dsm(){
+	pthread_t dsm_thread;
+	if(dsm_running || !n_dsm_segments) return 0;
+	dsm_running = 1;
+	pthread_create(&dsm_thread, NULL, dsm_loop, NULL);
+	pthread_detach(dsm_thread);
+	return 0;
+}
+
+int set_new_dsm_data_func(int (*func)(void)){
+	dsm_func = func;
+	return 0;
+}
+
+int is_new_dsm_data(){
+	return atomic_exchange(&dsm_new, 0);
+}
+
+int is_dsm_active(){
+	return dsm_running;
+}
+
+float get_dsm_ch_normalized(int ch){
+	if(ch<1 || ch>DSM_CHANNELS) return 0;
+	return atomic_load(&dsm_ch[ch]);
+}
+
+/*******************************************************************************
+* void sample_sensors()
+*
+* Fill the encoders, imu_data and the MPU's FIFO from the plant. The board
+* is pitched back by the mount angle, theta is measured from gravity in its
+* Y-Z plane.
+*******************************************************************************/
+static void sample_sensors(){
+	const double counts = MIP_GEARBOX*MIP_ENCODER_RES/TWO_PI;
+	double board = plant.theta - MIP_CAPE_MOUNT_ANGLE;
+	double dmp, a[3], g[3];
+	int i;
+
+	atomic_store(&enc_raw[MIPSIM_ENCODER_L], \
+		(int)lround(MIPSIM_ENCODER_POL_L*mip_plant_wheel_l(&plant)*counts));
+	atomic_store(&enc_raw[MIPSIM_ENCODER_R], \
+		(int)lround(MIPSIM_ENCODER_POL_R*mip_plant_wheel_r(&plant)*counts));
+
+	if(imu_data==NULL && !mipsim_mpu_enabled()) return;
+	dmp = board + noise*DMP_NOISE*gaussian();
+	g[0] = plant.theta_dot*RAD_TO_DEG + noise*gyro_noise*gaussian();
+	g[1] = noise*gyro_noise*gaussian();
+	g[2] = noise*gyro_noise*gaussian();
+	a[0] = accel_bias[0] + noise*accel_noise*gaussian();
+	a[1] = MIP_GRAVITY*cos(board) + accel_bias[1] \
+											+ noise*accel_noise*gaussian();
+	a[2] = -MIP_GRAVITY*sin(board) + accel_bias[2] \
+											+ noise*accel_noise*gaussian();
+	mipsim_mpu_push(a, g);
+	if(imu_data==NULL) return;
+	imu_data->dmp_TaitBryan[TB_PITCH_X] = dmp;
+	imu_data->dmp_TaitBryan[TB_ROLL_Y] = 0;
+	imu_data->dmp_TaitBryan[TB_YAW_Z] = mip_plant_gamma(&plant);
+	for(i=0;i<3;i++){
+		imu_data->gyro[i] = g[i];
+		imu_data->accel[i] = a[i];
+	}
+}
+
+/*******************************************************************************
+* void* imu_loop()
+*
+* One plant step and one interrupt per sample, on an absolute schedule so the
+* rate doesn't drift with the work done in the interrupt function.
+*******************************************************************************/
+static void* imu_loop(void* ptr){
+	struct timespec next;
+	const double dt = 1.0/imu_rate;
+	const long period_ns = 1000000000L/imu_rate;
+	struct timespec c0, c1, late = {0, 0};
+	double duty_l, duty_r;
+	uint64_t n_steps = 0;
+	int i, enabled;
+	struct sched_param param = {.sched_priority = 80};
+	cpu_set_t cpus;
+
+	// best effort, needs root like on the BeagleBone
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if(cpu>=0){
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		if(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)){
+			printf("ERROR: mipsim can't pin the IMU thread to cpu %d\n", cpu);
+		}
+	}
+	mipsim_score_init(dt);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while(imu_running){
+		next.tv_nsec += period_ns;
+		if(next.tv_nsec>=1000000000L){
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		if(!imu_running) break;
+
+		enabled = atomic_load(&motors_enabled);
+		duty_l = MIPSIM_MOTOR_POL_L*atomic_load(&duty[MIPSIM_MOTOR_L]);
+		duty_r = MIPSIM_MOTOR_POL_R*atomic_load(&duty[MIPSIM_MOTOR_R]);
+		if(held && !hold && enabled && atomic_load(&driven)){
+			held = 0;
+			mipsim_score_event(sim_time);
+		}
+		for(i=0;i<n_pushes && !held;i++){
+			if(!pushes[i].done && sim_time>=pushes[i].t){
+				plant.theta_dot += pushes[i].dv;
+				pushes[i].done = 1;
+			}
+		}
+		mip_plant_step(&plant, duty_l, duty_r, atomic_load(&v_term), \
+															enabled, dt);
+		// cells drain at v_drain and sag with the current drawn
+		atomic_store(&v_term, v_batt - v_drain*sim_time/60.0 \
+				- MIP_BATTERY_RESISTANCE*(plant.current + MIP_BOARD_CURRENT));
+		if(held){
+			plant.theta = theta0;
+			plant.theta_dot = 0;
+			plant.phi_dot = 0;
+			plant.psi_dot = 0;
+		}
+		else{
+			if(fabs(plant.theta)>max_theta) max_theta = fabs(plant.theta);
+			mipsim_score_sample(sim_time, &plant, enabled*duty_l, \
+												enabled*duty_r);
+		}
+		sample_sensors();
+
+		sim_time += dt;
+		if(enabled) time_enabled += dt;
+		n_steps++;
+
+		// interrupt timing faults, if asked for
+		if(imu_func!=NULL && drop_every && n_steps%drop_every==0){
+			n_dropped++;
+		}
+		else if(imu_func!=NULL){
+			if(jitter>0){
+				late.tv_nsec = jitter*uniform()*1e9;
+				nanosleep(&late, NULL);
+			}
+			clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c0);
+			imu_func();
+			clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c1);
+			if(enabled) mipsim_score_cost((c1.tv_sec-c0.tv_sec)*1000000000LL \
+												+ (c1.tv_nsec-c0.tv_nsec));
+			if(repeat_every && n_steps%repeat_every==0){
+				n_repeated++;
+				imu_func();
+			}
+		}
+		if(sim_time>=duration && state!=EXITING){
+			printf("\nmipsim: %.1f s done\n", duration);
+			state = EXITING;
+		}
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* IMU setup and teardown
+*******************************************************************************/
+imu_config_t get_default_imu_config(){
+	imu_config_t conf;
+	conf.dmp_sample_rate = 100;
+	conf.orientation = ORIENTATION_Z_UP;
+	return conf;
+}
+
+int initialize_imu_dmp(imu_data_t* data, imu_config_t conf){
+	if(conf.dmp_sample_rate<4 || conf.dmp_sample_rate>1000){
+		printf("ERROR: dmp_sample_rate must be 4 to 1000\n");
+		return -1;
+	}
+	imu_data = data;
+	sample_sensors();
+	return mipsim_imu_start(conf.dmp_sample_rate);
+}
+
+/*******************************************************************************
+* int mipsim_imu_start()
+*
+* The sample thread on its own, for the MPU's FIFO when there is no DMP.
+* Does nothing if it's already running.
+*******************************************************************************/
+int mipsim_imu_start(int rate_hz){
+	if(imu_running) return 0;
+	imu_rate = rate_hz;
+	imu_running = 1;
+	if(pthread_create(&imu_thread, NULL, imu_loop, NULL)){
+		printf("ERROR: failed to start imu thread\n");
+		imu_running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+int set_imu_interrupt_func(int (*func)(void)){
+	imu_func = func;
+	return 0;
+}
+
+int stop_imu_interrupt_func(){
+	imu_func = NULL;
+	return 0;
+}
+
+int power_off_imu(){
+	if(!imu_running) return 0;
+	imu_running = 0;
+	pthread_join(imu_thread, NULL);
+	return 0;
+}
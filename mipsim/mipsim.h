@@ -0,0 +1,217 @@
+/*******************************************************************************
+* mipsim.h
+* By: Stuart Sonatina
+*
+* Host simulator standing in for the robotics cape library. The balance
+* programs include this instead of roboticscape.h when built with -DMIP_SIM
+* (see mipsim/Makefile) and run unchanged on a desktop against the plant in
+* mip_plant.c.
+*
+* The IMU interrupt is a real time thread at dmp_sample_rate that advances
+* the plant one sample, fills imu_data_t and calls the interrupt function.
+* Motors, encoders and the battery are wired to the plant. A "hand" holds the
+* robot still at MIPSIM_THETA0 until the motors are enabled and driven, so
+* the programs' pickup detection works as on the bench.
+*
+* Programs reading the MPU's FIFO themselves get it over I2C instead, the
+* same thread fills it at the rate they set, see mipsim_mpu.h.
+*
+* Wiring is compile time since every program hooks the motors up its own way:
+*	MIPSIM_MOTOR_L, MIPSIM_MOTOR_R			motor channels of each wheel
+*	MIPSIM_MOTOR_POL_L, MIPSIM_MOTOR_POL_R	duty sign that drives it forward
+*	MIPSIM_ENCODER_L, MIPSIM_ENCODER_R		encoder channels
+*	MIPSIM_ENCODER_POL_L, MIPSIM_ENCODER_POL_R
+*
+* Run time settings come from the environment:
+*	MIPSIM_DURATION		seconds until the sim sets EXITING (default 10)
+*	MIPSIM_THETA0		lean the hand holds the robot at (default 0.05 rad)
+*	MIPSIM_NOISE		sensor noise scale, 0 for perfect sensors (default 1)
+*	MIPSIM_GYRO_NOISE	gyro noise of each sample (default 0.1 deg/s rms)
+*	MIPSIM_ACCEL_NOISE	accel noise of each sample (default 0.03 m/s^2 rms)
+*	MIPSIM_VBATT		open circuit battery voltage (default 7.4), the
+*						reading sags with motor current
+*	MIPSIM_VDRAIN		battery discharge in V/min (default 0)
+*	MIPSIM_SEED			noise seed (default 1)
+*	MIPSIM_BUTTONS		scripted presses, "pause@1.0+0.1,mode@3+2.5" holds
+*						pause at 1 s for 0.1 s then mode at 3 s for 2.5 s
+*	MIPSIM_DSM			scripted sticks, "3=0.5@5+2,2=-1@8+1" holds channel
+*						3 at 0.5 from 5 s for 2 s then channel 2 at -1 from
+*						8 s for 1 s. Frames come every MIPSIM_DSM_PERIOD.
+*	MIPSIM_PUSH			scripted pushes, "1.5@6,-1@9" adds 1.5 rad/s to the
+*						body's pitch rate at 6 s and -1 rad/s at 9 s
+*	MIPSIM_SCORE		file to append the run's metrics to as a JSON line,
+*						see mipsim_score.h
+*	MIPSIM_SCENARIO		name the score line carries
+*	MIPSIM_HOLD			1 keeps the robot in the hand the whole run, the
+*						armed controller runs every sample without falling
+*	MIPSIM_CPU			pin the IMU thread to this CPU
+*	MIPSIM_DROP			1 in n interrupts never comes, the plant steps on
+*	MIPSIM_REPEAT		1 in n interrupts comes twice with the same sample
+*	MIPSIM_JITTER		interrupts come up to this many us late
+*	MIPSIM_STALL		scripted stalls, "6000@5+1" makes set_motor() in the
+*						interrupt block 6000 us from 5 s for 1 s
+*	MIPSIM_VIRTUAL		1 runs on a virtual clock, as fast as the CPU allows
+*						and the same every time, see mipsim_vtime.h
+*******************************************************************************/
+
+#ifndef MIPSIM_H
+#define MIPSIM_H
+
+// everything roboticscape-usefulincludes.h would have brought in
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#define DEG_TO_RAD		0.0174532925199
+#define RAD_TO_DEG		57.295779513
+#define TWO_PI			6.28318530718
+
+/*******************************************************************************
+* program state, LEDs, buttons, cpu
+*******************************************************************************/
+typedef enum state_t{
+	UNINITIALIZED,
+	RUNNING,
+	PAUSED,
+	EXITING
+}state_t;
+
+typedef enum led_t{
+	GREEN,
+	RED
+}led_t;
+
+typedef enum button_state_t{
+	RELEASED,
+	PRESSED
+}button_state_t;
+
+typedef enum cpu_frequency_t{
+	FREQ_ONDEMAND,
+	FREQ_300MHZ,
+	FREQ_600MHZ,
+	FREQ_800MHZ,
+	FREQ_1000MHZ
+}cpu_frequency_t;
+
+int initialize_cape();
+int cleanup_cape();
+state_t get_state();
+int set_state(state_t new_state);
+int set_led(led_t led, int state);
+int blink_led(led_t led, float hz, float period);
+int set_pause_pressed_func(int (*func)(void));
+int set_pause_released_func(int (*func)(void));
+int set_mode_pressed_func(int (*func)(void));
+int set_mode_released_func(int (*func)(void));
+button_state_t get_pause_button();
+button_state_t get_mode_button();
+int set_cpu_frequency(cpu_frequency_t freq);
+
+/*******************************************************************************
+* motors, encoders, battery, radio
+*******************************************************************************/
+int enable_motors();
+int disable_motors();
+int set_motor(int motor, float duty);
+int set_motor_all(float duty);
+int get_encoder_pos(int ch);
+int set_encoder_pos(int ch, int value);
+float get_battery_voltage();
+int initialize_dsm();
+int set_new_dsm_data_func(int (*func)(void));
+int is_new_dsm_data();
+int is_dsm_active();
+float get_dsm_ch_normalized(int ch);
+
+/*******************************************************************************
+* IMU
+*******************************************************************************/
+enum{
+	TB_PITCH_X,
+	TB_ROLL_Y,
+	TB_YAW_Z
+};
+
+typedef enum imu_orientation_t{
+	ORIENTATION_Z_UP,
+	ORIENTATION_Z_DOWN,
+	ORIENTATION_X_UP,
+	ORIENTATION_X_DOWN,
+	ORIENTATION_Y_UP,
+	ORIENTATION_Y_DOWN
+}imu_orientation_t;
+
+typedef struct imu_data_t{
+	float accel[3];				// m/s^2
+	float gyro[3];				// deg/s
+	float dmp_TaitBryan[3];		// rad
+}imu_data_t;
+
+typedef struct imu_config_t{
+	int dmp_sample_rate;
+	imu_orientation_t orientation;
+}imu_config_t;
+
+imu_config_t get_default_imu_config();
+int initialize_imu_dmp(imu_data_t* data, imu_config_t conf);
+int set_imu_interrupt_func(int (*func)(void));
+int stop_imu_interrupt_func();
+int power_off_imu();
+
+/*******************************************************************************
+* I2C, only the MPU-9250 on bus 2 answers, see mipsim_mpu.h
+*******************************************************************************/
+int i2c_init(int bus, uint8_t devAddr);
+int i2c_close(int bus);
+int i2c_set_device_address(int bus, uint8_t devAddr);
+int i2c_claim_bus(int bus);
+int i2c_release_bus(int bus);
+int i2c_read_byte(int bus, uint8_t regAddr, uint8_t* data);
+int i2c_read_bytes(int bus, uint8_t regAddr, uint8_t length, uint8_t* data);
+int i2c_write_byte(int bus, uint8_t regAddr, uint8_t data);
+int i2c_write_bytes(int bus, uint8_t regAddr, uint8_t length, uint8_t* data);
+
+/*******************************************************************************
+* discrete filters, same behaviour as the library's d_filter_t
+*******************************************************************************/
+#define MIPSIM_FILTER_MAX_ORDER	8
+
+typedef struct d_filter_t{
+	int order;
+	float dt;
+	float gain;
+	float numerator[MIPSIM_FILTER_MAX_ORDER+1];
+	float denominator[MIPSIM_FILTER_MAX_ORDER+1];
+	float in_buf[MIPSIM_FILTER_MAX_ORDER+1];	// [0] newest
+	float out_buf[MIPSIM_FILTER_MAX_ORDER+1];
+	float newest_input;
+	float newest_output;
+	int sat_en;
+	float sat_min, sat_max;
+	int sat_flag;
+	int ss_en;
+	float ss_steps;
+	uint64_t step;
+	int initialized;
+}d_filter_t;
+
+d_filter_t create_filter(int order, float dt, float* num, float* den);
+d_filter_t create_pid(float kp, float ki, float kd, float Tf, float dt);
+d_filter_t create_first_order_lowpass(float dt, float time_constant);
+d_filter_t create_first_order_highpass(float dt, float time_constant);
+float march_filter(d_filter_t* f, float new_input);
+int reset_filter(d_filter_t* f);
+int enable_saturation(d_filter_t* f, float min, float max);
+int enable_soft_start(d_filter_t* f, float seconds);
+int did_filter_saturate(d_filter_t* f);
+int saturate_float(float* val, float min, float max);
+
+#endif //MIPSIM_H
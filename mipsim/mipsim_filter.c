@@ -0,0 +1,183 @@
+/*******************************************************************************
+* mipsim_filter.c
+* By: Stuart Sonatina
+*
+* d_filter_t for the simulator, following the robotics cape library so the
+* controllers see the same gain, saturation and soft start behaviour.
+*******************************************************************************/
+
+#include "mipsim.h"
+
+/*******************************************************************************
+* d_filter_t create_filter()
+*
+* Transfer function num/den in z^-1 with order+1 coefficients each.
+*******************************************************************************/
+d_filter_t create_filter(int order, float dt, float* num, float* den){
+	d_filter_t f;
+	int i;
+	memset(&f, 0, sizeof(f));
+	if(order<0 || order>MIPSIM_FILTER_MAX_ORDER){
+		printf("ERROR: create_filter, order must be 0 to %d\n", \
+											MIPSIM_FILTER_MAX_ORDER);
+		return f;
+	}
+	if(den[0]==0){
+		printf("ERROR: create_filter, den[0] must not be 0\n");
+		return f;
+	}
+	f.order = order;
+	f.dt = dt;
+	f.gain = 1.0;
+	// normalize so den[0] is 1
+	for(i=0;i<=order;i++){
+		f.numerator[i] = num[i]/den[0];
+		f.denominator[i] = den[i]/den[0];
+	}
+	f.initialized = 1;
+	return f;
+}
+
+/*******************************************************************************
+* d_filter_t create_pid()
+*
+* kp + ki/s + kd*s/(Tf*s+1) discretized with forward euler.
+*******************************************************************************/
+d_filter_t create_pid(float kp, float ki, float kd, float Tf, float dt){
+	float num[3], den[3];
+	float c = Tf, d = dt-Tf;
+	if(kd==0){
+		num[0] = kp + ki*dt;
+		num[1] = -kp;
+		den[0] = 1;
+		den[1] = -1;
+		return create_filter(1, dt, num, den);
+	}
+	if(Tf<=dt/2){
+		printf("ERROR: create_pid, Tf must be > dt/2 for stability\n");
+		Tf = dt;
+		c = Tf;
+		d = dt-Tf;
+	}
+	num[0] = kp*c + kd;
+	num[1] = kp*(d-c) + ki*dt*c - 2*kd;
+	num[2] = -kp*d + ki*dt*d + kd;
+	den[0] = c;
+	den[1] = d-c;
+	den[2] = -d;
+	return create_filter(2, dt, num, den);
+}
+
+/*******************************************************************************
+* first order lowpass and highpass with time constant tc
+*******************************************************************************/
+d_filter_t create_first_order_lowpass(float dt, float time_constant){
+	float c = dt/time_constant;
+	float num[2] = {c, 0};
+	float den[2] = {1, c-1};
+	return create_filter(1, dt, num, den);
+}
+
+d_filter_t create_first_order_highpass(float dt, float time_constant){
+	float c = dt/time_constant;
+	float num[2] = {1-c, c-1};
+	float den[2] = {1, c-1};
+	return create_filter(1, dt, num, den);
+}
+
+/*******************************************************************************
+* float march_filter()
+*
+* Push one input through the filter and return the new output.
+*******************************************************************************/
+float march_filter(d_filter_t* f, float new_input){
+	float out = 0, a, b;
+	int i;
+	if(!f->initialized){
+		printf("ERROR: march_filter, filter not initialized\n");
+		return 0;
+	}
+	for(i=f->order;i>0;i--) f->in_buf[i] = f->in_buf[i-1];
+	f->in_buf[0] = new_input;
+	for(i=0;i<=f->order;i++) out += f->gain*f->numerator[i]*f->in_buf[i];
+	for(i=1;i<=f->order;i++) out -= f->denominator[i]*f->out_buf[i-1];
+
+	// soft start ramps the saturation limits up from 0
+	if(f->ss_en && f->step<f->ss_steps){
+		a = f->sat_max*(f->step/f->ss_steps);
+		b = f->sat_min*(f->step/f->ss_steps);
+		if(out>a) out = a;
+		if(out<b) out = b;
+	}
+	f->sat_flag = 0;
+	if(f->sat_en){
+		if(out>f->sat_max){
+			out = f->sat_max;
+			f->sat_flag = 1;
+		}
+		else if(out<f->sat_min){
+			out = f->sat_min;
+			f->sat_flag = 1;
+		}
+	}
+
+	for(i=f->order;i>0;i--) f->out_buf[i] = f->out_buf[i-1];
+	f->out_buf[0] = out;
+	f->newest_input = new_input;
+	f->newest_output = out;
+	f->step++;
+	return out;
+}
+
+/*******************************************************************************
+* int reset_filter()
+*******************************************************************************/
+int reset_filter(d_filter_t* f){
+	memset(f->in_buf, 0, sizeof(f->in_buf));
+	memset(f->out_buf, 0, sizeof(f->out_buf));
+	f->newest_input = 0;
+	f->newest_output = 0;
+	f->sat_flag = 0;
+	f->step = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* saturation and soft start
+*******************************************************************************/
+int enable_saturation(d_filter_t* f, float min, float max){
+	if(min>=max){
+		printf("ERROR: enable_saturation, max must be more than min\n");
+		return -1;
+	}
+	f->sat_en = 1;
+	f->sat_min = min;
+	f->sat_max = max;
+	return 0;
+}
+
+int enable_soft_start(d_filter_t* f, float seconds){
+	if(!f->sat_en){
+		printf("ERROR: enable saturation before soft start\n");
+		return -1;
+	}
+	f->ss_en = 1;
+	f->ss_steps = seconds/f->dt;
+	return 0;
+}
+
+int did_filter_saturate(d_filter_t* f){
+	return f->sat_flag;
+}
+
+int saturate_float(float* val, float min, float max){
+	if(*val>max){
+		*val = max;
+		return 1;
+	}
+	if(*val<min){
+		*val = min;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,187 @@
+/*******************************************************************************
+* mipsim_mpu.c
+* By: Stuart Sonatina
+*
+* MPU-9250 registers and FIFO behind the I2C calls, see mipsim_mpu.h
+*******************************************************************************/
+
+#include <stdatomic.h>
+
+#include "mipsim.h"
+#include "mipsim_mpu.h"
+
+#define BUS				2
+#define ADDR			0x68
+
+#define SMPLRT_DIV		0x19
+#define CONFIG			0x1A
+#define GYRO_CONFIG		0x1B
+#define ACCEL_CONFIG	0x1C
+#define FIFO_EN			0x23
+#define INT_STATUS		0x3A
+#define USER_CTRL		0x6A
+#define PWR_MGMT_1		0x6B
+#define FIFO_COUNTH		0x72
+#define FIFO_R_W		0x74
+#define WHO_AM_I		0x75
+
+#define FIFO_OFLOW		0x10
+#define FIFO_BYTES		512
+#define FRAME			12
+
+static uint8_t regs[128];
+static uint8_t addr = 0;
+static _Atomic int enabled = 0;
+static _Atomic int overflowed = 0;
+
+// the FIFO, the IMU thread writes head and the reader tail
+static uint8_t fifo[FIFO_BYTES];
+static _Atomic uint32_t head = 0, tail = 0;
+static _Atomic uint32_t n_pushed = 0, n_dropped = 0;
+
+static void reset_regs(){
+	memset(regs, 0, sizeof(regs));
+	regs[WHO_AM_I] = 0x71;
+	regs[PWR_MGMT_1] = 0x01;
+	atomic_store(&enabled, 0);
+}
+
+static void update(){
+	atomic_store(&enabled, (regs[USER_CTRL]&0x40) && \
+				(regs[FIFO_EN]&0x78)==0x78 && !(regs[PWR_MGMT_1]&0x40));
+}
+
+static int16_t to_raw(double v, double full_scale){
+	double r = round(v/full_scale*32768.0);
+	if(r>32767) r = 32767;
+	if(r<-32768) r = -32768;
+	return (int16_t)r;
+}
+
+/*******************************************************************************
+* int mipsim_mpu_enabled(), int mipsim_mpu_push()
+*
+* From the IMU thread, one sample in m/s^2 and deg/s.
+*******************************************************************************/
+int mipsim_mpu_enabled(){
+	return atomic_load(&enabled);
+}
+
+int mipsim_mpu_push(const double* accel, const double* gyro){
+	const double a_fs = 9.80665*(2<<((regs[ACCEL_CONFIG]>>3)&3));
+	const double g_fs = 250<<((regs[GYRO_CONFIG]>>3)&3);
+	uint32_t h = atomic_load(&head);
+	int16_t v;
+	int i;
+	if(!atomic_load(&enabled)) return 0;
+	if(h-atomic_load(&tail)>FIFO_BYTES-FRAME){
+		atomic_store(&overflowed, 1);
+		atomic_fetch_add(&n_dropped, 1);
+		return 0;
+	}
+	for(i=0;i<6;i++){
+		v = i<3 ? to_raw(accel[i], a_fs) : to_raw(gyro[i-3], g_fs);
+		fifo[(h+2*i)%FIFO_BYTES] = (uint16_t)v>>8;
+		fifo[(h+2*i+1)%FIFO_BYTES] = v&0xFF;
+	}
+	atomic_store(&head, h+FRAME);
+	atomic_fetch_add(&n_pushed, 1);
+	return 1;
+}
+
+int mipsim_mpu_print(){
+	if(atomic_load(&n_pushed)==0) return 0;
+	printf("mipsim: mpu fifo took %u samples, dropped %u when full\n", \
+				atomic_load(&n_pushed), atomic_load(&n_dropped));
+	return 0;
+}
+
+/*******************************************************************************
+* I2C, only the MPU answers
+*******************************************************************************/
+static int check(int bus){
+	if(bus!=BUS || addr!=ADDR){
+		printf("ERROR: mipsim only has the MPU-9250 at 0x%02x on i2c%d\n", \
+																ADDR, BUS);
+		return -1;
+	}
+	return 0;
+}
+
+int i2c_init(int bus, uint8_t devAddr){
+	addr = devAddr;
+	if(check(bus)) return -1;
+	if(regs[WHO_AM_I]==0) reset_regs();
+	return 0;
+}
+
+int i2c_close(int bus){
+	return 0;
+}
+
+int i2c_set_device_address(int bus, uint8_t devAddr){
+	addr = devAddr;
+	return 0;
+}
+
+int i2c_claim_bus(int bus){
+	return 0;
+}
+
+int i2c_release_bus(int bus){
+	return 0;
+}
+
+int i2c_read_bytes(int bus, uint8_t regAddr, uint8_t length, uint8_t* data){
+	uint32_t t, n;
+	int i;
+	if(check(bus)) return -1;
+	if(regAddr==FIFO_R_W){
+		t = atomic_load(&tail);
+		n = atomic_load(&head) - t;
+		for(i=0;i<length;i++) data[i] = i<n ? fifo[(t+i)%FIFO_BYTES] : 0;
+		atomic_store(&tail, t + (length<n ? length : n));
+		return length;
+	}
+	if(regAddr==FIFO_COUNTH){
+		n = atomic_load(&head) - atomic_load(&tail);
+		regs[FIFO_COUNTH] = n>>8;
+		regs[FIFO_COUNTH+1] = n&0xFF;
+	}
+	if(regAddr<=INT_STATUS && regAddr+length>INT_STATUS){
+		regs[INT_STATUS] = atomic_exchange(&overflowed, 0) ? FIFO_OFLOW : 0;
+	}
+	for(i=0;i<length;i++) data[i] = regs[(regAddr+i)&0x7F];
+	return length;
+}
+
+int i2c_read_byte(int bus, uint8_t regAddr, uint8_t* data){
+	return i2c_read_bytes(bus, regAddr, 1, data)==1 ? 1 : -1;
+}
+
+int i2c_write_byte(int bus, uint8_t regAddr, uint8_t data){
+	if(check(bus)) return -1;
+	if(regAddr==PWR_MGMT_1 && (data&0x80)){
+		reset_regs();
+		atomic_store(&tail, atomic_load(&head));
+		return 0;
+	}
+	regs[regAddr&0x7F] = data;
+	if(regAddr==USER_CTRL && (data&0x04)){
+		atomic_store(&tail, atomic_load(&head));
+		regs[USER_CTRL] &= ~0x04;
+	}
+	update();
+	if(regAddr==USER_CTRL && (data&0x40)){
+		return mipsim_imu_start(1000/(1+regs[SMPLRT_DIV]));
+	}
+	return 0;
+}
+
+int i2c_write_bytes(int bus, uint8_t regAddr, uint8_t length, uint8_t* data){
+	int i;
+	for(i=0;i<length;i++){
+		if(i2c_write_byte(bus, regAddr+i, data[i])) return -1;
+	}
+	return 0;
+}
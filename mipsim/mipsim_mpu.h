@@ -0,0 +1,39 @@
+/*******************************************************************************
+* mipsim_mpu.h
+* By: Stuart Sonatina
+*
+* The cape library's I2C calls for the simulator, answering as the
+* MPU-9250 at 0x68 on bus 2 closely enough for ../common/mip_fifo.c to run
+* against it unchanged.
+*
+* The registers are plain memory except for these:
+*
+*	WHO_AM_I			reads 0x71
+*	SMPLRT_DIV			sample rate 1000/(1+div) Hz, the DLPF is assumed on
+*	GYRO_CONFIG, ACCEL_CONFIG	full scale of the FIFO data
+*	CONFIG				FIFO_MODE, when full new samples are dropped
+*	FIFO_EN				accel and gyro together (0x78) or nothing
+*	USER_CTRL			FIFO_EN starts the sim's IMU thread at the sample
+*						rate if it isn't running, FIFO_RST empties the FIFO
+*	PWR_MGMT_1			SLEEP stops filling the FIFO, H_RESET resets it all
+*	INT_STATUS			FIFO_OFLOW, cleared by reading
+*	FIFO_COUNTH/L		bytes in the FIFO
+*	FIFO_R_W			reads pop the FIFO
+*
+* The IMU thread pushes a frame of accel and gyro, big endian int16 in the
+* board's frame, each sample the FIFO is enabled. The FIFO holds 512 bytes
+* like the chip's, in a ring with one writer and one reader so a read from
+* the control thread never takes a lock.
+*******************************************************************************/
+
+#ifndef MIPSIM_MPU_H
+#define MIPSIM_MPU_H
+
+int mipsim_mpu_enabled();
+int mipsim_mpu_push(const double* accel, const double* gyro);
+int mipsim_mpu_print();
+
+// in mipsim.c, starts the IMU thread without the DMP
+int mipsim_imu_start(int rate_hz);
+
+#endif //MIPSIM_MPU_H
@@ -0,0 +1,158 @@
+/*******************************************************************************
+* mipsim_score.c
+* By: Stuart Sonatina
+*
+* Run metrics for the scorecard, see mipsim_score.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "mipsim_score.h"
+
+static double dt_s = 0.005;
+static double t_first = 0;				// first sample out of the hand
+static float theta[MIPSIM_SCORE_SAMPLES];
+static int n = 0;
+static int n_sat = 0;
+static int fell = 0;
+static double fall_t = 0;
+static double events[MIPSIM_SCORE_EVENTS];
+static int n_events = 0;
+static uint32_t cost[MIPSIM_SCORE_SAMPLES];
+static int n_cost = 0;
+
+/*******************************************************************************
+* int mipsim_score_init()
+*******************************************************************************/
+int mipsim_score_init(double dt){
+	dt_s = dt;
+	return 0;
+}
+
+/*******************************************************************************
+* int mipsim_score_event()
+*
+* A disturbance at sim time t, events after the run ends don't count.
+*******************************************************************************/
+int mipsim_score_event(double t){
+	if(n_events>=MIPSIM_SCORE_EVENTS) return -1;
+	events[n_events++] = t;
+	return 0;
+}
+
+/*******************************************************************************
+* int mipsim_score_sample()
+*
+* Plant state after the step at sim time t and the duties that drove it.
+*******************************************************************************/
+int mipsim_score_sample(double t, const mip_plant_t* p, double duty_l,
+															double duty_r){
+	if(fell || n>=MIPSIM_SCORE_SAMPLES) return 0;
+	if(n==0) t_first = t;
+	if(p->fallen){
+		fell = 1;
+		fall_t = t - t_first;
+		return 0;
+	}
+	theta[n++] = p->theta;
+	if(fabs(duty_l)>=MIPSIM_SCORE_SAT || fabs(duty_r)>=MIPSIM_SCORE_SAT){
+		n_sat++;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int mipsim_score_cost()
+*******************************************************************************/
+int mipsim_score_cost(uint64_t ns){
+	if(n_cost>=MIPSIM_SCORE_SAMPLES) return 0;
+	cost[n_cost++] = ns>UINT32_MAX ? UINT32_MAX : ns;
+	return 0;
+}
+
+static int cmp_u32(const void* a, const void* b){
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x>y) - (x<y);
+}
+
+/*******************************************************************************
+* void print_num()
+*
+* JSON number, or null when the metric doesn't exist for this run.
+*******************************************************************************/
+static void print_num(FILE* fd, const char* key, double v, int ok){
+	if(ok && isfinite(v)) fprintf(fd, ", \"%s\": %.6g", key, v);
+	else fprintf(fd, ", \"%s\": null", key);
+}
+
+/*******************************************************************************
+* int mipsim_score_write()
+*
+* Appends one line so a suite of runs builds up a JSON lines file.
+*******************************************************************************/
+int mipsim_score_write(const char* path, const char* program,
+								const char* scenario, const mip_plant_t* p){
+	double sum2 = 0, max = 0, end = 0, last = t_first, d, s, over = 0;
+	double settle = 0, mean = 0;
+	int i, k0, tail, crossed, settled = 0;
+	FILE* fd;
+
+	for(i=0;i<n;i++){
+		sum2 += theta[i]*theta[i];
+		if(fabs(theta[i])>max) max = fabs(theta[i]);
+	}
+
+	// step response to the last disturbance inside the run
+	for(i=0;i<n_events;i++){
+		if(events[i]>last && events[i]<t_first+n*dt_s) last = events[i];
+	}
+	k0 = (last-t_first)/dt_s;
+	tail = MIPSIM_SCORE_TAIL/dt_s;
+	if(!fell && n-k0>tail){
+		for(i=n-tail;i<n;i++) end += theta[i];
+		end /= tail;
+		for(i=n-1;i>=k0 && fabs(theta[i]-end)<=MIPSIM_SCORE_BAND;i--);
+		settled = i<n-tail;
+		settle = (i+1-k0)*dt_s;
+		s = crossed = 0;
+		for(i=k0;i<n;i++){
+			d = theta[i]-end;
+			if(s==0 && fabs(d)>MIPSIM_SCORE_BAND) s = d>0 ? 1 : -1;
+			if(s!=0 && s*d<=0) crossed = 1;
+			if(crossed && -s*d>over) over = -s*d;
+		}
+	}
+
+	if(n_cost) qsort(cost, n_cost, sizeof(cost[0]), cmp_u32);
+	for(i=0;i<n_cost;i++) mean += cost[i];
+	if(n_cost) mean /= n_cost;
+
+	if((fd=fopen(path, "a"))==NULL){
+		printf("ERROR: mipsim can't append the score to %s\n", path);
+		return -1;
+	}
+	fprintf(fd, "{\"program\": \"%s\", \"scenario\": \"%s\"", program, \
+															scenario);
+	print_num(fd, "released_s", n*dt_s, 1);
+	fprintf(fd, ", \"fell\": %d", fell);
+	print_num(fd, "fall_s", fall_t, fell);
+	print_num(fd, "rms_theta", sqrt(sum2/n), n>0);
+	print_num(fd, "max_theta", max, n>0);
+	print_num(fd, "overshoot", over, !fell && n-k0>tail);
+	print_num(fd, "settle_s", settle, settled);
+	print_num(fd, "saturated_s", n_sat*dt_s, 1);
+	print_num(fd, "phi_end", p->phi, 1);
+	print_num(fd, "gamma_end", mip_plant_gamma(p), 1);
+	print_num(fd, "cpu_calls", n_cost, 1);
+	print_num(fd, "cpu_min_ns", n_cost ? cost[0] : 0, n_cost>0);
+	print_num(fd, "cpu_p50_ns", n_cost ? cost[n_cost/2] : 0, n_cost>0);
+	print_num(fd, "cpu_mean_ns", mean, n_cost>0);
+	print_num(fd, "cpu_p99_ns", n_cost ? cost[(int)(0.99*(n_cost-1))] : 0, \
+																n_cost>0);
+	print_num(fd, "cpu_max_ns", n_cost ? cost[n_cost-1] : 0, n_cost>0);
+	fprintf(fd, "}\n");
+	fclose(fd);
+	return 0;
+}
@@ -0,0 +1,50 @@
+/*******************************************************************************
+* mipsim_score.h
+* By: Stuart Sonatina
+*
+* Control metrics of one simulated run, written as a line of JSON for the
+* scorecard tool when MIPSIM_SCORE names a file.
+*
+* The IMU thread hands over the true plant state every sample once the
+* robot is out of the hand, the CPU time each interrupt call took and the
+* times of disturbances: the release, pushes and stick changes. From the
+* last disturbance on, theta is compared with where it ends up, the mean of
+* the last MIPSIM_SCORE_TAIL seconds:
+*
+*	overshoot	furthest theta swings past the final value, on the other
+*				side from where the disturbance sent it (rad)
+*	settle_s	time until theta stays within MIPSIM_SCORE_BAND of the final
+*				value, null if it never does
+*
+* Over the whole time out of the hand until a fall:
+*
+*	rms_theta, max_theta	lean (rad)
+*	saturated_s				time with either duty at MIPSIM_SCORE_SAT or more
+*	fell, fall_s			whether and when it fell, from the release
+*	cpu_calls				interrupt calls while the motors are enabled
+*	cpu_min_ns, cpu_p50_ns, cpu_mean_ns, cpu_p99_ns, cpu_max_ns
+*							thread CPU time per one of those calls
+*******************************************************************************/
+
+#ifndef MIPSIM_SCORE_H
+#define MIPSIM_SCORE_H
+
+#include <stdint.h>
+
+#include "mip_plant.h"
+
+#define MIPSIM_SCORE_BAND		0.02	// rad
+#define MIPSIM_SCORE_TAIL		0.5		// s
+#define MIPSIM_SCORE_SAT		0.99	// duty
+#define MIPSIM_SCORE_SAMPLES	24000	// 120 s at 200 Hz, later ones ignored
+#define MIPSIM_SCORE_EVENTS		64
+
+int mipsim_score_init(double dt);
+int mipsim_score_event(double t);
+int mipsim_score_sample(double t, const mip_plant_t* p, double duty_l,
+															double duty_r);
+int mipsim_score_cost(uint64_t ns);
+int mipsim_score_write(const char* path, const char* program,
+								const char* scenario, const mip_plant_t* p);
+
+#endif //MIPSIM_SCORE_H
@@ -0,0 +1,379 @@
+/*******************************************************************************
+* mipsim_vtime.c
+* By: Stuart Sonatina
+*
+* Virtual clock and one-at-a-time thread scheduler, see mipsim_vtime.h
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#include "mipsim_vtime.h"
+
+#define NEVER	UINT64_MAX
+
+/*******************************************************************************
+* vthread_t
+*
+* A thread while it isn't running: when it wants to run again, NEVER for
+* a join or a wait without a deadline, and what would wake it early.
+*******************************************************************************/
+typedef struct vthread_t{
+	pthread_t tid;
+	pthread_cond_t go;			// the turn was handed to this thread
+	uint64_t wake;				// virtual ns
+	const void* obj;			// condition or semaphore waited on
+	int join;					// thread waited for, -1 none
+	int signaled;
+	int done;
+	void* (*func)(void*);
+	void* arg;
+}vthread_t;
+
+// the real calls, linked with -Wl,--wrap
+int __real_usleep(useconds_t us);
+int __real_nanosleep(const struct timespec* req, struct timespec* rem);
+int __real_clock_nanosleep(clockid_t clk, int flags,
+						const struct timespec* req, struct timespec* rem);
+int __real_clock_gettime(clockid_t clk, struct timespec* ts);
+int __real_pthread_create(pthread_t* t, const pthread_attr_t* attr,
+										void* (*func)(void*), void* arg);
+int __real_pthread_join(pthread_t t, void** ret);
+int __real_pthread_cond_timedwait(pthread_cond_t* c, pthread_mutex_t* m,
+											const struct timespec* abstime);
+int __real_pthread_cond_signal(pthread_cond_t* c);
+int __real_pthread_cond_broadcast(pthread_cond_t* c);
+int __real_sem_timedwait(sem_t* s, const struct timespec* abstime);
+int __real_sem_post(sem_t* s);
+// the scheduler's own lock isn't the program's, see mip_tripwire.h
+int __real_pthread_mutex_lock(pthread_mutex_t* m);
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static vthread_t threads[MIPSIM_VTIME_THREADS];
+static int n_threads = 0;
+static int current = -1;				// the one thread allowed to run
+static uint64_t now = 0;				// virtual ns since the start
+static uint64_t mono0, real0;			// real clocks at the start
+static _Atomic int active = 0;
+static __thread int self = -1;
+
+static uint64_t ts_ns(const struct timespec* ts){
+	return (uint64_t)ts->tv_sec*1000000000ULL + ts->tv_nsec;
+}
+
+static void ns_ts(uint64_t ns, struct timespec* ts){
+	ts->tv_sec = ns/1000000000ULL;
+	ts->tv_nsec = ns%1000000000ULL;
+}
+
+// ours to schedule: started and called from a known thread
+static int ours(){
+	return atomic_load(&active) && self>=0;
+}
+
+/*******************************************************************************
+* int mipsim_vtime_start()
+*
+* The calling thread becomes the first known one and holds the turn.
+*******************************************************************************/
+int mipsim_vtime_start(){
+	struct timespec ts;
+	if(atomic_load(&active)) return 0;
+	__real_pthread_mutex_lock(&lock);
+	__real_clock_gettime(CLOCK_MONOTONIC, &ts);
+	mono0 = ts_ns(&ts);
+	__real_clock_gettime(CLOCK_REALTIME, &ts);
+	real0 = ts_ns(&ts);
+	pthread_cond_init(&threads[0].go, NULL);
+	threads[0].tid = pthread_self();
+	threads[0].wake = NEVER;
+	threads[0].join = -1;
+	n_threads = 1;
+	current = self = 0;
+	atomic_store(&active, 1);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+int mipsim_vtime_active(){
+	return atomic_load(&active);
+}
+
+uint64_t mipsim_vtime_now(){
+	uint64_t t;
+	__real_pthread_mutex_lock(&lock);
+	t = now;
+	pthread_mutex_unlock(&lock);
+	return t;
+}
+
+/*******************************************************************************
+* void hand_on()
+*
+* With the lock held, gives the turn to the waiting thread that wakes
+* first, which may be the caller, and moves the clock to it. Nobody left
+* to wake means every thread waits on another, the run can't go on.
+*******************************************************************************/
+static void hand_on(){
+	int i, next = -1;
+	for(i=0;i<n_threads;i++){
+		if(threads[i].done || threads[i].wake==NEVER) continue;
+		if(next<0 || threads[i].wake<threads[next].wake) next = i;
+	}
+	if(next<0){
+		printf("ERROR: mipsim virtual time, every thread is waiting\n");
+		exit(-1);
+	}
+	if(threads[next].wake>now) now = threads[next].wake;
+	current = next;
+	__real_pthread_cond_signal(&threads[next].go);
+}
+
+/*******************************************************************************
+* void wait_turn()
+*
+* With the lock held, hands the turn on and sleeps until it comes back.
+* The caller sets its wake time and what else may wake it first.
+*******************************************************************************/
+static void wait_turn(){
+	vthread_t* me = &threads[self];
+	hand_on();
+	while(current!=self) pthread_cond_wait(&me->go, &lock);
+	me->wake = NEVER;
+	me->obj = NULL;
+	me->join = -1;
+}
+
+/*******************************************************************************
+* void wake_waiters()
+*
+* Waiting on obj ends now for the first thread or all of them.
+*******************************************************************************/
+static void wake_waiters(const void* obj, int all){
+	int i;
+	__real_pthread_mutex_lock(&lock);
+	for(i=0;i<n_threads;i++){
+		if(threads[i].done || threads[i].obj!=obj) continue;
+		threads[i].obj = NULL;
+		threads[i].signaled = 1;
+		threads[i].wake = now;
+		if(!all) break;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/*******************************************************************************
+* uint64_t deadline()
+*
+* Absolute time on a real clock to virtual ns. Condition variables don't
+* say which clock they use, so when clk is -1 it is whichever of
+* CLOCK_MONOTONIC and CLOCK_REALTIME the time is nearer, they are decades
+* apart.
+*******************************************************************************/
+static uint64_t deadline(clockid_t clk, const struct timespec* ts){
+	uint64_t t = ts_ns(ts), base;
+	int64_t dm = t-(mono0+now), dr = t-(real0+now);
+	if(clk==CLOCK_REALTIME) base = real0;
+	else if(clk==(clockid_t)-1) base = llabs(dm)<=llabs(dr) ? mono0 : real0;
+	else base = mono0;
+	if(t<base+now) return now;
+	return t-base;
+}
+
+static void sleep_until(uint64_t t){
+	__real_pthread_mutex_lock(&lock);
+	threads[self].wake = t<now ? now : t;
+	wait_turn();
+	pthread_mutex_unlock(&lock);
+}
+
+/*******************************************************************************
+* sleeps and clocks
+*******************************************************************************/
+int __wrap_usleep(useconds_t us){
+	if(!ours()) return __real_usleep(us);
+	sleep_until(mipsim_vtime_now() + us*1000ULL);
+	return 0;
+}
+
+int __wrap_nanosleep(const struct timespec* req, struct timespec* rem){
+	if(!ours()) return __real_nanosleep(req, rem);
+	sleep_until(mipsim_vtime_now() + ts_ns(req));
+	return 0;
+}
+
+int __wrap_clock_nanosleep(clockid_t clk, int flags,
+						const struct timespec* req, struct timespec* rem){
+	if(!ours() || (clk!=CLOCK_MONOTONIC && clk!=CLOCK_REALTIME)){
+		return __real_clock_nanosleep(clk, flags, req, rem);
+	}
+	if(flags&TIMER_ABSTIME){
+		__real_pthread_mutex_lock(&lock);
+		threads[self].wake = deadline(clk, req);
+		wait_turn();
+		pthread_mutex_unlock(&lock);
+	}
+	else sleep_until(mipsim_vtime_now() + ts_ns(req));
+	return 0;
+}
+
+int __wrap_clock_gettime(clockid_t clk, struct timespec* ts){
+	if(!atomic_load(&active)) return __real_clock_gettime(clk, ts);
+	switch(clk){
+	case CLOCK_MONOTONIC:
+	case CLOCK_MONOTONIC_RAW:
+	case CLOCK_MONOTONIC_COARSE:
+	case CLOCK_BOOTTIME:
+		ns_ts(mono0 + mipsim_vtime_now(), ts);
+		return 0;
+	case CLOCK_REALTIME:
+	case CLOCK_REALTIME_COARSE:
+		ns_ts(real0 + mipsim_vtime_now(), ts);
+		return 0;
+	default:
+		return __real_clock_gettime(clk, ts);
+	}
+}
+
+/*******************************************************************************
+* threads
+*
+* A new thread waits for its first turn, which it gets at the time it was
+* created once its creator waits. At the end it wakes its joiners and hands
+* the turn on without waiting for it back.
+*******************************************************************************/
+static void* trampoline(void* ptr){
+	vthread_t* me = ptr;
+	void* ret;
+	int i;
+
+	__real_pthread_mutex_lock(&lock);
+	self = me - threads;
+	while(current!=self) pthread_cond_wait(&me->go, &lock);
+	me->wake = NEVER;
+	pthread_mutex_unlock(&lock);
+
+	ret = me->func(me->arg);
+
+	__real_pthread_mutex_lock(&lock);
+	me->done = 1;
+	for(i=0;i<n_threads;i++){
+		if(threads[i].join==self){
+			threads[i].join = -1;
+			threads[i].wake = now;
+		}
+	}
+	hand_on();
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+int __wrap_pthread_create(pthread_t* t, const pthread_attr_t* attr,
+										void* (*func)(void*), void* arg){
+	vthread_t* v;
+	int ret;
+	if(!ours()) return __real_pthread_create(t, attr, func, arg);
+	__real_pthread_mutex_lock(&lock);
+	if(n_threads>=MIPSIM_VTIME_THREADS){
+		pthread_mutex_unlock(&lock);
+		printf("ERROR: mipsim virtual time has no room for another thread\n");
+		return EAGAIN;
+	}
+	v = &threads[n_threads];
+	pthread_cond_init(&v->go, NULL);
+	v->wake = now;
+	v->obj = NULL;
+	v->join = -1;
+	v->done = 0;
+	v->func = func;
+	v->arg = arg;
+	ret = __real_pthread_create(t, attr, trampoline, v);
+	if(ret==0){
+		v->tid = *t;
+		n_threads++;
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+int __wrap_pthread_join(pthread_t t, void** ret){
+	int i, found = -1;
+	if(ours()){
+		__real_pthread_mutex_lock(&lock);
+		for(i=1;i<n_threads && found<0;i++){
+			if(pthread_equal(threads[i].tid, t)) found = i;
+		}
+		if(found>=0 && !threads[found].done){
+			threads[self].join = found;
+			threads[self].wake = NEVER;
+			wait_turn();
+		}
+		pthread_mutex_unlock(&lock);
+	}
+	return __real_pthread_join(t, ret);
+}
+
+/*******************************************************************************
+* condition variables and semaphores
+*
+* A signal wakes the first known waiter at the current time. The real
+* signal still goes out for threads that aren't ours.
+*******************************************************************************/
+int __wrap_pthread_cond_timedwait(pthread_cond_t* c, pthread_mutex_t* m,
+											const struct timespec* abstime){
+	int signaled;
+	if(!ours()) return __real_pthread_cond_timedwait(c, m, abstime);
+	__real_pthread_mutex_lock(&lock);
+	threads[self].wake = deadline(-1, abstime);
+	threads[self].obj = c;
+	threads[self].signaled = 0;
+	pthread_mutex_unlock(m);
+	wait_turn();
+	signaled = threads[self].signaled;
+	pthread_mutex_unlock(&lock);
+	pthread_mutex_lock(m);
+	return signaled ? 0 : ETIMEDOUT;
+}
+
+int __wrap_pthread_cond_signal(pthread_cond_t* c){
+	if(atomic_load(&active)) wake_waiters(c, 0);
+	return __real_pthread_cond_signal(c);
+}
+
+int __wrap_pthread_cond_broadcast(pthread_cond_t* c){
+	if(atomic_load(&active)) wake_waiters(c, 1);
+	return __real_pthread_cond_broadcast(c);
+}
+
+int __wrap_sem_timedwait(sem_t* s, const struct timespec* abstime){
+	uint64_t t;
+	if(!ours()) return __real_sem_timedwait(s, abstime);
+	__real_pthread_mutex_lock(&lock);
+	t = deadline(CLOCK_REALTIME, abstime);
+	pthread_mutex_unlock(&lock);
+	while(sem_trywait(s)){
+		__real_pthread_mutex_lock(&lock);
+		if(now>=t){
+			pthread_mutex_unlock(&lock);
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		threads[self].wake = t;
+		threads[self].obj = s;
+		wait_turn();
+		pthread_mutex_unlock(&lock);
+	}
+	return 0;
+}
+
+int __wrap_sem_post(sem_t* s){
+	int ret = __real_sem_post(s);
+	if(atomic_load(&active)) wake_waiters(s, 0);
+	return ret;
+}
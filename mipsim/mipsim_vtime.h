@@ -0,0 +1,46 @@
+/*******************************************************************************
+* mipsim_vtime.h
+* By: Stuart Sonatina
+*
+* Virtual time for the simulated programs, on with MIPSIM_VIRTUAL=1.
+*
+* The sim links with -Wl,--wrap for the calls the programs wait and tell
+* time with (see mipsim/Makefile), so Jbalance, stubalance, the common
+* modules and mipsim itself all go through here unchanged:
+*
+*	usleep, nanosleep, clock_nanosleep
+*	clock_gettime			CLOCK_MONOTONIC and CLOCK_REALTIME (and their
+*							_RAW, _COARSE, BOOTTIME kin) read the virtual
+*							clock, the CPU time clocks stay real
+*	pthread_cond_timedwait, pthread_cond_signal, pthread_cond_broadcast
+*	sem_timedwait, sem_post
+*	pthread_create, pthread_join
+*
+* Once started, every thread created through pthread_create() is known
+* here and only one of them runs at a time. A thread runs until it sleeps
+* or waits, then the waiting thread with the earliest wake time gets to
+* run, lower creation order first on a tie, and the clock jumps to that
+* wake time. Code takes no virtual time at all, so a run goes as fast as
+* the CPU allows and the interleaving of threads, and with it the whole
+* run, is the same every time for the same settings.
+*
+* What this can't model: time spent computing. Latencies measured with
+* CLOCK_MONOTONIC come out 0 and deadlines like the MPC's never pass, use
+* real time for those. Threads started before mipsim_vtime_start() and
+* waits not listed above (pthread_mutex_lock, read) run as usual, a thread
+* blocking on one of them for another sim thread would hang the run, so
+* none of the programs do.
+*******************************************************************************/
+
+#ifndef MIPSIM_VTIME_H
+#define MIPSIM_VTIME_H
+
+#include <stdint.h>
+
+#define MIPSIM_VTIME_THREADS	32		// threads per run, slots aren't reused
+
+int mipsim_vtime_start();
+int mipsim_vtime_active();
+uint64_t mipsim_vtime_now();
+
+#endif //MIPSIM_VTIME_H
@@ -0,0 +1,220 @@
+/*******************************************************************************
+* mpc_bench.c
+* By: Stuart Sonatina
+*
+* Host tool that runs Jbalance's model predictive controller in closed loop
+* with the simulator's nonlinear plant and reports how long the solver takes
+* at 100 and 200 Hz.
+*
+* usage: mpc_bench [-H horizon] [-i max_iter] [-b budget_us] [-s seconds]
+*                  [-p push] [-n noise] [-q th,th_dot,phi,phi_dot] [-r u]
+*
+* The robot starts leaning and gets a push of p rad/s on theta_dot every
+* second, alternating forward and back, so the plan keeps running into the
+* duty limits. The controller sees the plant's state plus gaussian noise,
+* about what Jbalance's estimates carry at noise 1, which is what keeps the
+* warm start from being exact. The solve time of every step goes into a
+* mip_latency_t. A step over the budget falls back to the clipped terminal
+* LQR, Jbalance uses the D1/D2 cascade there.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "../common/mip_mpc.h"
+#include "../common/mip_latency.h"
+#include "../common/mip_model.h"
+#include "../common/mip_mat.h"
+#include "../mipsim/mip_plant.h"
+
+#define NOISE_THETA		0.001	// rad
+#define NOISE_THETA_DOT	0.02	// rad/s
+#define NOISE_PHI		0.002	// rad
+#define NOISE_PHI_DOT	0.05	// rad/s
+
+// function declarations
+int parse_list(const char* s, double* v, int n);
+int run(int rate_hz, int horizon, int max_iter, int budget_us, double seconds,
+		double push, double noise, const double* x_max, double u_weight);
+double gauss();
+double unconstrained_error(mip_mpc_t* m);
+
+/******************************************************************************
+* int main()
+******************************************************************************/
+int main(int argc, char* argv[]){
+	double x_max[MIP_MPC_STATES] = {0.05, 0.3, 1.0, 8.0};
+	double u_weight = 1.0, seconds = 20, push = 2.0, noise = 1.0;
+	int horizon = 20, max_iter = 100, budget_us = 1000, c;
+
+	while((c=getopt(argc, argv, "H:i:b:s:p:n:q:r:h"))!=-1){
+		switch(c){
+		case 'H':
+			horizon = atoi(optarg);
+			break;
+		case 'i':
+			max_iter = atoi(optarg);
+			break;
+		case 'b':
+			budget_us = atoi(optarg);
+			break;
+		case 's':
+			seconds = atof(optarg);
+			break;
+		case 'p':
+			push = atof(optarg);
+			break;
+		case 'n':
+			noise = atof(optarg);
+			break;
+		case 'q':
+			if(parse_list(optarg, x_max, MIP_MPC_STATES)) return -1;
+			break;
+		case 'r':
+			u_weight = atof(optarg);
+			break;
+		default:
+			printf("usage: %s [-H horizon] [-i max_iter] [-b budget_us] " \
+					"[-s seconds] [-p push] [-n noise] " \
+					"[-q th,th_dot,phi,phi_dot] [-r u]\n", argv[0]);
+			return -1;
+		}
+	}
+	if(seconds<=0 || budget_us<0){
+		printf("ERROR: seconds must be > 0 and budget_us >= 0\n");
+		return -1;
+	}
+	if(run(100, horizon, max_iter, budget_us, seconds, push, noise, x_max, \
+													u_weight)) return -1;
+	printf("\n");
+	return run(200, horizon, max_iter, budget_us, seconds, push, noise, \
+													x_max, u_weight);
+}
+
+/*******************************************************************************
+* int parse_list()
+*
+* n comma separated numbers, empty ones keep their default.
+*******************************************************************************/
+int parse_list(const char* s, double* v, int n){
+	char* end;
+	int i;
+	for(i=0;i<n && *s;i++){
+		if(*s!=','){
+			v[i] = strtod(s, &end);
+			if(end==s){
+				printf("ERROR: bad number in %s\n", s);
+				return -1;
+			}
+			s = end;
+		}
+		if(*s==',') s++;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int run()
+*
+* One closed loop run at rate_hz, prints the solve time distribution and
+* what the controller did.
+*******************************************************************************/
+int run(int rate_hz, int horizon, int max_iter, int budget_us, double seconds,
+		double push, double noise, const double* x_max, double u_weight){
+	static mip_mpc_t mpc;
+	const double dt = 1.0/rate_hz;
+	const long steps = seconds*rate_hz;
+	mip_latency_t solve;
+	mip_plant_t plant;
+	float x[MIP_MPC_STATES], u;
+	double worst_theta = 0;
+	long i, limited = 0, fallbacks = 0;
+	uint64_t t0;
+	int j;
+
+	if(mip_mpc_init(&mpc, horizon, dt, x_max, u_weight, max_iter)) return -1;
+	mip_latency_init(&solve, "solve", 100);
+	mip_plant_reset(&plant, 0.2);
+	srand(1);
+
+	for(i=0;i<steps && !plant.fallen;i++){
+		if(i%rate_hz==rate_hz/2) plant.theta_dot += (i/rate_hz)%2 ? -push:push;
+		x[0] = plant.theta + noise*NOISE_THETA*gauss();
+		x[1] = plant.theta_dot + noise*NOISE_THETA_DOT*gauss();
+		x[2] = plant.phi + noise*NOISE_PHI*gauss();
+		x[3] = plant.phi_dot + noise*NOISE_PHI_DOT*gauss();
+
+		t0 = mip_latency_now();
+		if(mip_mpc_solve(&mpc, x, budget_us ? t0+budget_us*1000ULL : 0, &u)<0){
+			fallbacks++;
+			u = 0;
+			for(j=0;j<MIP_MPC_STATES;j++) u -= mpc.K[j]*x[j];
+			if(u>1) u = 1;
+			if(u<-1) u = -1;
+		}
+		mip_latency_add(&solve, t0);
+
+		if(fabsf(u)>=0.999f) limited++;
+		if(fabs(plant.theta)>worst_theta) worst_theta = fabs(plant.theta);
+		mip_plant_step(&plant, u, u, MIP_V_NOMINAL, 1, dt);
+	}
+
+	printf("%d Hz, horizon %d (%.0f ms), budget %d us, %ld steps\n", \
+			rate_hz, horizon, horizon*dt*1e3, budget_us, i);
+	printf("solve time: mean %.2f us, p50 %.1f, p90 %.1f, p99 %.1f, " \
+			"p99.9 %.1f, max %.1f us\n", solve.sum/solve.n/1e3, \
+			mip_latency_percentile(&solve, 50)/1e3, \
+			mip_latency_percentile(&solve, 90)/1e3, \
+			mip_latency_percentile(&solve, 99)/1e3, \
+			mip_latency_percentile(&solve, 99.9)/1e3, solve.max/1e3);
+	mip_mpc_print(&mpc);
+	printf("duty at its limit %.1f%% of steps, %ld fallbacks, worst theta " \
+			"%.3f rad%s\n", 100.0*limited/i, fallbacks, worst_theta, \
+			plant.fallen ? ", FELL OVER" : "");
+	printf("unconstrained first duty vs terminal LQR: %.2g\n", \
+												unconstrained_error(&mpc));
+	return 0;
+}
+
+/*******************************************************************************
+* double gauss()
+*
+* Unit normal by Box-Muller.
+*******************************************************************************/
+double gauss(){
+	double u1 = (rand()+1.0)/(RAND_MAX+2.0);
+	double u2 = (rand()+1.0)/(RAND_MAX+2.0);
+	return sqrt(-2*log(u1))*cos(2*M_PI*u2);
+}
+
+/*******************************************************************************
+* double unconstrained_error()
+*
+* Checks the QP against the terminal LQR: without limits the plan is
+* -H^-1*F*x0 and its first duty has to be -Kx0 since the terminal cost is
+* the Riccati solution. Largest difference over a few states, solved
+* exactly so the solver's tolerance doesn't enter.
+*******************************************************************************/
+double unconstrained_error(mip_mpc_t* m){
+	const float xs[4][MIP_MPC_STATES] = {
+		{0.01, 0, 0, 0}, {0, 0.1, 0, 0}, {0, 0, 0.2, 0}, {0.005, 0.05, 0.1, 1}
+	};
+	const int n = m->horizon;
+	double H[n][n], Hi[n][n], u, u_lqr, err = 0;
+	int i, j, k, ok;
+
+	for(i=0;i<n;i++) for(j=0;j<n;j++) H[i][j] = m->H[i][j];
+	MIP_MAT_INV(Hi, H, n, double, ok);
+	if(!ok) return NAN;
+	for(k=0;k<4;k++){
+		u = u_lqr = 0;
+		for(i=0;i<n;i++) for(j=0;j<MIP_MPC_STATES;j++){
+			u -= Hi[0][i]*m->F[i][j]*xs[k][j];
+		}
+		for(j=0;j<MIP_MPC_STATES;j++) u_lqr -= m->K[j]*xs[k][j];
+		if(fabs(u-u_lqr)>err) err = fabs(u-u_lqr);
+	}
+	return err;
+}
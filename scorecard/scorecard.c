@@ -0,0 +1,343 @@
+/*******************************************************************************
+* scorecard.c
+* By: Stuart Sonatina
+*
+* Runs the balance programs through the same simulated scenarios and puts
+* their control metrics and CPU time per step side by side.
+*
+* usage: scorecard [-d sim_dir] [-o results.jsonl] [-b baseline.jsonl]
+*                  [-t tolerance] [-c cpu_tolerance] [-p program,...]
+*                  [-s scenario,...]
+*
+* Every run is one mipsim binary on virtual time with the scenario's
+* MIPSIM_* settings and MIPSIM_SCORE pointing at the results file, which
+* collects one JSON line per run (see ../mipsim/mipsim_score.h for the
+* metrics). With -b the results are compared with an earlier results file
+* and anything worse than the tolerance is listed, the exit status is 1 if
+* there was any.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define MAX_SETTINGS	4
+#define MAX_RESULTS		64
+#define LINE			1024
+
+/*******************************************************************************
+* scenario_t
+*
+* Times are from the start of the program, the robot is picked up and
+* released about 3 s in.
+*******************************************************************************/
+typedef struct scenario_t{
+	const char* name;
+	const char* duration;
+	const char* settings[MAX_SETTINGS];
+}scenario_t;
+
+static const scenario_t scenarios[] = {
+	{"tilt",		"8",	{"MIPSIM_THETA0=0.15"}},
+	{"push",		"10",	{"MIPSIM_PUSH=1.5@6"}},
+	{"drive",		"12",	{"MIPSIM_DSM=3=0.5@6+2"}},
+	{"turn",		"12",	{"MIPSIM_DSM=2=0.5@6+2"}},
+	{"low_battery",	"10",	{"MIPSIM_VBATT=6.2", "MIPSIM_PUSH=1@6"}},
+};
+#define N_SCENARIOS (int)(sizeof(scenarios)/sizeof(scenarios[0]))
+
+static const char* programs[] = {"jbalance_sim", "stubalance_sim"};
+#define N_PROGRAMS (int)(sizeof(programs)/sizeof(programs[0]))
+
+/*******************************************************************************
+* metric_t
+*
+* What the comparison looks at. A metric is worse when it grew by more than
+* the tolerance and by more than floor, so noise on tiny values doesn't
+* count.
+*******************************************************************************/
+typedef struct metric_t{
+	const char* key;
+	double floor;
+	int cpu;			// uses the CPU tolerance
+}metric_t;
+
+static const metric_t metrics[] = {
+	{"rms_theta",	0.002,	0},
+	{"overshoot",	0.005,	0},
+	{"settle_s",	0.1,	0},
+	{"saturated_s",	0.05,	0},
+	{"cpu_mean_ns",	200,	1},
+	{"cpu_p99_ns",	1000,	1},
+};
+#define N_METRICS (int)(sizeof(metrics)/sizeof(metrics[0]))
+
+typedef struct result_t{
+	char line[LINE];
+	char program[64];
+	char scenario[64];
+}result_t;
+
+// function declarations
+int in_list(const char* list, const char* name);
+int run(const char* dir, const char* program, const scenario_t* s,
+													const char* results);
+int load(const char* path, result_t* r, int max);
+double get_num(const char* line, const char* key);
+int get_str(const char* line, const char* key, char* out, int size);
+int print_table(const result_t* r, int n);
+int compare(const result_t* r, int n, const result_t* base, int n_base,
+												double tol, double cpu_tol);
+
+/*******************************************************************************
+* int main()
+*******************************************************************************/
+int main(int argc, char* argv[]){
+	const char* dir = "../mipsim";
+	const char* out = "scorecard.jsonl";
+	const char* baseline = NULL;
+	const char* only_p = NULL;
+	const char* only_s = NULL;
+	char results[PATH_MAX];
+	static result_t r[MAX_RESULTS], base[MAX_RESULTS];
+	double tol = 0.2, cpu_tol = 0.5;
+	int c, i, j, n, n_base, ret = 0;
+	FILE* fd;
+
+	while((c=getopt(argc, argv, "d:o:b:t:c:p:s:h"))!=-1){
+		switch(c){
+		case 'd': dir = optarg; break;
+		case 'o': out = optarg; break;
+		case 'b': baseline = optarg; break;
+		case 't': tol = atof(optarg); break;
+		case 'c': cpu_tol = atof(optarg); break;
+		case 'p': only_p = optarg; break;
+		case 's': only_s = optarg; break;
+		default:
+			printf("usage: %s [-d sim_dir] [-o results.jsonl] " \
+					"[-b baseline.jsonl] [-t tolerance] [-c cpu_tolerance] " \
+					"[-p program,...] [-s scenario,...]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	// the sims run elsewhere, give them an absolute path to append to
+	if((fd=fopen(out, "w"))==NULL || realpath(out, results)==NULL){
+		printf("ERROR: can't write %s\n", out);
+		return -1;
+	}
+	fclose(fd);
+
+	for(i=0;i<N_PROGRAMS;i++){
+		if(only_p && !in_list(only_p, programs[i])) continue;
+		for(j=0;j<N_SCENARIOS;j++){
+			if(only_s && !in_list(only_s, scenarios[j].name)) continue;
+			printf("%-16s %-12s ...\n", programs[i], scenarios[j].name);
+			fflush(stdout);
+			if(run(dir, programs[i], &scenarios[j], results)) ret = -1;
+		}
+	}
+
+	n = load(out, r, MAX_RESULTS);
+	printf("\n");
+	print_table(r, n);
+	if(baseline){
+		n_base = load(baseline, base, MAX_RESULTS);
+		if(n_base<0) return -1;
+		if(compare(r, n, base, n_base, tol, cpu_tol)) ret = 1;
+	}
+	return ret;
+}
+
+/*******************************************************************************
+* int in_list()
+*
+* Whether name is one of a comma separated list.
+*******************************************************************************/
+int in_list(const char* list, const char* name){
+	int len = strlen(name);
+	const char* s = list;
+	while((s=strstr(s, name))!=NULL){
+		if((s==list || s[-1]==',') && (s[len]==0 || s[len]==',')) return 1;
+		s += len;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int run()
+*
+* One program through one scenario, its console output thrown away. Logs
+* and traces land in the current directory like any other run.
+*******************************************************************************/
+int run(const char* dir, const char* program, const scenario_t* s,
+													const char* results){
+	char path[PATH_MAX];
+	pid_t pid;
+	int i, status;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, program);
+	if(access(path, X_OK)){
+		printf("ERROR: no %s, build it with make -C %s\n", path, dir);
+		return -1;
+	}
+	pid = fork();
+	if(pid<0){
+		printf("ERROR: fork failed\n");
+		return -1;
+	}
+	if(pid==0){
+		setenv("MIPSIM_SCORE", results, 1);
+		setenv("MIPSIM_VIRTUAL", "1", 1);
+		setenv("MIPSIM_SCENARIO", s->name, 1);
+		setenv("MIPSIM_DURATION", s->duration, 1);
+		for(i=0;i<MAX_SETTINGS && s->settings[i];i++){
+			putenv((char*)s->settings[i]);
+		}
+		if(freopen("/dev/null", "w", stdout)==NULL) _exit(127);
+		execl(path, program, (char*)NULL);
+		_exit(127);
+	}
+	if(waitpid(pid, &status, 0)<0 || !WIFEXITED(status) || \
+											WEXITSTATUS(status)==127){
+		printf("ERROR: %s didn't finish %s\n", program, s->name);
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int load()
+*
+* Reads a results file, returns how many lines or -1.
+*******************************************************************************/
+int load(const char* path, result_t* r, int max){
+	FILE* fd;
+	int n = 0;
+	if((fd=fopen(path, "r"))==NULL){
+		printf("ERROR: can't read %s\n", path);
+		return -1;
+	}
+	while(n<max && fgets(r[n].line, LINE, fd)){
+		if(get_str(r[n].line, "program", r[n].program, 64)) continue;
+		if(get_str(r[n].line, "scenario", r[n].scenario, 64)) continue;
+		n++;
+	}
+	fclose(fd);
+	return n;
+}
+
+/*******************************************************************************
+* double get_num(), int get_str()
+*
+* Values out of the flat JSON mipsim writes, NAN for null or missing.
+*******************************************************************************/
+double get_num(const char* line, const char* key){
+	char pat[64];
+	const char* s;
+	snprintf(pat, sizeof(pat), "\"%s\": ", key);
+	if((s=strstr(line, pat))==NULL) return NAN;
+	s += strlen(pat);
+	if(!strncmp(s, "null", 4)) return NAN;
+	return strtod(s, NULL);
+}
+
+int get_str(const char* line, const char* key, char* out, int size){
+	char pat[64];
+	const char* s;
+	int i;
+	snprintf(pat, sizeof(pat), "\"%s\": \"", key);
+	if((s=strstr(line, pat))==NULL) return -1;
+	s += strlen(pat);
+	for(i=0;i<size-1 && s[i] && s[i]!='"';i++) out[i] = s[i];
+	out[i] = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int print_table()
+*******************************************************************************/
+static void print_cell(double v, const char* fmt, double scale){
+	if(isnan(v)) printf("%9s", "-");
+	else printf(fmt, v*scale);
+}
+
+int print_table(const result_t* r, int n){
+	int i;
+	printf("%-16s %-12s %4s %9s %9s %9s %9s %9s %9s\n", "program", \
+			"scenario", "fell", "rms_th", "overshoot", "settle_s", "sat_s", \
+			"cpu_us", "p99_us");
+	for(i=0;i<n;i++){
+		printf("%-16s %-12s %4.0f", r[i].program, r[i].scenario, \
+											get_num(r[i].line, "fell"));
+		print_cell(get_num(r[i].line, "rms_theta"), " %8.4f", 1);
+		print_cell(get_num(r[i].line, "overshoot"), " %8.4f", 1);
+		// a fall is the reason it never settled, say so
+		if(get_num(r[i].line, "fell")>0) printf(" %8s", "FELL");
+		else print_cell(get_num(r[i].line, "settle_s"), " %8.2f", 1);
+		print_cell(get_num(r[i].line, "saturated_s"), " %8.2f", 1);
+		print_cell(get_num(r[i].line, "cpu_mean_ns"), " %8.2f", 1e-3);
+		print_cell(get_num(r[i].line, "cpu_p99_ns"), " %8.2f", 1e-3);
+		printf("\n");
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int compare()
+*
+* Each result against the baseline run of the same program and scenario.
+* Falling where it didn't, or never settling where it did, is always a
+* regression. Where the baseline fell its metrics are of a robot on the
+* floor, so nothing is compared and a fix isn't counted against it.
+* Returns the number of regressions.
+*******************************************************************************/
+int compare(const result_t* r, int n, const result_t* base, int n_base,
+												double tol, double cpu_tol){
+	const result_t* b;
+	double x, y, t;
+	int i, j, k, bad = 0;
+
+	printf("\ncompared with the baseline, tolerance %.0f%%, cpu %.0f%%\n", \
+												tol*100, cpu_tol*100);
+	for(i=0;i<n;i++){
+		for(b=NULL,j=0;j<n_base && !b;j++){
+			if(!strcmp(r[i].program, base[j].program) && \
+					!strcmp(r[i].scenario, base[j].scenario)) b = &base[j];
+		}
+		if(!b){
+			printf("  %s %s: not in the baseline\n", r[i].program, \
+														r[i].scenario);
+			continue;
+		}
+		if(get_num(r[i].line, "fell")>get_num(b->line, "fell")){
+			printf("  REGRESSION %s %s: fell over\n", r[i].program, \
+														r[i].scenario);
+			bad++;
+			continue;
+		}
+		if(get_num(b->line, "fell")>0){
+			printf("  %s %s: fell in the baseline, not compared\n", \
+										r[i].program, r[i].scenario);
+			continue;
+		}
+		for(k=0;k<N_METRICS;k++){
+			x = get_num(b->line, metrics[k].key);
+			y = get_num(r[i].line, metrics[k].key);
+			if(isnan(x)) continue;
+			t = metrics[k].cpu ? cpu_tol : tol;
+			if(isnan(y) || (y>x*(1+t) && y-x>metrics[k].floor)){
+				printf("  REGRESSION %s %s: %s %g -> %g\n", r[i].program, \
+							r[i].scenario, metrics[k].key, x, y);
+				bad++;
+			}
+		}
+	}
+	if(!bad) printf("  no regressions\n");
+	return bad;
+}
@@ -5,10 +5,53 @@
 * Reference solution for balancing EduMiP
 *******************************************************************************/
 
+#ifdef MIP_SIM
+#include "../mipsim/mipsim.h"
+#else
 #include "../../libraries/roboticscape-usefulincludes.h"
 #include "../../libraries/roboticscape.h"
+#endif
 
-#include "balance_config.h"
+#include "stubalance_config.h"
+#include "../common/mip_logger.h"
+#include "../common/mip_trace.h"
+#include "../common/mip_perf.h"
+#include "../common/mip_button.h"
+#include "../common/mip_dsm.h"
+#include "../common/mip_filter.h"
+#include "../common/mip_latency.h"
+#include "../common/mip_battery.h"
+#include "../common/mip_governor.h"
+#include "../common/mip_idle.h"
+#include "../common/mip_mat.h"
+#include "../common/mip_mpc.h"
+#include "../common/mip_sysid.h"
+#include "../common/mip_tune.h"
+#include "../common/mip_arena.h"
+#include "../common/mip_tripwire.h"
+#include "../common/mip_acq.h"
+#include "../common/mip_watchdog.h"
+#include "../common/mip_telem.h"
+#include <stdatomic.h>
+
+/*******************************************************************************
+* LQR size, with LQR_STEERING it also replaces D3
+*******************************************************************************/
+#define LQR_STEERS (CONTROLLER_TYPE==CONTROLLER_LQR && LQR_STEERING)
+#if LQR_STEERING
+#define LQR_STATES	6
+#define LQR_INPUTS	2
+#define LQR_K		LQR_K6
+#else
+#define LQR_STATES	4
+#define LQR_INPUTS	1
+#define LQR_K		LQR_K4
+#endif
+
+// the cascade's filters in each mip_tune set, in order of mip_tune_add()
+#define TUNE_D1		0
+#define TUNE_D2		1
+#define TUNE_D3		2
 
 /*******************************************************************************
 * drive_mode_t
@@ -55,8 +98,11 @@ typedef struct core_state_t{
 	float wheelAngleR;	// wheel rotation relative to body
 	float wheelAngleL;
 	float theta; 		// body angle radians
+	float theta_dot;	// gyro rate, only LQR and MPC use the rates
 	float phi;			// average wheel angle in global frame
+	float phi_dot;
 	float gamma;		// body turn (yaw) angle radians
+	float gamma_dot;
 	float vBatt; 		// battery voltage 
 	float d1_u;			// output of balance controller D1 to motors
 	float d2_u;			// output of position controller D2 (theta_ref)
@@ -69,9 +115,17 @@ typedef struct core_state_t{
 *******************************************************************************/
 // IMU interrupt routine
 int balance_controller(); 
+int balance_step(uint64_t t_irq);
+int watchdog_step(uint64_t t_irq, uint64_t t_end);
+int telem_step(uint64_t t_irq);
+int shedding(int level);
+int cascade_step();
+int lqr_step();
+int mpc_step();
+int rates_step();
+int sysid_step();
 // threads
 void* setpoint_manager(void* ptr);
-void* battery_checker(void* ptr);
 void* printf_loop(void* ptr);
 // regular functions
 int zero_out_controller();
@@ -79,17 +133,68 @@ int disarm_controller();
 int arm_controller();
 int wait_for_starting_condition();
 int on_pause_press();
-int on_mode_release();
+int on_pause_long();
+int on_mode_click();
 int blink_green();
 int blink_red();
+int dsm_to_rates(float drive_stick, float turn_stick, float* phi_dot,
+														float* gamma_dot);
+int dsm_step();
+float vbatt_comp(float v, float x);
+int set_cpu_level(int level);
+void on_idle_change(int idle);
+int use_tune(mip_tune_set_t* set);
 
 /*******************************************************************************
 * Global Variables				
 *******************************************************************************/
 core_state_t cstate;
 setpoint_t setpoint;
-d_filter_t D1, D2, D3;	
+mip_filter_t *D1, *D2, *D3;		// the live set's, only the interrupt swaps
+mip_tune_set_t* tune;
+mip_gain_table_t vbatt_table;	// V_NOMINAL over battery voltage
+mip_acq_rate_t phi_rate, gamma_rate;	// lowpassed derivatives, LQR and MPC
+int fb_steps;					// state feedback steps since arming
+mip_mpc_t mpc;
+mip_latency_t mpc_latency;
+mip_excite_t excite;			// sysid test signal
+int sysid_steps;				// since arming, the signal waits for soft start
 imu_data_t imu_data;
+mip_acq_t acq;
+mip_acq_sample_t sample;		// this interrupt's sensors, time and dt
+mip_logger_t logger;
+mip_perf_t perf;
+mip_latency_t motor_latency;	// interrupt function entry to set_motor()
+_Atomic uint64_t setpoint_stamp = 0;	// arrival of the frame behind phi_dot
+mip_watchdog_t watchdog;
+int outer_due;					// D2 and D3 run this step
+
+/*******************************************************************************
+* Log channels, one row per controller step while ARMED
+*******************************************************************************/
+#define LOG_CHANNELS 12
+const char* log_names[LOG_CHANNELS] = {
+	"theta", "theta_ref", "phi", "phi_ref", "gamma",
+	"d1_u", "d3_u", "vBatt", "encoder_L", "encoder_R", "dt", "missed"
+};
+const mip_codec_type_t log_codecs[LOG_CHANNELS] = {
+	MIP_CODEC_QUANT, MIP_CODEC_QUANT, MIP_CODEC_QUANT, MIP_CODEC_QUANT,
+	MIP_CODEC_QUANT, MIP_CODEC_QUANT, MIP_CODEC_QUANT, MIP_CODEC_QUANT,
+	MIP_CODEC_INT, MIP_CODEC_INT, MIP_CODEC_QUANT, MIP_CODEC_INT
+};
+const float log_errors[LOG_CHANNELS] = {
+	LOG_ANGLE_ERROR, LOG_ANGLE_ERROR, LOG_ANGLE_ERROR, LOG_ANGLE_ERROR,
+	LOG_ANGLE_ERROR, LOG_DUTY_ERROR, LOG_DUTY_ERROR, LOG_VOLTAGE_ERROR, 0, 0,
+	LOG_DT_ERROR, 0
+};
+
+/*******************************************************************************
+* Telemetry channels, one frame per controller step, what printf_loop shows
+*******************************************************************************/
+#define TELEM_CHANNELS 8
+const char* telem_names[TELEM_CHANNELS] = {
+	"theta", "theta_ref", "phi", "phi_ref", "gamma", "d1_u", "d3_u", "vBatt"
+};
 
 /*******************************************************************************
 * main()
@@ -99,6 +204,21 @@ imu_data_t imu_data;
 int main(){
 	set_cpu_frequency(FREQ_1000MHZ);
 
+	// everything the modules allocate for the run comes from the arena
+	if(mip_arena_init(ARENA_BYTES)){
+		printf("WARNING: no arena, allocating from the heap\n");
+	}
+
+	// start tracing first so every thread gets its ring before it runs
+	if(ENABLE_TRACE){
+		if(mip_trace_start()) printf("WARNING: failed to start tracing\n");
+		mip_trace_thread_name("main");
+	}
+	if(ENABLE_PERF){
+		mip_perf_init(&perf);
+		mip_perf_install_signal();
+	}
+
 	if(initialize_cape()<0){
 		printf("ERROR: failed to initialize cape\n");
 		return -1;
@@ -112,38 +232,99 @@ int main(){
 	setpoint.arm_state = DISARMED;
 	setpoint.drive_mode = NOVICE;
 	
+	// the cascade is copied into mip_tune's sets and runs from the live one
+	mip_filter_t f;
+
 	// set up D1 Theta controller
 	float D1_num[] = D1_NUM;
 	float D1_den[] = D1_DEN;
-	D1 = create_filter(D1_ORDER, DT, D1_num, D1_den);
-	D1.gain = D1_GAIN;
-	enable_saturation(&D1, -1.0, 1.0);
-	enable_soft_start(&D1, SOFT_START_SEC);
+	mip_filter_init(&f, D1_ORDER, DT, D1_num, D1_den);
+	f.gain = D1_GAIN;
+	mip_filter_saturation(&f, -1.0, 1.0);
+	mip_filter_soft_start(&f, SOFT_START_SEC);
+	mip_tune_add("D1", &f, NULL, 0);
 	
 	// set up D2 Phi controller
 	float D2_num[] = D2_NUM;
 	float D2_den[] = D2_DEN;
-	D2 = create_filter(D2_ORDER, DT, D2_num, D2_den);
-	D2.gain = D2_GAIN;
-	enable_saturation(&D2, -THETA_REF_MAX, THETA_REF_MAX);
+	mip_filter_init(&f, D2_ORDER, DT, D2_num, D2_den);
+	f.gain = D2_GAIN;
+	mip_filter_saturation(&f, -THETA_REF_MAX, THETA_REF_MAX);
+	mip_tune_add("D2", &f, "THETA_REF_MAX", TIP_ANGLE);
 
 	// set up D3 gamma (steering) controller
-	D3 = create_pid(D3_KP, D3_KI, D3_KD, 4*DT, DT);
-	enable_saturation(&D3, -STEERING_INPUT_MAX, STEERING_INPUT_MAX);
+	mip_filter_pid(&f, D3_KP, D3_KI, D3_KD, 4*DT, DT);
+	mip_filter_saturation(&f, -STEERING_INPUT_MAX, STEERING_INPUT_MAX);
+	mip_tune_add_pid("D3", &f, D3_KP, D3_KI, D3_KD, 4*DT, \
+										"STEERING_INPUT_MAX", 1.0);
+	use_tune(mip_tune_live());
+
+	// LQR rate estimates, s/(LQR_RATE_TAU*s+1) by backward Euler
+	mip_acq_rate_init(&phi_rate, LQR_RATE_TAU);
+	mip_acq_rate_init(&gamma_rate, LQR_RATE_TAU);
+	mip_gain_table_init(&vbatt_table, MIP_BATTERY_V_MIN, MIP_BATTERY_V_MAX, \
+								D1_GAIN_TABLE_POINTS, 0, 0, 1, &vbatt_comp);
+	mip_latency_init(&motor_latency, "interrupt to set_motor", 100);
+
+	// MPC, builds its QP from the model once
+	if(CONTROLLER_TYPE==CONTROLLER_MPC){
+		double mpc_x_max[] = MPC_WEIGHTS;
+		if(mip_mpc_init(&mpc, MPC_HORIZON, DT, mpc_x_max, MPC_DUTY_WEIGHT, \
+														MPC_MAX_ITER)){
+			printf("ERROR: failed to set up MPC\n");
+			return -1;
+		}
+		mip_latency_init(&mpc_latency, "mpc solve", 1000);
+	}
 
-	// set up button handlers
-	set_pause_pressed_func(&on_pause_press);
-	set_mode_released_func(&on_mode_release);
+	// system identification, signal and estimator thread
+	if(ENABLE_SYSID){
+		if(mip_excite_init(&excite, SYSID_SIGNAL==SYSID_PRBS ? \
+				MIP_EXCITE_PRBS : MIP_EXCITE_CHIRP, SYSID_AMPLITUDE, \
+				SYSID_F0, SYSID_F1, SYSID_SEC, SAMPLE_RATE_HZ, \
+				SYSID_PRBS_HOLD) || mip_sysid_start(SAMPLE_RATE_HZ)){
+			printf("ERROR: failed to set up system identification\n");
+			return -1;
+		}
+	}
+
+	// set up button handlers, gestures are timed by mip_button's own thread
+	mip_button_set_func(MIP_BUTTON_PAUSE, MIP_GESTURE_PRESS, &on_pause_press);
+	mip_button_set_func(MIP_BUTTON_PAUSE, MIP_GESTURE_LONG, &on_pause_long);
+	mip_button_set_func(MIP_BUTTON_MODE, MIP_GESTURE_SHORT, &on_mode_click);
+	if(mip_button_start()){
+		printf("ERROR: failed to start button handling\n");
+		return -1;
+	}
 	
-	// start a thread to slowly sample battery 
-	pthread_t  battery_thread;
-	pthread_create(&battery_thread, NULL, battery_checker, (void*) NULL);
-	// wait for the battery thread to make the first read
-	while(cstate.vBatt==0 && get_state()!=EXITING) usleep(1000);
+	// idle mode switches, the setpoint thread starts out disarmed and idle
+	mip_idle_init(IDLE_DECIMATION, &on_idle_change);
+
+	// start sampling the battery
+	if(mip_battery_start(BATTERY_CHECK_HZ)){
+		printf("ERROR: failed to start battery monitoring\n");
+		return -1;
+	}
+	// wait for the battery thread to make the first read, V_NOMINAL if
+	// there's nothing to read
+	mip_battery_wait(BATTERY_WAIT_S, V_NOMINAL);
+	cstate.vBatt = mip_battery_voltage();
+
+	// watch for new controller coefficients
+	if(ENABLE_TUNE && mip_tune_start(TUNE_FILE, TUNE_CHECK_HZ)){
+		printf("WARNING: failed to start tuning, using the built in gains\n");
+	}
 	
-	// start printf_thread if running from a terminal
+	// viewers connect to the telemetry socket, otherwise start printf_thread
+	// if running from a terminal
 	// if it was started as a background process then don't bother
-	if(isatty(fileno(stdout))){
+	if(ENABLE_TELEM){
+		if(mip_telem_start(TELEM_SOCKET, "jbalance", telem_names, \
+					TELEM_CHANNELS, SAMPLE_RATE_HZ, TELEM_SERVE_HZ)){
+			printf("WARNING: failed to start telemetry, nothing to view\n");
+		}
+	}
+	else if(isatty(fileno(stdout))){
 		pthread_t  printf_thread;
 		pthread_create(&printf_thread, NULL, printf_loop, (void*) NULL);
 	}
@@ -160,26 +341,86 @@ int main(){
 		return -1;
 	}
 	
+	// start the background logger before the controller can push to it
+	if(ENABLE_LOGGING){
+		if(mip_logger_start(&logger, LOG_FILE, log_names, LOG_CHANNELS, \
+							SAMPLE_RATE_HZ, log_codecs, log_errors)){
+			printf("WARNING: failed to start logger, not logging\n");
+		}
+	}
+	
+	// radio frames are captured from here on
+	mip_dsm_start();
+	
 	// start balance stack to control setpoints
 	pthread_t  setpoint_thread;
 	pthread_create(&setpoint_thread, NULL, setpoint_manager, (void*) NULL);
 
 	// this should be the last step in initialization 
 	// to make sure other setup functions don't interfere
+	// the governor starts at the top clock and works down from there
+	if(ENABLE_GOVERNOR){
+		if(mip_governor_start(DT, GOVERNOR_MARGIN, GOVERNOR_HOLD, \
+								GOVERNOR_WINDOW, &set_cpu_level)){
+			printf("WARNING: no frequency governor, staying at 1GHz\n");
+		}
+	}
+	mip_acq_init(&acq, DT, ENCODER_CHANNEL_L, ENCODER_CHANNEL_R);
+	if(ENABLE_WATCHDOG){
+		mip_watchdog_init(&watchdog, DT, WATCHDOG_WINDOW, WATCHDOG_TRIP, \
+									WATCHDOG_RECOVER, WATCHDOG_HOLD);
+	}
 	set_imu_interrupt_func(&balance_controller);
 	
 	// start in the RUNNING state, pressing the puase button will swap to 
 	// the PUASED state then back again.
 	printf("\nHold your MIP upright to begin balancing\n");
+	mip_arena_seal();
 	set_state(RUNNING);
 	
 	// chill until something exits the program
 	while(get_state()!=EXITING){
+		if(ENABLE_PERF && mip_perf_report_requested()) mip_perf_print(&perf);
 		usleep(10000);
 	}
 	
-	// cleanup
+	// cleanup, leaving idle wakes any parked threads so they see EXITING
+	mip_idle_exit();
 	power_off_imu();
+	if(ENABLE_TELEM) mip_telem_stop();
+	if(ENABLE_GOVERNOR) mip_governor_stop();
+	mip_idle_print();
+	mip_button_stop();
+	mip_dsm_stop();
+	mip_battery_stop();
+	if(ENABLE_TUNE) mip_tune_stop();
+	if(ENABLE_SYSID) mip_sysid_stop();
+	mip_dsm_print_stats();
+	mip_acq_print(&acq);
+	if(ENABLE_WATCHDOG) mip_watchdog_print(&watchdog);
+	mip_battery_print();
+	if(ENABLE_TUNE) mip_tune_print();
+	if(ENABLE_TELEM) mip_telem_print();
+	mip_latency_print(&motor_latency);
+	if(CONTROLLER_TYPE==CONTROLLER_MPC){
+		mip_latency_print(&mpc_latency);
+		mip_mpc_print(&mpc);
+	}
+	if(ENABLE_SYSID){
+		mip_sysid_print();
+		mip_sysid_write(SYSID_FILE);
+	}
+	if(ENABLE_LOGGING) mip_logger_stop(&logger);
+	if(ENABLE_PERF){
+		mip_perf_print(&perf);
+		mip_perf_close(&perf);
+	}
+	if(ENABLE_TRACE){
+		mip_trace_stop();
+		mip_trace_write_json(TRACE_FILE);
+	}
+	mip_arena_print();
+	if(ENABLE_TRIPWIRE) mip_tripwire_print();
 	cleanup_cape();
 	set_cpu_frequency(FREQ_ONDEMAND);
 	return 0;
@@ -194,6 +435,8 @@ int main(){
 *******************************************************************************/
 void* setpoint_manager(void* ptr){
 	float drive_stick, turn_stick; // dsm input sticks
+	mip_dsm_frame_t frame;
+	mip_trace_thread_name("setpoint_manager");
 
 	// wait for IMU to settle
 	disarm_controller();
@@ -206,15 +449,22 @@ void* setpoint_manager(void* ptr){
 	
 	while(get_state()!=EXITING){
 		// sleep at beginning of loop so we can use the 'continue' statement
-		usleep(1000000/SETPOINT_MANAGER_HZ); 
+		// parked while idle, the interrupt wakes us when MIP is picked up
+		mip_idle_sleep(1000000/SETPOINT_MANAGER_HZ, 0); 
+		// polling reads the library directly, just keep the queue empty
+		if(!ENABLE_DSM_PIPELINE) mip_dsm_pop(&frame);
 		
-		// nothing to do if paused, go back to beginning of loop
+		// nothing to do if paused or idle, go back to beginning of loop
 		if(get_state() != RUNNING) continue;
+		if(mip_idle_is_idle()) continue;
 
 		// if we got here the state is RUNNING, but controller is not
 		// necessarily armed. If DISARMED, wait for the user to pick MIP up
 		// which will we detected by wait_for_starting_condition()
+		MIP_TRACE_SCOPE("setpoint_manager");
 		if(setpoint.arm_state == DISARMED){
+			// not while the watchdog still has the controller disarmed
+			if(shedding(MIP_SHED_DISARM)) continue;
 			if(wait_for_starting_condition()==0){
 				zero_out_controller();
 				arm_controller();
@@ -222,33 +472,19 @@ void* setpoint_manager(void* ptr){
 			else continue;
 		}
 	
+		// with the DSM pipeline the control step reads the radio itself
+		if(ENABLE_DSM_PIPELINE) continue;
+	
 		// if dsm is active, update the setpoint rates
 		if(is_new_dsm_data()){
-			// Read normalized (+-1) inputs from RC radio stick and multiply by 
-			// polarity setting so positive stick means positive setpoint
-			turn_stick  = get_dsm_ch_normalized(DSM_TURN_CH) * DSM_TURN_POL;
-			drive_stick = get_dsm_ch_normalized(DSM_DRIVE_CH)* DSM_DRIVE_POL;
-			
-			// saturate the inputs to avoid possible erratic behavior
-			saturate_float(&drive_stick,-1,1);
-			saturate_float(&turn_stick,-1,1);
-			
-			// use a small deadzone to prevent slow drifts in position
-			if(fabs(drive_stick)<DSM_DEAD_ZONE) drive_stick = 0.0;
-			if(fabs(turn_stick)<DSM_DEAD_ZONE)  turn_stick  = 0.0;
-
-			// translate normalized user input to real setpoint values
-			switch(setpoint.drive_mode){
-			case NOVICE:
-				setpoint.phi_dot   = DRIVE_RATE_NOVICE * drive_stick;
-				setpoint.gamma_dot =  TURN_RATE_NOVICE * turn_stick;
-				break;
-			case ADVANCED:
-				setpoint.phi_dot   = DRIVE_RATE_ADVANCED * drive_stick;
-				setpoint.gamma_dot = TURN_RATE_ADVANCED  * turn_stick;
-				break;
-			default: break;
-			}
+			// Read normalized (+-1) inputs from RC radio stick
+			turn_stick  = get_dsm_ch_normalized(DSM_TURN_CH);
+			drive_stick = get_dsm_ch_normalized(DSM_DRIVE_CH);
+			dsm_to_rates(drive_stick, turn_stick, &setpoint.phi_dot, \
+													&setpoint.gamma_dot);
+			setpoint_stamp = mip_dsm_latest_ns();
+			MIP_TRACE_COUNTER("phi_dot", setpoint.phi_dot);
+			MIP_TRACE_COUNTER("gamma_dot", setpoint.gamma_dot);
 		}
 		// if dsm had timed out, put setpoint rates back to 0
 		else if(is_dsm_active()==0){
@@ -267,23 +503,124 @@ void* setpoint_manager(void* ptr){
 /*******************************************************************************
 * balance_controller()
 *
+* IMU interrupt function, times the step for the frequency governor and the
+* deadline watchdog
+*******************************************************************************/
+int balance_controller(){
+	uint64_t t_irq = mip_latency_now();
+	uint64_t t_end;
+	static int watched = 0;
+	float theta;
+	if(ENABLE_TRIPWIRE && !watched){
+		watched = !mip_tripwire_watch(TRIPWIRE_ABORT);
+	}
+	// the same sample twice, the first one already ran the step
+	if(mip_acq_capture(&acq, t_irq, &imu_data, &sample)){
+		MIP_TRACE_INSTANT("duplicate");
+		return 0;
+	}
+	if(sample.missed) MIP_TRACE_COUNTER("missed", mip_acq_missed(&acq));
+	// idle looks at the DMP angle every sample so this very sample runs in
+	// full once MIP is upright, otherwise only 1 in IDLE_DECIMATION runs
+	if(mip_idle_is_idle()){
+		theta = sample.dmp_TaitBryan[TB_PITCH_X] + CAPE_MOUNT_ANGLE;
+		if(get_state()==RUNNING && fabs(theta)<START_ANGLE) mip_idle_exit();
+		else{
+			if(mip_idle_tick()){
+				balance_step(t_irq);
+				telem_step(t_irq);
+			}
+			if(ENABLE_GOVERNOR) mip_governor_skip();
+			if(ENABLE_WATCHDOG) watchdog_step(t_irq, mip_latency_now());
+			return 0;
+		}
+	}
+	balance_step(t_irq);
+	telem_step(t_irq);
+	t_end = mip_latency_now();
+	if(ENABLE_GOVERNOR) mip_governor_step(t_irq, t_end);
+	if(ENABLE_WATCHDOG) watchdog_step(t_irq, t_end);
+	return 0;
+}
+
+/*******************************************************************************
+* int telem_step()
+*
+* The step's result to the telemetry ring, which never waits on a viewer.
+* Shed with tracing, so viewers see the console and log levels go by.
+*******************************************************************************/
+int telem_step(uint64_t t_irq){
+	uint32_t flags;
+	if(!ENABLE_TELEM || shedding(MIP_SHED_TELEMETRY)) return 0;
+	MIP_TRACE_SCOPE("telem_publish");
+	float row[TELEM_CHANNELS] = {
+		cstate.theta, setpoint.theta, cstate.phi, setpoint.phi,
+		cstate.gamma, cstate.d1_u, cstate.d3_u, cstate.vBatt
+	};
+	flags = MIP_TELEM_SHED_FLAGS(mip_watchdog_level(&watchdog));
+	if(setpoint.arm_state==ARMED) flags |= MIP_TELEM_ARMED;
+	return mip_telem_publish(t_irq, get_state(), flags, row);
+}
+
+/*******************************************************************************
+* int watchdog_step()
+*
+* Hands the step's timing to the watchdog. Tracing is paused and resumed
+* here when the level crosses MIP_SHED_TELEMETRY, everything else that can
+* be shed checks shedding() where it runs.
+*******************************************************************************/
+int watchdog_step(uint64_t t_irq, uint64_t t_end){
+	int was = mip_watchdog_level(&watchdog);
+	int level = mip_watchdog_step(&watchdog, t_irq, t_end, sample.missed);
+	if(level==was) return 0;
+	if(level<MIP_SHED_TELEMETRY && was>=MIP_SHED_TELEMETRY){
+		mip_trace_pause(0);
+	}
+	MIP_TRACE_COUNTER("shed", level);
+	if(level>=MIP_SHED_TELEMETRY && was<MIP_SHED_TELEMETRY){
+		mip_trace_pause(1);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int shedding()
+*
+* 1 if the watchdog has shed level, and with it every level before it.
+*******************************************************************************/
+int shedding(int level){
+	return ENABLE_WATCHDOG && mip_watchdog_level(&watchdog)>=level;
+}
+
+/*******************************************************************************
+* balance_step()
+*
 * discrete-time balance controller operated off IMU interrupt
 * Called at SAMPLE_RATE_HZ
 *******************************************************************************/
-int balance_controller(){
+int balance_step(uint64_t t_irq){
 	static int inner_saturation_counter = 0; 
+	static uint64_t applied_stamp = 0;
+	uint64_t stamp;
 	float dutyL, dutyR;
+	int encoderL, encoderR, saturated;
+	static int named = 0;
+	if(!named) named = !mip_trace_thread_name("imu_interrupt");
+	MIP_TRACE_SCOPE("balance_controller");
+	if(ENABLE_PERF) mip_perf_begin(&perf);
 	/******************************************************************
 	* STATE_ESTIMATION
 	* read sensors and compute the state when either ARMED or DISARMED
 	******************************************************************/
 	// angle theta is positive in the direction of forward tip around X axis
-	cstate.theta = imu_data.dmp_TaitBryan[TB_PITCH_X] + CAPE_MOUNT_ANGLE; 
+	cstate.theta = sample.dmp_TaitBryan[TB_PITCH_X] + CAPE_MOUNT_ANGLE; 
 	
-	// collect encoder positions, right wheel is reversed 
-	cstate.wheelAngleR = (get_encoder_pos(ENCODER_CHANNEL_R) * TWO_PI) \
+	// encoder positions from the same snapshot, right wheel is reversed 
+	encoderR = sample.encoder_r;
+	encoderL = sample.encoder_l;
+	cstate.wheelAngleR = (encoderR * TWO_PI) \
 								/(ENCODER_POLARITY_R * GEARBOX * ENCODER_RES);
-	cstate.wheelAngleL = (get_encoder_pos(ENCODER_CHANNEL_L) * TWO_PI) \
+	cstate.wheelAngleL = (encoderL * TWO_PI) \
 								/(ENCODER_POLARITY_L * GEARBOX * ENCODER_RES);
 	
 	// Phi is average wheel rotation also add theta body angle to get absolute 
@@ -293,6 +630,10 @@ int balance_controller(){
 	// steering angle gamma estimate 
 	cstate.gamma = (cstate.wheelAngleR-cstate.wheelAngleL) \
 											* (WHEEL_RADIUS_M/TRACK_WIDTH_M);
+	if(ENABLE_PERF) mip_perf_mark(&perf, "estimate");
+
+	// radio input, pops the newest frame and steps the rate limits
+	if(ENABLE_DSM_PIPELINE) dsm_step();
 
 	/*************************************************************
 	* check for various exit conditions AFTER state estimate
@@ -314,50 +655,67 @@ int balance_controller(){
 	// check for a tipover
 	if(fabs(cstate.theta) > TIP_ANGLE){
 		disarm_controller();
+		MIP_TRACE_INSTANT("tip");
 		printf("tip detected \n");
 		return 0;
 	}
-	
-	/************************************************************
-	* OUTER LOOP PHI controller D2
-	* Move the position setpoint based on phi_dot. 
-	* Input to the controller is phi error (setpoint-state).
-	*************************************************************/
-	if(ENABLE_POSITION_HOLD){
-		if(setpoint.phi_dot != 0.0) setpoint.phi += setpoint.phi_dot*DT;
-		cstate.d2_u = march_filter(&D2,setpoint.phi-cstate.phi);
-		setpoint.theta = cstate.d2_u;
+
+	// the watchdog shed everything else and the steps still overrun
+	if(shedding(MIP_SHED_DISARM)){
+		disarm_controller();
+		MIP_TRACE_INSTANT("overrun");
+		printf("control steps overrunning, disarmed\n");
+		return 0;
 	}
-	else setpoint.theta = 0.0;
 	
+	// coefficients staged from TUNE_FILE take over here, between steps
+	if(ENABLE_TUNE && use_tune(mip_tune_tick())) MIP_TRACE_INSTANT("tune");
+
 	/************************************************************
-	* INNER LOOP ANGLE Theta controller D1
-	* Input to D1 is theta error (setpoint-state). Then scale the 
-	* output u to compensate for changing battery voltage.
+	* Move the position and steering setpoints based on phi_dot
+	* and gamma_dot over the measured dt, then run the balance
+	* controller. Either one leaves its motor command in
+	* cstate.d1_u.
 	*************************************************************/
-	D1.gain = D1_GAIN * V_NOMINAL/cstate.vBatt;
-	cstate.d1_u = march_filter(&D1,setpoint.theta - cstate.theta);
+	if(ENABLE_POSITION_HOLD && setpoint.phi_dot!=0.0){
+		setpoint.phi += setpoint.phi_dot*sample.dt;
+	}
+	if(setpoint.gamma_dot != 0.0){
+		setpoint.gamma += setpoint.gamma_dot*sample.dt;
+	}
+	cstate.vBatt = mip_battery_voltage();
+	// under overload the outer loops hold their output every other step
+	outer_due = !shedding(MIP_SHED_OUTER) || !outer_due;
+	if(CONTROLLER_TYPE==CONTROLLER_LQR) saturated = lqr_step();
+	else if(CONTROLLER_TYPE==CONTROLLER_MPC) saturated = mpc_step();
+	else saturated = cascade_step();
 
 	/*************************************************************
 	* Check if the inner loop saturated. If it saturates for over
 	* a second disarm the controller to prevent stalling motors.
 	*************************************************************/
-	if(did_filter_saturate(&D1)) inner_saturation_counter++;
+	if(saturated) inner_saturation_counter++;
 	else inner_saturation_counter = 0; 
  	// if saturate for a second, disarm for safety
 	if(inner_saturation_counter > (SAMPLE_RATE_HZ*D1_SATURATION_TIMEOUT)){
 		printf("inner loop controller saturated\n");
+		MIP_TRACE_INSTANT("saturated");
 		disarm_controller();
 		inner_saturation_counter = 0;
 		return 0;
 	}
 	
+	// test signal on top of the balance duty, if identifying
+	if(ENABLE_SYSID) sysid_step();
+
 	/**********************************************************
-	* gama (steering) controller D3
-	* move the setpoint gamma based on user input like phi
+	* gama (steering) controller D3, unless the LQR steers
 	***********************************************************/
-	if(setpoint.gamma_dot != 0.0) setpoint.gamma += setpoint.gamma_dot * DT;
-	cstate.d3_u = march_filter(&D3,setpoint.gamma - cstate.gamma);
+	if(!LQR_STEERS && outer_due){
+		cstate.d3_u = mip_filter_output(D3,setpoint.gamma - cstate.gamma);
+		if(!ENABLE_SPLIT_STEP) mip_filter_commit(D3);
+		if(ENABLE_PERF) mip_perf_mark(&perf, "D3");
+	}
 	
 	/**********************************************************
 	* Send signal to motors
@@ -368,7 +726,270 @@ int balance_controller(){
 	dutyR = cstate.d1_u + cstate.d3_u;	
 	set_motor(MOTOR_CHANNEL_L, MOTOR_POLARITY_L * dutyL); 
 	set_motor(MOTOR_CHANNEL_R, MOTOR_POLARITY_R * dutyR); 
+	mip_latency_add(&motor_latency, t_irq);
+	if(ENABLE_PERF) mip_perf_mark(&perf, "motors");
+
+	/**********************************************************
+	* With split steps the filters' history is updated and the
+	* next step's past terms summed now, off the critical path
+	***********************************************************/
+	if(ENABLE_SPLIT_STEP){
+		if(CONTROLLER_TYPE!=CONTROLLER_LQR){
+			if(ENABLE_POSITION_HOLD && outer_due) mip_filter_commit(D2);
+			mip_filter_commit(D1);
+		}
+		if(!LQR_STEERS && outer_due) mip_filter_commit(D3);
+		if(ENABLE_PERF) mip_perf_mark(&perf, "commit");
+	}
+
+	// first motor write using a new radio frame, measure how long it took
+	stamp = setpoint_stamp;
+	if(stamp!=applied_stamp){
+		applied_stamp = stamp;
+		mip_dsm_latency_add(stamp);
+	}
 
+	/**********************************************************
+	* Log after the motors are written, this only copies the
+	* row into the logger's ring so it never waits on the disk
+	***********************************************************/
+	if(ENABLE_LOGGING && !shedding(MIP_SHED_LOG)){
+		MIP_TRACE_SCOPE("log_push");
+		float row[LOG_CHANNELS] = {
+			cstate.theta, setpoint.theta, cstate.phi, setpoint.phi,
+			cstate.gamma, cstate.d1_u, cstate.d3_u, cstate.vBatt,
+			encoderL, encoderR, sample.dt, mip_acq_missed(&acq)
+		};
+		mip_logger_push(&logger, row);
+		if(ENABLE_PERF) mip_perf_mark(&perf, "log");
+	}
+
+	if(ENABLE_PERF) mip_perf_end(&perf);
+	return 0;
+}
+
+/*******************************************************************************
+* int cascade_step()
+*
+* D2 turns the phi error into a theta setpoint and D1 the theta error into
+* d1_u, scaled for the battery voltage. Returns 1 if D1 saturated.
+*******************************************************************************/
+int cascade_step(){
+	if(ENABLE_POSITION_HOLD){
+		if(outer_due){
+			cstate.d2_u = mip_filter_output(D2,setpoint.phi-cstate.phi);
+			if(!ENABLE_SPLIT_STEP) mip_filter_commit(D2);
+		}
+		setpoint.theta = cstate.d2_u;
+	}
+	else setpoint.theta = 0.0;
+	if(ENABLE_PERF) mip_perf_mark(&perf, "D2");
+
+	D1->gain = tune->gain[TUNE_D1]* \
+					mip_gain_table_lookup(&vbatt_table, cstate.vBatt, 0);
+	cstate.d1_u = mip_filter_output(D1,setpoint.theta - cstate.theta);
+	if(!ENABLE_SPLIT_STEP) mip_filter_commit(D1);
+	if(ENABLE_PERF) mip_perf_mark(&perf, "D1");
+	return mip_filter_saturated(D1);
+}
+
+/*******************************************************************************
+* int rates_step()
+*
+* Rates for the state feedback controllers. theta_dot comes from the gyro,
+* phi_dot and gamma_dot from lowpassed differences. phi_dot is the
+* difference of phi as a whole rather than gyro plus wheel rate, the lowpass
+* would delay only the wheels and at the body's fast mode the two halves
+* stop cancelling.
+*******************************************************************************/
+int rates_step(){
+	// first step since arming, the rate filters start at rest
+	if(fb_steps==0){
+		mip_acq_rate_reset(&phi_rate, cstate.phi, 0);
+		mip_acq_rate_reset(&gamma_rate, cstate.gamma, 0);
+	}
+	cstate.theta_dot = sample.gyro[0]*DEG_TO_RAD;
+	cstate.phi_dot = mip_acq_rate(&phi_rate, cstate.phi, sample.dt);
+	cstate.gamma_dot = mip_acq_rate(&gamma_rate, cstate.gamma, sample.dt);
+	return 0;
+}
+
+/*******************************************************************************
+* int lqr_step()
+*
+* u = -K*(x - x_ref) over theta, theta_dot, phi, phi_dot and with
+* LQR_STEERING gamma, gamma_dot too, rates from rates_step(). The gain ramps
+* up over SOFT_START_SEC after arming like D1 and is scaled for the battery
+* voltage. Returns 1 if the drive duty saturated.
+*******************************************************************************/
+int lqr_step(){
+	static const float K[LQR_INPUTS][LQR_STATES] = LQR_K;
+	const float ramp = SOFT_START_SEC*SAMPLE_RATE_HZ;
+	float x[LQR_STATES], u[LQR_INPUTS], scale;
+
+	rates_step();
+	x[0] = cstate.theta;
+	x[1] = cstate.theta_dot;
+	x[2] = ENABLE_POSITION_HOLD ? cstate.phi - setpoint.phi : 0;
+	x[3] = cstate.phi_dot - setpoint.phi_dot;
+	if(LQR_STEERING){
+		x[LQR_STATES-2] = cstate.gamma - setpoint.gamma;
+		x[LQR_STATES-1] = cstate.gamma_dot - setpoint.gamma_dot;
+	}
+	MIP_MAT_VEC(u, K, x, LQR_INPUTS, LQR_STATES);
+
+	scale = -mip_gain_table_lookup(&vbatt_table, cstate.vBatt, 0);
+	if(fb_steps < ramp) scale *= fb_steps/ramp;
+	if(fb_steps <= ramp) fb_steps++;
+	cstate.d1_u = scale*u[0];
+	if(LQR_STEERS){
+		cstate.d3_u = scale*u[LQR_INPUTS-1];
+		if(cstate.d3_u > STEERING_INPUT_MAX) cstate.d3_u = STEERING_INPUT_MAX;
+		if(cstate.d3_u <-STEERING_INPUT_MAX) cstate.d3_u =-STEERING_INPUT_MAX;
+	}
+	if(ENABLE_PERF) mip_perf_mark(&perf, "LQR");
+	if(cstate.d1_u > 1.0) cstate.d1_u = 1.0;
+	else if(cstate.d1_u < -1.0) cstate.d1_u = -1.0;
+	else return 0;
+	return 1;
+}
+
+/*******************************************************************************
+* int mpc_step()
+*
+* Drive duty from mip_mpc over the same four states as LQR_K4, steering
+* stays with D3. The battery compensation and the soft start narrow the
+* plan's duty limits instead of scaling its output, so the duty applied
+* never passes +-1. D1/D2 run every step on the same errors, a solve that
+* misses MPC_BUDGET_US hands this step to them with their filters current.
+* Returns 1 if the drive duty is at its limit.
+*******************************************************************************/
+int mpc_step(){
+	const float ramp = SOFT_START_SEC*SAMPLE_RATE_HZ;
+	float x[MIP_MPC_STATES], u, scale, limit;
+	uint64_t t0;
+	int saturated, ret;
+
+	rates_step();
+	x[0] = cstate.theta;
+	x[1] = cstate.theta_dot;
+	x[2] = ENABLE_POSITION_HOLD ? cstate.phi - setpoint.phi : 0;
+	x[3] = cstate.phi_dot - setpoint.phi_dot;
+
+	scale = mip_gain_table_lookup(&vbatt_table, cstate.vBatt, 0);
+	limit = 1.0/scale;
+	if(fb_steps < ramp) limit *= fb_steps/ramp;
+	if(fb_steps <= ramp) fb_steps++;
+	mip_mpc_limits(&mpc, -limit, limit);
+	t0 = mip_latency_now();
+	ret = mip_mpc_solve(&mpc, x, t0 + MPC_BUDGET_US*1000ULL, &u);
+	mip_latency_add(&mpc_latency, t0);
+	if(ENABLE_PERF) mip_perf_mark(&perf, "MPC");
+
+	saturated = cascade_step();
+	if(ret<0){
+		MIP_TRACE_INSTANT("mpc fallback");
+		return saturated;
+	}
+	cstate.d1_u = scale*u;
+	return fabs(cstate.d1_u) >= 0.999;
+}
+
+/*******************************************************************************
+* int sysid_step()
+*
+* Once the soft start is over, adds the next sample of the test signal to
+* d1_u and hands the duty as it would be at V_NOMINAL, theta and phi to the
+* estimator. Each arming runs the whole signal once, the first sample
+* starts a new record.
+*******************************************************************************/
+int sysid_step(){
+	int start;
+	if(sysid_steps < SOFT_START_SEC*SAMPLE_RATE_HZ){
+		sysid_steps++;
+		return 0;
+	}
+	if(mip_excite_done(&excite)) return 0;
+	start = excite.k==0;
+	if(start) MIP_TRACE_INSTANT("sysid start");
+	cstate.d1_u += mip_excite_step(&excite);
+	saturate_float(&cstate.d1_u, -1, 1);
+	mip_sysid_push(cstate.d1_u*cstate.vBatt/V_NOMINAL, cstate.theta, \
+													cstate.phi, start);
+	if(mip_excite_done(&excite)) MIP_TRACE_INSTANT("sysid done");
+	return 0;
+}
+
+/*******************************************************************************
+* int dsm_to_rates()
+*
+* Turn normalized (+-1) drive and turn sticks into phi_dot and gamma_dot
+* setpoints for the current drive mode. Polarity makes positive stick mean
+* positive setpoint, then saturation and a deadzone are applied.
+*******************************************************************************/
+int dsm_to_rates(float drive_stick, float turn_stick, float* phi_dot,
+														float* gamma_dot){
+	drive_stick *= DSM_DRIVE_POL;
+	turn_stick  *= DSM_TURN_POL;
+
+	// saturate the inputs to avoid possible erratic behavior
+	saturate_float(&drive_stick,-1,1);
+	saturate_float(&turn_stick,-1,1);
+	
+	// use a small deadzone to prevent slow drifts in position
+	if(fabs(drive_stick)<DSM_DEAD_ZONE) drive_stick = 0.0;
+	if(fabs(turn_stick)<DSM_DEAD_ZONE)  turn_stick  = 0.0;
+
+	// translate normalized user input to real setpoint values
+	switch(setpoint.drive_mode){
+	case NOVICE:
+		*phi_dot   = DRIVE_RATE_NOVICE * drive_stick;
+		*gamma_dot =  TURN_RATE_NOVICE * turn_stick;
+		break;
+	case ADVANCED:
+		*phi_dot   = DRIVE_RATE_ADVANCED * drive_stick;
+		*gamma_dot = TURN_RATE_ADVANCED  * turn_stick;
+		break;
+	default: break;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int dsm_step()
+*
+* Called every control step. A new frame is scaled once into rate targets,
+* then phi_dot and gamma_dot move toward them by at most DSM_DRIVE_ACCEL and
+* DSM_TURN_ACCEL so stick changes arrive as ramps instead of steps. Targets
+* drop to zero once no frame arrived for DSM_TIMEOUT.
+*******************************************************************************/
+int dsm_step(){
+	static float phi_dot_target = 0, gamma_dot_target = 0;
+	static uint64_t t_last = 0;
+	const float drive_step = DSM_DRIVE_ACCEL*sample.dt;
+	const float turn_step = DSM_TURN_ACCEL*sample.dt;
+	mip_dsm_frame_t frame;
+	float d;
+
+	if(mip_dsm_pop(&frame)){
+		dsm_to_rates(frame.ch[DSM_DRIVE_CH], frame.ch[DSM_TURN_CH], \
+									&phi_dot_target, &gamma_dot_target);
+		t_last = frame.t_ns;
+		setpoint_stamp = frame.t_ns;
+		MIP_TRACE_COUNTER("phi_dot", phi_dot_target);
+		MIP_TRACE_COUNTER("gamma_dot", gamma_dot_target);
+	}
+	else if(mip_dsm_now_ns()-t_last > DSM_TIMEOUT*1e9){
+		phi_dot_target = 0;
+		gamma_dot_target = 0;
+	}
+
+	d = phi_dot_target - setpoint.phi_dot;
+	saturate_float(&d, -drive_step, drive_step);
+	setpoint.phi_dot += d;
+	d = gamma_dot_target - setpoint.gamma_dot;
+	saturate_float(&d, -turn_step, turn_step);
+	setpoint.gamma_dot += d;
 	return 0;
 }
 
@@ -378,9 +999,15 @@ int balance_controller(){
 *	Clear the controller's memory and zero out setpoints.
 *******************************************************************************/
 int zero_out_controller(){
-	reset_filter(&D1);
-	reset_filter(&D2);
-	reset_filter(&D3);
+	mip_filter_reset(D1);
+	mip_filter_reset(D2);
+	mip_filter_reset(D3);
+	mip_acq_rate_reset(&phi_rate, 0, 0);
+	mip_acq_rate_reset(&gamma_rate, 0, 0);
+	mip_mpc_reset(&mpc);
+	fb_steps = 0;
+	mip_excite_reset(&excite);
+	sysid_steps = 0;
 	setpoint.theta = 0.0;
 	setpoint.phi   = 0.0;
 	setpoint.gamma = 0.0;
@@ -394,8 +1021,11 @@ int zero_out_controller(){
 * disable motors & set the setpoint.core_mode to DISARMED
 *******************************************************************************/
 int disarm_controller(){
+	if(ENABLE_TRIPWIRE) mip_tripwire_arm(0);
+	if(setpoint.arm_state==ARMED) MIP_TRACE_INSTANT("disarm");
 	disable_motors();
 	setpoint.arm_state = DISARMED;
+	if(ENABLE_IDLE) mip_idle_enter();
 	return 0;
 }
 
@@ -409,8 +1039,12 @@ int arm_controller(){
 	set_encoder_pos(ENCODER_CHANNEL_L,0);
 	set_encoder_pos(ENCODER_CHANNEL_R,0);
 	// prefill_filter_inputs(&D1,cstate.theta); 
+	// full clock before the first armed step, the governor backs off later
+	if(ENABLE_GOVERNOR) mip_governor_request_boost();
 	setpoint.arm_state = ARMED;
 	enable_motors();
+	MIP_TRACE_INSTANT("arm");
+	if(ENABLE_TRIPWIRE) mip_tripwire_arm(1);
 	return 0;
 }
 
@@ -426,6 +1060,7 @@ int wait_for_starting_condition(){
 	const int check_hz = 20;	// check 20 times per second
 	int checks_needed = round(START_DELAY*check_hz);
 	int wait_us = 1000000/check_hz; 
+	MIP_TRACE_SCOPE("wait_for_starting_condition");
 
 	// exit if state becomes paused or exiting
 	while(get_state()==RUNNING){
@@ -435,7 +1070,11 @@ int wait_for_starting_condition(){
 			// waited long enough, return
 			if(checks >= checks_needed) return 0;
 		}
-		// fell out of range, restart counter
+		// fell out of range, go back to idle or restart counter
+		else if(ENABLE_IDLE){
+			mip_idle_enter();
+			return -1;
+		}
 		else checks = 0;
 		usleep(wait_us);
 	}
@@ -443,21 +1082,56 @@ int wait_for_starting_condition(){
 }
 
 /*******************************************************************************
-* battery_checker()
+* float vbatt_comp()
 *
-* Slow loop checking battery voltage. Also changes the D1 saturation limit
-* since that is dependent on the battery voltage.
+* Duty scale for battery voltage, fills vbatt_table so the controllers
+* don't divide every step.
 *******************************************************************************/
-void* battery_checker(void* ptr){
-	float new_v;
-	while(get_state()!=EXITING){
-		new_v = get_battery_voltage();
-		// if the value doesn't make sense, use nominal voltage
-		if (new_v>9.0 || new_v<5.0) new_v = V_NOMINAL;
-		cstate.vBatt = new_v;
-		usleep(1000000 / BATTERY_CHECK_HZ);
-	}
-	return NULL;
+float vbatt_comp(float v, float x){
+	return V_NOMINAL/v;
+}
+
+/*******************************************************************************
+* int use_tune()
+*
+* Point D1, D2 and D3 at a set of filters, returns 1 if it is a new set.
+*******************************************************************************/
+int use_tune(mip_tune_set_t* set){
+	if(set==tune) return 0;
+	tune = set;
+	D1 = &set->f[TUNE_D1];
+	D2 = &set->f[TUNE_D2];
+	D3 = &set->f[TUNE_D3];
+	return 1;
+}
+
+/*******************************************************************************
+* int set_cpu_level()
+*
+* Frequency interface for the governor, level indexes mip_governor_mhz.
+*******************************************************************************/
+int set_cpu_level(int level){
+	static const cpu_frequency_t freq[MIP_GOVERNOR_LEVELS] = {
+		FREQ_300MHZ, FREQ_600MHZ, FREQ_800MHZ, FREQ_1000MHZ
+	};
+	if(level<0 || level>=MIP_GOVERNOR_LEVELS) return -1;
+	MIP_TRACE_COUNTER("cpu_mhz", mip_governor_mhz[level]);
+	return set_cpu_frequency(freq[level]);
+}
+
+/*******************************************************************************
+* void on_idle_change()
+*
+* Called by mip_idle when entering or leaving idle, on the thread that
+* entered or on the helper thread that finished leaving, never the IMU
+* interrupt. The idle lock is held, so it must not call back into mip_idle.
+* Slows the battery thread and parks the logger.
+*******************************************************************************/
+void on_idle_change(int idle){
+	if(idle) MIP_TRACE_INSTANT("idle");
+	else MIP_TRACE_INSTANT("active");
+	mip_battery_set_rate(idle ? IDLE_BATTERY_HZ : BATTERY_CHECK_HZ);
+	if(ENABLE_LOGGING) mip_logger_park(&logger, idle);
 }
 
 /*******************************************************************************
@@ -467,8 +1141,10 @@ void* battery_checker(void* ptr){
 * this only gets started if executing from terminal
 *******************************************************************************/
 void* printf_loop(void* ptr){
-	state_t last_state, new_state; // keep track of last state 
+	state_t last_state = UNINITIALIZED, new_state; // keep track of last state 
+	mip_trace_thread_name("printf_loop");
 	while(get_state()!=EXITING){
+		MIP_TRACE_BEGIN("printf_loop");
 		new_state = get_state();
 		// check if this is the first time since being paused
 		if(new_state==RUNNING && last_state!=RUNNING){
@@ -490,7 +1166,7 @@ void* printf_loop(void* ptr){
 		last_state = new_state;
 		
 		// decide what to print or exit
-		if(new_state == RUNNING){	
+		if(new_state == RUNNING && !shedding(MIP_SHED_CONSOLE)){	
 			printf("\r");
 			printf("%7.2f  |", cstate.theta);
 			printf("%7.2f  |", setpoint.theta);
@@ -505,20 +1181,19 @@ void* printf_loop(void* ptr){
 			else printf("DISARMED |");
 			fflush(stdout);
 		}
-		usleep(1000000 / PRINTF_HZ);
+		MIP_TRACE_END("printf_loop");
+		mip_idle_sleep(1000000 / PRINTF_HZ, 1000000 / IDLE_PRINTF_HZ);
 	}
 	return NULL;
 } 
 
 /*******************************************************************************
 *	on_pause_press() 
-*	Disarm the controller and set system state to paused.
-*	If the user holds the pause button for 2 seconds, exit cleanly
+*	Disarm the controller and toggle between PAUSED and RUNNING right on the
+*	press edge. Holding the button is handled by on_pause_long().
 *******************************************************************************/
 int on_pause_press(){
-	int i=0;
-	const int samples = 100;	// check for release 100 times in this period
-	const int us_wait = 2000000; // 2 seconds
+	MIP_TRACE_SCOPE("on_pause_press");
 	
 	switch(get_state()){
 	// pause if running
@@ -539,27 +1214,30 @@ int on_pause_press(){
 	default:
 		break;
 	}
-	
-	// now wait to see if the user want to shut down the program
-	while(i<samples){
-		usleep(us_wait/samples);
-		if(get_pause_button() == RELEASED){
-			return 0; //user let go before time-out
-		}
-		i++;
-	}
-	printf("long press detected, shutting down\n");
-	//user held the button down long enough, blink and exit cleanly
-	blink_led(RED,5,2);
+	return 0;
+}
+
+/*******************************************************************************
+*	on_pause_long()
+*	The pause button was held for MIP_BUTTON_LONG_MS, exit cleanly
+*******************************************************************************/
+int on_pause_long(){
+	MIP_TRACE_INSTANT("long_press");
+	printf("long press detected (%llu ms), shutting down\n", \
+		(unsigned long long)mip_button_held_ms(MIP_BUTTON_PAUSE));
+	disarm_controller();
+	set_led(RED,1);
+	set_led(GREEN,0);
 	set_state(EXITING);
 	return 0;
 }
 
 /*******************************************************************************
-*	on_mode_release()
-*	toggle between position and angle modes if MiP is paused
+*	on_mode_click()
+*	toggle between NOVICE and ADVANCED drive modes on a short mode click
 *******************************************************************************/
-int on_mode_release(){
+int on_mode_click(){
+	MIP_TRACE_SCOPE("on_mode_click");
 	// toggle between position and angle modes
 	if(setpoint.drive_mode == NOVICE){
 		setpoint.drive_mode = ADVANCED;
@@ -569,7 +1247,5 @@ int on_mode_release(){
 		setpoint.drive_mode = NOVICE;
 		printf("using drive_mode = NOVICE\n");
 	}
-	
-	blink_led(GREEN,5,1);
 	return 0;
 }
\ No newline at end of file
@@ -6,13 +6,26 @@
 *
 *******************************************************************************/
 
+#ifdef MIP_SIM
+#include "../mipsim/mipsim.h"
+#else
 #include "../../libraries/roboticscape-usefulincludes.h"
 #include "../../libraries/roboticscape.h"
+#endif
 
 #include "./stubalance_config.h"
+#include "../common/mip_trace.h"
+#include "../common/mip_perf.h"
+#include "../common/mip_filter.h"
+#include "../common/mip_latency.h"
+#include "../common/mip_idle.h"
+#include "../common/mip_arena.h"
+#include "../common/mip_tripwire.h"
+#include "../common/mip_acq.h"
+#include "../common/mip_fifo.h"
+#include "../common/mip_telem.h"
 
 #define SAMPLE_RATE 200 // Hz
-#define TIME_CONSTANT 2.0 // Sec
 
 
 // function declarations
@@ -23,6 +36,7 @@ int disarm_controller();
 int arm_controller();
 int wait_for_starting_condition();
 int zero_out_controller();
+int telem_step(uint64_t t_irq);
 
 // threads
 void* print_data(void* ptr);
@@ -30,16 +44,25 @@ void* setpoint_manager(void* ptr);
  
 // Global variables
 imu_data_t data; //struct to hold new data from IMU
-d_filter_t LP, HP; // Lowpass and Highpass filters structs
-
-float g_y, g_z, theta_a, filtered_theta_a, filtered_theta_g, theta; //gravity,thetas
-float theta_dot, theta_g=0; // initialize starting angle for euler's method
-float PhiLeft=0, PhiRight=0, Phi=0, Phi1=0, theta_r=0, theta_r1=0;//outer loop
-float d1u=0, d1u1=0, d1u2=0, theta_e=0, theta_e1=0, theta_e2=0; // inner loop
+mip_perf_t perf; // counters around controller()
+mip_filter_t D1, D2; // inner and outer loop controllers
+mip_latency_t motor_latency; // controller() entry to set_motor()
+mip_acq_t acq; // timestamps the sensors, measures dt
+mip_acq_sample_t sample; // this interrupt's snapshot
+
+float theta; // complementary filter's estimate
+float PhiLeft=0, PhiRight=0, Phi=0, theta_r=0; //outer loop
+float d1u=0, theta_e=0; // inner loop
 float mount_angle = 0.4; // set angle of BBB on MIP
 float offset = 0; // offset of gyro around X axis
 const float TIME_STEP = 1.0/(float)SAMPLE_RATE; // Calc dt from sample rate
 
+// complementary filter, see stubalance_estimator.h
+#include "./stubalance_estimator.h"
+cf_t cf; // complementary filter state
+cf_in_t cf_in; // this sample's readings
+cf_out_t cf_out; // and every stage's output
+
 /*******************************************************************************
 * arm_state_t
 *
@@ -51,6 +74,12 @@ typedef enum arm_state_t{
 }arm_state_t;
 arm_state_t arm_state = DISARMED;
 
+// telemetry channels, what print_data shows
+#define TELEM_CHANNELS 6
+const char* telem_names[TELEM_CHANNELS] = {
+	"accel_x", "accel_y", "accel_z", "theta", "Phi", "u"
+};
+
 /******************************************************************************
 * int main()
 ******************************************************************************/
@@ -61,6 +90,21 @@ int main(){
 	printf("\n| Wow get ready for balance action! |\n");
 	printf("-------------------------------------\n");
 	
+	// the trace buffers come from the arena
+	if(mip_arena_init(ARENA_BYTES)){
+		printf("WARNING: no arena, allocating from the heap\n");
+	}
+
+	// start tracing before any thread can record
+	if(ENABLE_TRACE){
+		if(mip_trace_start()) printf("WARNING: failed to start tracing\n");
+		mip_trace_thread_name("main");
+	}
+	if(ENABLE_PERF){
+		mip_perf_init(&perf);
+		mip_perf_install_signal();
+	}
+
 	// Initialize cape library
 	if(initialize_cape()){
 		printf("ERROR: failed to initialize_cape\n");
@@ -72,11 +116,17 @@ int main(){
     enable_motors();
     
     // get yourself some filters
-	LP = create_first_order_lowpass(TIME_STEP, TIME_CONSTANT);
-	HP = create_first_order_highpass(TIME_STEP, TIME_CONSTANT);
-	// reset them filters
-	reset_filter(&LP);
-	reset_filter(&HP);
+	cf_init(&cf, TIME_STEP);
+
+	// outer loop D2 makes theta_r from Phi, inner loop D1 makes u from error
+	float D2_num[] = {1.6666, -1.6666*0.9975};
+	float D2_den[] = {1, -0.9608};
+	float D1_num[] = {-3.8333, 7.3476, -3.5171};
+	float D1_den[] = {1, -1.8372, 0.83725};
+	mip_filter_init(&D2, 1, TIME_STEP, D2_num, D2_den);
+	mip_filter_init(&D1, 2, TIME_STEP, D1_num, D1_den);
+	mip_latency_init(&motor_latency, "interrupt to set_motor", 100);
+	mip_idle_init(1, NULL);
 
 	// set imu configuration to defaults
 	imu_config_t imu_config = get_default_imu_config();
@@ -84,41 +134,78 @@ int main(){
 	imu_config.orientation = ORIENTATION_Y_UP; // change orientation to Y up
 	imu_config.dmp_sample_rate = SAMPLE_RATE;  // change sample rate
 	
-	if(initialize_imu_dmp(&data, imu_config)){
+	// the FIFO reader starts with the interrupt function further down
+	if(!ENABLE_IMU_FIFO && initialize_imu_dmp(&data, imu_config)){
 		printf("initialize_imu_dmp() failed\n");
 		printf("ERROR: IMU might be toast\n");
 		blink_led(RED, 5, 10);
 		return -1;
 	}
 	
-	// Print header to console
-	printf("   Accel XYZ(m/s^2)  |");
-	printf(" theta |");
-	printf("  Phi  |");
-	printf("   u   |");
-	printf("\n");
-	
-	// start print_data thread
-    pthread_t print_data_thread;
-    pthread_create(&print_data_thread, NULL, print_data, (void*) NULL);
+	// telemetry for ../telem_view, or print to the console
+	if(ENABLE_TELEM){
+		if(mip_telem_start(TELEM_SOCKET, "stubalance", telem_names, \
+					TELEM_CHANNELS, SAMPLE_RATE, TELEM_SERVE_HZ)){
+			printf("WARNING: failed to start telemetry, nothing to view\n");
+		}
+	}
+	else{
+		// Print header to console
+		printf("   Accel XYZ(m/s^2)  |");
+		printf(" theta |");
+		printf("  Phi  |");
+		printf("   u   |");
+		printf("\n");
+
+		// start print_data thread
+		pthread_t print_data_thread;
+		pthread_create(&print_data_thread, NULL, print_data, (void*) NULL);
+	}
     
 	// start setpoint thread
 	pthread_t  setpoint_thread;
 	pthread_create(&setpoint_thread, NULL, setpoint_manager, (void*) NULL);
 
 	// The interrupt function will print data when invoked
-	set_imu_interrupt_func(&controller);
+	mip_acq_init(&acq, TIME_STEP, 2, 3);
+	if(!ENABLE_IMU_FIFO) set_imu_interrupt_func(&controller);
+	else if(mip_fifo_start(&data, IMU_FIFO_HZ, SAMPLE_RATE, IMU_FIFO_TAPS, \
+									IMU_FIFO_CUTOFF, &controller)){
+		printf("ERROR: IMU FIFO failed to start\n");
+		blink_led(RED, 5, 10);
+		return -1;
+	}
 	
+	mip_arena_seal();
 	set_state(RUNNING);
 	
 	// Keep looping until state changes to EXITING
 	while(get_state()!=EXITING) {
+		if(ENABLE_PERF && mip_perf_report_requested()) mip_perf_print(&perf);
 		usleep(10000); // sleep for 10 ms
 	}
 	
-	// exit cleanly
+	// exit cleanly, leaving idle wakes the parked setpoint thread
+	mip_idle_exit();
 	disable_motors();
-	power_off_imu();
+	if(ENABLE_IMU_FIFO) mip_fifo_stop();
+	else power_off_imu();
+	if(ENABLE_TELEM) mip_telem_stop();
+	if(ENABLE_IMU_FIFO) mip_fifo_print();
+	if(ENABLE_TELEM) mip_telem_print();
+	mip_idle_print();
+	mip_acq_print(&acq);
+	mip_latency_print(&motor_latency);
+	if(ENABLE_PERF){
+		mip_perf_print(&perf);
+		mip_perf_close(&perf);
+	}
+	if(ENABLE_TRACE){
+		mip_trace_stop();
+		mip_trace_write_json(TRACE_FILE);
+	}
+	mip_arena_print();
+	if(ENABLE_TRIPWIRE) mip_tripwire_print();
 	cleanup_cape();
 	return 0;
 }
@@ -130,68 +217,106 @@ int main(){
 *
 ******************************************************************************/
 int controller(){
-    
-	// Integrate gyro data to get absolute position of theta
-	theta_dot = (data.gyro[0] - offset)*DEG_TO_RAD; // spin rate in rad
-	theta_g = theta_g + TIME_STEP*theta_dot; // euler's method
-	// filter low freq noise out of gyro data
-	filtered_theta_g = march_filter(&HP,theta_g + mount_angle);
-
-	// calc theta from accelerometer G and Z components
-	g_y = data.accel[1]-0.1;  // Y direction is 0.1 too high
-	g_z = data.accel[2]-0.45; // Z direction is 0.45 too high
-	theta_a = atan2(-g_z/9.8,g_y/9.8) + mount_angle; // angle to gravity
-	// filter high freq noise out of accelerometer data
-	filtered_theta_a = march_filter(&LP,theta_a);
-    
-	// add them together
-	theta = filtered_theta_a + filtered_theta_g;
+	uint64_t t_irq = mip_latency_now();
+	static int named = 0, watched = 0;
+	if(!named) named = !mip_trace_thread_name("imu_interrupt");
+	if(ENABLE_TRIPWIRE && !watched){
+		watched = !mip_tripwire_watch(TRIPWIRE_ABORT);
+	}
+	MIP_TRACE_SCOPE("controller");
+	// a repeated sample was already handled
+	if(mip_acq_capture(&acq, t_irq, &data, &sample)) return 0;
+	if(ENABLE_PERF) mip_perf_begin(&perf);
+
+	// gyro and accelerometer through the complementary filter
+	cf_in.gyro_x = sample.gyro[0];
+	cf_in.accel_y = sample.accel[1];
+	cf_in.accel_z = sample.accel[2];
+	cf_in.dt = sample.dt; // measured dt
+	cf_step(&cf, &cf_in, &cf_out);
+	theta = cf_out.theta;
+	if(ENABLE_PERF) mip_perf_mark(&perf, "estimate");
     
 	// disable motors if MIP tips over
 	if(fabs(theta)>TIP_ANGLE){
+		if(arm_state==ARMED) MIP_TRACE_INSTANT("tip");
         disarm_controller();
 	}
+
+	// the complementary filter needs every sample, but while idle that is
+	// all, until MIP looks upright again
+	if(mip_idle_is_idle()){
+		if(get_state()==RUNNING && fabs(theta)<START_ANGLE) mip_idle_exit();
+		telem_step(t_irq);
+		if(ENABLE_PERF) mip_perf_end(&perf);
+		return 0;
+	}
 	
     // collect encoder positions, right wheel is reversed
-	PhiRight = -1*(float)get_encoder_pos(3) * TWO_PI/(GEARBOX*60.0);
-	PhiLeft =     (float)get_encoder_pos(2) * TWO_PI/(GEARBOX*60.0);
+	PhiRight = -1*(float)sample.encoder_r * TWO_PI/(GEARBOX*60.0);
+	PhiLeft =     (float)sample.encoder_l * TWO_PI/(GEARBOX*60.0);
 	    
     // Get average Phi
     Phi = (PhiLeft + PhiRight)/2.0 + theta;
+	if(ENABLE_PERF) mip_perf_mark(&perf, "encoders");
 
     // Get desired theta from outer loop D2 controller
-    theta_r = 1.6666*(Phi - 0.9975*Phi1) + 0.9608*theta_r1;
-    Phi1=Phi;
-    theta_r1=theta_r;
+    theta_r = mip_filter_output(&D2, Phi);
 
     // theta error is (reference theta - current theta) * prefactor ??????????
     theta_e = (theta_r - theta)*0.333;
 
     // Control motors based on D1 controller
-    d1u = 1.8372*d1u1 - 0.83725*d1u2 - 3.8333*theta_e + 7.3476*theta_e1 - 3.5171*theta_e2;
-
-    // shift values down (I know I need to learn how to use the damn ring buffer)
-	d1u2=d1u1;
-	d1u1=d1u;
-	theta_e2=theta_e1;
-	theta_e1=theta_e;
+    d1u = mip_filter_output(&D1, theta_e);
+	if(!ENABLE_SPLIT_STEP){
+		mip_filter_commit(&D2);
+		mip_filter_commit(&D1);
+	}
+	if(ENABLE_PERF) mip_perf_mark(&perf, "D1 D2");
     
-	// exit if the controller is disarmed or state is exiting
+	// exit if state is exiting
 	if(get_state() == EXITING){
 		disable_motors();
 		return 0;
 	}
-	if(arm_state==DISARMED){
-		return 0;
+	// only drive the motors if armed, the filters keep running either way
+	if(arm_state==ARMED){
+		set_motor(2, d1u); // Left
+		set_motor(3, -1*d1u); // Right
+		mip_latency_add(&motor_latency, t_irq);
+		if(ENABLE_PERF) mip_perf_mark(&perf, "motors");
+		if(!ENABLE_TELEM){
+			printf("\r ");
+			if(ENABLE_PERF) mip_perf_mark(&perf, "printf");
+		}
 	}
-	printf("\r ");
-
-    set_motor(2, d1u); // Left
-    set_motor(3, -1*d1u); // Right
 
+	// history and next step's past terms, after the motors are written
+	if(ENABLE_SPLIT_STEP){
+		mip_filter_commit(&D2);
+		mip_filter_commit(&D1);
+		if(ENABLE_PERF) mip_perf_mark(&perf, "commit");
+	}
+	telem_step(t_irq);
+	if(ENABLE_PERF) mip_perf_end(&perf);
 	return 0;
 }
 
+/******************************************************************************
+* int telem_step()
+*
+* This sample to the telemetry ring, never waits on a viewer
+******************************************************************************/
+int telem_step(uint64_t t_irq){
+	if(!ENABLE_TELEM) return 0;
+	MIP_TRACE_SCOPE("telem_publish");
+	float row[TELEM_CHANNELS] = {
+		sample.accel[0], sample.accel[1], sample.accel[2], theta, Phi, d1u
+	};
+	return mip_telem_publish(t_irq, get_state(), \
+							arm_state==ARMED ? MIP_TELEM_ARMED : 0, row);
+}
+
 /******************************************************************************
 * void* print_data()
 *
@@ -200,7 +325,9 @@ int controller(){
 ******************************************************************************/
 
 void* print_data(void* ptr){
+	mip_trace_thread_name("print_data");
     while(get_state()!=EXITING){
+		MIP_TRACE_BEGIN("print_data");
         printf("\r");
 
 		printf("%6.2f %6.2f %6.2f |",	data.accel[0],\
@@ -211,7 +338,8 @@ void* print_data(void* ptr){
 		printf(" %5.2f |", d1u);
 		
 		fflush(stdout); // flush to console (necessary?)
-		usleep(500000);
+		MIP_TRACE_END("print_data");
+		mip_idle_sleep(500000, 1000000/IDLE_PRINTF_HZ);
 	}
 	return NULL;
 }
@@ -222,8 +350,11 @@ void* print_data(void* ptr){
 * disable motors & set the arm state to DISARMED
 *******************************************************************************/
 int disarm_controller(){
+	if(ENABLE_TRIPWIRE) mip_tripwire_arm(0);
+	if(arm_state==ARMED) MIP_TRACE_INSTANT("disarm");
 	disable_motors();
 	arm_state = DISARMED;
+	if(ENABLE_IDLE) mip_idle_enter();
 	return 0;
 }
 
@@ -239,6 +370,8 @@ int arm_controller(){
 	// prefill_filter_inputs(&D1,theta);
 	arm_state = ARMED;
 	enable_motors();
+	MIP_TRACE_INSTANT("arm");
+	if(ENABLE_TRIPWIRE) mip_tripwire_arm(1);
 	return 0;
 }
 
@@ -249,13 +382,10 @@ int arm_controller(){
 *******************************************************************************/
 int zero_out_controller(){
 	d1u = 0;
-	d1u1 = 0;
-	d1u2 = 0;
 	theta_e = 0.0;
-	theta_e1 = 0;
-	theta_e2 = 0;
 	Phi = 0.0;
-	Phi1 = 0;
+	mip_filter_reset(&D1);
+	mip_filter_reset(&D2);
 	set_motor_all(0);
 	return 0;
 }
@@ -281,7 +411,11 @@ int wait_for_starting_condition(){
 			// waited long enough, return
 			if(checks >= checks_needed) return 0;
 		}
-		// fell out of range, restart counter
+		// fell out of range, go back to idle or restart counter
+		else if(ENABLE_IDLE){
+			mip_idle_enter();
+			return -1;
+		}
 		else checks = 0;
 		usleep(wait_us);
 	}
@@ -295,6 +429,7 @@ int wait_for_starting_condition(){
 *
 *******************************************************************************/
 void* setpoint_manager(void* ptr){
+	mip_trace_thread_name("setpoint_manager");
 
 	// wait for IMU to settle
 	disarm_controller();
@@ -307,14 +442,17 @@ void* setpoint_manager(void* ptr){
 	
 	while(get_state()!=EXITING){
 		// sleep at beginning of loop so we can use the 'continue' statement
-		usleep(1000000/SETPOINT_MANAGER_HZ);
+		// parked while idle, the interrupt wakes us when MIP is picked up
+		mip_idle_sleep(1000000/SETPOINT_MANAGER_HZ, 0);
 		
-		// nothing to do if paused, go back to beginning of loop
+		// nothing to do if paused or idle, go back to beginning of loop
 		if(get_state() != RUNNING) continue;
+		if(mip_idle_is_idle()) continue;
 
 		// if we got here the state is RUNNING, but controller is not
 		// necessarily armed. If DISARMED, wait for the user to pick MIP up
 		// which will we detected by wait_for_starting_condition()
+		MIP_TRACE_SCOPE("setpoint_manager");
 		if(arm_state == DISARMED){
 			if(wait_for_starting_condition()==0){
 				zero_out_controller();
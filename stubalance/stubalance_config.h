@@ -24,6 +24,7 @@
 #define D1_NUM					{-6.289, 11.910, -5.634 }
 #define D1_DEN					{ 1.000, -1.702,  0.702 }
 #define D1_SATURATION_TIMEOUT	0.5
+#define D1_GAIN_TABLE_POINTS	41		// over 5 to 9 V battery
 
 // outer loop controller original 200hz
 #define D2_GAIN					0.7
@@ -48,12 +49,45 @@
 // #define 	D2_DEN					{1, -2.86, 2.721, -0.8605}
 // #define 	THETA_REF_MAX			0.37
 
+// balance controller, the D1/D2 cascade above, full state feedback or
+// model predictive
+#define CONTROLLER_CASCADE		0
+#define CONTROLLER_LQR			1
+#define CONTROLLER_MPC			2
+#ifndef CONTROLLER_TYPE
+#define CONTROLLER_TYPE			CONTROLLER_CASCADE
+#endif
+
+// full state LQR on theta, theta_dot, phi, phi_dot (gamma, gamma_dot), from
+// lqr_design -q 0.05,0.3,1,8,0.5,5 -r 1,0.5 -d 0.005
+#define LQR_STEERING			1		// steer with LQR_K6 instead of D3
+#define LQR_RATE_TAU			0.02	// s, lowpass on phi_dot and gamma_dot
+#define LQR_K4					{{-5.235, -0.6291, -0.1359, -0.1135}}
+#define LQR_K6					{{-5.235, -0.6291, -0.1359, -0.1135, 0, 0}, \
+								 {0, 0, 0, 0, 0.8807, 0.09765}}
+
+// model predictive control, plans MPC_HORIZON samples of drive duty within
+// the duty limits with the LQR_K4 weights, steering stays with D3. D1/D2 run
+// alongside and take over any step whose solve misses MPC_BUDGET_US
+#define MPC_HORIZON				20		// samples, 100 ms
+#define MPC_WEIGHTS				{0.05, 0.3, 1, 8}	// lqr_design -q
+#define MPC_DUTY_WEIGHT			1.0		// lqr_design -r
+#define MPC_MAX_ITER			100
+#define MPC_BUDGET_US			1000
+
 // steering controller
 #define D3_KP					1.0
 #define D3_KI					0.05
 #define D3_KD					0.1
 #define STEERING_INPUT_MAX		0.5
 
+// runtime tuning, D1_*, D2_*, D3_K*, THETA_REF_MAX and STEERING_INPUT_MAX
+// lines in TUNE_FILE override the ones above, checked and then swapped in
+// between two armed steps without restarting, see mip_tune.h
+#define ENABLE_TUNE				1
+#define TUNE_FILE				"balance_tune.txt"
+#define TUNE_CHECK_HZ			4
+
 // electrical hookups
 #define MOTOR_CHANNEL_L			3
 #define MOTOR_CHANNEL_R			2
@@ -77,10 +111,116 @@
 #define DSM_TURN_CH				2
 #define DSM_DEAD_ZONE			0.04
 
+// DSM frames go straight to the control step instead of setpoint_manager
+#define ENABLE_DSM_PIPELINE		1
+#define DSM_DRIVE_ACCEL			80		// max change of phi_dot (rad/s^2)
+#define DSM_TURN_ACCEL			40		// max change of gamma_dot (rad/s^2)
+#define DSM_TIMEOUT				0.3		// s without frames before stopping
+
 // Thread Loop Rates
-#define BATTERY_CHECK_HZ		5
+#define BATTERY_CHECK_HZ		50
+#define BATTERY_WAIT_S			1.0		// for a first reading, then V_NOMINAL
 #define SETPOINT_MANAGER_HZ		100
-#define PRINTF_HZ				50
+#define PRINTF_HZ				50		// console, when telemetry is off
+
+// telemetry for ../telem_view in place of the console, see mip_telem.h
+#ifndef ENABLE_TELEM
+#define ENABLE_TELEM			1
+#endif
+#define TELEM_SOCKET			"balance_telem.sock"
+#define TELEM_SERVE_HZ			50		// server passes per second
+
+// logging, written in the background as a compressed MIP log
+#define ENABLE_LOGGING			1
+#define LOG_FILE				"balance_log.mipl"
+#define LOG_ANGLE_ERROR			0.0005	// max error of logged angles (rad)
+#define LOG_DUTY_ERROR			0.0005	// max error of logged duty cycles
+#define LOG_VOLTAGE_ERROR		0.005	// max error of logged voltage (V)
+#define LOG_DT_ERROR			1e-6	// max error of logged dt (s)
+
+// thread tracing, open the file in chrome://tracing or ui.perfetto.dev
+#define ENABLE_TRACE			1
+#define TRACE_FILE				"balance_trace.json"
+
+// hardware counters around the control step, report at exit or on SIGUSR1
+#ifndef ENABLE_PERF
+#define ENABLE_PERF				0
+#endif
+
+// run the controllers' past terms after set_motor so only the new sample's
+// multiply-add sits between the IMU interrupt and the motors
+#ifndef ENABLE_SPLIT_STEP
+#define ENABLE_SPLIT_STEP		1
+#endif
+
+// CPU clock governor, lowest clock whose worst step in each window leaves
+// GOVERNOR_MARGIN of the sample period free, full clock on arm or overrun
+#define ENABLE_GOVERNOR			1
+#define GOVERNOR_MARGIN			0.5
+#define GOVERNOR_WINDOW			0.1		// s between decisions
+#define GOVERNOR_HOLD			1.0		// s of spare slack before clocking down
+
+// deadline watchdog, when control steps overrun the period it gives up the
+// console, logging, tracing and the outer loop rate in that order, then
+// disarms, and restores them once the slack is back, see mip_watchdog.h
+#ifndef ENABLE_WATCHDOG
+#define ENABLE_WATCHDOG			1
+#endif
+#define WATCHDOG_WINDOW			20		// steps per decision, 0.1 s
+#define WATCHDOG_TRIP			2		// overruns in a window to shed a level
+#define WATCHDOG_RECOVER		0.5		// of the period free for a clean window
+#define WATCHDOG_HOLD			10		// clean windows to restore a level
+
+// stubalance reads accel and gyro from the MPU's FIFO at IMU_FIFO_HZ and
+// decimates them to its sample rate with an IMU_FIFO_TAPS FIR instead of
+// taking the DMP's interrupt, see mip_fifo.h. With the noise filtered the
+// complementary filter can hand over to the accelerometer sooner.
+#ifndef ENABLE_IMU_FIFO
+#define ENABLE_IMU_FIFO			0
+#endif
+#define IMU_FIFO_HZ				1000
+#define IMU_FIFO_TAPS			10		// 4.5 ms of delay at 1 kHz
+#define IMU_FIFO_CUTOFF			1.0		// of the sample rate's Nyquist
+#define IMU_FIFO_TIME_CONSTANT	0.5		// s, complementary filter, 2 with DMP
+
+// idle while disarmed or paused: 1 in IDLE_DECIMATION IMU samples, parked
+// setpoint thread and logger, slower console and battery checks
+#ifndef ENABLE_IDLE
+#define ENABLE_IDLE				1
+#endif
+#define IDLE_DECIMATION			10		// 20 Hz at SAMPLE_RATE_HZ 200
+#define IDLE_PRINTF_HZ			2
+#define IDLE_BATTERY_HZ			5
+
+// system identification, adds a test signal to d1_u for SYSID_SEC after each
+// soft start and fits ARX models of theta and phi in an idle priority
+// thread, written to SYSID_FILE at exit
+#ifndef ENABLE_SYSID
+#define ENABLE_SYSID			0
+#endif
+#define SYSID_CHIRP				0
+#define SYSID_PRBS				1
+#define SYSID_SIGNAL			SYSID_CHIRP
+#define SYSID_AMPLITUDE			0.05	// duty
+#define SYSID_F0				0.5		// Hz, chirp sweep
+#define SYSID_F1				20
+#define SYSID_PRBS_HOLD			2		// samples per bit
+#define SYSID_SEC				20
+#define SYSID_FILE				"balance_sysid.txt"
+
+// memory for the rings, codecs, log blocks and trace buffers, taken and
+// locked at startup then sealed, see mip_arena.h. Tracing is most of it,
+// MIP_TRACE_MAX_THREADS rings of 1 MB.
+#define ARENA_BYTES				(20<<20)
+
+// count any allocation or mutex lock in the control thread while armed,
+// TRIPWIRE_ABORT stops the program at the first one instead
+#ifndef ENABLE_TRIPWIRE
+#define ENABLE_TRIPWIRE			0
+#endif
+#ifndef TRIPWIRE_ABORT
+#define TRIPWIRE_ABORT			0
+#endif
 
 // other
 #define TIP_ANGLE				0.75
@@ -0,0 +1,36 @@
+/*******************************************************************************
+* stubalance_estimator.h
+* By: Stuart Sonatina
+*
+* stubalance's complementary filter: gyro integrated and highpassed plus
+* the accelerometer's angle to gravity lowpassed, as a stage list for
+* ../common/mip_estimator.h. ../microbench includes it too, so it times the
+* same pipeline the program runs.
+*
+* Include once, after stubalance_config.h and with the floats offset and
+* mount_angle in scope. It defines cf_t, cf_in_t, cf_out_t, cf_init(),
+* cf_step() and cf_batch().
+*******************************************************************************/
+
+#if ENABLE_IMU_FIFO
+#define TIME_CONSTANT IMU_FIFO_TIME_CONSTANT // Sec
+#else
+#define TIME_CONSTANT 2.0 // Sec
+#endif
+
+#define MIP_EST_NAME(f) cf_##f
+#define MIP_EST_INPUTS(X) X(gyro_x) X(accel_y) X(accel_z) X(dt)
+#define MIP_EST_STAGES(X) \
+	/* gyro rate in rad/s, Euler's method over the measured dt */ \
+	X(AFFINE,	theta_dot,	gyro_x,	offset,	DEG_TO_RAD) \
+	X(INTEGRATE,	theta_g,	theta_dot,	dt,	0) \
+	/* filter low freq drift out of the gyro angle */ \
+	X(HIGHPASS,	filtered_theta_g,	theta_g + mount_angle,	TIME_CONSTANT,	0) \
+	/* Y direction is 0.1 too high, Z 0.45 */ \
+	X(AFFINE,	g_y,	accel_y,	0.1,	1) \
+	X(AFFINE,	g_z,	accel_z,	0.45,	1) \
+	/* angle to gravity, high freq noise filtered out */ \
+	X(ATAN2,	theta_a,	-g_z/9.8,	g_y/9.8,	mount_angle) \
+	X(LOWPASS,	filtered_theta_a,	theta_a,	TIME_CONSTANT,	0) \
+	X(SUM,		theta,	filtered_theta_a,	filtered_theta_g,	0)
+#include "../common/mip_estimator.h"
@@ -14,11 +14,13 @@
 #include <usefulincludes.h>
 #include <roboticscape.h>
 
+#include "../common/mip_button.h"
+
 
 // function declarations
-int on_pause_pressed();
-int on_pause_released();
-int on_mode_released();
+int on_pause_click();
+int on_pause_long();
+int on_mode_click();
 
 // mode toggles between blink patterns
 int mode;
@@ -39,9 +41,10 @@ int main(){
 
 	// do your own initialization here
 	printf("\nWelcome to Stublink!\n");
-	set_pause_pressed_func(&on_pause_pressed);
-	set_pause_released_func(&on_pause_released);
-	set_mode_released_func(&on_mode_released);
+	mip_button_set_func(MIP_BUTTON_PAUSE, MIP_GESTURE_SHORT, &on_pause_click);
+	mip_button_set_func(MIP_BUTTON_PAUSE, MIP_GESTURE_LONG, &on_pause_long);
+	mip_button_set_func(MIP_BUTTON_MODE, MIP_GESTURE_SHORT, &on_mode_click);
+	mip_button_start();
 
 	// done initializing so set state to RUNNING
 	set_state(RUNNING);
@@ -99,18 +102,19 @@ int main(){
 	printf("\nGoodbye Cruel World\n");
 
 	// exit cleanly
+	mip_button_stop();
 	cleanup_cape();
 	return 0;
 }
 
 
 /*******************************************************************************
-* int on_pause_released()
+* int on_pause_click()
 *
 * 1. Make the Pause button toggle between paused and running states.
 * 4. Print status only when status changes
 *******************************************************************************/
-int on_pause_released(){
+int on_pause_click(){
 	// toggle between paused and running modes
 	if(get_state()==RUNNING){
 		set_state(PAUSED);
@@ -126,7 +130,7 @@ int on_pause_released(){
 }
 
 /*******************************************************************************
-* int on_mode_released()
+* int on_mode_click()
 *
 * 1. Mode button changes mode
 *
@@ -135,29 +139,22 @@ int on_pause_released(){
 *  5 hz
 * 10 hz
 *******************************************************************************/
-int on_mode_released(){
+int on_mode_click(){
 	// cycle through modes
 	if(mode<2)mode++;
 	else mode=0;
 	return 0;
 }
 /*******************************************************************************
-* int on_pause_pressed()
+* int on_pause_long()
 *
 * If the user holds the pause button for 2 seconds, set state to exiting which
-* triggers the rest of the program to exit cleanly.
+* triggers the rest of the program to exit cleanly. mip_button times the hold,
+* nothing sleeps in the button callback.
 *******************************************************************************/
-int on_pause_pressed(){
-	int i=0;
-	const int samples = 100;	 // check for release 100 times in this period
-	const int us_wait = 2000000; // 2 seconds
-
-	// now keep checking to see if the button is still held down
-	for(i=0;i<samples;i++){
-		usleep(us_wait/samples);
-		if(get_pause_button() == RELEASED) return 0;
-	}
-	printf("\nlong press detected, shutting down\n");
+int on_pause_long(){
+	printf("\nlong press detected (%llu ms), shutting down\n", \
+		(unsigned long long)mip_button_held_ms(MIP_BUTTON_PAUSE));
 	set_state(EXITING);
 	return 0;
 }
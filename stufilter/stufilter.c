@@ -7,8 +7,14 @@
 * All while using MY OWN DAMN FILTER CODE!
 *******************************************************************************/
 
+#ifdef MIP_SIM
+#include "../mipsim/mipsim.h"
+#else
 #include <usefulincludes.h>
 #include <roboticscape.h>
+#endif
+#include "../common/mip_acq.h"
+#include "../common/mip_latency.h"
 
 #define SAMPLE_RATE 100
 #define TIME_CONSTANT 10
@@ -30,6 +36,8 @@ const float TIME_STEP = 1.0/(float)SAMPLE_RATE; // Calc dt from sample rate
 char filename[] = "HW6P4"; // file name for csv
 FILE *fp; // Makes a file pointer to stream thing I have no idea really
 float old_lp_output, old_hp_output, old_hp_input; // low/hipass variables
+mip_acq_t acq; // timestamps each sample, measures dt
+mip_acq_sample_t sample; // this interrupt's snapshot
 
 /******************************************************************************
 * int main()
@@ -74,6 +82,7 @@ int main(){
 	printf("\n");
 	
 	// The interrupt function will print data when invoked
+	mip_acq_init(&acq, TIME_STEP, 2, 3);
 	set_imu_interrupt_func(&print_data);
 	
 	// Keep looping until state changes to EXITING
@@ -85,6 +94,7 @@ int main(){
 	fclose(fp);
 	stop_imu_interrupt_func();
 	power_off_imu();
+	mip_acq_print(&acq);
 	cleanup_cape();
 	return 0;
 }
@@ -96,16 +106,18 @@ int main(){
 *
 ******************************************************************************/
 int print_data(){
+	// skip a repeated sample
+	if(mip_acq_capture(&acq, mip_latency_now(), &data, &sample)) return 0;
 	printf("\r ");
 
 	// Integrate gyro data to get absolute position of theta
-	theta_dot = (data.gyro[0] - offset)*DEG_TO_RAD; // spin rate in rad
-	theta_g = theta_g + TIME_STEP*theta_dot; // euler's method
+	theta_dot = (sample.gyro[0] - offset)*DEG_TO_RAD; // spin rate in rad
+	theta_g = theta_g + sample.dt*theta_dot; // euler's method, measured dt
 	filtered_theta_g = Hi_Pass(0.995,theta_g); // filter with high pass
 
     // calc theta from accelerometer G and Z components
-	g_y = data.accel[1]-0.1;  // Y direction is 0.1 too high
-	g_z = data.accel[2]-0.45; // Z direction is 0.45 too high
+	g_y = sample.accel[1]-0.1;  // Y direction is 0.1 too high
+	g_z = sample.accel[2]-0.45; // Z direction is 0.45 too high
 	theta_a = atan2(-g_z/9.8,g_y/9.8); // angle to gravity
 	filtered_theta_a = Low_Pass(0.004988,theta_a); // filter with low pass
     
@@ -113,9 +125,9 @@ int print_data(){
     sum = filtered_theta_a + filtered_theta_g;
 	
 	// Print data to console
-	printf("%6.2f %6.2f %6.2f   |",	data.accel[0],\
-									data.accel[1],\
-									data.accel[2]);
+	printf("%6.2f %6.2f %6.2f   |",	sample.accel[0],\
+									sample.accel[1],\
+									sample.accel[2]);
 	printf("        %6.2f      |", filtered_theta_g); // Print angle from acc
 	printf("        %6.2f      |", filtered_theta_a); // Print angle from gyro
 	printf("        %6.2f      |", sum); // Print sum
@@ -0,0 +1,200 @@
+/*******************************************************************************
+* telem_view.c
+* By: Stuart Sonatina
+*
+* Live view of a balance program's telemetry, the table printf_loop used to
+* print on the robot's console, formatted here instead.
+*
+* usage: telem_view [-s socket] [-d decimation] [-n frames] [-c out.csv]
+*
+* Connects to the program's telemetry socket (see ../common/mip_telem.h),
+* on the robot or forwarded to the host with ssh -L, subscribes to every
+* decimation-th frame and prints one row per frame.
+* Any number of viewers can watch at once, each at its own decimation, and
+* a slow one only loses its own frames. With -c every frame is also written
+* to a CSV file. Frames the server couldn't deliver are counted from the
+* gaps in the sequence numbers and reported at exit.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../common/mip_telem.h"
+
+// the cape library's state_t
+enum{
+	UNINITIALIZED,
+	RUNNING,
+	PAUSED,
+	EXITING
+};
+
+static volatile sig_atomic_t stop = 0;
+
+// function declarations
+int connect_to(const char* path, uint32_t decimation,
+												mip_telem_hello_t* hello);
+int print_header(const mip_telem_hello_t* hello);
+int print_row(const mip_telem_hello_t* hello, const mip_telem_frame_t* f,
+																int tty);
+
+static void on_signal(int sig){
+	stop = 1;
+}
+
+/*******************************************************************************
+* int main()
+*******************************************************************************/
+int main(int argc, char* argv[]){
+	const char* path = "balance_telem.sock";
+	const char* csv = NULL;
+	mip_telem_hello_t hello;
+	mip_telem_frame_t f;
+	struct sigaction sa;
+	uint64_t n_frames = 0, n_missed = 0, limit = 0, last = 0;
+	uint32_t decimation = 1, i;
+	int c, fd, tty, state = UNINITIALIZED;
+	ssize_t n;
+	FILE* out = NULL;
+
+	while((c=getopt(argc, argv, "s:d:n:c:h"))!=-1){
+		switch(c){
+		case 's': path = optarg; break;
+		case 'd': decimation = atoi(optarg); break;
+		case 'n': limit = strtoull(optarg, NULL, 10); break;
+		case 'c': csv = optarg; break;
+		default:
+			printf("usage: %s [-s socket] [-d decimation] [-n frames] " \
+					"[-c out.csv]\n", argv[0]);
+			return -1;
+		}
+	}
+	if(decimation<1) decimation = 1;
+
+	if((fd=connect_to(path, decimation, &hello))<0) return -1;
+	if(csv!=NULL){
+		if((out=fopen(csv, "w"))==NULL){
+			printf("ERROR: can't write %s\n", csv);
+			close(fd);
+			return -1;
+		}
+		fprintf(out, "seq,t,state,flags");
+		for(i=0;i<hello.n_channels;i++) fprintf(out, ",%s", hello.names[i]);
+		fprintf(out, "\n");
+	}
+	printf("%s: %u channels at %.0f Hz, decimation %u\n", hello.program, \
+				hello.n_channels, hello.rate_hz, hello.decimation);
+
+	// Ctrl-C ends the recv() below instead of the program
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	tty = isatty(fileno(stdout));
+	while(!stop && (limit==0 || n_frames<limit)){
+		// a part frame is a signal or the end, the stream is gone either way
+		n = recv(fd, &f, sizeof(f), MSG_WAITALL);
+		if(n!=sizeof(f)) break;
+		if(n_frames && f.seq>last+hello.decimation){
+			n_missed += (f.seq-last)/hello.decimation - 1;
+		}
+		last = f.seq;
+		n_frames++;
+
+		if(f.state!=state){
+			if(f.state==RUNNING){
+				printf("\nRUNNING: Hold upright to balance.\n");
+				print_header(&hello);
+			}
+			else if(f.state==PAUSED){
+				printf("\nPAUSED: press pause again to start.\n");
+			}
+			state = f.state;
+		}
+		if(state==RUNNING) print_row(&hello, &f, tty);
+		if(out!=NULL){
+			fprintf(out, "%llu,%.6f,%d,%u", (unsigned long long)f.seq, \
+								f.t_ns*1e-9, (int)f.state, f.flags);
+			for(i=0;i<hello.n_channels;i++) fprintf(out, ",%g", f.v[i]);
+			fprintf(out, "\n");
+		}
+	}
+	if(n==0) printf("\n%s exited\n", hello.program);
+	printf("\n%llu frames, %llu missed\n", (unsigned long long)n_frames, \
+										(unsigned long long)n_missed);
+	if(out!=NULL) fclose(out);
+	close(fd);
+	return 0;
+}
+
+/*******************************************************************************
+* int connect_to()
+*
+* Connects, subscribes and waits for the hello. Returns the socket or -1.
+*******************************************************************************/
+int connect_to(const char* path, uint32_t decimation,
+												mip_telem_hello_t* hello){
+	struct sockaddr_un addr;
+	mip_telem_sub_t sub = {MIP_TELEM_MAGIC, decimation};
+	int fd;
+	if(strlen(path)>=sizeof(addr.sun_path)){
+		printf("ERROR: socket path too long\n");
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd<0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr))){
+		printf("ERROR: can't connect to %s, is the program running?\n", path);
+		if(fd>=0) close(fd);
+		return -1;
+	}
+	if(send(fd, &sub, sizeof(sub), 0)!=sizeof(sub) || \
+		recv(fd, hello, sizeof(*hello), MSG_WAITALL)!=sizeof(*hello) || \
+		hello->magic!=MIP_TELEM_MAGIC || \
+		hello->n_channels<1 || hello->n_channels>MIP_TELEM_MAX_CHANNELS){
+		printf("ERROR: %s isn't a telemetry socket or refused us\n", path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*******************************************************************************
+* int print_header()
+*******************************************************************************/
+int print_header(const mip_telem_hello_t* hello){
+	uint32_t i;
+	for(i=0;i<hello->n_channels;i++){
+		printf("%8.8s |", hello->names[i]);
+	}
+	printf("arm_state|\n");
+	return 0;
+}
+
+/*******************************************************************************
+* int print_row()
+*
+* Over the last row on a terminal, a new line for each one otherwise
+*******************************************************************************/
+int print_row(const mip_telem_hello_t* hello, const mip_telem_frame_t* f,
+																int tty){
+	uint32_t i;
+	if(tty) printf("\r");
+	for(i=0;i<hello->n_channels;i++) printf("%7.2f  |", f->v[i]);
+	if(f->flags & MIP_TELEM_ARMED) printf("  ARMED  |");
+	else printf("DISARMED |");
+	if(MIP_TELEM_SHED(f->flags)) printf(" shed %d", MIP_TELEM_SHED(f->flags));
+	else if(tty) printf("       ");
+	if(tty) fflush(stdout);
+	else printf("\n");
+	return 0;
+}